@@ -0,0 +1,434 @@
+#include "service_backend.h"
+
+#ifdef _WIN32
+
+#include "scm_notify.h"
+#include "scratch.h"
+#include "service_schema.h"
+#include <psapi.h>
+#include <tlhelp32.h>
+#include <string.h>
+#include <vector>
+
+// Backend over the documented advapi32.dll Service Control Manager API.
+// Handles wrap an SC_HANDLE together with its status-change registration.
+
+struct Advapi32Handle {
+    SC_HANDLE Handle;
+    SCM_NOTIFY Notify;
+};
+
+static SVC_HANDLE Advapi32Wrap(SC_HANDLE handle) {
+    if (!handle) return NULL;
+    Advapi32Handle* h = new Advapi32Handle();
+    h->Handle = handle;
+    ScmNotifyInit(&h->Notify);
+    return (SVC_HANDLE)h;
+}
+
+static SC_HANDLE Advapi32Unwrap(SVC_HANDLE handle) {
+    return handle ? ((Advapi32Handle*)handle)->Handle : NULL;
+}
+
+static BOOL Advapi32Initialize() {
+    return TRUE;
+}
+
+static SVC_HANDLE Advapi32Connect(DWORD desiredAccess) {
+    return Advapi32Wrap(OpenSCManagerW(NULL, NULL, desiredAccess));
+}
+
+static SVC_HANDLE Advapi32Open(SVC_HANDLE manager, LPCWSTR serviceName, DWORD desiredAccess) {
+    return Advapi32Wrap(OpenServiceW(Advapi32Unwrap(manager), serviceName, desiredAccess));
+}
+
+// One restart action per delay plus the non-crash failure flag. No
+// restarts passes an empty action list, which deletes the actions.
+static BOOL Advapi32SetRecovery(SC_HANDLE service, const SERVICE_RECOVERY* recovery) {
+    if (recovery->RestartCount > SERVICE_RECOVERY_MAX_RESTARTS) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    
+    SC_ACTION actions[SERVICE_RECOVERY_MAX_RESTARTS];
+    for (DWORD i = 0; i < recovery->RestartCount; i++) {
+        actions[i].Type = SC_ACTION_RESTART;
+        actions[i].Delay = recovery->RestartDelayMs[i];
+    }
+    SERVICE_FAILURE_ACTIONSW failure;
+    memset(&failure, 0, sizeof(failure));
+    failure.dwResetPeriod = recovery->ResetPeriod;
+    failure.cActions = recovery->RestartCount;
+    failure.lpsaActions = actions;
+    if (!ChangeServiceConfig2W(service, SERVICE_CONFIG_FAILURE_ACTIONS, &failure)) return FALSE;
+    
+    SERVICE_FAILURE_ACTIONS_FLAG flag;
+    flag.fFailureActionsOnNonCrashFailures = recovery->OnNonCrashFailure ? TRUE : FALSE;
+    return ChangeServiceConfig2W(service, SERVICE_CONFIG_FAILURE_ACTIONS_FLAG, &flag);
+}
+
+static BOOL Advapi32SetDelayed(SC_HANDLE service, BOOL delayed) {
+    SERVICE_DELAYED_AUTO_START_INFO info;
+    info.fDelayedAutostart = delayed ? TRUE : FALSE;
+    return ChangeServiceConfig2W(service, SERVICE_CONFIG_DELAYED_AUTO_START_INFO, &info);
+}
+
+// One start trigger, or none: an empty list deletes every trigger
+static BOOL Advapi32SetTrigger(SC_HANDLE service, const SERVICE_START_TRIGGER* trigger) {
+    SERVICE_TRIGGER entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.dwTriggerType = trigger->Type;
+    entry.dwAction = SERVICE_TRIGGER_ACTION_SERVICE_START;
+    entry.pTriggerSubtype = (GUID*)&trigger->Subtype;
+    
+    SERVICE_TRIGGER_INFO info;
+    memset(&info, 0, sizeof(info));
+    info.cTriggers = trigger->Type ? 1 : 0;
+    info.pTriggers = trigger->Type ? &entry : NULL;
+    return ChangeServiceConfig2W(service, SERVICE_CONFIG_TRIGGER_INFO, &info);
+}
+
+// Boot options CreateServiceW has no parameter for, set on the handle it
+// returned so no extra open is needed
+static BOOL Advapi32SetBootOptions(SC_HANDLE service, const SERVICE_INSTALL_SPEC* spec) {
+    if (SchemaSpecValue(spec, FIELD_DELAYED_AUTO_START).Number && !Advapi32SetDelayed(service, TRUE)) return FALSE;
+    if (spec->Trigger.Type && !Advapi32SetTrigger(service, &spec->Trigger)) return FALSE;
+    if (spec->Recovery.RestartCount && !Advapi32SetRecovery(service, &spec->Recovery)) return FALSE;
+    return TRUE;
+}
+
+// CreateServiceW takes the fields positionally; each comes from the schema
+// so defaults match what the other backends write
+static SVC_HANDLE Advapi32Create(SVC_HANDLE manager, const SERVICE_INSTALL_SPEC* spec) {
+    SC_HANDLE service = CreateServiceW(
+        Advapi32Unwrap(manager),
+        spec->ServiceName,
+        SchemaSpecValue(spec, FIELD_DISPLAY_NAME).Text,
+        SERVICE_ALL_ACCESS,
+        SchemaSpecValue(spec, FIELD_SERVICE_TYPE).Number,
+        SchemaSpecValue(spec, FIELD_START_TYPE).Number,
+        SchemaSpecValue(spec, FIELD_ERROR_CONTROL).Number,
+        SchemaSpecValue(spec, FIELD_IMAGE_PATH).Text,
+        NULL,   // No load ordering group
+        NULL,   // No tag identifier
+        spec->Dependencies,
+        SchemaSpecValue(spec, FIELD_OBJECT_NAME).Text,
+        NULL    // No password
+    );
+    if (!service) return NULL;
+    
+    // A service without its boot options would start at the wrong time:
+    // remove it rather than leave it half-configured
+    if (!Advapi32SetBootOptions(service, spec)) {
+        DWORD err = GetLastError();
+        DeleteService(service);
+        CloseServiceHandle(service);
+        SetLastError(err);
+        return NULL;
+    }
+    return Advapi32Wrap(service);
+}
+
+static BOOL Advapi32SetDescription(SVC_HANDLE service, LPCWSTR description) {
+    SERVICE_DESCRIPTIONW sd;
+    sd.lpDescription = (LPWSTR)description;
+    return ChangeServiceConfig2W(Advapi32Unwrap(service), SERVICE_CONFIG_DESCRIPTION, &sd);
+}
+
+static BOOL Advapi32Delete(SVC_HANDLE service) {
+    return DeleteService(Advapi32Unwrap(service));
+}
+
+static BOOL Advapi32Start(SVC_HANDLE service) {
+    return StartServiceW(Advapi32Unwrap(service), 0, NULL);
+}
+
+static BOOL Advapi32Control(SVC_HANDLE service, DWORD control, SERVICE_STATUS* status) {
+    SERVICE_STATUS ignored;
+    return ControlService(Advapi32Unwrap(service), control, status ? status : &ignored);
+}
+
+static BOOL Advapi32QueryStatus(SVC_HANDLE service, SERVICE_STATUS* status) {
+    return QueryServiceStatus(Advapi32Unwrap(service), status);
+}
+
+static BOOL Advapi32QueryConfig(SVC_HANDLE service, LPQUERY_SERVICE_CONFIGW config, DWORD bufSize, LPDWORD bytesNeeded) {
+    return QueryServiceConfigW(Advapi32Unwrap(service), config, bufSize, bytesNeeded);
+}
+
+static BOOL Advapi32ChangeConfig(SVC_HANDLE service, const QUERY_SERVICE_CONFIGW* changes) {
+    return ChangeServiceConfigW(Advapi32Unwrap(service), changes->dwServiceType, changes->dwStartType,
+        changes->dwErrorControl, changes->lpBinaryPathName, NULL, NULL, changes->lpDependencies,
+        changes->lpServiceStartName, NULL, changes->lpDisplayName);
+}
+
+// QueryServiceConfig2W into the scratch buffer, growing and retrying once
+// when the hint was too small (as ScratchQueryConfig)
+static LPBYTE Advapi32QueryConfig2(SC_HANDLE service, DWORD infoLevel, SCRATCH_BUFFER* scratch) {
+    if (!ScratchReserve(scratch, SCRATCH_SIZE_HINT)) return NULL;
+    
+    DWORD needed = 0;
+    if (QueryServiceConfig2W(service, infoLevel, scratch->Data, scratch->Size, &needed)) return scratch->Data;
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER || !ScratchReserve(scratch, needed)) return NULL;
+    
+    if (!QueryServiceConfig2W(service, infoLevel, scratch->Data, scratch->Size, &needed)) return NULL;
+    return scratch->Data;
+}
+
+// Leading restart actions become the restart delays; any other action, or
+// restarts past SERVICE_RECOVERY_MAX_RESTARTS, only sets OtherActions
+static BOOL Advapi32QueryRecovery(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_RECOVERY* recovery) {
+    SC_HANDLE handle = Advapi32Unwrap(service);
+    SERVICE_FAILURE_ACTIONS_FLAG flag;
+    DWORD needed = 0;
+    if (!QueryServiceConfig2W(handle, SERVICE_CONFIG_FAILURE_ACTIONS_FLAG, (LPBYTE)&flag, sizeof(flag), &needed)) {
+        return FALSE;
+    }
+    const SERVICE_FAILURE_ACTIONSW* failure =
+        (const SERVICE_FAILURE_ACTIONSW*)Advapi32QueryConfig2(handle, SERVICE_CONFIG_FAILURE_ACTIONS, scratch);
+    if (!failure) return FALSE;
+    
+    memset(recovery, 0, sizeof(*recovery));
+    recovery->ResetPeriod = failure->dwResetPeriod;
+    recovery->OnNonCrashFailure = flag.fFailureActionsOnNonCrashFailures;
+    DWORD count = failure->lpsaActions ? failure->cActions : 0;
+    for (DWORD i = 0; i < count; i++) {
+        const SC_ACTION& action = failure->lpsaActions[i];
+        if (action.Type != SC_ACTION_RESTART || recovery->OtherActions ||
+            recovery->RestartCount == SERVICE_RECOVERY_MAX_RESTARTS) {
+            recovery->OtherActions = TRUE;
+            continue;
+        }
+        recovery->RestartDelayMs[recovery->RestartCount++] = action.Delay;
+    }
+    return TRUE;
+}
+
+static BOOL Advapi32ChangeRecovery(SVC_HANDLE service, const SERVICE_RECOVERY* recovery) {
+    return Advapi32SetRecovery(Advapi32Unwrap(service), recovery);
+}
+
+// The first trigger, when it only starts the service, becomes Trigger; any
+// other trigger only sets OtherTriggers
+static BOOL Advapi32QueryStartOptions(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_START_OPTIONS* options) {
+    SC_HANDLE handle = Advapi32Unwrap(service);
+    SERVICE_DELAYED_AUTO_START_INFO delayed;
+    DWORD needed = 0;
+    if (!QueryServiceConfig2W(handle, SERVICE_CONFIG_DELAYED_AUTO_START_INFO, (LPBYTE)&delayed, sizeof(delayed),
+        &needed)) {
+        return FALSE;
+    }
+    const SERVICE_TRIGGER_INFO* info =
+        (const SERVICE_TRIGGER_INFO*)Advapi32QueryConfig2(handle, SERVICE_CONFIG_TRIGGER_INFO, scratch);
+    if (!info) return FALSE;
+    
+    memset(options, 0, sizeof(*options));
+    options->DelayedAutoStart = delayed.fDelayedAutostart;
+    DWORD count = info->pTriggers ? info->cTriggers : 0;
+    for (DWORD i = 0; i < count; i++) {
+        const SERVICE_TRIGGER& trigger = info->pTriggers[i];
+        if (i > 0 || trigger.dwAction != SERVICE_TRIGGER_ACTION_SERVICE_START || !trigger.pTriggerSubtype ||
+            trigger.cDataItems) {
+            options->OtherTriggers = TRUE;
+            continue;
+        }
+        options->Trigger.Type = trigger.dwTriggerType;
+        options->Trigger.Subtype = *trigger.pTriggerSubtype;
+    }
+    return TRUE;
+}
+
+static BOOL Advapi32ChangeStartOptions(SVC_HANDLE service, const SERVICE_START_OPTIONS* options) {
+    SC_HANDLE handle = Advapi32Unwrap(service);
+    return Advapi32SetDelayed(handle, options->DelayedAutoStart) && Advapi32SetTrigger(handle, &options->Trigger);
+}
+
+static BOOL Advapi32EnumServices(SVC_HANDLE manager, DWORD serviceType, DWORD serviceState, LPBYTE buffer, DWORD bufSize,
+    LPDWORD bytesNeeded, LPDWORD servicesReturned, LPDWORD resumeHandle) {
+    return EnumServicesStatusExW(Advapi32Unwrap(manager), SC_ENUM_PROCESS_INFO, serviceType, serviceState,
+        buffer, bufSize, bytesNeeded, servicesReturned, resumeHandle, NULL);
+}
+
+static BOOL Advapi32EnumDependents(SVC_HANDLE service, DWORD serviceState, LPENUM_SERVICE_STATUSW services,
+    DWORD bufSize, LPDWORD bytesNeeded, LPDWORD servicesReturned) {
+    return EnumDependentServicesW(Advapi32Unwrap(service), serviceState, services, bufSize, bytesNeeded,
+        servicesReturned);
+}
+
+static DWORD Advapi32WaitStatusChange(SVC_HANDLE* services, const DWORD* knownStates, DWORD count, DWORD timeoutMs) {
+    std::vector<SC_HANDLE> handles(count);
+    std::vector<SCM_NOTIFY*> notifies(count);
+    
+    for (DWORD i = 0; i < count; i++) {
+        Advapi32Handle* h = (Advapi32Handle*)services[i];
+        handles[i] = h->Handle;
+        notifies[i] = &h->Notify;
+    }
+    return ScmWaitStatusChange(handles.data(), notifies.data(), knownStates, count, timeoutMs);
+}
+
+// Buffers for one registry walk, reused for every entry so a full-host
+// inventory allocates nothing per service. String values longer than
+// ADVAPI32_VALUE_CHARS read as missing.
+#define ADVAPI32_VALUE_CHARS  1024
+#define ADVAPI32_KEY_CHARS    256
+
+struct Advapi32RegistryBuffers {
+    WCHAR Name[ADVAPI32_KEY_CHARS + 1];
+    WCHAR Values[FIELD_COUNT][ADVAPI32_VALUE_CHARS + 1];
+};
+
+static LONG Advapi32VisitService(HKEY servicesKey, LPCWSTR serviceName, Advapi32RegistryBuffers* buffers,
+    SERVICE_REGISTRY_ROUTINE routine, PVOID context, BOOL* more) {
+    HKEY serviceKey = NULL;
+    LONG result = RegOpenKeyExW(servicesKey, serviceName, 0, KEY_QUERY_VALUE, &serviceKey);
+    if (result != ERROR_SUCCESS) return result;
+    
+    SERVICE_REGISTRY_ENTRY entry;
+    entry.Name = serviceName;
+    SchemaInitConfig(&entry.Config);
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        const SCHEMA_FIELD& field = g_ServiceSchema[i];
+        if (!(field.Flags & SCHEMA_INVENTORY)) continue;
+        
+        // Keep room for a terminator: REG_SZ data need not carry one
+        DWORD type = 0;
+        DWORD size = ADVAPI32_VALUE_CHARS * sizeof(WCHAR);
+        if (RegQueryValueExW(serviceKey, field.ValueName, NULL, &type, (LPBYTE)buffers->Values[i], &size) != ERROR_SUCCESS) {
+            continue;
+        }
+        
+        SCHEMA_VALUE value = { SERVICE_NO_CHANGE, NULL };
+        if (field.Type == SCHEMA_DWORD) {
+            if (type != REG_DWORD || size != sizeof(DWORD)) continue;
+            memcpy(&value.Number, buffers->Values[i], sizeof(DWORD));
+        } else {
+            if (type != REG_SZ && type != REG_EXPAND_SZ) continue;
+            buffers->Values[i][size / sizeof(WCHAR)] = L'\0';
+            value.Text = buffers->Values[i];
+        }
+        SchemaStoreConfig(&entry.Config, field.Id, value);
+    }
+    RegCloseKey(serviceKey);
+    
+    *more = routine(context, &entry);
+    return ERROR_SUCCESS;
+}
+
+// Reads the Services key directly (read-only, no SCM call per name)
+static BOOL Advapi32ReadRegistry(SVC_HANDLE manager, LPCWSTR serviceName, SERVICE_REGISTRY_ROUTINE routine, PVOID context) {
+    (void)manager;
+    HKEY servicesKey = NULL;
+    LONG result = RegOpenKeyExW(HKEY_LOCAL_MACHINE, L"SYSTEM\\CurrentControlSet\\Services", 0,
+        KEY_ENUMERATE_SUB_KEYS | KEY_QUERY_VALUE, &servicesKey);
+    if (result != ERROR_SUCCESS) {
+        SetLastError(result);
+        return FALSE;
+    }
+    
+    Advapi32RegistryBuffers buffers;
+    BOOL more = TRUE;
+    if (serviceName) {
+        result = Advapi32VisitService(servicesKey, serviceName, &buffers, routine, context, &more);
+        if (result == ERROR_FILE_NOT_FOUND) result = ERROR_SERVICE_DOES_NOT_EXIST;
+    } else {
+        for (DWORD index = 0; more; index++) {
+            DWORD chars = ADVAPI32_KEY_CHARS + 1;
+            result = RegEnumKeyExW(servicesKey, index, buffers.Name, &chars, NULL, NULL, NULL, NULL);
+            if (result == ERROR_NO_MORE_ITEMS) {
+                result = ERROR_SUCCESS;
+                break;
+            }
+            if (result == ERROR_MORE_DATA) continue;  // Longer than any service name
+            if (result != ERROR_SUCCESS) break;
+            
+            // A subkey we may not read is left out rather than ending the walk
+            Advapi32VisitService(servicesKey, buffers.Name, &buffers, routine, context, &more);
+        }
+    }
+    RegCloseKey(servicesKey);
+    
+    if (result != ERROR_SUCCESS) {
+        SetLastError(result);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Thread counts come from one process snapshot; times, memory and handle
+// counts need a limited-query handle per process. A process that has
+// exited or refuses the query is left not Present.
+static BOOL Advapi32QueryProcesses(SERVICE_PROCESS_USAGE* usage, DWORD count) {
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (snapshot == INVALID_HANDLE_VALUE) return FALSE;
+    
+    for (DWORD i = 0; i < count; i++) {
+        usage[i].Present = FALSE;
+        usage[i].ThreadCount = 0;
+    }
+    PROCESSENTRY32W entry;
+    entry.dwSize = sizeof(entry);
+    for (BOOL more = Process32FirstW(snapshot, &entry); more; more = Process32NextW(snapshot, &entry)) {
+        for (DWORD i = 0; i < count; i++) {
+            if (usage[i].ProcessId == entry.th32ProcessID) usage[i].ThreadCount = entry.cntThreads;
+        }
+    }
+    CloseHandle(snapshot);
+    
+    for (DWORD i = 0; i < count; i++) {
+        if (usage[i].ProcessId == 0 || usage[i].ThreadCount == 0) continue;
+        HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, usage[i].ProcessId);
+        if (!process) continue;
+        
+        FILETIME created, exited, kernel, user;
+        PROCESS_MEMORY_COUNTERS_EX memory;
+        DWORD handles = 0;
+        if (GetProcessTimes(process, &created, &exited, &kernel, &user) &&
+            GetProcessMemoryInfo(process, (PROCESS_MEMORY_COUNTERS*)&memory, sizeof(memory)) &&
+            GetProcessHandleCount(process, &handles)) {
+            usage[i].Present = TRUE;
+            usage[i].CpuTime = (((ULONGLONG)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+                (((ULONGLONG)user.dwHighDateTime << 32) | user.dwLowDateTime);
+            usage[i].WorkingSet = memory.WorkingSetSize;
+            usage[i].PrivateBytes = memory.PrivateUsage;
+            usage[i].HandleCount = handles;
+        }
+        CloseHandle(process);
+    }
+    return TRUE;
+}
+
+static void Advapi32Close(SVC_HANDLE handle) {
+    if (!handle) return;
+    Advapi32Handle* h = (Advapi32Handle*)handle;
+    // Drains the status-change callbacks that still point into h
+    ScmNotifyClose(h->Handle, &h->Notify);
+    delete h;
+}
+
+const SERVICE_BACKEND Advapi32Backend = {
+    L"advapi32",
+    Advapi32Initialize,
+    Advapi32Connect,
+    Advapi32Open,
+    Advapi32Create,
+    Advapi32SetDescription,
+    Advapi32Delete,
+    Advapi32Start,
+    Advapi32Control,
+    Advapi32QueryStatus,
+    Advapi32QueryConfig,
+    Advapi32ChangeConfig,
+    Advapi32QueryRecovery,
+    Advapi32ChangeRecovery,
+    Advapi32QueryStartOptions,
+    Advapi32ChangeStartOptions,
+    Advapi32EnumServices,
+    Advapi32EnumDependents,
+    Advapi32WaitStatusChange,
+    Advapi32ReadRegistry,
+    Advapi32QueryProcesses,
+    Advapi32Close
+};
+
+#endif // _WIN32
@@ -0,0 +1,288 @@
+#include "bench.h"
+#include "commands.h"
+#include "executor.h"
+#include "metrics.h"
+#include "output.h"
+#include "reconcile.h"
+#include "service_installer.h"
+#include "service_manager.h"
+#include "service_wait.h"
+#include <stdlib.h>
+#include <wchar.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define BENCH_MAX_SIZE  100000  // Upper bound on services per batch
+
+static BOOL BenchInstall(LPCWSTR serviceName);
+static BOOL BenchReconcile(LPCWSTR serviceName);
+static BOOL BenchStart(LPCWSTR serviceName);
+
+// Command paths in lifecycle order; each leaves the services ready for the
+// next one and uninstall leaves nothing behind
+typedef struct _BENCH_PATH {
+    LPCWSTR Name;
+    BOOL (*Run)(LPCWSTR serviceName);
+} BENCH_PATH;
+
+static const BENCH_PATH BenchPaths[] = {
+    { L"install", BenchInstall },
+    { L"reconcile", BenchReconcile },
+    { L"start", BenchStart },
+    { L"status", GetServiceStatusByName },
+    { L"stop", StopServiceByName },
+    { L"uninstall", UninstallService },
+};
+
+#define BENCH_PATH_COUNT  (sizeof(BenchPaths) / sizeof(BenchPaths[0]))
+
+// Library path: the whole lifecycle of each service queued at once
+static const BENCH_PATH BenchPipelinePath = { L"pipeline", NULL };
+
+// Lifecycle steps queued per service by the pipeline path, and the state
+// each must leave the service in
+#define BENCH_PIPELINE_STEPS  6
+
+static const DWORD BenchPipelineStates[BENCH_PIPELINE_STEPS] = {
+    SERVICE_STOPPED,    // Install
+    SERVICE_RUNNING,    // Start
+    SERVICE_RUNNING,    // Query
+    SERVICE_STOPPED,    // Stop
+    SERVICE_STOPPED,    // Query
+    0,                  // Uninstall: the service is gone
+};
+
+static LPCWSTR g_BenchImage = L"C:\\Bench\\bench.exe";
+
+static BOOL BenchInstall(LPCWSTR serviceName) {
+    return InstallService(g_BenchImage, serviceName, NULL, NULL, NULL);
+}
+
+// Move the service to other boot options, then reconcile again with the
+// same arguments: the second pass must find nothing to change
+static BOOL BenchReconcile(LPCWSTR serviceName) {
+    wchar_t* argv[] = { (wchar_t*)L"reconcile", (wchar_t*)g_BenchImage, (wchar_t*)serviceName,
+        (wchar_t*)L"--start", (wchar_t*)L"demand", (wchar_t*)L"--trigger", (wchar_t*)L"network",
+        (wchar_t*)L"--restart", (wchar_t*)L"1000,5000" };
+    SERVICE_COMMAND parsed;
+    if (!ParseServiceCommand(sizeof(argv) / sizeof(argv[0]), argv, &parsed)) return FALSE;
+    
+    DWORD changed = 0;
+    if (!ReconcileService(g_BenchImage, serviceName, NULL, NULL, &parsed.Boot, &changed) ||
+        !ReconcileService(g_BenchImage, serviceName, NULL, NULL, &parsed.Boot, &changed)) {
+        return FALSE;
+    }
+    return changed == 0;
+}
+
+static BOOL BenchStart(LPCWSTR serviceName) {
+    return StartServiceByName(serviceName);
+}
+
+// One batch of one path: the service names and the latency of each call
+struct BenchRun {
+    const BENCH_PATH* Path;
+    const std::vector<std::wstring>* Names;
+    std::vector<ULONGLONG> LatencyUs;
+};
+
+// Executor routine: run one operation and record its latency
+static int BenchOperation(PVOID context, DWORD index) {
+    BenchRun* run = (BenchRun*)context;
+    ScopedSessionUse use(ScmDefaultSession());
+    ULONGLONG start = MetricsNow();
+    BOOL ok = run->Path->Run((*run->Names)[index].c_str());
+    run->LatencyUs[index] = MetricsNow() - start;
+    return ok ? 0 : 1;
+}
+
+// Results of one path at one batch size, over all rounds
+struct BenchResult {
+    std::vector<ULONGLONG> LatencyUs;
+    ULONGLONG WallUs;
+    DWORD Failed;
+};
+
+// Queue install, start, query, stop, query and uninstall of every service
+// on a ServiceManager without waiting in between, then check each future in
+// order. Only per-service ordering makes the queries see the state the
+// step before them left, so a service counts as failed when any step
+// failed or left another state. Its latency is the sum of its six
+// operation times.
+static void BenchPipeline(const std::vector<std::wstring>& names, BenchResult* result) {
+    ServiceManager manager(g_ExecutorJobs, g_ServiceWaitTimeout);
+    std::vector<std::future<SERVICE_RESULT> > futures;
+    ULONGLONG start = MetricsNow();
+    for (size_t i = 0; i < names.size(); i++) {
+        LPCWSTR name = names[i].c_str();
+        SERVICE_INSTALL_SPEC spec;
+        SchemaInitSpec(&spec);
+        spec.ServiceName = name;
+        spec.ImagePath = g_BenchImage;
+        futures.push_back(manager.Install(spec));
+        futures.push_back(manager.Start(name));
+        futures.push_back(manager.Query(name));
+        futures.push_back(manager.Stop(name));
+        futures.push_back(manager.Query(name));
+        futures.push_back(manager.Uninstall(name));
+    }
+    
+    for (size_t i = 0; i < names.size(); i++) {
+        ULONGLONG latency = 0;
+        BOOL ok = TRUE;
+        for (DWORD step = 0; step < BENCH_PIPELINE_STEPS; step++) {
+            SERVICE_RESULT op = futures[i * BENCH_PIPELINE_STEPS + step].get();
+            latency += op.ElapsedUs;
+            if (op.Error != ERROR_SUCCESS) ok = FALSE;
+            if (BenchPipelineStates[step] && op.State != BenchPipelineStates[step]) ok = FALSE;
+        }
+        result->LatencyUs.push_back(latency);
+        if (!ok) result->Failed++;
+    }
+    result->WallUs += MetricsNow() - start;
+}
+
+// Nearest-rank percentile of sorted samples
+static ULONGLONG BenchPercentile(const std::vector<ULONGLONG>& sorted, DWORD percent) {
+    if (sorted.empty()) return 0;
+    size_t rank = (sorted.size() * percent + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void BenchReport(const BENCH_PATH* path, DWORD size, BenchResult* result) {
+    std::vector<ULONGLONG>& samples = result->LatencyUs;
+    std::sort(samples.begin(), samples.end());
+    ULONGLONG total = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+        total += samples[i];
+    }
+    DWORD rate = result->WallUs ? (DWORD)(samples.size() * 1000000ULL / result->WallUs) : 0;
+    
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"bench", NULL);
+    record.Call = path->Name;
+    record.BatchSize = size;
+    record.Count = (DWORD)samples.size();
+    record.Failed = result->Failed;
+    record.Rate = rate;
+    record.P50Us = BenchPercentile(samples, 50);
+    record.P95Us = BenchPercentile(samples, 95);
+    record.P99Us = BenchPercentile(samples, 99);
+    record.MaxUs = samples.empty() ? 0 : samples.back();
+    record.TotalUs = total;
+    OutputFinish(&record, result->Failed == 0, ERROR_GEN_FAILURE, L"%-10ls %-7u %-7u %-7u %10u %10.3f %10.3f %10.3f %10.3f",
+        path->Name, size, record.Count, result->Failed, rate, record.P50Us / 1e3, record.P95Us / 1e3,
+        record.P99Us / 1e3, record.MaxUs / 1e3);
+}
+
+// Comma-separated batch sizes, each 1..BENCH_MAX_SIZE
+static BOOL BenchParseSizes(LPCWSTR text, std::vector<DWORD>* sizes) {
+    sizes->clear();
+    while (*text) {
+        wchar_t* end;
+        unsigned long size = wcstoul(text, &end, 10);
+        if (end == text || size < 1 || size > BENCH_MAX_SIZE || (*end && *end != L',')) return FALSE;
+        sizes->push_back((DWORD)size);
+        text = *end ? end + 1 : end;
+    }
+    return !sizes->empty();
+}
+
+int RunBenchmark(int argc, wchar_t* argv[]) {
+    std::vector<DWORD> sizes;
+    sizes.push_back(1);
+    sizes.push_back(10);
+    sizes.push_back(100);
+    sizes.push_back(1000);
+    DWORD rounds = 1;
+    LPCWSTR prefix = L"SiBench";
+    
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"bench", NULL);
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && _wcsicmp(argv[i], L"--sizes") == 0) {
+            if (!BenchParseSizes(argv[++i], &sizes)) {
+                OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER, L"Invalid --sizes '%ls' (comma-separated, 1-%u)",
+                    argv[i], BENCH_MAX_SIZE);
+                return 1;
+            }
+        } else if (i + 1 < argc && _wcsicmp(argv[i], L"--rounds") == 0) {
+            rounds = (DWORD)wcstoul(argv[++i], NULL, 10);
+            if (rounds < 1) rounds = 1;
+        } else if (i + 1 < argc && _wcsicmp(argv[i], L"--image") == 0) {
+            g_BenchImage = argv[++i];
+        } else if (i + 1 < argc && _wcsicmp(argv[i], L"--prefix") == 0) {
+            prefix = argv[++i];
+        } else {
+            OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER, L"Unknown bench option: %ls\n"
+                L"Usage: bench [--sizes <n,...>] [--rounds <n>] [--image <path>] [--prefix <name>]", argv[i]);
+            return 1;
+        }
+    }
+    
+    OutputText(L"Benchmark: backend %ls, %u job(s), %u round(s)\n\n", g_Backend->Name, g_ExecutorJobs, rounds);
+    OutputText(L"%-10ls %-7ls %-7ls %-7ls %10ls %10ls %10ls %10ls %10ls\n", L"Path", L"Batch", L"Ops", L"Failed",
+        L"Ops/s", L"p50 ms", L"p95 ms", L"p99 ms", L"Max ms");
+    OutputFlush();
+    
+    DWORD failed = 0;
+    for (size_t s = 0; s < sizes.size(); s++) {
+        DWORD size = sizes[s];
+        BenchResult results[BENCH_PATH_COUNT];
+        for (size_t p = 0; p < BENCH_PATH_COUNT; p++) {
+            results[p].WallUs = 0;
+            results[p].Failed = 0;
+        }
+        BenchResult pipeline;
+        pipeline.WallUs = 0;
+        pipeline.Failed = 0;
+        
+        for (DWORD round = 0; round < rounds; round++) {
+            // Fresh names per batch and round, so a failed uninstall cannot
+            // make the next install collide
+            std::vector<std::wstring> names;
+            WCHAR name[128];
+            for (DWORD i = 0; i < size; i++) {
+                swprintf(name, sizeof(name) / sizeof(WCHAR), L"%ls_%u_%u_%05u", prefix, size, round, i);
+                names.push_back(name);
+            }
+            
+            for (size_t p = 0; p < BENCH_PATH_COUNT; p++) {
+                BenchRun run;
+                run.Path = &BenchPaths[p];
+                run.Names = &names;
+                run.LatencyUs.assign(size, 0);
+                
+                // The commands report every operation; only the totals matter here
+                std::vector<EXECUTOR_RESULT> opResults;
+                g_OutputMuted = TRUE;
+                ULONGLONG start = MetricsNow();
+                ExecuteOperations(names, BenchOperation, &run, g_ExecutorJobs, FALSE, &opResults);
+                results[p].WallUs += MetricsNow() - start;
+                g_OutputMuted = FALSE;
+                
+                for (DWORD i = 0; i < size; i++) {
+                    if (opResults[i].ExitCode != 0) results[p].Failed++;
+                }
+                results[p].LatencyUs.insert(results[p].LatencyUs.end(), run.LatencyUs.begin(), run.LatencyUs.end());
+            }
+            
+            for (DWORD i = 0; i < size; i++) {
+                swprintf(name, sizeof(name) / sizeof(WCHAR), L"%ls_%u_%u_p%05u", prefix, size, round, i);
+                names[i] = name;
+            }
+            BenchPipeline(names, &pipeline);
+        }
+        
+        for (size_t p = 0; p < BENCH_PATH_COUNT; p++) {
+            BenchReport(&BenchPaths[p], size, &results[p]);
+            failed += results[p].Failed;
+        }
+        BenchReport(&BenchPipelinePath, size, &pipeline);
+        failed += pipeline.Failed;
+        OutputFlush();
+    }
+    
+    return failed == 0 ? 0 : 1;
+}
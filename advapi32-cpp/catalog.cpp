@@ -0,0 +1,139 @@
+#include "catalog.h"
+#include <stdlib.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#define CATALOG_ENUM_BUFFER  (64 * 1024)  // Holds ~300 typical services in one call
+
+// FNV-1a over the lowercased UTF-16 code units
+static DWORD CatalogHash(LPCWSTR name) {
+    DWORD hash = 2166136261u;
+    for (; *name; name++) {
+        DWORD ch = (DWORD)towlower((wint_t)*name) & 0xFFFF;
+        hash = (hash ^ (ch & 0xFF)) * 16777619u;
+        hash = (hash ^ (ch >> 8)) * 16777619u;
+    }
+    return hash;
+}
+
+static DWORD CatalogAddString(SERVICE_CATALOG* catalog, LPCWSTR text) {
+    DWORD offset = (DWORD)catalog->Pool.size();
+    catalog->Pool.insert(catalog->Pool.end(), text, text + wcslen(text) + 1);
+    return offset;
+}
+
+static void CatalogBuildIndex(SERVICE_CATALOG* catalog) {
+    size_t capacity = 16;
+    while (capacity < catalog->Entries.size() * 2) capacity *= 2;
+    catalog->Index.assign(capacity, 0);
+    
+    for (DWORD i = 0; i < (DWORD)catalog->Entries.size(); i++) {
+        size_t slot = catalog->Entries[i].Hash & (capacity - 1);
+        while (catalog->Index[slot]) slot = (slot + 1) & (capacity - 1);
+        catalog->Index[slot] = i + 1;
+    }
+}
+
+BOOL CatalogLoad(SCM_SESSION* session, SERVICE_CATALOG* catalog) {
+    catalog->Entries.clear();
+    catalog->Pool.clear();
+    catalog->Index.clear();
+    
+    SVC_HANDLE manager = ScmSessionManager(session, SC_MANAGER_CONNECT | SC_MANAGER_ENUMERATE_SERVICE);
+    if (!manager) return FALSE;
+    
+    // Records point into the scratch buffer, so it is held until copied out
+    ScopedScratch scratch(session);
+    SCRATCH_BUFFER* buffer = scratch.Buffer;
+    if (!ScratchReserve(buffer, CATALOG_ENUM_BUFFER)) return FALSE;
+    DWORD resume = 0;
+    
+    for (;;) {
+        DWORD bytesNeeded = 0;
+        DWORD returned = 0;
+        BOOL done = g_Backend->EnumServices(manager, SERVICE_WIN32, SERVICE_STATE_ALL, buffer->Data,
+            buffer->Size, &bytesNeeded, &returned, &resume);
+        if (!done && GetLastError() != ERROR_MORE_DATA) return FALSE;
+        
+        ENUM_SERVICE_STATUS_PROCESSW* records = (ENUM_SERVICE_STATUS_PROCESSW*)buffer->Data;
+        for (DWORD i = 0; i < returned; i++) {
+            CATALOG_ENTRY entry;
+            entry.Name = CatalogAddString(catalog, records[i].lpServiceName);
+            entry.DisplayName = CatalogAddString(catalog, records[i].lpDisplayName);
+            entry.Hash = CatalogHash(records[i].lpServiceName);
+            entry.ServiceType = records[i].ServiceStatusProcess.dwServiceType;
+            entry.CurrentState = records[i].ServiceStatusProcess.dwCurrentState;
+            entry.ProcessId = records[i].ServiceStatusProcess.dwProcessId;
+            catalog->Entries.push_back(entry);
+        }
+        
+        if (done) break;
+        // Grow so the rest arrives in the next call
+        DWORD grow = (bytesNeeded > buffer->Size) ? bytesNeeded : (returned == 0 ? buffer->Size * 2 : 0);
+        if (grow && !ScratchReserve(buffer, grow)) return FALSE;
+    }
+    
+    CatalogBuildIndex(catalog);
+    return TRUE;
+}
+
+const CATALOG_ENTRY* CatalogFind(const SERVICE_CATALOG* catalog, LPCWSTR serviceName) {
+    if (catalog->Index.empty()) return NULL;
+    
+    size_t mask = catalog->Index.size() - 1;
+    DWORD hash = CatalogHash(serviceName);
+    for (size_t slot = hash & mask; catalog->Index[slot]; slot = (slot + 1) & mask) {
+        const CATALOG_ENTRY* entry = &catalog->Entries[catalog->Index[slot] - 1];
+        if (entry->Hash == hash && _wcsicmp(CatalogString(catalog, entry->Name), serviceName) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+DWORD CatalogMatch(const SERVICE_CATALOG* catalog, LPCWSTR pattern, std::vector<DWORD>* matches) {
+    if (!IsServicePattern(pattern)) {
+        const CATALOG_ENTRY* entry = CatalogFind(catalog, pattern);
+        if (!entry) return 0;
+        matches->push_back((DWORD)(entry - &catalog->Entries[0]));
+        return 1;
+    }
+    
+    DWORD count = 0;
+    for (DWORD i = 0; i < (DWORD)catalog->Entries.size(); i++) {
+        if (WildcardMatch(pattern, CatalogString(catalog, catalog->Entries[i].Name))) {
+            matches->push_back(i);
+            count++;
+        }
+    }
+    return count;
+}
+
+BOOL IsServicePattern(LPCWSTR name) {
+    return wcspbrk(name, L"*?") != NULL;
+}
+
+// Iterative matcher: on a mismatch, retry from the character after the
+// most recent '*' (linear backtracking, no recursion)
+BOOL WildcardMatch(LPCWSTR pattern, LPCWSTR text) {
+    LPCWSTR star = NULL;
+    LPCWSTR resume = NULL;
+    
+    while (*text) {
+        if (*pattern == L'*') {
+            star = pattern++;
+            resume = text;
+        } else if (*pattern == L'?' || (*pattern && towlower((wint_t)*pattern) == towlower((wint_t)*text))) {
+            pattern++;
+            text++;
+        } else if (star) {
+            pattern = star + 1;
+            text = ++resume;
+        } else {
+            return FALSE;
+        }
+    }
+    
+    while (*pattern == L'*') pattern++;
+    return *pattern == L'\0';
+}
@@ -0,0 +1,45 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "scm_session.h"
+#include <vector>
+
+// One service in a catalog snapshot. Strings live in the catalog's pool and
+// are referenced by offset, so the entry array stays small and contiguous.
+typedef struct _CATALOG_ENTRY {
+    DWORD Name;           // Pool offset of the service name
+    DWORD DisplayName;    // Pool offset of the display name
+    DWORD Hash;           // Case-insensitive hash of the name
+    DWORD ServiceType;
+    DWORD CurrentState;
+    DWORD ProcessId;
+} CATALOG_ENTRY;
+
+// Snapshot of every Win32 service from one bulk enumeration, with an
+// open-addressing hash index over the names (slot = entry index + 1,
+// 0 = empty; capacity is a power of two, at most half full)
+typedef struct _SERVICE_CATALOG {
+    std::vector<CATALOG_ENTRY> Entries;
+    std::vector<WCHAR> Pool;
+    std::vector<DWORD> Index;
+} SERVICE_CATALOG;
+
+// Fill the catalog from the session's backend (needs ENUMERATE_SERVICE)
+BOOL CatalogLoad(SCM_SESSION* session, SERVICE_CATALOG* catalog);
+
+inline LPCWSTR CatalogString(const SERVICE_CATALOG* catalog, DWORD offset) {
+    return &catalog->Pool[offset];
+}
+
+// Exact, case-insensitive lookup; NULL when the service is not listed
+const CATALOG_ENTRY* CatalogFind(const SERVICE_CATALOG* catalog, LPCWSTR serviceName);
+
+// Append the indices of all entries matching a name or wildcard pattern, in
+// catalog order. Returns the number of matches.
+DWORD CatalogMatch(const SERVICE_CATALOG* catalog, LPCWSTR pattern, std::vector<DWORD>* matches);
+
+// Wildcards: '*' matches any run of characters, '?' exactly one
+BOOL IsServicePattern(LPCWSTR name);
+BOOL WildcardMatch(LPCWSTR pattern, LPCWSTR text);
+
+#endif // CATALOG_H
@@ -0,0 +1,513 @@
+#include "commands.h"
+#include "catalog.h"
+#include "watch.h"
+#include "top.h"
+#include "profile.h"
+#include "inventory.h"
+#include "snapshot.h"
+#include "service_host.h"
+#include "reconcile.h"
+#include "service_graph.h"
+#include "output.h"
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <string>
+#include <vector>
+
+// Load the catalog and resolve a name or pattern; reports empty results
+static BOOL LoadMatches(LPCWSTR command, LPCWSTR pattern, SERVICE_CATALOG* catalog, std::vector<DWORD>* matches) {
+    OUTPUT_RECORD record;
+    OutputBegin(&record, command, pattern);
+    if (!CatalogLoad(ScmDefaultSession(), catalog)) {
+        DWORD err = GetLastError();
+        return OutputFinish(&record, FALSE, err, L"EnumServicesStatusEx failed: %d", err);
+    }
+    if (CatalogMatch(catalog, pattern, matches) == 0) {
+        return OutputFinish(&record, FALSE, ERROR_SERVICE_DOES_NOT_EXIST, L"No services match '%ls'", pattern);
+    }
+    return TRUE;
+}
+
+// One record per service: a table row in text, an object in JSON
+static void PrintCatalogEntries(LPCWSTR command, const SERVICE_CATALOG* catalog, const std::vector<DWORD>& matches) {
+    OutputText(L"%-32ls %-16ls %-8ls %ls\n", L"Name", L"State", L"PID", L"Display Name");
+    for (size_t i = 0; i < matches.size(); i++) {
+        const CATALOG_ENTRY* entry = &catalog->Entries[matches[i]];
+        OUTPUT_RECORD record;
+        OutputBegin(&record, command, CatalogString(catalog, entry->Name));
+        record.DisplayName = CatalogString(catalog, entry->DisplayName);
+        record.State = entry->CurrentState;
+        record.ProcessId = entry->ProcessId;
+        OutputFinish(&record, TRUE, ERROR_SUCCESS, L"%-32ls %-16ls %-8u %ls", record.Service,
+            ServiceStateName(entry->CurrentState), entry->ProcessId, record.DisplayName);
+    }
+    OutputText(L"%u service(s)\n", (DWORD)matches.size());
+}
+
+// List every service, or those matching a pattern, from one enumeration
+static int ListServices(LPCWSTR command, LPCWSTR pattern) {
+    SERVICE_CATALOG catalog;
+    std::vector<DWORD> matches;
+    if (!LoadMatches(command, pattern ? pattern : L"*", &catalog, &matches)) return 1;
+    
+    PrintCatalogEntries(command, &catalog, matches);
+    return 0;
+}
+
+// Start or stop every service matching a pattern. Services already in the
+// target state (per the snapshot) are skipped without being opened; the
+// rest run in dependency waves on the executor, g_ExecutorJobs at a time.
+static int ControlMatchingServices(LPCWSTR pattern, BOOL start) {
+    SERVICE_CATALOG catalog;
+    std::vector<DWORD> matches;
+    if (!LoadMatches(start ? L"start" : L"stop", pattern, &catalog, &matches)) return 1;
+    
+    std::vector<std::wstring> names;
+    DWORD target = start ? SERVICE_RUNNING : SERVICE_STOPPED;
+    for (size_t i = 0; i < matches.size(); i++) {
+        const CATALOG_ENTRY* entry = &catalog.Entries[matches[i]];
+        if (entry->CurrentState != target) {
+            names.push_back(CatalogString(&catalog, entry->Name));
+        }
+    }
+    
+    OutputText(L"%ls %u of %u service(s) matching '%ls' (%u already %ls)\n", start ? L"Starting" : L"Stopping",
+        (DWORD)names.size(), (DWORD)matches.size(), pattern,
+        (DWORD)(matches.size() - names.size()), start ? L"running" : L"stopped");
+    return ControlServiceGraph(pattern, names, start, (DWORD)(matches.size() - names.size()));
+}
+
+// "{xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx}", braces optional
+static BOOL ParseGuid(LPCWSTR text, GUID* guid) {
+    unsigned int data1, data2, data3, data4[8];
+    WCHAR trailing;
+    if (*text == L'{') text++;
+    int fields = swscanf(text, L"%8x-%4x-%4x-%2x%2x-%2x%2x%2x%2x%2x%2x%lc", &data1, &data2, &data3, &data4[0],
+        &data4[1], &data4[2], &data4[3], &data4[4], &data4[5], &data4[6], &data4[7], &trailing);
+    if (fields != 11 && !(fields == 12 && trailing == L'}')) return FALSE;
+    
+    guid->Data1 = data1;
+    guid->Data2 = (USHORT)data2;
+    guid->Data3 = (USHORT)data3;
+    for (int i = 0; i < 8; i++) {
+        guid->Data4[i] = (BYTE)data4[i];
+    }
+    return TRUE;
+}
+
+// Leading decimal digits of 'text' as a DWORD; *end is the first character
+// after them. FALSE without a digit or when the value does not fit.
+static BOOL ParseDword(LPCWSTR text, DWORD* value, LPCWSTR* end) {
+    ULONGLONG result = 0;
+    LPCWSTR cursor = text;
+    while (iswdigit(*cursor)) {
+        result = result * 10 + (ULONGLONG)(*cursor++ - L'0');
+        if (result > 0xFFFFFFFFull) return FALSE;
+    }
+    if (cursor == text) return FALSE;
+    *value = (DWORD)result;
+    *end = cursor;
+    return TRUE;
+}
+
+// "--restart" delays: milliseconds before each consecutive restart,
+// comma-separated, e.g. "0,5000,60000"
+static BOOL ParseRestartDelays(LPCWSTR text, SERVICE_RECOVERY* recovery) {
+    recovery->RestartCount = 0;
+    while (*text) {
+        LPCWSTR end;
+        if (recovery->RestartCount == SERVICE_RECOVERY_MAX_RESTARTS) return FALSE;
+        if (!ParseDword(text, &recovery->RestartDelayMs[recovery->RestartCount++], &end)) return FALSE;
+        if (*end == L',' && end[1]) end++;
+        else if (*end) return FALSE;
+        text = end;
+    }
+    return recovery->RestartCount > 0;
+}
+
+// Split install arguments into positional ones and the boot options.
+// Default: automatic start; a trigger without --start makes it demand
+// start, so the service runs only when the trigger fires. The --depends
+// list is stored double-null-terminated in 'dependencies'; --host gives
+// the log file of the service host (NULL when the command runs directly).
+// Without --restart the service stays down after a failure; the failure
+// count resets after a day unless --reset-period says otherwise. A repeated
+// --depends adds to the list; any other "--" token is an error.
+static BOOL ParseBootOptions(int argc, wchar_t* argv[], std::vector<wchar_t*>* args, SERVICE_BOOT_OPTIONS* boot,
+    std::wstring* dependencies, LPCWSTR* hostLog) {
+    // First IP address on any interface (NETWORK_MANAGER_FIRST_IP_ADDRESS_ARRIVAL_GUID)
+    static const GUID networkArrival = { 0x4f27f2de, 0x14e2, 0x430b, { 0xa5, 0x49, 0x7c, 0xd4, 0x8c, 0xbc, 0x82, 0x45 } };
+    LPCWSTR start = NULL;
+    *hostLog = NULL;
+    memset(boot, 0, sizeof(*boot));
+    boot->StartType = SERVICE_AUTO_START;
+    boot->Recovery.ResetPeriod = 24 * 60 * 60;
+    BOOL recoveryOption = FALSE;
+    
+    for (int i = 0; i < argc; i++) {
+        if (_wcsicmp(argv[i], L"--start") == 0 && i + 1 < argc) {
+            start = argv[++i];
+        } else if (_wcsicmp(argv[i], L"--trigger") == 0 && i + 1 < argc) {
+            LPCWSTR trigger = argv[++i];
+            if (_wcsicmp(trigger, L"network") == 0) {
+                boot->Trigger.Type = SERVICE_TRIGGER_TYPE_IP_ADDRESS_AVAILABILITY;
+                boot->Trigger.Subtype = networkArrival;
+            } else if (_wcsnicmp(trigger, L"event:", 6) == 0 && ParseGuid(trigger + 6, &boot->Trigger.Subtype)) {
+                boot->Trigger.Type = SERVICE_TRIGGER_TYPE_CUSTOM;
+            } else {
+                return FALSE;
+            }
+        } else if (_wcsicmp(argv[i], L"--depends") == 0 && i + 1 < argc) {
+            // Reopen the list: drop its final terminator
+            if (!dependencies->empty()) dependencies->erase(dependencies->size() - 1);
+            for (LPCWSTR name = argv[++i]; *name; ) {
+                size_t length = wcscspn(name, L",");
+                if (length == 0) return FALSE;
+                dependencies->append(name, length);
+                dependencies->push_back(L'\0');
+                name += length;
+                if (*name) name++;
+            }
+            dependencies->push_back(L'\0');
+            boot->Dependencies = dependencies->c_str();
+        } else if (_wcsicmp(argv[i], L"--host") == 0 && i + 1 < argc) {
+            *hostLog = argv[++i];
+        } else if (_wcsicmp(argv[i], L"--restart") == 0 && i + 1 < argc) {
+            if (!ParseRestartDelays(argv[++i], &boot->Recovery)) return FALSE;
+        } else if (_wcsicmp(argv[i], L"--reset-period") == 0 && i + 1 < argc) {
+            LPCWSTR end;
+            if (!ParseDword(argv[++i], &boot->Recovery.ResetPeriod, &end) || *end) return FALSE;
+            recoveryOption = TRUE;
+        } else if (_wcsicmp(argv[i], L"--restart-on-error") == 0) {
+            boot->Recovery.OnNonCrashFailure = TRUE;
+            recoveryOption = TRUE;
+        } else if (wcsncmp(argv[i], L"--", 2) == 0) {
+            return FALSE;
+        } else {
+            args->push_back(argv[i]);
+        }
+    }
+    
+    // The reset period and the error-exit flag only qualify restarts
+    if (recoveryOption && boot->Recovery.RestartCount == 0) return FALSE;
+    
+    if (!start) {
+        if (boot->Trigger.Type) boot->StartType = SERVICE_DEMAND_START;
+    } else if (_wcsicmp(start, L"delayed") == 0) {
+        boot->DelayedAutoStart = TRUE;
+    } else if (_wcsicmp(start, L"demand") == 0 || _wcsicmp(start, L"manual") == 0) {
+        boot->StartType = SERVICE_DEMAND_START;
+    } else if (_wcsicmp(start, L"disabled") == 0) {
+        boot->StartType = SERVICE_DISABLED;
+    } else if (_wcsicmp(start, L"auto") != 0) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// start / restart options after the service name. *ready stays
+// SERVICE_PROBE_NONE without --ready; FALSE for an unknown option, a bad
+// probe, or --ready-timeout / --ready-interval without --ready.
+static BOOL ParseReadyOptions(int argc, wchar_t* argv[], SERVICE_PROBE* ready) {
+    LPCWSTR probe = NULL;
+    DWORD timeoutMs = 0;
+    DWORD intervalMs = SERVICE_PROBE_INTERVAL_MS;
+    BOOL tuned = FALSE;
+    memset(ready, 0, sizeof(*ready));
+    
+    for (int i = 0; i < argc; i++) {
+        if (_wcsicmp(argv[i], L"--ready") == 0 && i + 1 < argc) {
+            probe = argv[++i];
+        } else if (_wcsicmp(argv[i], L"--ready-timeout") == 0 && i + 1 < argc) {
+            timeoutMs = (DWORD)wcstoul(argv[++i], NULL, 10);
+            tuned = TRUE;
+        } else if (_wcsicmp(argv[i], L"--ready-interval") == 0 && i + 1 < argc) {
+            intervalMs = (DWORD)wcstoul(argv[++i], NULL, 10);
+            if (intervalMs == 0) return FALSE;
+            tuned = TRUE;
+        } else {
+            return FALSE;
+        }
+    }
+    
+    if (!probe) return !tuned;
+    if (!ParseServiceProbe(probe, ready)) return FALSE;
+    ready->TimeoutMs = timeoutMs;
+    ready->IntervalMs = intervalMs;
+    return TRUE;
+}
+
+// Report a malformed command line
+static int CommandUsage(LPCWSTR command, LPCWSTR error, LPCWSTR usage) {
+    OUTPUT_RECORD record;
+    OutputBegin(&record, command, NULL);
+    OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER, L"ERROR: %ls\nUsage: %ls", error, usage);
+    return 1;
+}
+
+// Image path to register: the command itself, or the command wrapped in
+// this tool's service host when --host is given (NULL after reporting a
+// failure)
+static LPCWSTR HostedImagePath(LPCWSTR command, LPCWSTR exePath, LPCWSTR hostLog, std::wstring* hosted) {
+    if (!hostLog) return exePath;
+    if (!ServiceHostImagePath(hostLog, exePath, hosted)) {
+        DWORD err = GetLastError();
+        OUTPUT_RECORD record;
+        OutputBegin(&record, command, NULL);
+        OutputFinish(&record, FALSE, err, L"Cannot resolve the path of this executable: %d", err);
+        return NULL;
+    }
+    return hosted->c_str();
+}
+
+// Options shared by install and reconcile
+#define BOOT_OPTIONS_USAGE \
+    L"    [--start <auto|delayed|demand|disabled>] [--trigger <network|event:<provider-guid>>]\n" \
+    L"    [--depends <service,...>] [--host <log-file>]\n" \
+    L"    [--restart <ms,...>] [--reset-period <seconds>] [--restart-on-error]"
+
+// Commands whose only argument is the service name
+typedef struct _NAMED_COMMAND {
+    LPCWSTR Name;
+    LPCWSTR Usage;
+    LPCWSTR Missing;    // Error when the name is left out
+} NAMED_COMMAND;
+
+static const NAMED_COMMAND NamedCommands[] = {
+    { L"uninstall", L"uninstall <service-name>", L"uninstall command requires service name" },
+    { L"stop", L"stop <service-name>", L"stop command requires service name" },
+    { L"status", L"status <service-name>", L"status command requires service name" },
+};
+
+static BOOL CommandRejected(SERVICE_COMMAND* parsed, LPCWSTR error) {
+    parsed->Error = error;
+    return FALSE;
+}
+
+BOOL ParseServiceCommand(int argc, wchar_t* argv[], SERVICE_COMMAND* parsed) {
+    LPCWSTR command = argv[0];
+    parsed->Command = command;
+    parsed->ServiceName = NULL;
+    parsed->ExePath = NULL;
+    parsed->DisplayName = NULL;
+    parsed->Description = NULL;
+    parsed->HostLog = NULL;
+    memset(&parsed->Boot, 0, sizeof(parsed->Boot));
+    parsed->Dependencies.clear();
+    memset(&parsed->Ready, 0, sizeof(parsed->Ready));
+    parsed->Error = NULL;
+    parsed->Usage = NULL;
+    
+    // Install / reconcile: reconcile applies the same arguments as differences
+    BOOL install = _wcsicmp(command, L"install") == 0;
+    if (install || _wcsicmp(command, L"reconcile") == 0) {
+        parsed->Usage = install ? L"install <exe-path> <service-name> [display-name] [description]\n" BOOT_OPTIONS_USAGE
+            : L"reconcile <exe-path> <service-name> [display-name] [description]\n" BOOT_OPTIONS_USAGE;
+        std::vector<wchar_t*> args;
+        if (!ParseBootOptions(argc, argv, &args, &parsed->Boot, &parsed->Dependencies, &parsed->HostLog)) {
+            return CommandRejected(parsed, L"unknown option or invalid --start, --trigger, --depends or --restart value");
+        }
+        if (args.size() < 3) {
+            return CommandRejected(parsed, install ? L"install command requires at least 2 arguments"
+                : L"reconcile command requires at least 2 arguments");
+        }
+        
+        parsed->ExePath = args[1];
+        parsed->ServiceName = args[2];
+        parsed->DisplayName = (args.size() > 3) ? args[3] : NULL;
+        parsed->Description = (args.size() > 4) ? args[4] : NULL;
+        return TRUE;
+    }
+    
+    BOOL start = _wcsicmp(command, L"start") == 0;
+    if (start || _wcsicmp(command, L"restart") == 0) {
+        parsed->Usage = start ? L"start <service-name> [--ready <tcp:[host:]port|pipe:<name>|file:<path>>]\n"
+            L"    [--ready-timeout <ms>] [--ready-interval <ms>]"
+            : L"restart <service-name> [--ready <tcp:[host:]port|pipe:<name>|file:<path>>]\n"
+            L"    [--ready-timeout <ms>] [--ready-interval <ms>]";
+        if (argc < 2) {
+            return CommandRejected(parsed, start ? L"start command requires service name"
+                : L"restart command requires service name");
+        }
+        if (!ParseReadyOptions(argc - 2, argv + 2, &parsed->Ready)) {
+            return CommandRejected(parsed, L"invalid --ready, --ready-timeout or --ready-interval value");
+        }
+        
+        parsed->ServiceName = argv[1];
+        if (parsed->Ready.Type != SERVICE_PROBE_NONE && IsServicePattern(parsed->ServiceName)) {
+            return CommandRejected(parsed, L"--ready needs a single service name");
+        }
+        return TRUE;
+    }
+    
+    // Commands that take just the service name
+    for (size_t i = 0; i < sizeof(NamedCommands) / sizeof(NamedCommands[0]); i++) {
+        if (_wcsicmp(command, NamedCommands[i].Name) != 0) continue;
+        
+        parsed->Usage = NamedCommands[i].Usage;
+        if (argc < 2) return CommandRejected(parsed, NamedCommands[i].Missing);
+        parsed->ServiceName = argv[1];
+        return TRUE;
+    }
+    
+    if (_wcsicmp(command, L"list") == 0) {
+        parsed->ServiceName = argc > 1 ? argv[1] : NULL;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Run a command line ParseServiceCommand accepted
+static int RunParsedCommand(const SERVICE_COMMAND* parsed) {
+    LPCWSTR command = parsed->Command;
+    LPCWSTR serviceName = parsed->ServiceName;
+    const SERVICE_PROBE* ready = parsed->Ready.Type != SERVICE_PROBE_NONE ? &parsed->Ready : NULL;
+    
+    // Install / reconcile commands
+    BOOL install = _wcsicmp(command, L"install") == 0;
+    if (install || _wcsicmp(command, L"reconcile") == 0) {
+        std::wstring hosted;
+        LPCWSTR exePath = HostedImagePath(command, parsed->ExePath, parsed->HostLog, &hosted);
+        if (!exePath) return 1;
+        
+        if (install) {
+            return InstallService(exePath, serviceName, parsed->DisplayName, parsed->Description, &parsed->Boot) ? 0 : 1;
+        }
+        return ReconcileService(exePath, serviceName, parsed->DisplayName, parsed->Description, &parsed->Boot) ? 0 : 1;
+    }
+    
+    // Uninstall command
+    if (_wcsicmp(command, L"uninstall") == 0) {
+        return UninstallService(serviceName) ? 0 : 1;
+    }
+    
+    // Start command
+    if (_wcsicmp(command, L"start") == 0) {
+        if (IsServicePattern(serviceName)) return ControlMatchingServices(serviceName, TRUE);
+        return ControlServiceGraph(NULL, std::vector<std::wstring>(1, serviceName), TRUE, 0, ready);
+    }
+    
+    // Stop command
+    if (_wcsicmp(command, L"stop") == 0) {
+        if (IsServicePattern(serviceName)) return ControlMatchingServices(serviceName, FALSE);
+        return ControlServiceGraph(NULL, std::vector<std::wstring>(1, serviceName), FALSE, 0);
+    }
+    
+    // Restart command
+    if (_wcsicmp(command, L"restart") == 0) {
+        return RestartServiceByName(serviceName, ready) ? 0 : 1;
+    }
+    
+    // Status command
+    if (_wcsicmp(command, L"status") == 0) {
+        if (IsServicePattern(serviceName)) return ListServices(L"status", serviceName);
+        return GetServiceStatusByName(serviceName) ? 0 : 1;
+    }
+    
+    // List command
+    return ListServices(L"list", serviceName);
+}
+
+int RunServiceCommand(int argc, wchar_t* argv[]) {
+    wchar_t* command = argv[0];
+    
+    // Service lifecycle commands, checked before any of them runs
+    SERVICE_COMMAND parsed;
+    if (ParseServiceCommand(argc, argv, &parsed)) return RunParsedCommand(&parsed);
+    if (parsed.Error) return CommandUsage(command, parsed.Error, parsed.Usage);
+    
+    // Inventory command (registry view, read-only)
+    if (_wcsicmp(command, L"inventory") == 0) {
+        return InventoryServices(argc > 1 ? argv[1] : NULL);
+    }
+    
+    // Export command (snapshot file)
+    if (_wcsicmp(command, L"export") == 0) {
+        if (argc < 2) {
+            return CommandUsage(command, L"export command requires a file name",
+                L"export <snapshot-file> [pattern]");
+        }
+        
+        return ExportSnapshot(argv[1], argc > 2 ? argv[2] : NULL);
+    }
+    
+    // Diff command (two snapshot files)
+    if (_wcsicmp(command, L"diff") == 0) {
+        if (argc < 3) {
+            return CommandUsage(command, L"diff command requires two snapshot files",
+                L"diff <before-file> <after-file>");
+        }
+        
+        return DiffSnapshots(argv[1], argv[2]);
+    }
+    
+    // Watch command
+    if (_wcsicmp(command, L"watch") == 0) {
+        std::vector<LPCWSTR> targets;
+        DWORD duration = INFINITE;
+        for (int i = 1; i < argc; i++) {
+            if (_wcsicmp(argv[i], L"--duration") == 0 && i + 1 < argc) {
+                duration = (DWORD)wcstoul(argv[++i], NULL, 10);
+            } else {
+                targets.push_back(argv[i]);
+            }
+        }
+        if (targets.empty()) {
+            return CommandUsage(command, L"watch command requires service name",
+                L"watch <service-name|pattern>... [--duration <ms>]");
+        }
+        
+        return WatchServices(targets.data(), (DWORD)targets.size(), duration);
+    }
+    
+    // Profile-start command
+    if (_wcsicmp(command, L"profile-start") == 0) {
+        LPCWSTR serviceName = NULL;
+        DWORD runs = 5;
+        DWORD poll = 5;
+        BOOL timeline = FALSE;
+        for (int i = 1; i < argc; i++) {
+            if (_wcsicmp(argv[i], L"--runs") == 0 && i + 1 < argc) {
+                runs = (DWORD)wcstoul(argv[++i], NULL, 10);
+            } else if (_wcsicmp(argv[i], L"--poll") == 0 && i + 1 < argc) {
+                poll = (DWORD)wcstoul(argv[++i], NULL, 10);
+            } else if (_wcsicmp(argv[i], L"--timeline") == 0) {
+                timeline = TRUE;
+            } else if (!serviceName) {
+                serviceName = argv[i];
+            }
+        }
+        if (!serviceName || runs == 0) {
+            return CommandUsage(command, L"profile-start command requires service name",
+                L"profile-start <service-name> [--runs <n>] [--poll <ms>] [--timeline]");
+        }
+        
+        return ProfileServiceStart(serviceName, runs, poll, timeline);
+    }
+    
+    // Top command (process resource use)
+    if (_wcsicmp(command, L"top") == 0) {
+        std::vector<LPCWSTR> targets;
+        DWORD interval = 1000;
+        DWORD samples = 0;
+        for (int i = 1; i < argc; i++) {
+            if (_wcsicmp(argv[i], L"--interval") == 0 && i + 1 < argc) {
+                interval = (DWORD)wcstoul(argv[++i], NULL, 10);
+            } else if (_wcsicmp(argv[i], L"--count") == 0 && i + 1 < argc) {
+                samples = (DWORD)wcstoul(argv[++i], NULL, 10);
+            } else {
+                targets.push_back(argv[i]);
+            }
+        }
+        if (targets.empty()) {
+            return CommandUsage(command, L"top command requires service name",
+                L"top <service-name|pattern>... [--interval <ms>] [--count <n>]");
+        }
+        
+        return TopServices(targets.data(), (DWORD)targets.size(), interval, samples);
+    }
+    
+    return COMMAND_UNKNOWN;
+}
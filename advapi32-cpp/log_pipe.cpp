@@ -0,0 +1,211 @@
+#include "log_pipe.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct _LOG_PIPE {
+    LOG_PIPE_CONFIG Config;
+    std::wstring Path;
+    FILE* File;                 // Writer thread only
+    ULONGLONG FileBytes;
+    ULONGLONG Lost;             // Bytes the file would not take (writer thread)
+    
+    std::mutex Lock;
+    std::condition_variable Ready;
+    std::vector<char> Pending;
+    ULONGLONG PendingSince;     // Tick of the oldest pending byte
+    ULONGLONG Dropped;          // Since the last batch
+    BOOL Closing;
+    LOG_PIPE_STATS Stats;       // Producers add DroppedBytes, the writer the rest
+    std::thread Writer;
+};
+
+VOID LogPipeInitConfig(LOG_PIPE_CONFIG* config, LPCWSTR path) {
+    config->Path = path;
+    config->MaxFileBytes = 10ULL * 1024 * 1024;
+    config->MaxFiles = 5;
+    config->FlushMs = 200;
+    config->MaxPendingBytes = 8 * 1024 * 1024;
+}
+
+#ifndef _WIN32
+static std::string LogPipeNarrow(const std::wstring& path) {
+    size_t len = wcstombs(NULL, path.c_str(), 0);
+    if (len == (size_t)-1) return std::string();
+    std::string narrow(len, '\0');
+    wcstombs(&narrow[0], path.c_str(), len + 1);
+    return narrow;
+}
+#endif
+
+static FILE* LogPipeOpenFile(const std::wstring& path, LPCWSTR mode) {
+#ifdef _WIN32
+    return _wfopen(path.c_str(), mode);
+#else
+    std::string narrow = LogPipeNarrow(path);
+    if (narrow.empty()) return NULL;
+    return fopen(narrow.c_str(), mode[0] == L'a' ? "ab" : "wb");
+#endif
+}
+
+static void LogPipeMoveFile(const std::wstring& from, const std::wstring& to) {
+#ifdef _WIN32
+    _wremove(to.c_str());
+    _wrename(from.c_str(), to.c_str());
+#else
+    rename(LogPipeNarrow(from).c_str(), LogPipeNarrow(to).c_str());
+#endif
+}
+
+static std::wstring LogPipeRotatedName(const LOG_PIPE* pipe, DWORD index) {
+    WCHAR suffix[16];
+    swprintf(suffix, sizeof(suffix) / sizeof(WCHAR), L".%u", index);
+    return pipe->Path + suffix;
+}
+
+// <path>.N-1 -> <path>.N, ..., <path> -> <path>.1, then a new empty file.
+// The oldest file falls off the end.
+static void LogPipeRotate(LOG_PIPE* pipe) {
+    if (pipe->File) fclose(pipe->File);
+    for (DWORD i = pipe->Config.MaxFiles; i > 1; i--) {
+        LogPipeMoveFile(LogPipeRotatedName(pipe, i - 1), LogPipeRotatedName(pipe, i));
+    }
+    if (pipe->Config.MaxFiles) LogPipeMoveFile(pipe->Path, LogPipeRotatedName(pipe, 1));
+    
+    pipe->File = LogPipeOpenFile(pipe->Path, L"wb");
+    pipe->FileBytes = 0;
+    pipe->Stats.Rotations++;
+}
+
+// Write one batch, rotating where the size limit falls: after the last
+// complete line that still fits, or mid-line when a single line is longer
+// than a whole file
+static void LogPipeEmit(LOG_PIPE* pipe, const char* data, size_t size) {
+    ULONGLONG limit = pipe->Config.MaxFileBytes;
+    while (size) {
+        size_t take = size;
+        if (limit && pipe->FileBytes + size > limit) {
+            size_t room = pipe->FileBytes < limit ? (size_t)(limit - pipe->FileBytes) : 0;
+            take = 0;
+            for (size_t i = room; i > 0; i--) {
+                if (data[i - 1] == '\n') {
+                    take = i;
+                    break;
+                }
+            }
+            if (take == 0 && pipe->FileBytes == 0) take = room;
+            if (take == 0) {
+                LogPipeRotate(pipe);
+                continue;
+            }
+        }
+        
+        if (!pipe->File || fwrite(data, 1, take, pipe->File) != take) {
+            pipe->Lost += size;
+            return;
+        }
+        pipe->FileBytes += take;
+        pipe->Stats.WrittenBytes += take;
+        data += take;
+        size -= take;
+        if (size) LogPipeRotate(pipe);
+    }
+}
+
+static void LogPipeWriterLoop(LOG_PIPE* pipe) {
+    std::vector<char> batch;
+    std::unique_lock<std::mutex> lock(pipe->Lock);
+    for (;;) {
+        // Sleep until a batch is full, the oldest byte is due or the pipe closes
+        while (!pipe->Closing) {
+            if (pipe->Pending.empty() && !pipe->Dropped) {
+                pipe->Ready.wait(lock);
+                continue;
+            }
+            ULONGLONG waited = GetTickCount64() - pipe->PendingSince;
+            if (pipe->Pending.size() >= LOG_PIPE_BATCH_BYTES || waited >= pipe->Config.FlushMs) break;
+            pipe->Ready.wait_for(lock, std::chrono::milliseconds(pipe->Config.FlushMs - waited));
+        }
+        if (pipe->Pending.empty() && !pipe->Dropped) break;
+        
+        batch.swap(pipe->Pending);
+        pipe->Pending.clear();
+        ULONGLONG dropped = pipe->Dropped;
+        pipe->Dropped = 0;
+        lock.unlock();
+        
+        if (dropped) {
+            char marker[64];
+            int length = snprintf(marker, sizeof(marker), "[log: %llu bytes dropped]\n",
+                (unsigned long long)dropped);
+            LogPipeEmit(pipe, marker, (size_t)length);
+        }
+        LogPipeEmit(pipe, batch.data(), batch.size());
+        if (pipe->File) fflush(pipe->File);
+        
+        lock.lock();
+        pipe->Stats.Batches++;
+    }
+}
+
+LOG_PIPE* LogPipeOpen(const LOG_PIPE_CONFIG* config) {
+    LOG_PIPE* pipe = new LOG_PIPE();
+    pipe->Config = *config;
+    pipe->Path = config->Path;
+    pipe->File = LogPipeOpenFile(pipe->Path, L"ab");
+    if (!pipe->File) {
+        delete pipe;
+        SetLastError(ERROR_FILE_NOT_FOUND);
+        return NULL;
+    }
+    
+    // Appending: the existing content counts toward the size limit
+    fseek(pipe->File, 0, SEEK_END);
+    long existing = ftell(pipe->File);
+    pipe->FileBytes = existing > 0 ? (ULONGLONG)existing : 0;
+    pipe->Lost = 0;
+    pipe->PendingSince = 0;
+    pipe->Dropped = 0;
+    pipe->Closing = FALSE;
+    memset(&pipe->Stats, 0, sizeof(pipe->Stats));
+    pipe->Pending.reserve(LOG_PIPE_BATCH_BYTES);
+    pipe->Writer = std::thread(LogPipeWriterLoop, pipe);
+    return pipe;
+}
+
+VOID LogPipeWrite(LOG_PIPE* pipe, const void* data, DWORD bytes) {
+    if (bytes == 0) return;
+    
+    std::lock_guard<std::mutex> lock(pipe->Lock);
+    if (pipe->Pending.size() + bytes > pipe->Config.MaxPendingBytes) {
+        pipe->Dropped += bytes;
+        pipe->Stats.DroppedBytes += bytes;
+        return;
+    }
+    
+    // Wake the writer to start its flush timer, or when a batch is full
+    BOOL wake = pipe->Pending.empty() || pipe->Pending.size() + bytes >= LOG_PIPE_BATCH_BYTES;
+    if (pipe->Pending.empty()) pipe->PendingSince = GetTickCount64();
+    pipe->Pending.insert(pipe->Pending.end(), (const char*)data, (const char*)data + bytes);
+    if (wake) pipe->Ready.notify_one();
+}
+
+VOID LogPipeClose(LOG_PIPE* pipe, LOG_PIPE_STATS* stats) {
+    {
+        std::lock_guard<std::mutex> lock(pipe->Lock);
+        pipe->Closing = TRUE;
+    }
+    pipe->Ready.notify_one();
+    pipe->Writer.join();
+    
+    if (pipe->File) fclose(pipe->File);
+    pipe->Stats.DroppedBytes += pipe->Lost;
+    if (stats) *stats = pipe->Stats;
+    delete pipe;
+}
@@ -0,0 +1,359 @@
+#include "metrics.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#define METRIC_SUB_BITS   3                             // 8 buckets per power of two
+#define METRIC_SUB_COUNT  (1 << METRIC_SUB_BITS)
+#define METRIC_BUCKETS    (METRIC_SUB_COUNT * 40)       // Exact below 8 us, up to ~2^42 us
+
+BOOL g_MetricsEnabled = FALSE;
+
+// Counters are only ever added to; static storage starts them at zero
+struct MetricHistogram {
+    std::atomic<ULONGLONG> Count;
+    std::atomic<ULONGLONG> SumUs;
+    std::atomic<ULONGLONG> MaxUs;
+    std::atomic<ULONGLONG> Buckets[METRIC_BUCKETS];
+};
+
+static MetricHistogram g_Metrics[METRIC_COUNT];
+
+// Names used in reports and as the Prometheus "call" label
+static const LPCWSTR g_MetricNames[] = {
+    L"connect",
+    L"open",
+    L"create",
+    L"set_description",
+    L"delete",
+    L"start",
+    L"control",
+    L"query_status",
+    L"query_config",
+    L"change_config",
+    L"query_recovery",
+    L"change_recovery",
+    L"query_start_options",
+    L"change_start_options",
+    L"enum_services",
+    L"enum_dependents",
+    L"wait_status_change",
+    L"read_registry",
+    L"query_processes",
+    L"close",
+    L"wait_state",
+    L"poll_sleep",
+    L"wait_ready",
+};
+
+static_assert(sizeof(g_MetricNames) / sizeof(g_MetricNames[0]) == METRIC_COUNT, "one name per METRIC_ID");
+
+ULONGLONG MetricsNow() {
+    return (ULONGLONG)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LPCWSTR MetricName(METRIC_ID id) {
+    return (DWORD)id < METRIC_COUNT ? g_MetricNames[id] : NULL;
+}
+
+// Values below METRIC_SUB_COUNT get a bucket each; above, every power of two
+// is split into METRIC_SUB_COUNT equal buckets
+static DWORD MetricBucket(ULONGLONG us) {
+    if (us < METRIC_SUB_COUNT) return (DWORD)us;
+    
+    DWORD exponent = METRIC_SUB_BITS;
+    while ((us >> (exponent + 1)) != 0) exponent++;
+    DWORD sub = (DWORD)(us >> (exponent - METRIC_SUB_BITS)) & (METRIC_SUB_COUNT - 1);
+    DWORD index = (exponent - METRIC_SUB_BITS + 1) * METRIC_SUB_COUNT + sub;
+    return index < METRIC_BUCKETS ? index : METRIC_BUCKETS - 1;
+}
+
+// Largest value that lands in a bucket
+static ULONGLONG MetricBucketUpper(DWORD index) {
+    if (index < METRIC_SUB_COUNT) return index;
+    
+    DWORD shift = index / METRIC_SUB_COUNT - 1;
+    ULONGLONG lower = (ULONGLONG)(METRIC_SUB_COUNT + index % METRIC_SUB_COUNT) << shift;
+    return lower + (1ULL << shift) - 1;
+}
+
+VOID MetricsRecord(METRIC_ID id, ULONGLONG elapsedUs) {
+    MetricHistogram* h = &g_Metrics[id];
+    h->Count.fetch_add(1, std::memory_order_relaxed);
+    h->SumUs.fetch_add(elapsedUs, std::memory_order_relaxed);
+    h->Buckets[MetricBucket(elapsedUs)].fetch_add(1, std::memory_order_relaxed);
+    
+    ULONGLONG max = h->MaxUs.load(std::memory_order_relaxed);
+    while (elapsedUs > max && !h->MaxUs.compare_exchange_weak(max, elapsedUs, std::memory_order_relaxed)) {
+    }
+}
+
+// Nearest-rank percentile (0 = the smallest value), reported as its
+// bucket's upper bound (capped at the exact maximum)
+static ULONGLONG MetricPercentile(const MetricHistogram* h, ULONGLONG count, ULONGLONG max, DWORD percent) {
+    ULONGLONG rank = (count * percent + 99) / 100;
+    if (rank == 0) rank = 1;
+    ULONGLONG seen = 0;
+    for (DWORD i = 0; i < METRIC_BUCKETS; i++) {
+        seen += h->Buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            ULONGLONG upper = MetricBucketUpper(i);
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+// Timing wrappers around the selected backend. Each forwards unchanged, so
+// the error code of the inner call is what the caller sees.
+static const SERVICE_BACKEND* g_MetricsInner = NULL;
+static SERVICE_BACKEND g_MetricsBackend;
+
+static SVC_HANDLE MetricsConnect(DWORD desiredAccess) {
+    MetricScope scope(METRIC_CONNECT);
+    return g_MetricsInner->Connect(desiredAccess);
+}
+
+static SVC_HANDLE MetricsOpen(SVC_HANDLE manager, LPCWSTR serviceName, DWORD desiredAccess) {
+    MetricScope scope(METRIC_OPEN);
+    return g_MetricsInner->Open(manager, serviceName, desiredAccess);
+}
+
+static SVC_HANDLE MetricsCreate(SVC_HANDLE manager, const SERVICE_INSTALL_SPEC* spec) {
+    MetricScope scope(METRIC_CREATE);
+    return g_MetricsInner->Create(manager, spec);
+}
+
+static BOOL MetricsSetDescription(SVC_HANDLE service, LPCWSTR description) {
+    MetricScope scope(METRIC_SET_DESCRIPTION);
+    return g_MetricsInner->SetDescription(service, description);
+}
+
+static BOOL MetricsDelete(SVC_HANDLE service) {
+    MetricScope scope(METRIC_DELETE);
+    return g_MetricsInner->Delete(service);
+}
+
+static BOOL MetricsStart(SVC_HANDLE service) {
+    MetricScope scope(METRIC_START);
+    return g_MetricsInner->Start(service);
+}
+
+static BOOL MetricsControl(SVC_HANDLE service, DWORD control, SERVICE_STATUS* status) {
+    MetricScope scope(METRIC_CONTROL);
+    return g_MetricsInner->Control(service, control, status);
+}
+
+static BOOL MetricsQueryStatus(SVC_HANDLE service, SERVICE_STATUS* status) {
+    MetricScope scope(METRIC_QUERY_STATUS);
+    return g_MetricsInner->QueryStatus(service, status);
+}
+
+static BOOL MetricsQueryConfig(SVC_HANDLE service, LPQUERY_SERVICE_CONFIGW config, DWORD bufSize, LPDWORD bytesNeeded) {
+    MetricScope scope(METRIC_QUERY_CONFIG);
+    return g_MetricsInner->QueryConfig(service, config, bufSize, bytesNeeded);
+}
+
+static BOOL MetricsChangeConfig(SVC_HANDLE service, const QUERY_SERVICE_CONFIGW* changes) {
+    MetricScope scope(METRIC_CHANGE_CONFIG);
+    return g_MetricsInner->ChangeConfig(service, changes);
+}
+
+static BOOL MetricsQueryRecovery(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_RECOVERY* recovery) {
+    MetricScope scope(METRIC_QUERY_RECOVERY);
+    return g_MetricsInner->QueryRecovery(service, scratch, recovery);
+}
+
+static BOOL MetricsChangeRecovery(SVC_HANDLE service, const SERVICE_RECOVERY* recovery) {
+    MetricScope scope(METRIC_CHANGE_RECOVERY);
+    return g_MetricsInner->ChangeRecovery(service, recovery);
+}
+
+static BOOL MetricsQueryStartOptions(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_START_OPTIONS* options) {
+    MetricScope scope(METRIC_QUERY_START_OPTIONS);
+    return g_MetricsInner->QueryStartOptions(service, scratch, options);
+}
+
+static BOOL MetricsChangeStartOptions(SVC_HANDLE service, const SERVICE_START_OPTIONS* options) {
+    MetricScope scope(METRIC_CHANGE_START_OPTIONS);
+    return g_MetricsInner->ChangeStartOptions(service, options);
+}
+
+static BOOL MetricsEnumServices(SVC_HANDLE manager, DWORD serviceType, DWORD serviceState, LPBYTE buffer, DWORD bufSize,
+    LPDWORD bytesNeeded, LPDWORD servicesReturned, LPDWORD resumeHandle) {
+    MetricScope scope(METRIC_ENUM_SERVICES);
+    return g_MetricsInner->EnumServices(manager, serviceType, serviceState, buffer, bufSize, bytesNeeded,
+        servicesReturned, resumeHandle);
+}
+
+static BOOL MetricsEnumDependents(SVC_HANDLE service, DWORD serviceState, LPENUM_SERVICE_STATUSW services,
+    DWORD bufSize, LPDWORD bytesNeeded, LPDWORD servicesReturned) {
+    MetricScope scope(METRIC_ENUM_DEPENDENTS);
+    return g_MetricsInner->EnumDependents(service, serviceState, services, bufSize, bytesNeeded, servicesReturned);
+}
+
+static DWORD MetricsWaitStatusChange(SVC_HANDLE* services, const DWORD* knownStates, DWORD count, DWORD timeoutMs) {
+    MetricScope scope(METRIC_WAIT_STATUS_CHANGE);
+    return g_MetricsInner->WaitStatusChange(services, knownStates, count, timeoutMs);
+}
+
+static BOOL MetricsReadRegistry(SVC_HANDLE manager, LPCWSTR serviceName, SERVICE_REGISTRY_ROUTINE routine, PVOID context) {
+    MetricScope scope(METRIC_READ_REGISTRY);
+    return g_MetricsInner->ReadRegistry(manager, serviceName, routine, context);
+}
+
+static BOOL MetricsQueryProcesses(SERVICE_PROCESS_USAGE* usage, DWORD count) {
+    MetricScope scope(METRIC_QUERY_PROCESSES);
+    return g_MetricsInner->QueryProcesses(usage, count);
+}
+
+static void MetricsClose(SVC_HANDLE handle) {
+    MetricScope scope(METRIC_CLOSE);
+    g_MetricsInner->Close(handle);
+}
+
+VOID MetricsEnable() {
+    if (g_MetricsEnabled) return;
+    
+    // Optional entries stay NULL so callers still see what is unsupported
+    g_MetricsInner = g_Backend;
+    g_MetricsBackend = *g_Backend;
+    g_MetricsBackend.Connect = MetricsConnect;
+    g_MetricsBackend.Open = MetricsOpen;
+    g_MetricsBackend.Create = MetricsCreate;
+    g_MetricsBackend.SetDescription = MetricsSetDescription;
+    g_MetricsBackend.Delete = MetricsDelete;
+    g_MetricsBackend.Start = MetricsStart;
+    g_MetricsBackend.Control = MetricsControl;
+    g_MetricsBackend.QueryStatus = MetricsQueryStatus;
+    g_MetricsBackend.QueryConfig = MetricsQueryConfig;
+    g_MetricsBackend.ChangeConfig = MetricsChangeConfig;
+    g_MetricsBackend.QueryRecovery = MetricsQueryRecovery;
+    g_MetricsBackend.ChangeRecovery = MetricsChangeRecovery;
+    g_MetricsBackend.QueryStartOptions = MetricsQueryStartOptions;
+    g_MetricsBackend.ChangeStartOptions = MetricsChangeStartOptions;
+    g_MetricsBackend.EnumServices = MetricsEnumServices;
+    g_MetricsBackend.EnumDependents = MetricsEnumDependents;
+    if (g_MetricsInner->WaitStatusChange) g_MetricsBackend.WaitStatusChange = MetricsWaitStatusChange;
+    if (g_MetricsInner->ReadRegistry) g_MetricsBackend.ReadRegistry = MetricsReadRegistry;
+    if (g_MetricsInner->QueryProcesses) g_MetricsBackend.QueryProcesses = MetricsQueryProcesses;
+    g_MetricsBackend.Close = MetricsClose;
+    
+    g_Backend = &g_MetricsBackend;
+    g_MetricsEnabled = TRUE;
+}
+
+static FILE* MetricsOpenFile(LPCWSTR path) {
+#ifdef _WIN32
+    return _wfopen(path, L"wb");
+#else
+    size_t len = wcstombs(NULL, path, 0);
+    if (len == (size_t)-1) return NULL;
+    std::string narrow(len, '\0');
+    wcstombs(&narrow[0], path, len + 1);
+    return fopen(narrow.c_str(), "wb");
+#endif
+}
+
+typedef struct _METRIC_SUMMARY {
+    ULONGLONG Count;
+    ULONGLONG SumUs;
+    ULONGLONG MaxUs;
+    ULONGLONG MinUs;
+    ULONGLONG P50Us;
+    ULONGLONG P95Us;
+    ULONGLONG P99Us;
+} METRIC_SUMMARY;
+
+static void MetricSummarize(METRIC_ID id, METRIC_SUMMARY* summary) {
+    const MetricHistogram* h = &g_Metrics[id];
+    summary->Count = h->Count.load(std::memory_order_relaxed);
+    summary->SumUs = h->SumUs.load(std::memory_order_relaxed);
+    summary->MaxUs = h->MaxUs.load(std::memory_order_relaxed);
+    summary->MinUs = MetricPercentile(h, summary->Count, summary->MaxUs, 0);
+    summary->P50Us = MetricPercentile(h, summary->Count, summary->MaxUs, 50);
+    summary->P95Us = MetricPercentile(h, summary->Count, summary->MaxUs, 95);
+    summary->P99Us = MetricPercentile(h, summary->Count, summary->MaxUs, 99);
+}
+
+// Summary per call type; quantiles and sums in seconds as Prometheus expects
+static BOOL MetricsWritePrometheus(LPCWSTR path, const METRIC_SUMMARY* summaries) {
+    FILE* file = MetricsOpenFile(path);
+    if (!file) return FALSE;
+    
+    LPCWSTR backend = g_MetricsInner ? g_MetricsInner->Name : g_Backend->Name;
+    fprintf(file, "# HELP service_installer_call_duration_seconds Latency of backend calls and state waits\n");
+    fprintf(file, "# TYPE service_installer_call_duration_seconds summary\n");
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        const METRIC_SUMMARY* s = &summaries[i];
+        if (s->Count == 0) continue;
+        
+        const ULONGLONG quantiles[] = { s->P50Us, s->P95Us, s->P99Us };
+        const char* labels[] = { "0.5", "0.95", "0.99" };
+        for (int q = 0; q < 3; q++) {
+            fprintf(file, "service_installer_call_duration_seconds{backend=\"%ls\",call=\"%ls\",quantile=\"%s\"} %.6f\n",
+                backend, g_MetricNames[i], labels[q], quantiles[q] / 1e6);
+        }
+        fprintf(file, "service_installer_call_duration_seconds_sum{backend=\"%ls\",call=\"%ls\"} %.6f\n",
+            backend, g_MetricNames[i], s->SumUs / 1e6);
+        fprintf(file, "service_installer_call_duration_seconds_count{backend=\"%ls\",call=\"%ls\"} %llu\n",
+            backend, g_MetricNames[i], (unsigned long long)s->Count);
+    }
+    
+    fprintf(file, "# HELP service_installer_call_duration_max_seconds Slowest backend call or state wait\n");
+    fprintf(file, "# TYPE service_installer_call_duration_max_seconds gauge\n");
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        if (summaries[i].Count == 0) continue;
+        fprintf(file, "service_installer_call_duration_max_seconds{backend=\"%ls\",call=\"%ls\"} %.6f\n",
+            backend, g_MetricNames[i], summaries[i].MaxUs / 1e6);
+    }
+    
+    BOOL written = !ferror(file);
+    if (fclose(file) != 0) written = FALSE;
+    return written;
+}
+
+BOOL MetricsReport(LPCWSTR prometheusPath) {
+    METRIC_SUMMARY summaries[METRIC_COUNT];
+    BOOL recorded = FALSE;
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        MetricSummarize((METRIC_ID)i, &summaries[i]);
+        if (summaries[i].Count) recorded = TRUE;
+    }
+    
+    if (recorded) {
+        OutputText(L"\n%-20ls %-8ls %10ls %10ls %10ls %10ls %12ls\n", L"Call", L"Count", L"p50 ms", L"p95 ms",
+            L"p99 ms", L"Max ms", L"Total ms");
+    }
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        const METRIC_SUMMARY* s = &summaries[i];
+        if (s->Count == 0) continue;
+        
+        OUTPUT_RECORD record;
+        OutputBegin(&record, L"stats", NULL);
+        record.Call = g_MetricNames[i];
+        record.Count = (DWORD)s->Count;
+        record.MinUs = s->MinUs;
+        record.P50Us = s->P50Us;
+        record.P95Us = s->P95Us;
+        record.P99Us = s->P99Us;
+        record.MaxUs = s->MaxUs;
+        record.TotalUs = s->SumUs;
+        OutputFinish(&record, TRUE, ERROR_SUCCESS, L"%-20ls %-8llu %10.3f %10.3f %10.3f %10.3f %12.3f", g_MetricNames[i],
+            (unsigned long long)s->Count, s->P50Us / 1e3, s->P95Us / 1e3, s->P99Us / 1e3, s->MaxUs / 1e3, s->SumUs / 1e3);
+    }
+    
+    if (!prometheusPath) return TRUE;
+    
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"stats", NULL);
+    if (!MetricsWritePrometheus(prometheusPath, summaries)) {
+        return OutputFinish(&record, FALSE, ERROR_FILE_NOT_FOUND, L"Failed to write metrics file '%ls'", prometheusPath);
+    }
+    OutputText(L"Metrics written to '%ls'\n", prometheusPath);
+    return TRUE;
+}
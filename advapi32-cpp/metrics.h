@@ -0,0 +1,63 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "service_backend.h"
+
+// Latency instrumentation (--stats). Every backend call and every state
+// wait is timed into a per-call histogram: lock-free log-linear buckets
+// (8 per power of two, so percentiles are within ~12%), plus exact count,
+// sum and max. Disabled it costs one flag test per wait and nothing per
+// backend call, since the timing wrappers are only installed on demand.
+
+typedef enum _METRIC_ID {
+    METRIC_CONNECT,
+    METRIC_OPEN,
+    METRIC_CREATE,
+    METRIC_SET_DESCRIPTION,
+    METRIC_DELETE,
+    METRIC_START,
+    METRIC_CONTROL,
+    METRIC_QUERY_STATUS,
+    METRIC_QUERY_CONFIG,
+    METRIC_CHANGE_CONFIG,
+    METRIC_QUERY_RECOVERY,
+    METRIC_CHANGE_RECOVERY,
+    METRIC_QUERY_START_OPTIONS,
+    METRIC_CHANGE_START_OPTIONS,
+    METRIC_ENUM_SERVICES,
+    METRIC_ENUM_DEPENDENTS,
+    METRIC_WAIT_STATUS_CHANGE,
+    METRIC_READ_REGISTRY,
+    METRIC_QUERY_PROCESSES,
+    METRIC_CLOSE,
+    METRIC_WAIT_STATE,      // WaitForServiceState, end to end
+    METRIC_POLL_SLEEP,      // Sleeps of the polling fallback
+    METRIC_WAIT_READY,      // WaitForServiceReady, end to end
+    METRIC_COUNT
+} METRIC_ID;
+
+extern BOOL g_MetricsEnabled;
+
+// Start collecting: route g_Backend through timing wrappers. Call after the
+// backend is selected and before any worker thread starts.
+VOID MetricsEnable();
+
+ULONGLONG MetricsNow();  // Monotonic microseconds
+LPCWSTR MetricName(METRIC_ID id);  // "query_status", ...; NULL when out of range
+VOID MetricsRecord(METRIC_ID id, ULONGLONG elapsedUs);
+
+// Times the enclosing scope when metrics are enabled
+struct MetricScope {
+    explicit MetricScope(METRIC_ID id) : Id(id), Start(g_MetricsEnabled ? MetricsNow() : 0) {}
+    ~MetricScope() { if (Start) MetricsRecord(Id, MetricsNow() - Start); }
+    
+    METRIC_ID Id;
+    ULONGLONG Start;
+};
+
+// Emit one record per call type that ran (count, p50/p95/p99, max) and, if
+// 'prometheusPath' is set, write the histograms there in the Prometheus
+// text exposition format. Returns FALSE if the file could not be written.
+BOOL MetricsReport(LPCWSTR prometheusPath);
+
+#endif // METRICS_H
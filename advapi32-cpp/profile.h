@@ -0,0 +1,14 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "service_backend.h"
+
+// Start the service 'runs' times, stopping it in between (stop time is not
+// measured), and poll its status every pollMs from the StartService call
+// until RUNNING. Reports time-to-running per run with min/median/max, and
+// how long the service stayed at each (state, checkpoint) step. The service
+// is left in the state it was found in. 'timeline' also reports every
+// observed state, checkpoint and wait hint change.
+int ProfileServiceStart(LPCWSTR serviceName, DWORD runs, DWORD pollMs, BOOL timeline);
+
+#endif // PROFILE_H
@@ -0,0 +1,202 @@
+#include "reconcile.h"
+#include "scm_session.h"
+#include "output.h"
+#include <string.h>
+#include <wchar.h>
+#include <string>
+
+// Whether the current value of a field differs from the desired one
+static BOOL ReconcileDiffers(SERVICE_FIELD_ID id, SCHEMA_VALUE current, SCHEMA_VALUE desired) {
+    if (SchemaField(id).Type == SCHEMA_DWORD) return current.Number != desired.Number;
+    if (!current.Text || !desired.Text) return current.Text != desired.Text;
+    return wcscmp(current.Text, desired.Text) != 0;
+}
+
+// Whether two double-null-terminated service lists differ. NULL is the
+// empty list; names compare case-insensitively, as the SCM does.
+static BOOL ReconcileListDiffers(LPCWSTR current, LPCWSTR desired) {
+    if (!current) current = L"";
+    if (!desired) desired = L"";
+    while (*current && *desired) {
+        if (_wcsicmp(current, desired) != 0) return TRUE;
+        current += wcslen(current) + 1;
+        desired += wcslen(desired) + 1;
+    }
+    return *current != *desired;
+}
+
+// "A, B", or "none"
+static void ReconcileDescribeList(std::wstring* out, LPCWSTR list) {
+    if (!list || !*list) {
+        out->append(L"none");
+        return;
+    }
+    for (LPCWSTR name = list; *name; name += wcslen(name) + 1) {
+        if (name != list) out->append(L", ");
+        out->append(name);
+    }
+}
+
+// "Network", "none", or with the triggers this tool does not write noted
+static void ReconcileDescribeTrigger(std::wstring* out, const SERVICE_START_OPTIONS* options) {
+    if (options->Trigger.Type) out->append(ServiceTriggerName(options->Trigger.Type));
+    if (options->OtherTriggers) out->append(options->Trigger.Type ? L" + others" : L"others");
+    if (!options->Trigger.Type && !options->OtherTriggers) out->append(L"none");
+}
+
+static BOOL ReconcileTriggerDiffers(const SERVICE_START_OPTIONS* current, const SERVICE_START_OPTIONS* desired) {
+    if (current->OtherTriggers || current->Trigger.Type != desired->Trigger.Type) return TRUE;
+    return current->Trigger.Type && memcmp(&current->Trigger.Subtype, &desired->Trigger.Subtype, sizeof(GUID)) != 0;
+}
+
+BOOL ReconcileService(LPCWSTR exePath, LPCWSTR serviceName, LPCWSTR displayName, LPCWSTR description,
+    const SERVICE_BOOT_OPTIONS* boot, LPDWORD changedCount) {
+    SCM_SESSION* session = ScmDefaultSession();
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"reconcile", serviceName);
+    
+    if (!ScmSessionManager(session, SC_MANAGER_CONNECT)) {
+        DWORD err = GetLastError();
+        return OutputFinish(&record, FALSE, err, L"Failed to open service manager: %d", err);
+    }
+    
+    // A policy that restarts the service can only be set with the right to start it
+    DWORD access = SERVICE_QUERY_CONFIG | SERVICE_CHANGE_CONFIG;
+    if (boot && boot->Recovery.RestartCount) access |= SERVICE_START;
+    SVC_HANDLE service = ScmSessionOpenService(session, serviceName, access);
+    if (!service) {
+        DWORD err = GetLastError();
+        if (err == ERROR_SERVICE_DOES_NOT_EXIST) {
+            // Nothing to compare against: install reports its own record
+            if (changedCount) *changedCount = 1;
+            return InstallService(exePath, serviceName, displayName, description, boot);
+        }
+        return OutputFinish(&record, FALSE, err, L"OpenService failed: %d", err);
+    }
+    
+    ScopedScratch scratch(session);
+    LPQUERY_SERVICE_CONFIGW current = ScratchQueryConfig(service, scratch.Buffer);
+    if (!current) {
+        DWORD err = GetLastError();
+        return OutputFinish(&record, FALSE, err, L"QueryServiceConfig failed: %d", err);
+    }
+    
+    SERVICE_INSTALL_SPEC desired;
+    SchemaInitSpec(&desired);
+    desired.ServiceName = serviceName;
+    desired.DisplayName = displayName;
+    desired.ImagePath = exePath;
+    if (boot) {
+        desired.StartType = boot->StartType;
+        desired.DelayedAutoStart = boot->DelayedAutoStart;
+        desired.Trigger = boot->Trigger;
+        desired.Dependencies = boot->Dependencies;
+        desired.Recovery = boot->Recovery;
+    }
+    
+    // Collect the differing fields; the rest stay SERVICE_NO_CHANGE / NULL
+    QUERY_SERVICE_CONFIGW changes;
+    SchemaInitConfig(&changes);
+    std::wstring details;
+    DWORD changed = 0;
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        const SCHEMA_FIELD& field = g_ServiceSchema[i];
+        if (!(field.Flags & SCHEMA_INSTALL) || field.ConfigOffset == SCHEMA_NO_OFFSET) continue;
+        
+        SCHEMA_VALUE from = SchemaConfigValue(current, field.Id);
+        SCHEMA_VALUE to = SchemaSpecValue(&desired, field.Id);
+        if (!ReconcileDiffers(field.Id, from, to)) continue;
+        
+        WCHAR fromNumber[16], toNumber[16];
+        details.append(L"\n");
+        details.append(field.Label);
+        details.append(L": ");
+        details.append(SchemaFormatValue(field.Id, from, fromNumber, sizeof(fromNumber) / sizeof(WCHAR)));
+        details.append(L" -> ");
+        details.append(SchemaFormatValue(field.Id, to, toNumber, sizeof(toNumber) / sizeof(WCHAR)));
+        SchemaStoreConfig(&changes, field.Id, to);
+        changed++;
+    }
+    
+    // Dependencies go in the same ChangeConfig call; an empty list removes
+    // them all
+    if (ReconcileListDiffers(current->lpDependencies, desired.Dependencies)) {
+        details.append(L"\nDependencies: ");
+        ReconcileDescribeList(&details, current->lpDependencies);
+        details.append(L" -> ");
+        ReconcileDescribeList(&details, desired.Dependencies);
+        changes.lpDependencies = (LPWSTR)(desired.Dependencies ? desired.Dependencies : L"");
+        changed++;
+    }
+    DWORD fieldsChanged = changed;
+    
+    // current still points into the first buffer: the QueryServiceConfig2
+    // results share a second one
+    ScopedScratch config2Scratch(session);
+    SERVICE_START_OPTIONS startOptions;
+    if (!g_Backend->QueryStartOptions(service, config2Scratch.Buffer, &startOptions)) {
+        DWORD err = GetLastError();
+        return OutputFinish(&record, FALSE, err, L"QueryServiceConfig2 failed: %d", err);
+    }
+    SERVICE_START_OPTIONS desiredOptions;
+    memset(&desiredOptions, 0, sizeof(desiredOptions));
+    desiredOptions.DelayedAutoStart = SchemaSpecValue(&desired, FIELD_DELAYED_AUTO_START).Number ? TRUE : FALSE;
+    desiredOptions.Trigger = desired.Trigger;
+    DWORD optionsChanged = 0;
+    if ((startOptions.DelayedAutoStart ? TRUE : FALSE) != desiredOptions.DelayedAutoStart) {
+        SCHEMA_VALUE from = { (DWORD)(startOptions.DelayedAutoStart ? TRUE : FALSE), NULL };
+        SCHEMA_VALUE to = { (DWORD)desiredOptions.DelayedAutoStart, NULL };
+        WCHAR fromNumber[16], toNumber[16];
+        details.append(L"\n");
+        details.append(SchemaField(FIELD_DELAYED_AUTO_START).Label);
+        details.append(L": ");
+        details.append(SchemaFormatValue(FIELD_DELAYED_AUTO_START, from, fromNumber, sizeof(fromNumber) / sizeof(WCHAR)));
+        details.append(L" -> ");
+        details.append(SchemaFormatValue(FIELD_DELAYED_AUTO_START, to, toNumber, sizeof(toNumber) / sizeof(WCHAR)));
+        optionsChanged++;
+    }
+    if (ReconcileTriggerDiffers(&startOptions, &desiredOptions)) {
+        details.append(L"\nTrigger: ");
+        ReconcileDescribeTrigger(&details, &startOptions);
+        details.append(L" -> ");
+        ReconcileDescribeTrigger(&details, &desiredOptions);
+        optionsChanged++;
+    }
+    changed += optionsChanged;
+    
+    // The recovery policy is compared as a whole and replaced as a whole
+    SERVICE_RECOVERY recovery;
+    if (!g_Backend->QueryRecovery(service, config2Scratch.Buffer, &recovery)) {
+        DWORD err = GetLastError();
+        return OutputFinish(&record, FALSE, err, L"QueryServiceConfig2 failed: %d", err);
+    }
+    BOOL recoveryChanged = SchemaRecoveryDiffers(&recovery, &desired.Recovery);
+    if (recoveryChanged) {
+        details.append(L"\nRecovery: ");
+        SchemaDescribeRecovery(&details, &recovery);
+        details.append(L" -> ");
+        SchemaDescribeRecovery(&details, &desired.Recovery);
+        changed++;
+    }
+    
+    record.Count = changed;
+    if (changedCount) *changedCount = changed;
+    if (changed == 0) {
+        return OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Service '%ls' is up to date", serviceName);
+    }
+    if (fieldsChanged && !g_Backend->ChangeConfig(service, &changes)) {
+        DWORD err = GetLastError();
+        return OutputFinish(&record, FALSE, err, L"ChangeServiceConfig failed: %d", err);
+    }
+    // After ChangeConfig: a delayed start needs the service automatic first
+    if (optionsChanged && !g_Backend->ChangeStartOptions(service, &desiredOptions)) {
+        DWORD err = GetLastError();
+        return OutputFinish(&record, FALSE, err, L"ChangeServiceConfig2 (start options) failed: %d", err);
+    }
+    if (recoveryChanged && !g_Backend->ChangeRecovery(service, &desired.Recovery)) {
+        DWORD err = GetLastError();
+        return OutputFinish(&record, FALSE, err, L"ChangeServiceConfig2 (failure actions) failed: %d", err);
+    }
+    return OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Service '%ls' reconciled: %u field(s) changed%ls",
+        serviceName, changed, details.c_str());
+}
@@ -0,0 +1,21 @@
+#ifndef RECONCILE_H
+#define RECONCILE_H
+
+#include "service_installer.h"
+
+// Bring one service to the desired config: install it when it is missing,
+// otherwise read its config once, compare it field by field with the
+// install defaults plus the given values and apply only the differences in
+// a single ChangeConfig call, dependencies included. Delayed start and the
+// start trigger are compared next and replaced together in one
+// ChangeStartOptions call; the recovery policy likewise in one
+// ChangeRecovery call. A service that already matches costs one open and
+// three backend queries (five SCM calls on advapi32, registry reads only
+// on nt). The description is
+// written only when the service is created. 'changed' (may be NULL)
+// receives the number of differences applied: 0 when the service already
+// matched, 1 when it had to be installed.
+BOOL ReconcileService(LPCWSTR exePath, LPCWSTR serviceName, LPCWSTR displayName, LPCWSTR description,
+    const SERVICE_BOOT_OPTIONS* boot, LPDWORD changed = NULL);
+
+#endif // RECONCILE_H
@@ -0,0 +1,551 @@
+#include "replay.h"
+#include "batch.h"
+#include "commands.h"
+#include "executor.h"
+#include "metrics.h"
+#include "output.h"
+#include "service_wait.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// What the trace shows of one service
+typedef struct _REPLAY_SERVICE {
+    std::wstring Name;
+    DWORD InitialState;                 // SERVICE_STOPPED / SERVICE_RUNNING, 0 = not known yet
+    BOOL Absent;                        // Did not exist before the run (created, or not found)
+    DWORD Pending;                      // Start or stop in progress (final state), 0 = none
+    ULONGLONG PendingSinceUs;
+    std::vector<DWORD> StartMs;         // Start call returned -> RUNNING seen
+    std::vector<DWORD> StopMs;          // Stop call returned -> STOPPED seen
+    std::set<std::wstring> Dependencies;
+} REPLAY_SERVICE;
+
+// Recorded durations of one call on one service, used in order
+typedef struct _REPLAY_DELAYS {
+    std::vector<DWORD> Us;
+    size_t Next;
+} REPLAY_DELAYS;
+
+typedef std::pair<int, std::wstring> REPLAY_KEY;
+
+static const SERVICE_BACKEND* g_ReplayInner;
+static SERVICE_BACKEND g_ReplayBackend;
+static std::mutex g_ReplayLock;
+static std::map<REPLAY_KEY, REPLAY_DELAYS> g_ReplayDelays;
+static DWORD g_ReplayMedianUs[METRIC_COUNT];
+static std::map<SVC_HANDLE, std::wstring> g_ReplayHandles;
+
+static std::wstring ReplayKeyOf(LPCWSTR name) {
+    std::wstring key(name ? name : L"");
+    for (size_t i = 0; i < key.size(); i++) {
+        key[i] = (wchar_t)towlower((wint_t)key[i]);
+    }
+    return key;
+}
+
+// 'percent' of a sorted list
+static DWORD ReplayPercentile(const std::vector<DWORD>& sorted, DWORD percent) {
+    if (sorted.empty()) return 0;
+    return sorted[(sorted.size() - 1) * percent / 100];
+}
+
+static REPLAY_SERVICE* ReplayService(std::map<std::wstring, REPLAY_SERVICE>* services, LPCWSTR name) {
+    if (!name || !*name) return NULL;
+    REPLAY_SERVICE& svc = (*services)[ReplayKeyOf(name)];
+    if (svc.Name.empty()) {
+        svc.Name = name;
+        svc.InitialState = 0;
+        svc.Absent = FALSE;
+        svc.Pending = 0;
+        svc.PendingSinceUs = 0;
+    }
+    return &svc;
+}
+
+// A state the run observed at 'atUs': fixes the initial state the first
+// time, and ends a start or stop in progress when it reached its final state
+static void ReplayObserve(REPLAY_SERVICE* svc, DWORD state, ULONGLONG atUs) {
+    if (!svc || state == 0) return;
+    if (svc->InitialState == 0 && !svc->Absent) {
+        svc->InitialState = (state == SERVICE_STOPPED || state == SERVICE_STOP_PENDING) ? SERVICE_STOPPED : SERVICE_RUNNING;
+    }
+    if (svc->Pending && state == svc->Pending) {
+        DWORD ms = atUs > svc->PendingSinceUs ? (DWORD)((atUs - svc->PendingSinceUs) / 1000) : 0;
+        (svc->Pending == SERVICE_RUNNING ? svc->StartMs : svc->StopMs).push_back(ms);
+        svc->Pending = 0;
+    }
+}
+
+static void ReplayBeginTransition(REPLAY_SERVICE* svc, DWORD initialState, DWORD finalState, ULONGLONG atUs) {
+    if (!svc) return;
+    if (svc->InitialState == 0 && !svc->Absent) svc->InitialState = initialState;
+    svc->Pending = finalState;
+    svc->PendingSinceUs = atUs;
+}
+
+// Walk the calls in start order and collect the services, their states,
+// transition times and dependencies, and the duration of every call
+static void ReplayBuildModel(const TRACE_LOG* log, std::map<std::wstring, REPLAY_SERVICE>* services) {
+    std::vector<std::pair<ULONGLONG, size_t> > order;
+    for (size_t i = 0; i < log->Calls.size(); i++) {
+        order.push_back(std::make_pair(log->Calls[i].StartUs, i));
+    }
+    std::sort(order.begin(), order.end());
+    
+    std::vector<DWORD> durations[METRIC_COUNT];
+    for (size_t n = 0; n < order.size(); n++) {
+        const TRACE_CALL* call = &log->Calls[order[n].second];
+        LPCWSTR name = TraceCallName(log, call);
+        REPLAY_SERVICE* svc = ReplayService(services, name);
+        ULONGLONG endUs = call->StartUs + call->DurationUs;
+        
+        durations[call->Call].push_back(call->DurationUs);
+        if (call->Call != METRIC_WAIT_STATUS_CHANGE) {
+            REPLAY_DELAYS& delays = g_ReplayDelays[REPLAY_KEY(call->Call, ReplayKeyOf(name))];
+            delays.Us.push_back(call->DurationUs);
+            delays.Next = 0;
+        }
+        
+        switch (call->Call) {
+            case METRIC_OPEN:
+                if (!call->Ok && call->Error == ERROR_SERVICE_DOES_NOT_EXIST && svc->InitialState == 0) svc->Absent = TRUE;
+                break;
+            case METRIC_CREATE:
+                if (call->Ok && svc->InitialState == 0) svc->Absent = TRUE;
+                break;
+            case METRIC_START:
+                if (call->Ok) ReplayBeginTransition(svc, SERVICE_STOPPED, SERVICE_RUNNING, endUs);
+                break;
+            case METRIC_CONTROL:
+                if (call->Ok && call->Arg == SERVICE_CONTROL_STOP) {
+                    ReplayBeginTransition(svc, SERVICE_RUNNING, SERVICE_STOPPED, endUs);
+                }
+                if (call->Ok) ReplayObserve(svc, call->State, call->StartUs);
+                break;
+            case METRIC_QUERY_STATUS:
+                // The state was read during the call; its start is the
+                // conservative end of a transition
+                if (call->Ok) ReplayObserve(svc, call->State, call->StartUs);
+                break;
+            case METRIC_ENUM_SERVICES:
+            case METRIC_ENUM_DEPENDENTS:
+                for (DWORD i = 0; i < call->ItemCount; i++) {
+                    const TRACE_ITEM* item = &log->Items[call->FirstItem + i];
+                    if (item->Id == 0 || item->Id >= log->Names.size()) continue;
+                    REPLAY_SERVICE* other = ReplayService(services, log->Names[item->Id].c_str());
+                    ReplayObserve(other, item->State, call->StartUs);
+                    if (call->Call == METRIC_ENUM_DEPENDENTS && svc) other->Dependencies.insert(svc->Name);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        std::sort(durations[i].begin(), durations[i].end());
+        g_ReplayMedianUs[i] = ReplayPercentile(durations[i], 50);
+    }
+}
+
+// Sleep as long as the recorded call took: the next unused duration of the
+// same call on the same service, else the median of the call
+static void ReplayDelay(METRIC_ID call, LPCWSTR name) {
+    DWORD us;
+    {
+        std::lock_guard<std::mutex> lock(g_ReplayLock);
+        std::map<REPLAY_KEY, REPLAY_DELAYS>::iterator it = g_ReplayDelays.find(REPLAY_KEY(call, ReplayKeyOf(name)));
+        if (it != g_ReplayDelays.end() && it->second.Next < it->second.Us.size()) {
+            us = it->second.Us[it->second.Next++];
+        } else {
+            us = g_ReplayMedianUs[call];
+        }
+    }
+    if (us) std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+static std::wstring ReplayHandleName(SVC_HANDLE handle) {
+    std::lock_guard<std::mutex> lock(g_ReplayLock);
+    std::map<SVC_HANDLE, std::wstring>::iterator it = g_ReplayHandles.find(handle);
+    return it == g_ReplayHandles.end() ? std::wstring() : it->second;
+}
+
+static void ReplayNameHandle(SVC_HANDLE handle, LPCWSTR name) {
+    if (!handle) return;
+    std::lock_guard<std::mutex> lock(g_ReplayLock);
+    g_ReplayHandles[handle] = name;
+}
+
+static SVC_HANDLE ReplayConnect(DWORD desiredAccess) {
+    ReplayDelay(METRIC_CONNECT, NULL);
+    return g_ReplayInner->Connect(desiredAccess);
+}
+
+static SVC_HANDLE ReplayOpen(SVC_HANDLE manager, LPCWSTR serviceName, DWORD desiredAccess) {
+    ReplayDelay(METRIC_OPEN, serviceName);
+    SVC_HANDLE handle = g_ReplayInner->Open(manager, serviceName, desiredAccess);
+    ReplayNameHandle(handle, serviceName);
+    return handle;
+}
+
+static SVC_HANDLE ReplayCreate(SVC_HANDLE manager, const SERVICE_INSTALL_SPEC* spec) {
+    ReplayDelay(METRIC_CREATE, spec->ServiceName);
+    SVC_HANDLE handle = g_ReplayInner->Create(manager, spec);
+    ReplayNameHandle(handle, spec->ServiceName);
+    return handle;
+}
+
+static BOOL ReplaySetDescription(SVC_HANDLE service, LPCWSTR description) {
+    ReplayDelay(METRIC_SET_DESCRIPTION, ReplayHandleName(service).c_str());
+    return g_ReplayInner->SetDescription(service, description);
+}
+
+static BOOL ReplayDelete(SVC_HANDLE service) {
+    ReplayDelay(METRIC_DELETE, ReplayHandleName(service).c_str());
+    return g_ReplayInner->Delete(service);
+}
+
+static BOOL ReplayStart(SVC_HANDLE service) {
+    ReplayDelay(METRIC_START, ReplayHandleName(service).c_str());
+    return g_ReplayInner->Start(service);
+}
+
+static BOOL ReplayControl(SVC_HANDLE service, DWORD control, SERVICE_STATUS* status) {
+    ReplayDelay(METRIC_CONTROL, ReplayHandleName(service).c_str());
+    return g_ReplayInner->Control(service, control, status);
+}
+
+static BOOL ReplayQueryStatus(SVC_HANDLE service, SERVICE_STATUS* status) {
+    ReplayDelay(METRIC_QUERY_STATUS, ReplayHandleName(service).c_str());
+    return g_ReplayInner->QueryStatus(service, status);
+}
+
+static BOOL ReplayQueryConfig(SVC_HANDLE service, LPQUERY_SERVICE_CONFIGW config, DWORD bufSize, LPDWORD bytesNeeded) {
+    ReplayDelay(METRIC_QUERY_CONFIG, ReplayHandleName(service).c_str());
+    return g_ReplayInner->QueryConfig(service, config, bufSize, bytesNeeded);
+}
+
+static BOOL ReplayChangeConfig(SVC_HANDLE service, const QUERY_SERVICE_CONFIGW* changes) {
+    ReplayDelay(METRIC_CHANGE_CONFIG, ReplayHandleName(service).c_str());
+    return g_ReplayInner->ChangeConfig(service, changes);
+}
+
+static BOOL ReplayQueryRecovery(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_RECOVERY* recovery) {
+    ReplayDelay(METRIC_QUERY_RECOVERY, ReplayHandleName(service).c_str());
+    return g_ReplayInner->QueryRecovery(service, scratch, recovery);
+}
+
+static BOOL ReplayChangeRecovery(SVC_HANDLE service, const SERVICE_RECOVERY* recovery) {
+    ReplayDelay(METRIC_CHANGE_RECOVERY, ReplayHandleName(service).c_str());
+    return g_ReplayInner->ChangeRecovery(service, recovery);
+}
+
+static BOOL ReplayQueryStartOptions(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_START_OPTIONS* options) {
+    ReplayDelay(METRIC_QUERY_START_OPTIONS, ReplayHandleName(service).c_str());
+    return g_ReplayInner->QueryStartOptions(service, scratch, options);
+}
+
+static BOOL ReplayChangeStartOptions(SVC_HANDLE service, const SERVICE_START_OPTIONS* options) {
+    ReplayDelay(METRIC_CHANGE_START_OPTIONS, ReplayHandleName(service).c_str());
+    return g_ReplayInner->ChangeStartOptions(service, options);
+}
+
+static BOOL ReplayEnumServices(SVC_HANDLE manager, DWORD serviceType, DWORD serviceState, LPBYTE buffer, DWORD bufSize,
+    LPDWORD bytesNeeded, LPDWORD servicesReturned, LPDWORD resumeHandle) {
+    ReplayDelay(METRIC_ENUM_SERVICES, NULL);
+    return g_ReplayInner->EnumServices(manager, serviceType, serviceState, buffer, bufSize, bytesNeeded,
+        servicesReturned, resumeHandle);
+}
+
+static BOOL ReplayEnumDependents(SVC_HANDLE service, DWORD serviceState, LPENUM_SERVICE_STATUSW services,
+    DWORD bufSize, LPDWORD bytesNeeded, LPDWORD servicesReturned) {
+    ReplayDelay(METRIC_ENUM_DEPENDENTS, ReplayHandleName(service).c_str());
+    return g_ReplayInner->EnumDependents(service, serviceState, services, bufSize, bytesNeeded, servicesReturned);
+}
+
+static BOOL ReplayReadRegistry(SVC_HANDLE manager, LPCWSTR serviceName, SERVICE_REGISTRY_ROUTINE routine, PVOID context) {
+    ReplayDelay(METRIC_READ_REGISTRY, serviceName);
+    return g_ReplayInner->ReadRegistry(manager, serviceName, routine, context);
+}
+
+static BOOL ReplayQueryProcesses(SERVICE_PROCESS_USAGE* usage, DWORD count) {
+    ReplayDelay(METRIC_QUERY_PROCESSES, NULL);
+    return g_ReplayInner->QueryProcesses(usage, count);
+}
+
+static void ReplayClose(SVC_HANDLE handle) {
+    ReplayDelay(METRIC_CLOSE, ReplayHandleName(handle).c_str());
+    g_ReplayInner->Close(handle);
+    std::lock_guard<std::mutex> lock(g_ReplayLock);
+    g_ReplayHandles.erase(handle);
+}
+
+// Status-change waits are modelled by the simulated SCM itself, so they
+// keep their own timing
+static void ReplayEnableLatency() {
+    g_ReplayInner = g_Backend;
+    g_ReplayBackend = *g_Backend;
+    g_ReplayBackend.Connect = ReplayConnect;
+    g_ReplayBackend.Open = ReplayOpen;
+    g_ReplayBackend.Create = ReplayCreate;
+    g_ReplayBackend.SetDescription = ReplaySetDescription;
+    g_ReplayBackend.Delete = ReplayDelete;
+    g_ReplayBackend.Start = ReplayStart;
+    g_ReplayBackend.Control = ReplayControl;
+    g_ReplayBackend.QueryStatus = ReplayQueryStatus;
+    g_ReplayBackend.QueryConfig = ReplayQueryConfig;
+    g_ReplayBackend.ChangeConfig = ReplayChangeConfig;
+    g_ReplayBackend.QueryRecovery = ReplayQueryRecovery;
+    g_ReplayBackend.ChangeRecovery = ReplayChangeRecovery;
+    g_ReplayBackend.QueryStartOptions = ReplayQueryStartOptions;
+    g_ReplayBackend.ChangeStartOptions = ReplayChangeStartOptions;
+    g_ReplayBackend.EnumServices = ReplayEnumServices;
+    g_ReplayBackend.EnumDependents = ReplayEnumDependents;
+    if (g_ReplayInner->ReadRegistry) g_ReplayBackend.ReadRegistry = ReplayReadRegistry;
+    if (g_ReplayInner->QueryProcesses) g_ReplayBackend.QueryProcesses = ReplayQueryProcesses;
+    g_ReplayBackend.Close = ReplayClose;
+    g_Backend = &g_ReplayBackend;
+}
+
+// Load every service that existed before the recorded run into the
+// simulated SCM. Transition times are the service's median, else the
+// median over all services, else the simulator's default.
+static DWORD ReplayLoadServices(const std::map<std::wstring, REPLAY_SERVICE>& services) {
+    std::vector<DWORD> allStart, allStop;
+    std::map<std::wstring, REPLAY_SERVICE>::const_iterator it;
+    for (it = services.begin(); it != services.end(); ++it) {
+        allStart.insert(allStart.end(), it->second.StartMs.begin(), it->second.StartMs.end());
+        allStop.insert(allStop.end(), it->second.StopMs.begin(), it->second.StopMs.end());
+    }
+    std::sort(allStart.begin(), allStart.end());
+    std::sort(allStop.begin(), allStop.end());
+    SIM_SCM_CONFIG config = { 0, 100, 100, 25 };
+    if (!allStart.empty()) config.StartTime = ReplayPercentile(allStart, 50);
+    if (!allStop.empty()) config.StopTime = ReplayPercentile(allStop, 50);
+    SimScmReset();
+    SimScmConfigure(&config);
+    
+    DWORD loaded = 0;
+    for (it = services.begin(); it != services.end(); ++it) {
+        const REPLAY_SERVICE* svc = &it->second;
+        if (svc->Absent) continue;
+        
+        std::vector<DWORD> start(svc->StartMs), stop(svc->StopMs);
+        std::sort(start.begin(), start.end());
+        std::sort(stop.begin(), stop.end());
+        std::wstring dependencies;
+        for (std::set<std::wstring>::const_iterator d = svc->Dependencies.begin(); d != svc->Dependencies.end(); ++d) {
+            dependencies.append(*d);
+            dependencies.push_back(L'\0');
+        }
+        dependencies.push_back(L'\0');
+        
+        if (SimScmLoadService(svc->Name.c_str(), svc->InitialState ? svc->InitialState : SERVICE_STOPPED,
+            start.empty() ? config.StartTime : ReplayPercentile(start, 50),
+            stop.empty() ? config.StopTime : ReplayPercentile(stop, 50), dependencies.c_str())) {
+            loaded++;
+        }
+    }
+    return loaded;
+}
+
+static void ReplayListCalls(const TRACE_LOG* log) {
+    OutputText(L"%12ls %-6ls %-20ls %-32ls %10ls  %ls\n", L"At ms", L"Thread", L"Call", L"Service", L"Took ms", L"Result");
+    for (size_t i = 0; i < log->Calls.size(); i++) {
+        const TRACE_CALL* call = &log->Calls[i];
+        LPCWSTR name = TraceCallName(log, call);
+        
+        WCHAR result[64];
+        if (!call->Ok) {
+            swprintf(result, sizeof(result) / sizeof(WCHAR), L"error %u", call->Error);
+        } else if (call->State) {
+            swprintf(result, sizeof(result) / sizeof(WCHAR), L"%ls", ServiceStateName(call->State));
+        } else if (call->Call == METRIC_WAIT_STATUS_CHANGE) {
+            swprintf(result, sizeof(result) / sizeof(WCHAR), call->Result == WAIT_TIMEOUT ? L"timeout" : L"changed");
+        } else if (call->Call == METRIC_ENUM_SERVICES || call->Call == METRIC_ENUM_DEPENDENTS ||
+            call->Call == METRIC_READ_REGISTRY) {
+            swprintf(result, sizeof(result) / sizeof(WCHAR), L"%u entries", call->Result);
+        } else {
+            swprintf(result, sizeof(result) / sizeof(WCHAR), L"ok");
+        }
+        
+        OUTPUT_RECORD record;
+        OutputBegin(&record, L"trace", name);
+        record.Call = MetricName(call->Call);
+        record.Thread = call->Thread;
+        record.AtUs = call->StartUs;
+        record.MinUs = record.P50Us = record.P95Us = record.P99Us = record.MaxUs = record.TotalUs = call->DurationUs;
+        if (call->State) {
+            record.State = call->State;
+            record.CheckPoint = call->CheckPoint;
+            record.WaitHint = call->WaitHint;
+        }
+        if (call->Call == METRIC_ENUM_SERVICES || call->Call == METRIC_ENUM_DEPENDENTS) record.Count = call->Result;
+        OutputFinish(&record, call->Ok, call->Error, L"%12.3f %-6u %-20ls %-32ls %10.3f  %ls", call->StartUs / 1e3,
+            call->Thread, record.Call, name ? name : L"-", call->DurationUs / 1e3, result);
+    }
+}
+
+// Per-call latency of the recorded run, in the layout of the --stats table
+static void ReplayReportRecorded(const TRACE_LOG* log) {
+    std::vector<DWORD> durations[METRIC_COUNT];
+    for (size_t i = 0; i < log->Calls.size(); i++) {
+        durations[log->Calls[i].Call].push_back(log->Calls[i].DurationUs);
+    }
+    
+    OutputText(L"\n%-20ls %-8ls %10ls %10ls %10ls %10ls %12ls\n", L"Call", L"Count", L"p50 ms", L"p95 ms", L"p99 ms",
+        L"Max ms", L"Total ms");
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        std::vector<DWORD>& sorted = durations[i];
+        if (sorted.empty()) continue;
+        std::sort(sorted.begin(), sorted.end());
+        ULONGLONG total = 0;
+        for (size_t n = 0; n < sorted.size(); n++) total += sorted[n];
+        
+        OUTPUT_RECORD record;
+        OutputBegin(&record, L"trace", NULL);
+        record.Call = MetricName((METRIC_ID)i);
+        record.Count = (DWORD)sorted.size();
+        record.MinUs = sorted.front();
+        record.P50Us = ReplayPercentile(sorted, 50);
+        record.P95Us = ReplayPercentile(sorted, 95);
+        record.P99Us = ReplayPercentile(sorted, 99);
+        record.MaxUs = sorted.back();
+        record.TotalUs = total;
+        OutputFinish(&record, TRUE, ERROR_SUCCESS, L"%-20ls %-8u %10.3f %10.3f %10.3f %10.3f %12.3f", record.Call,
+            record.Count, record.P50Us / 1e3, record.P95Us / 1e3, record.P99Us / 1e3, record.MaxUs / 1e3, total / 1e3);
+    }
+}
+
+int RunReplay(int argc, wchar_t* argv[]) {
+    LPCWSTR path = NULL;
+    BOOL list = FALSE;
+    DWORD jobs = 0;
+    DWORD timeout = 0;
+    BOOL timeoutSet = FALSE;
+    int commandIndex = 0;
+    
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"replay", NULL);
+    for (int i = 1; i < argc; i++) {
+        if (_wcsicmp(argv[i], L"--list") == 0) {
+            list = TRUE;
+        } else if (i + 1 < argc && _wcsicmp(argv[i], L"--jobs") == 0) {
+            jobs = (DWORD)wcstoul(argv[++i], NULL, 10);
+            if (jobs < 1) jobs = 1;
+            if (jobs > EXECUTOR_MAX_JOBS) jobs = EXECUTOR_MAX_JOBS;
+        } else if (i + 1 < argc && _wcsicmp(argv[i], L"--timeout") == 0) {
+            timeout = (DWORD)wcstoul(argv[++i], NULL, 10);
+            timeoutSet = TRUE;
+        } else if (wcscmp(argv[i], L"--") == 0 && i + 1 < argc) {
+            commandIndex = i + 1;
+            break;
+        } else if (!path && argv[i][0] != L'-') {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (!path) {
+        OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER,
+            L"Usage: replay <trace-file> [--list] [--jobs <n>] [--timeout <ms>] [-- <command> ...]");
+        return 1;
+    }
+    
+    TRACE_LOG log;
+    if (!TraceRead(path, &log)) {
+        DWORD error = GetLastError();
+        OutputFinish(&record, FALSE, error, error == ERROR_BAD_FORMAT ? L"'%ls' is not a trace file" :
+            L"Cannot read trace file '%ls'", path);
+        return 1;
+    }
+    if (log.Truncated) {
+        OutputText(L"Warning: the trace ends inside a record; using the %u complete calls\n", (DWORD)log.Calls.size());
+    }
+    
+    std::wstring recorded;
+    for (size_t i = 0; i < log.Args.size(); i++) {
+        if (i) recorded.push_back(L' ');
+        recorded.append(log.Args[i]);
+    }
+    OutputText(L"Trace '%ls': %ls backend, %u call(s), %u job(s), timeout %u ms: %ls\n", path, log.Backend.c_str(),
+        (DWORD)log.Calls.size(), log.Jobs, log.WaitTimeout, recorded.c_str());
+    if (list) {
+        ReplayListCalls(&log);
+        return 0;
+    }
+    
+    // The command to run again: the recorded one unless given after '--'
+    std::vector<std::wstring> args;
+    if (commandIndex) {
+        args.assign(argv + commandIndex, argv + argc);
+    } else {
+        args = log.Args;
+    }
+    if (args.empty()) {
+        OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER, L"The trace records no command; give one after '--'");
+        return 1;
+    }
+    
+    ULONGLONG firstUs = 0, lastUs = 0;
+    for (size_t i = 0; i < log.Calls.size(); i++) {
+        const TRACE_CALL* call = &log.Calls[i];
+        if (i == 0 || call->StartUs < firstUs) firstUs = call->StartUs;
+        if (call->StartUs + call->DurationUs > lastUs) lastUs = call->StartUs + call->DurationUs;
+    }
+    
+    std::map<std::wstring, REPLAY_SERVICE> services;
+    ReplayBuildModel(&log, &services);
+    if (!SelectServiceBackend(L"sim")) return 1;
+    DWORD loaded = ReplayLoadServices(services);
+    ReplayEnableLatency();
+    MetricsEnable();
+    g_ExecutorJobs = jobs ? jobs : (log.Jobs ? log.Jobs : 1);
+    g_ServiceWaitTimeout = timeoutSet ? timeout : log.WaitTimeout;
+    
+    OutputText(L"\nRecorded:");
+    ReplayReportRecorded(&log);
+    OutputText(L"\nReplaying with %u service(s), %u job(s), timeout %u ms:\n", loaded, g_ExecutorJobs,
+        g_ServiceWaitTimeout);
+    OutputFlush();
+    
+    std::vector<wchar_t*> commandArgv;
+    for (size_t i = 0; i < args.size(); i++) {
+        commandArgv.push_back(&args[i][0]);
+    }
+    commandArgv.push_back(NULL);
+    OutputBegin(&record, L"replay", NULL);
+    ULONGLONG replayStartUs = MetricsNow();
+    int exitCode;
+    if (_wcsicmp(args[0].c_str(), L"batch") == 0 && args.size() > 1) {
+        exitCode = RunBatch(args[1].c_str(), args.size() > 2 && _wcsicmp(args[2].c_str(), L"--stop-on-error") == 0);
+    } else {
+        exitCode = RunServiceCommand((int)args.size(), commandArgv.data());
+    }
+    ULONGLONG replayedUs = MetricsNow() - replayStartUs;
+    if (exitCode == COMMAND_UNKNOWN) {
+        OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER, L"Cannot replay '%ls': not a service or batch command",
+            args[0].c_str());
+        return 1;
+    }
+    
+    OutputText(L"\nReplayed:");
+    MetricsReport(NULL);
+    OutputText(L"\n");
+    record.Count = (DWORD)log.Calls.size();
+    OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Wall time: recorded %.3f ms, replayed %.3f ms", (lastUs - firstUs) / 1e3,
+        replayedUs / 1e3);
+    return exitCode;
+}
@@ -0,0 +1,176 @@
+#include "scm_notify.h"
+#include <string.h>
+
+#ifdef _WIN32
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#define SCM_NOTIFY_ALL_STATES (SERVICE_NOTIFY_STOPPED | SERVICE_NOTIFY_START_PENDING | \
+    SERVICE_NOTIFY_STOP_PENDING | SERVICE_NOTIFY_RUNNING | SERVICE_NOTIFY_CONTINUE_PENDING | \
+    SERVICE_NOTIFY_PAUSE_PENDING | SERVICE_NOTIFY_PAUSED)
+
+#define SCM_NOTIFY_IDLE     0
+#define SCM_NOTIFY_ARMING   1   // Queued to the notifier thread
+#define SCM_NOTIFY_ARMED    2
+
+static std::mutex g_NotifyLock;
+static std::condition_variable g_NotifyChanged;    // Any registration moved
+static HANDLE g_Notifier = NULL;
+
+// SERVICE_NOTIFY_* bit for a SERVICE_* state (STOPPED = 1 -> bit 0, ...)
+static DWORD ScmStateMask(DWORD state) {
+    return (state >= SERVICE_STOPPED && state <= SERVICE_PAUSED) ? (1u << (state - 1)) : 0;
+}
+
+// The notifier thread only ever sleeps alertably: registrations, their
+// callbacks and closes all run on it as APCs, in queue order
+static DWORD WINAPI ScmNotifierMain(LPVOID parameter) {
+    (void)parameter;
+    for (;;) {
+        SleepEx(INFINITE, TRUE);
+    }
+}
+
+// Caller holds g_NotifyLock
+static BOOL ScmNotifierStart() {
+    if (g_Notifier) return TRUE;
+    g_Notifier = CreateThread(NULL, 0, ScmNotifierMain, NULL, 0, NULL);
+    return g_Notifier != NULL;
+}
+
+static VOID CALLBACK ScmNotifyCallback(PVOID parameter) {
+    PSERVICE_NOTIFY_2W notify = (PSERVICE_NOTIFY_2W)parameter;
+    SCM_NOTIFY* state = (SCM_NOTIFY*)notify->pContext;
+    
+    std::lock_guard<std::mutex> lock(g_NotifyLock);
+    state->Registration = SCM_NOTIFY_IDLE;
+    // Any other status (service deleted, handle closed) is reported by the
+    // next registration attempt
+    state->Reported = notify->dwNotificationStatus == ERROR_SUCCESS;
+    state->State = notify->ServiceStatus.dwCurrentState;
+    g_NotifyChanged.notify_all();
+}
+
+static VOID CALLBACK ScmArmApc(ULONG_PTR parameter) {
+    SCM_NOTIFY* state = (SCM_NOTIFY*)parameter;
+    memset(&state->Notify, 0, sizeof(state->Notify));
+    state->Notify.dwVersion = SERVICE_NOTIFY_STATUS_CHANGE;
+    state->Notify.pfnNotifyCallback = (PFN_SC_NOTIFY_CALLBACK)ScmNotifyCallback;
+    state->Notify.pContext = state;
+    
+    // The callback can only run once this thread sleeps again
+    DWORD err = NotifyServiceStatusChangeW(state->Handle, state->Mask, (PSERVICE_NOTIFYW)&state->Notify);
+    
+    std::lock_guard<std::mutex> lock(g_NotifyLock);
+    state->Registration = err == ERROR_SUCCESS ? SCM_NOTIFY_ARMED : SCM_NOTIFY_IDLE;
+    state->ArmError = err;
+    g_NotifyChanged.notify_all();
+}
+
+// Queued behind the close: every callback queued before it has run
+static VOID CALLBACK ScmDrainApc(ULONG_PTR parameter) {
+    SCM_NOTIFY* state = (SCM_NOTIFY*)parameter;
+    std::lock_guard<std::mutex> lock(g_NotifyLock);
+    state->Closing = FALSE;
+    g_NotifyChanged.notify_all();
+}
+
+static VOID CALLBACK ScmCloseApc(ULONG_PTR parameter) {
+    SCM_NOTIFY* state = (SCM_NOTIFY*)parameter;
+    BOOL closed = CloseServiceHandle(state->Handle);
+    {
+        std::lock_guard<std::mutex> lock(g_NotifyLock);
+        state->CloseResult = closed;
+    }
+    // No APC is queued for the handle once it is closed
+    if (!QueueUserAPC(ScmDrainApc, g_Notifier, parameter)) ScmDrainApc(parameter);
+}
+
+VOID ScmNotifyInit(SCM_NOTIFY* notify) {
+    memset(notify, 0, sizeof(SCM_NOTIFY));
+}
+
+BOOL ScmNotifyClose(SC_HANDLE handle, SCM_NOTIFY* notify) {
+    std::unique_lock<std::mutex> lock(g_NotifyLock);
+    if (!notify->Used) {
+        lock.unlock();
+        return CloseServiceHandle(handle);
+    }
+    
+    notify->Handle = handle;
+    notify->Closing = TRUE;
+    if (!QueueUserAPC(ScmCloseApc, g_Notifier, (ULONG_PTR)notify)) {
+        notify->Closing = FALSE;
+        lock.unlock();
+        return CloseServiceHandle(handle);
+    }
+    while (notify->Closing) {
+        g_NotifyChanged.wait(lock);
+    }
+    return notify->CloseResult;
+}
+
+// Register through the notifier thread and wait for the outcome. Caller
+// holds the lock; returns the registration error.
+static DWORD ScmArmLocked(std::unique_lock<std::mutex>& lock, SC_HANDLE handle, SCM_NOTIFY* state, DWORD knownState) {
+    state->Handle = handle;
+    state->Mask = SCM_NOTIFY_ALL_STATES & ~ScmStateMask(knownState);
+    state->Baseline = knownState;
+    state->Reported = FALSE;
+    state->Used = TRUE;
+    state->Registration = SCM_NOTIFY_ARMING;
+    if (!QueueUserAPC(ScmArmApc, g_Notifier, (ULONG_PTR)state)) {
+        state->Registration = SCM_NOTIFY_IDLE;
+        return GetLastError();
+    }
+    while (state->Registration == SCM_NOTIFY_ARMING) {
+        g_NotifyChanged.wait(lock);
+    }
+    return state->Registration == SCM_NOTIFY_IDLE ? state->ArmError : ERROR_SUCCESS;
+}
+
+DWORD ScmWaitStatusChange(SC_HANDLE* handles, SCM_NOTIFY** notifies, const DWORD* knownStates, DWORD count, DWORD timeoutMs) {
+    ULONGLONG start = GetTickCount64();
+    
+    std::unique_lock<std::mutex> lock(g_NotifyLock);
+    if (!ScmNotifierStart()) return WAIT_FAILED;
+    
+    for (;;) {
+        for (DWORD i = 0; i < count; i++) {
+            SCM_NOTIFY* state = notifies[i];
+            
+            // Another waiter's registration may be on its way
+            while (state->Registration == SCM_NOTIFY_ARMING) {
+                g_NotifyChanged.wait(lock);
+            }
+            if (state->Registration == SCM_NOTIFY_ARMED) {
+                if (state->Baseline != knownStates[i]) return i;
+                continue;
+            }
+            if (state->Reported && state->State != knownStates[i]) {
+                return i;
+            }
+            
+            DWORD err = ScmArmLocked(lock, handles[i], state, knownStates[i]);
+            if (err != ERROR_SUCCESS) {
+                SetLastError(err);
+                return WAIT_FAILED;
+            }
+        }
+        
+        ULONGLONG elapsed = GetTickCount64() - start;
+        if (timeoutMs != INFINITE && elapsed >= timeoutMs) {
+            return WAIT_TIMEOUT;
+        }
+        
+        if (timeoutMs == INFINITE) {
+            g_NotifyChanged.wait(lock);
+        } else {
+            g_NotifyChanged.wait_for(lock, std::chrono::milliseconds(timeoutMs - elapsed));
+        }
+    }
+}
+
+#endif // _WIN32
@@ -0,0 +1,42 @@
+#ifndef SCM_NOTIFY_H
+#define SCM_NOTIFY_H
+
+#include "win_compat.h"
+
+#ifdef _WIN32
+
+// NotifyServiceStatusChange registration of one SC_HANDLE, shared by every
+// thread that waits on the handle. Registrations are made from one
+// process-wide notifier thread, which receives their APCs, so a waiter
+// never has to be the thread that registered. Fields other than Notify
+// are guarded by the module's lock; Notify belongs to the notifier thread.
+typedef struct _SCM_NOTIFY {
+    SERVICE_NOTIFY_2W Notify;
+    SC_HANDLE Handle;       // Registered on
+    DWORD Mask;
+    DWORD Registration;     // SCM_NOTIFY_IDLE / _ARMING / _ARMED
+    DWORD Baseline;         // State the armed registration waits to leave
+    DWORD ArmError;         // Last failed registration
+    BOOL Reported;          // The last callback reported State
+    DWORD State;
+    BOOL Used;              // Ever armed: closing goes through the notifier
+    BOOL Closing;
+    BOOL CloseResult;
+} SCM_NOTIFY;
+
+VOID ScmNotifyInit(SCM_NOTIFY* notify);
+
+// Close the handle 'notify' is registered on. Returns once no notification
+// callback can touch 'notify' any more, so it may then be freed.
+BOOL ScmNotifyClose(SC_HANDLE handle, SCM_NOTIFY* notify);
+
+// Wait until one of the services leaves its known state. Returns the index
+// of the first service that changed, WAIT_TIMEOUT, or WAIT_FAILED with
+// GetLastError() set when notifications are unavailable. A waiter that
+// joins a registration armed for a different state gets that index back at
+// once, so it re-reads the status.
+DWORD ScmWaitStatusChange(SC_HANDLE* handles, SCM_NOTIFY** notifies, const DWORD* knownStates, DWORD count, DWORD timeoutMs);
+
+#endif // _WIN32
+
+#endif // SCM_NOTIFY_H
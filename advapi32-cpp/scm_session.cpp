@@ -0,0 +1,299 @@
+#include "scm_session.h"
+#include <wctype.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct SessionEntry {
+    SVC_HANDLE Handle;
+    DWORD Access;
+    std::vector<SVC_HANDLE> Retired;  // Narrower handles other threads may still hold
+    DWORD Borrowers;                  // Open operation scopes that were handed a handle
+};
+
+static void SessionCloseEntry(SessionEntry* entry) {
+    for (size_t i = 0; i < entry->Retired.size(); i++) {
+        g_Backend->Close(entry->Retired[i]);
+    }
+    g_Backend->Close(entry->Handle);
+    delete entry;
+}
+
+struct _SCM_SESSION {
+    std::mutex Lock;
+    SVC_HANDLE Manager;
+    DWORD ManagerAccess;
+    std::vector<SVC_HANDLE> RetiredManagers;
+    std::vector<SCRATCH_BUFFER*> Scratch;      // Idle buffers
+    std::unordered_map<std::wstring, SessionEntry*> Services;
+    std::vector<SessionEntry*> Parked;         // Dropped from Services while borrowed
+};
+
+struct _SCM_SESSION_USE {
+    SCM_SESSION* Session;
+    std::vector<SessionEntry*> Borrowed;
+    SCM_SESSION_USE* Outer;
+};
+
+// Innermost operation scope of this thread
+static thread_local SCM_SESSION_USE* t_SessionUse = NULL;
+
+static std::wstring SessionKey(LPCWSTR name) {
+    std::wstring key(name);
+    for (size_t i = 0; i < key.size(); i++) {
+        key[i] = (wchar_t)towlower((wint_t)key[i]);
+    }
+    return key;
+}
+
+SCM_SESSION* ScmSessionCreate() {
+    SCM_SESSION* session = new SCM_SESSION();
+    session->Manager = NULL;
+    session->ManagerAccess = 0;
+    return session;
+}
+
+VOID ScmSessionDestroy(SCM_SESSION* session) {
+    if (!session) return;
+    
+    for (std::unordered_map<std::wstring, SessionEntry*>::iterator it = session->Services.begin(); it != session->Services.end(); ++it) {
+        SessionCloseEntry(it->second);
+    }
+    for (size_t i = 0; i < session->Parked.size(); i++) {
+        SessionCloseEntry(session->Parked[i]);
+    }
+    for (size_t i = 0; i < session->RetiredManagers.size(); i++) {
+        g_Backend->Close(session->RetiredManagers[i]);
+    }
+    if (session->Manager) g_Backend->Close(session->Manager);
+    for (size_t i = 0; i < session->Scratch.size(); i++) {
+        ScratchFree(session->Scratch[i]);
+        delete session->Scratch[i];
+    }
+    delete session;
+}
+
+SCM_SESSION* ScmDefaultSession() {
+    static SCM_SESSION* session = ScmSessionCreate();
+    return session;
+}
+
+// Record that the calling thread's scope on this session holds the entry.
+// Caller holds session->Lock.
+static void SessionBorrowLocked(SCM_SESSION* session, SessionEntry* entry) {
+    SCM_SESSION_USE* use = t_SessionUse;
+    while (use && use->Session != session) use = use->Outer;
+    if (!use) return;
+    if (std::find(use->Borrowed.begin(), use->Borrowed.end(), entry) != use->Borrowed.end()) return;
+    
+    use->Borrowed.push_back(entry);
+    entry->Borrowers++;
+}
+
+// Take the entry out of the cache: it closes now if no scope holds it,
+// else when the last one ends. Caller holds session->Lock; returns the
+// entry to close after the lock is released, or NULL.
+static SessionEntry* SessionDropLocked(SCM_SESSION* session, SessionEntry* entry) {
+    if (!entry->Borrowers) return entry;
+    session->Parked.push_back(entry);
+    return NULL;
+}
+
+SVC_HANDLE ScmSessionManager(SCM_SESSION* session, DWORD desiredAccess) {
+    DWORD access;
+    {
+        std::lock_guard<std::mutex> lock(session->Lock);
+        if (session->Manager && (session->ManagerAccess & desiredAccess) == desiredAccess) {
+            return session->Manager;
+        }
+        access = session->ManagerAccess | desiredAccess;
+    }
+    
+    SVC_HANDLE manager = g_Backend->Connect(access);
+    if (!manager) return NULL;
+    
+    SVC_HANDLE current;
+    {
+        std::lock_guard<std::mutex> lock(session->Lock);
+        current = session->Manager;
+        if (!current || (session->ManagerAccess & access) != access) {
+            // Another thread may still be enumerating through the old handle,
+            // so it is retired rather than closed (this happens at most once
+            // per right)
+            if (current) session->RetiredManagers.push_back(current);
+            session->Manager = manager;
+            session->ManagerAccess = access;
+            return manager;
+        }
+    }
+    // Another thread connected with these rights first
+    g_Backend->Close(manager);
+    return current;
+}
+
+SVC_HANDLE ScmSessionOpenService(SCM_SESSION* session, LPCWSTR serviceName, DWORD desiredAccess) {
+    std::wstring key = SessionKey(serviceName);
+    DWORD access = desiredAccess;
+    {
+        std::lock_guard<std::mutex> lock(session->Lock);
+        std::unordered_map<std::wstring, SessionEntry*>::iterator it = session->Services.find(key);
+        if (it != session->Services.end()) {
+            if ((it->second->Access & desiredAccess) == desiredAccess) {
+                SessionBorrowLocked(session, it->second);
+                return it->second->Handle;
+            }
+            access |= it->second->Access;
+        }
+    }
+    
+    SVC_HANDLE manager = ScmSessionManager(session, SC_MANAGER_CONNECT);
+    if (!manager) return NULL;
+    
+    // Open the wider handle before replacing the old one; on failure the old
+    // handle stays cached for callers that only need its rights. A replaced
+    // handle is retired, not closed, since another thread may be waiting on
+    // it; retired handles close with the entry.
+    SVC_HANDLE service = g_Backend->Open(manager, serviceName, access);
+    if (!service) return NULL;
+    
+    SVC_HANDLE current;
+    {
+        std::lock_guard<std::mutex> lock(session->Lock);
+        std::unordered_map<std::wstring, SessionEntry*>::iterator it = session->Services.find(key);
+        if (it == session->Services.end()) {
+            SessionEntry* entry = new SessionEntry();
+            entry->Handle = service;
+            entry->Access = access;
+            entry->Borrowers = 0;
+            session->Services[key] = entry;
+            SessionBorrowLocked(session, entry);
+            return service;
+        }
+        
+        SessionEntry* entry = it->second;
+        SessionBorrowLocked(session, entry);
+        if ((entry->Access & access) != access) {
+            entry->Retired.push_back(entry->Handle);
+            entry->Handle = service;
+            entry->Access = access;
+            return service;
+        }
+        current = entry->Handle;
+    }
+    // Another thread opened these rights first
+    g_Backend->Close(service);
+    return current;
+}
+
+SVC_HANDLE ScmSessionCreateService(SCM_SESSION* session, const SERVICE_INSTALL_SPEC* spec) {
+    SVC_HANDLE manager = ScmSessionManager(session, SC_MANAGER_CONNECT | SC_MANAGER_CREATE_SERVICE);
+    if (!manager) return NULL;
+    
+    SVC_HANDLE service = g_Backend->Create(manager, spec);
+    if (!service) return NULL;
+    
+    // Only count on the rights every backend's create handle carries (the
+    // registry backend's handle is a key, not an SCM handle)
+    SessionEntry* entry = new SessionEntry();
+    entry->Handle = service;
+    entry->Access = DELETE | SERVICE_CHANGE_CONFIG;
+    entry->Borrowers = 0;
+    
+    SessionEntry* stale = NULL;
+    {
+        std::lock_guard<std::mutex> lock(session->Lock);
+        std::wstring key = SessionKey(spec->ServiceName);
+        std::unordered_map<std::wstring, SessionEntry*>::iterator it = session->Services.find(key);
+        if (it != session->Services.end()) {
+            // Handles of the service's previous incarnation; other threads may
+            // still hold them
+            stale = SessionDropLocked(session, it->second);
+            it->second = entry;
+        } else {
+            session->Services[key] = entry;
+        }
+        SessionBorrowLocked(session, entry);
+    }
+    if (stale) SessionCloseEntry(stale);
+    return service;
+}
+
+VOID ScmSessionForget(SCM_SESSION* session, LPCWSTR serviceName) {
+    SessionEntry* entry;
+    {
+        std::lock_guard<std::mutex> lock(session->Lock);
+        std::unordered_map<std::wstring, SessionEntry*>::iterator it = session->Services.find(SessionKey(serviceName));
+        if (it == session->Services.end()) return;
+        
+        entry = it->second;
+        session->Services.erase(it);
+        
+        // The caller is done with it
+        for (SCM_SESSION_USE* use = t_SessionUse; use; use = use->Outer) {
+            std::vector<SessionEntry*>::iterator borrowed = std::find(use->Borrowed.begin(), use->Borrowed.end(), entry);
+            if (use->Session != session || borrowed == use->Borrowed.end()) continue;
+            use->Borrowed.erase(borrowed);
+            entry->Borrowers--;
+        }
+        entry = SessionDropLocked(session, entry);
+    }
+    if (entry) SessionCloseEntry(entry);
+}
+
+SCM_SESSION_USE* ScmSessionEnter(SCM_SESSION* session) {
+    SCM_SESSION_USE* use = new SCM_SESSION_USE();
+    use->Session = session;
+    use->Outer = t_SessionUse;
+    t_SessionUse = use;
+    return use;
+}
+
+VOID ScmSessionLeave(SCM_SESSION_USE* use) {
+    if (!use) return;
+    t_SessionUse = use->Outer;
+    
+    // Parked entries whose last borrower this was
+    std::vector<SessionEntry*> closing;
+    {
+        SCM_SESSION* session = use->Session;
+        std::lock_guard<std::mutex> lock(session->Lock);
+        for (size_t i = 0; i < use->Borrowed.size(); i++) {
+            SessionEntry* entry = use->Borrowed[i];
+            if (--entry->Borrowers) continue;
+            
+            std::vector<SessionEntry*>::iterator parked = std::find(session->Parked.begin(), session->Parked.end(), entry);
+            if (parked == session->Parked.end()) continue;
+            session->Parked.erase(parked);
+            closing.push_back(entry);
+        }
+    }
+    for (size_t i = 0; i < closing.size(); i++) {
+        SessionCloseEntry(closing[i]);
+    }
+    delete use;
+}
+
+SCRATCH_BUFFER* ScmSessionAcquireScratch(SCM_SESSION* session) {
+    {
+        std::lock_guard<std::mutex> lock(session->Lock);
+        if (!session->Scratch.empty()) {
+            SCRATCH_BUFFER* scratch = session->Scratch.back();
+            session->Scratch.pop_back();
+            return scratch;
+        }
+    }
+    
+    SCRATCH_BUFFER* scratch = new SCRATCH_BUFFER();
+    scratch->Data = NULL;
+    scratch->Size = 0;
+    ScratchReserve(scratch, SCRATCH_SIZE_HINT);
+    return scratch;
+}
+
+VOID ScmSessionReleaseScratch(SCM_SESSION* session, SCRATCH_BUFFER* scratch) {
+    if (!scratch) return;
+    std::lock_guard<std::mutex> lock(session->Lock);
+    session->Scratch.push_back(scratch);
+}
@@ -0,0 +1,39 @@
+#include "service_backend.h"
+#include "output.h"
+#include <wchar.h>
+
+// advapi32 build: the real SCM is the default everywhere it exists
+#ifdef _WIN32
+const SERVICE_BACKEND* g_Backend = &Advapi32Backend;
+#else
+const SERVICE_BACKEND* g_Backend = &SimulatedBackend;
+#endif
+
+// Backends report why they could not start through the last error
+static BOOL BackendInitialize() {
+    if (g_Backend->Initialize()) return TRUE;
+    
+    DWORD error = GetLastError();
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"backend", NULL);
+    return OutputFinish(&record, FALSE, error, L"Failed to initialize %ls backend: %d", g_Backend->Name, error);
+}
+
+BOOL SelectServiceBackend(LPCWSTR name) {
+    if (!name) return BackendInitialize();
+    
+#ifdef _WIN32
+    if (_wcsicmp(name, L"advapi32") == 0) {
+        g_Backend = &Advapi32Backend;
+        return BackendInitialize();
+    }
+#endif
+    if (_wcsicmp(name, L"sim") == 0) {
+        g_Backend = &SimulatedBackend;
+        return BackendInitialize();
+    }
+    
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"backend", NULL);
+    return OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER, L"Unknown backend: %ls", name);
+}
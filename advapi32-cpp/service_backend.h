@@ -0,0 +1,165 @@
+#ifndef SERVICE_BACKEND_H
+#define SERVICE_BACKEND_H
+
+#include "win_compat.h"
+
+// Opaque handle owned by a backend (manager or service)
+typedef struct _SVC_HANDLE_ *SVC_HANDLE;
+
+// Grow-only query buffer, defined in scratch.h
+typedef struct _SCRATCH_BUFFER SCRATCH_BUFFER;
+
+// Start trigger: the SCM starts the service when the event occurs
+typedef struct _SERVICE_START_TRIGGER {
+    DWORD Type;         // SERVICE_TRIGGER_TYPE_*, 0 = no trigger
+    GUID Subtype;       // Network event or ETW provider
+} SERVICE_START_TRIGGER;
+
+// Recovery policy: the SCM restarts the service after it fails, waiting
+// RestartDelayMs[n] before the n-th consecutive restart (the last delay
+// repeats for later failures)
+#define SERVICE_RECOVERY_MAX_RESTARTS  8
+
+typedef struct _SERVICE_RECOVERY {
+    DWORD RestartCount;         // 0 = no recovery: a failed service stays down
+    DWORD RestartDelayMs[SERVICE_RECOVERY_MAX_RESTARTS];
+    DWORD ResetPeriod;          // Seconds without a failure after which the count starts over
+    BOOL OnNonCrashFailure;     // Also after a stop with an error exit code, not only a crash
+    BOOL OtherActions;          // Query only: reboot / run-command / no-action entries are set too
+} SERVICE_RECOVERY;
+
+// Boot options kept outside QUERY_SERVICE_CONFIGW
+typedef struct _SERVICE_START_OPTIONS {
+    BOOL DelayedAutoStart;          // Automatic start after the boot-critical services
+    SERVICE_START_TRIGGER Trigger;  // Type 0 = no trigger
+    BOOL OtherTriggers;             // Query only: more triggers, or ones that do not just start the service
+} SERVICE_START_OPTIONS;
+
+// Parameters for creating a service. Create applies all of them, the boot
+// options included, before it returns the new service.
+typedef struct _SERVICE_INSTALL_SPEC {
+    LPCWSTR ServiceName;
+    LPCWSTR DisplayName;
+    LPCWSTR ImagePath;
+    DWORD ServiceType;
+    DWORD StartType;
+    DWORD ErrorControl;
+    DWORD DelayedAutoStart;         // Automatic start after the boot-critical services
+    SERVICE_START_TRIGGER Trigger;
+    LPCWSTR Dependencies;           // Services started first, double-null-terminated (NULL = none)
+    SERVICE_RECOVERY Recovery;
+} SERVICE_INSTALL_SPEC;
+
+// One service entry read straight from the Services registry key. Config
+// holds the inventory fields of the schema (SCHEMA_INVENTORY); a missing
+// value reads as SERVICE_NO_CHANGE / NULL. Strings point into buffers the
+// backend reuses for the next entry.
+typedef struct _SERVICE_REGISTRY_ENTRY {
+    LPCWSTR Name;
+    QUERY_SERVICE_CONFIGW Config;
+} SERVICE_REGISTRY_ENTRY;
+
+// Called once per registry entry; return FALSE to end the walk. Must not
+// call back into the backend.
+typedef BOOL (*SERVICE_REGISTRY_ROUTINE)(PVOID context, const SERVICE_REGISTRY_ENTRY* entry);
+
+// Resource use of one service process (QueryProcesses). The caller sets
+// ProcessId; the backend fills in the rest.
+typedef struct _SERVICE_PROCESS_USAGE {
+    DWORD ProcessId;
+    BOOL Present;               // FALSE: the process has exited or cannot be read
+    ULONGLONG CpuTime;          // Kernel + user time, 100 ns units
+    ULONGLONG WorkingSet;       // Bytes
+    ULONGLONG PrivateBytes;     // Committed private memory, bytes
+    DWORD HandleCount;
+    DWORD ThreadCount;
+} SERVICE_PROCESS_USAGE;
+
+// Service backend function table. Every call reports failure the Win32 way:
+// NULL / FALSE return with the error code available from GetLastError().
+typedef struct _SERVICE_BACKEND {
+    LPCWSTR Name;
+    BOOL (*Initialize)();
+    SVC_HANDLE (*Connect)(DWORD desiredAccess);
+    SVC_HANDLE (*Open)(SVC_HANDLE manager, LPCWSTR serviceName, DWORD desiredAccess);
+    SVC_HANDLE (*Create)(SVC_HANDLE manager, const SERVICE_INSTALL_SPEC* spec);
+    BOOL (*SetDescription)(SVC_HANDLE service, LPCWSTR description);
+    BOOL (*Delete)(SVC_HANDLE service);
+    BOOL (*Start)(SVC_HANDLE service);
+    BOOL (*Control)(SVC_HANDLE service, DWORD control, SERVICE_STATUS* status);
+    BOOL (*QueryStatus)(SVC_HANDLE service, SERVICE_STATUS* status);
+    BOOL (*QueryConfig)(SVC_HANDLE service, LPQUERY_SERVICE_CONFIGW config, DWORD bufSize, LPDWORD bytesNeeded);
+    // ChangeServiceConfigW semantics: members left at SERVICE_NO_CHANGE / NULL
+    // keep their current value, lpDependencies included (an empty list
+    // removes every dependency); the service needs SERVICE_CHANGE_CONFIG
+    BOOL (*ChangeConfig)(SVC_HANDLE service, const QUERY_SERVICE_CONFIGW* changes);
+    // Failure actions and the non-crash failure flag
+    // (SERVICE_CONFIG_FAILURE_ACTIONS / _FLAG). Query needs
+    // SERVICE_QUERY_CONFIG. Change needs SERVICE_CHANGE_CONFIG, and
+    // SERVICE_START as well when the policy restarts the service; it
+    // replaces every configured action. Query reads the variable-length
+    // result into the caller's scratch buffer (see scratch.h).
+    BOOL (*QueryRecovery)(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_RECOVERY* recovery);
+    BOOL (*ChangeRecovery)(SVC_HANDLE service, const SERVICE_RECOVERY* recovery);
+    // Delayed automatic start and the start triggers
+    // (SERVICE_CONFIG_DELAYED_AUTO_START_INFO / _TRIGGER_INFO), with the
+    // query result read the same way. Query needs SERVICE_QUERY_CONFIG,
+    // change SERVICE_CHANGE_CONFIG; change replaces every configured
+    // trigger, and a delayed start needs an automatic service.
+    BOOL (*QueryStartOptions)(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_START_OPTIONS* options);
+    BOOL (*ChangeStartOptions)(SVC_HANDLE service, const SERVICE_START_OPTIONS* options);
+    // EnumServicesStatusExW semantics: fills ENUM_SERVICE_STATUS_PROCESSW
+    // records, fails with ERROR_MORE_DATA and advances *resumeHandle when the
+    // buffer holds only part of the list (manager needs ENUMERATE_SERVICE)
+    BOOL (*EnumServices)(SVC_HANDLE manager, DWORD serviceType, DWORD serviceState, LPBYTE buffer, DWORD bufSize,
+        LPDWORD bytesNeeded, LPDWORD servicesReturned, LPDWORD resumeHandle);
+    // EnumDependentServicesW semantics: every service that depends on this
+    // one, directly or not, in the order they must stop; fails with
+    // ERROR_MORE_DATA when the buffer is too small (service needs
+    // SERVICE_ENUMERATE_DEPENDENTS)
+    BOOL (*EnumDependents)(SVC_HANDLE service, DWORD serviceState, LPENUM_SERVICE_STATUSW services, DWORD bufSize,
+        LPDWORD bytesNeeded, LPDWORD servicesReturned);
+    // Optional (may be NULL): block until one of the services leaves its known
+    // state. Returns its index, WAIT_TIMEOUT, or WAIT_FAILED if unsupported.
+    DWORD (*WaitStatusChange)(SVC_HANDLE* services, const DWORD* knownStates, DWORD count, DWORD timeoutMs);
+    // Optional (may be NULL): read entries from the Services registry key,
+    // including ones the SCM has not loaded yet, without an SCM call per
+    // name. serviceName NULL walks every subkey; a single name that has no
+    // key fails with ERROR_SERVICE_DOES_NOT_EXIST.
+    BOOL (*ReadRegistry)(SVC_HANDLE manager, LPCWSTR serviceName, SERVICE_REGISTRY_ROUTINE routine, PVOID context);
+    // Optional (may be NULL): sample 'count' processes in one pass. Entries
+    // whose process is gone are left not Present; fails only when no
+    // sample could be taken at all.
+    BOOL (*QueryProcesses)(SERVICE_PROCESS_USAGE* usage, DWORD count);
+    void (*Close)(SVC_HANDLE handle);
+} SERVICE_BACKEND;
+
+// Available backends
+#ifdef _WIN32
+extern const SERVICE_BACKEND Advapi32Backend;
+extern const SERVICE_BACKEND NtRegistryBackend;
+#endif
+extern const SERVICE_BACKEND SimulatedBackend;
+
+// Backend used by the service management functions
+extern const SERVICE_BACKEND* g_Backend;
+
+// Select backend by name ("advapi32", "nt", "sim"); NULL selects the default
+BOOL SelectServiceBackend(LPCWSTR name);
+
+// Simulated SCM tuning (times in milliseconds unless noted)
+typedef struct _SIM_SCM_CONFIG {
+    DWORD CallLatencyUs;       // Added to every backend call (microseconds)
+    DWORD StartTime;           // START_PENDING -> RUNNING
+    DWORD StopTime;            // STOP_PENDING -> STOPPED
+    DWORD CheckPointInterval;  // dwCheckPoint advances at this rate while pending
+} SIM_SCM_CONFIG;
+
+VOID SimScmConfigure(const SIM_SCM_CONFIG* config);
+BOOL SimScmAddService(LPCWSTR serviceName, DWORD startTime, DWORD stopTime);
+// A service already in 'state' (SERVICE_STOPPED or SERVICE_RUNNING) that
+// needs 'dependencies' (double-null-terminated, NULL = none)
+BOOL SimScmLoadService(LPCWSTR serviceName, DWORD state, DWORD startTime, DWORD stopTime, LPCWSTR dependencies);
+VOID SimScmReset();
+
+#endif // SERVICE_BACKEND_H
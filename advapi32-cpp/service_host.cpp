@@ -0,0 +1,515 @@
+#include "service_host.h"
+#include "log_pipe.h"
+#include "output.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define HOST_POLL_MS            100     // Child exit / stop request check interval
+#define HOST_PUMP_BYTES         (16 * 1024)
+#define HOST_STOP_TIMEOUT_MS    10000   // Default: stop request to forced kill
+
+typedef struct _HOST_CONFIG {
+    LOG_PIPE_CONFIG Log;
+    DWORD StopTimeoutMs;
+    std::wstring CommandLine;   // As logged; on Windows also what is run
+#ifndef _WIN32
+    wchar_t** Arguments;        // execvp argument vector, NULL-terminated
+#endif
+} HOST_CONFIG;
+
+typedef struct _HOST_CHILD {
+#ifdef _WIN32
+    HANDLE Process;
+    HANDLE Job;                 // Holds the child's descendants (may be NULL)
+    HANDLE Output;              // Read end of the stdout / stderr pipe
+#else
+    pid_t Process;              // Also the process group id
+    int Output;
+#endif
+    DWORD ProcessId;
+} HOST_CHILD;
+
+static HOST_CONFIG g_HostConfig;
+static std::atomic<bool> g_HostStopRequested(false);
+#ifdef _WIN32
+static SERVICE_STATUS_HANDLE g_HostStatusHandle = NULL;
+static int g_HostExitCode = 0;
+#endif
+
+// Tell the SCM where the service is; does nothing outside the SCM
+static void HostReportStatus(DWORD state, DWORD win32ExitCode, DWORD serviceExitCode, DWORD waitHint) {
+#ifdef _WIN32
+    static DWORD checkPoint = 0;
+    if (!g_HostStatusHandle) return;
+    
+    SERVICE_STATUS status;
+    status.dwServiceType = SERVICE_WIN32_OWN_PROCESS;
+    status.dwCurrentState = state;
+    status.dwControlsAccepted = (state == SERVICE_RUNNING) ? SERVICE_ACCEPT_STOP | SERVICE_ACCEPT_SHUTDOWN : 0;
+    status.dwWin32ExitCode = win32ExitCode;
+    status.dwServiceSpecificExitCode = serviceExitCode;
+    status.dwCheckPoint = (state == SERVICE_RUNNING || state == SERVICE_STOPPED) ? 0 : ++checkPoint;
+    status.dwWaitHint = waitHint;
+    SetServiceStatus(g_HostStatusHandle, &status);
+#else
+    (void)state;
+    (void)win32ExitCode;
+    (void)serviceExitCode;
+    (void)waitHint;
+#endif
+}
+
+static void HostAppendUtf8(std::string* out, LPCWSTR text) {
+    for (; *text; text++) {
+        DWORD cp = (DWORD)*text;
+        if (cp >= 0xD800 && cp <= 0xDBFF && (DWORD)text[1] >= 0xDC00 && (DWORD)text[1] <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + ((DWORD)*++text - 0xDC00);
+        }
+        if (cp < 0x80) {
+            out->push_back((char)cp);
+        } else if (cp < 0x800) {
+            out->push_back((char)(0xC0 | (cp >> 6)));
+            out->push_back((char)(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out->push_back((char)(0xE0 | (cp >> 12)));
+            out->push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+            out->push_back((char)(0x80 | (cp & 0x3F)));
+        } else {
+            out->push_back((char)(0xF0 | (cp >> 18)));
+            out->push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+            out->push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+            out->push_back((char)(0x80 | (cp & 0x3F)));
+        }
+    }
+}
+
+// One timestamped "[host]" line in the log, UTF-8 like the child's output
+static void HostLog(LOG_PIPE* log, LPCWSTR format, ...) {
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    WCHAR text[1024];
+    int prefix = swprintf(text, sizeof(text) / sizeof(WCHAR), L"%04u-%02u-%02u %02u:%02u:%02u.%03u [host] ",
+        now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond, now.wMilliseconds);
+    va_list args;
+    va_start(args, format);
+    int written = vswprintf(text + prefix, sizeof(text) / sizeof(WCHAR) - prefix, format, args);
+    va_end(args);
+    if (written < 0) wcscpy(text + prefix, L"(message too long)");
+    
+    std::string line;
+    HostAppendUtf8(&line, text);
+    line.push_back('\n');
+    LogPipeWrite(log, line.data(), (DWORD)line.size());
+}
+
+// Child output to the log until every holder of the pipe's write end is gone
+static void HostPump(const HOST_CHILD* child, LOG_PIPE* log) {
+    char buffer[HOST_PUMP_BYTES];
+    for (;;) {
+#ifdef _WIN32
+        DWORD bytes = 0;
+        if (!ReadFile(child->Output, buffer, sizeof(buffer), &bytes, NULL) || bytes == 0) break;
+#else
+        ssize_t bytes = read(child->Output, buffer, sizeof(buffer));
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0) break;
+#endif
+        LogPipeWrite(log, buffer, (DWORD)bytes);
+    }
+}
+
+#ifdef _WIN32
+
+static BOOL HostLaunch(const HOST_CONFIG* config, HOST_CHILD* child) {
+    SECURITY_ATTRIBUTES inherit = { sizeof(inherit), NULL, TRUE };
+    HANDLE readEnd;
+    HANDLE writeEnd;
+    if (!CreatePipe(&readEnd, &writeEnd, &inherit, 0)) return FALSE;
+    SetHandleInformation(readEnd, HANDLE_FLAG_INHERIT, 0);
+    HANDLE input = CreateFileW(L"NUL", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &inherit, OPEN_EXISTING, 0,
+        NULL);
+    
+    STARTUPINFOW startup;
+    ZeroMemory(&startup, sizeof(startup));
+    startup.cb = sizeof(startup);
+    startup.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
+    startup.wShowWindow = SW_HIDE;
+    startup.hStdInput = input;
+    startup.hStdOutput = writeEnd;
+    startup.hStdError = writeEnd;
+    
+    // A hidden console of its own, so Ctrl+C can be sent to it alone;
+    // suspended until it is in the job
+    std::vector<WCHAR> commandLine(config->CommandLine.begin(), config->CommandLine.end());
+    commandLine.push_back(L'\0');
+    PROCESS_INFORMATION process;
+    BOOL created = CreateProcessW(NULL, commandLine.data(), NULL, NULL, TRUE, CREATE_NEW_CONSOLE | CREATE_SUSPENDED,
+        NULL, NULL, &startup, &process);
+    DWORD err = GetLastError();
+    CloseHandle(writeEnd);
+    if (input != INVALID_HANDLE_VALUE) CloseHandle(input);
+    if (!created) {
+        CloseHandle(readEnd);
+        SetLastError(err);
+        return FALSE;
+    }
+    
+    // Closing the job (or the host exiting) ends every process left in it
+    child->Job = CreateJobObjectW(NULL, NULL);
+    if (child->Job) {
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+        ZeroMemory(&limits, sizeof(limits));
+        limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+        if (!SetInformationJobObject(child->Job, JobObjectExtendedLimitInformation, &limits, sizeof(limits)) ||
+            !AssignProcessToJobObject(child->Job, process.hProcess)) {
+            CloseHandle(child->Job);
+            child->Job = NULL;
+        }
+    }
+    ResumeThread(process.hThread);
+    CloseHandle(process.hThread);
+    
+    child->Process = process.hProcess;
+    child->ProcessId = process.dwProcessId;
+    child->Output = readEnd;
+    return TRUE;
+}
+
+// Ctrl+C reaches only processes attached to the console, so attach to the
+// child's for the moment it takes, ignoring the event ourselves. A host
+// started from a console goes back to its parent's afterwards.
+static BOOL HostSignalStop(const HOST_CHILD* child) {
+    FreeConsole();
+    BOOL sent = AttachConsole(child->ProcessId);
+    if (sent) {
+        SetConsoleCtrlHandler(NULL, TRUE);
+        sent = GenerateConsoleCtrlEvent(CTRL_C_EVENT, 0);
+        FreeConsole();
+    }
+    if (!g_HostStatusHandle) AttachConsole(ATTACH_PARENT_PROCESS);
+    return sent;
+}
+
+static void HostKill(const HOST_CHILD* child) {
+    if (child->Job) {
+        TerminateJobObject(child->Job, 1);
+    } else {
+        TerminateProcess(child->Process, 1);
+    }
+}
+
+static BOOL HostWaitChild(const HOST_CHILD* child, DWORD timeoutMs, DWORD* exitCode) {
+    if (WaitForSingleObject(child->Process, timeoutMs) != WAIT_OBJECT_0) return FALSE;
+    if (!GetExitCodeProcess(child->Process, exitCode)) *exitCode = 1;
+    return TRUE;
+}
+
+static void HostRelease(HOST_CHILD* child) {
+    CloseHandle(child->Output);
+    CloseHandle(child->Process);
+    if (child->Job) CloseHandle(child->Job);
+}
+
+static BOOL WINAPI HostConsoleHandler(DWORD event) {
+    (void)event;
+    g_HostStopRequested = true;
+    return TRUE;
+}
+
+static DWORD WINAPI HostControl(DWORD control, DWORD eventType, LPVOID eventData, LPVOID context) {
+    (void)eventType;
+    (void)eventData;
+    (void)context;
+    switch (control) {
+        case SERVICE_CONTROL_STOP:
+        case SERVICE_CONTROL_SHUTDOWN:
+            g_HostStopRequested = true;
+            return NO_ERROR;
+        case SERVICE_CONTROL_INTERROGATE:
+            return NO_ERROR;
+        default:
+            return ERROR_CALL_NOT_IMPLEMENTED;
+    }
+}
+
+#else
+
+static BOOL HostLaunch(const HOST_CONFIG* config, HOST_CHILD* child) {
+    // Everything the child needs is prepared before fork: only exec-safe
+    // calls run in between
+    std::vector<std::string> storage;
+    std::vector<char*> args;
+    for (wchar_t** arg = config->Arguments; *arg; arg++) {
+        size_t len = wcstombs(NULL, *arg, 0);
+        if (len == (size_t)-1) {
+            SetLastError(ERROR_INVALID_NAME);
+            return FALSE;
+        }
+        storage.push_back(std::string(len, '\0'));
+        wcstombs(&storage.back()[0], *arg, len + 1);
+    }
+    for (size_t i = 0; i < storage.size(); i++) {
+        args.push_back(&storage[i][0]);
+    }
+    args.push_back(NULL);
+    
+    int fds[2];
+    if (pipe(fds) != 0) {
+        SetLastError(ERROR_GEN_FAILURE);
+        return FALSE;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return FALSE;
+    }
+    if (pid == 0) {
+        // Own process group, so a stop or kill reaches its descendants too
+        static const char failed[] = "[host] exec failed\n";
+        setpgid(0, 0);
+        int input = open("/dev/null", O_RDONLY);
+        if (input >= 0) dup2(input, 0);
+        dup2(fds[1], 1);
+        dup2(fds[1], 2);
+        close(fds[0]);
+        close(fds[1]);
+        execvp(args[0], args.data());
+        ssize_t ignored = write(2, failed, sizeof(failed) - 1);
+        (void)ignored;
+        _exit(127);
+    }
+    
+    setpgid(pid, pid);
+    close(fds[1]);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    child->Process = pid;
+    child->ProcessId = (DWORD)pid;
+    child->Output = fds[0];
+    return TRUE;
+}
+
+static BOOL HostSignalStop(const HOST_CHILD* child) {
+    return kill(-child->Process, SIGTERM) == 0;
+}
+
+static void HostKill(const HOST_CHILD* child) {
+    kill(-child->Process, SIGKILL);
+}
+
+// Exit code as a shell reports it: the status, or 128 + the signal
+static BOOL HostWaitChild(const HOST_CHILD* child, DWORD timeoutMs, DWORD* exitCode) {
+    ULONGLONG deadline = GetTickCount64() + timeoutMs;
+    for (;;) {
+        int status;
+        pid_t done = waitpid(child->Process, &status, WNOHANG);
+        if (done == child->Process) {
+            *exitCode = WIFEXITED(status) ? (DWORD)WEXITSTATUS(status) : 128 + (DWORD)WTERMSIG(status);
+            return TRUE;
+        }
+        if (done < 0 && errno != EINTR) {
+            *exitCode = 1;
+            return TRUE;
+        }
+        if (GetTickCount64() >= deadline) return FALSE;
+        Sleep(10);
+    }
+}
+
+static void HostRelease(HOST_CHILD* child) {
+    close(child->Output);
+}
+
+static void HostSignal(int signal) {
+    (void)signal;
+    g_HostStopRequested = true;
+}
+
+#endif
+
+// Run the child to completion, forwarding a stop request; returns its exit code
+static int HostRun(const HOST_CONFIG* config) {
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"host", NULL);
+    LOG_PIPE* log = LogPipeOpen(&config->Log);
+    if (!log) {
+        DWORD err = GetLastError();
+        HostReportStatus(SERVICE_STOPPED, err, 0, 0);
+        OutputFinish(&record, FALSE, err, L"Failed to open log file '%ls'", config->Log.Path);
+        return 1;
+    }
+    
+    HOST_CHILD child;
+    if (!HostLaunch(config, &child)) {
+        DWORD err = GetLastError();
+        HostLog(log, L"Failed to start '%ls': %d", config->CommandLine.c_str(), err);
+        LogPipeClose(log, NULL);
+        HostReportStatus(SERVICE_STOPPED, err, 0, 0);
+        OutputFinish(&record, FALSE, err, L"Failed to start '%ls': %d", config->CommandLine.c_str(), err);
+        return 1;
+    }
+    
+    HostLog(log, L"Started '%ls' (pid %u)", config->CommandLine.c_str(), child.ProcessId);
+    HostReportStatus(SERVICE_RUNNING, NO_ERROR, 0, 0);
+    std::thread pump(HostPump, &child, log);
+    
+    DWORD exitCode = 0;
+    ULONGLONG stopAt = 0;
+    BOOL killed = FALSE;
+    while (!HostWaitChild(&child, HOST_POLL_MS, &exitCode)) {
+        if (!g_HostStopRequested) continue;
+        
+        HostReportStatus(SERVICE_STOP_PENDING, NO_ERROR, 0, config->StopTimeoutMs + HOST_POLL_MS);
+        if (!stopAt) {
+            stopAt = GetTickCount64();
+            BOOL sent = HostSignalStop(&child);
+            HostLog(log, sent ? L"Stop requested, signalled pid %u" : L"Stop requested, pid %u cannot be signalled",
+                child.ProcessId);
+        } else if (!killed && GetTickCount64() - stopAt >= config->StopTimeoutMs) {
+            HostLog(log, L"pid %u did not exit within %u ms, terminating it", child.ProcessId, config->StopTimeoutMs);
+            HostKill(&child);
+            killed = TRUE;
+        }
+    }
+    
+    // End whatever the child left running, so the pipe closes, then drain it
+    HostKill(&child);
+    pump.join();
+    HostRelease(&child);
+    HostLog(log, L"pid %u exited with code %u", child.ProcessId, exitCode);
+    
+    LOG_PIPE_STATS stats;
+    LogPipeClose(log, &stats);
+    
+    // A child that exits by itself is a service failure the SCM can act on;
+    // one that was asked to stop is not
+    BOOL failed = exitCode != 0 && !stopAt;
+    HostReportStatus(SERVICE_STOPPED, failed ? ERROR_SERVICE_SPECIFIC_ERROR : NO_ERROR, failed ? exitCode : 0, 0);
+    record.ProcessId = child.ProcessId;
+    OutputFinish(&record, !failed, failed ? ERROR_SERVICE_SPECIFIC_ERROR : ERROR_SUCCESS,
+        L"pid %u exited with code %u; %llu bytes logged, %llu dropped, %u rotation(s)", child.ProcessId, exitCode,
+        (unsigned long long)stats.WrittenBytes, (unsigned long long)stats.DroppedBytes, stats.Rotations);
+    return (int)exitCode;
+}
+
+#ifdef _WIN32
+static VOID WINAPI HostServiceMain(DWORD argc, LPWSTR* argv) {
+    g_HostStatusHandle = RegisterServiceCtrlHandlerExW(argc > 0 ? argv[0] : L"", HostControl, NULL);
+    if (!g_HostStatusHandle) return;
+    
+    HostReportStatus(SERVICE_START_PENDING, NO_ERROR, 0, 3000);
+    g_HostExitCode = HostRun(&g_HostConfig);
+}
+#endif
+
+static int HostUsage(LPCWSTR error) {
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"host", NULL);
+    OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER, L"ERROR: %ls\nUsage: host --log <file> [--log-size <bytes>] "
+        L"[--log-files <n>] [--stop-timeout <ms>] -- <command> [args...]", error);
+    return 1;
+}
+
+int RunServiceHost(int argc, wchar_t* argv[]) {
+    HOST_CONFIG* config = &g_HostConfig;
+    LPCWSTR logPath = NULL;
+    LogPipeInitConfig(&config->Log, NULL);
+    config->StopTimeoutMs = HOST_STOP_TIMEOUT_MS;
+    
+    int i = 1;
+    for (; i < argc && wcscmp(argv[i], L"--") != 0; i++) {
+        if (i + 1 >= argc) return HostUsage(L"option without a value");
+        if (_wcsicmp(argv[i], L"--log") == 0) {
+            logPath = argv[++i];
+        } else if (_wcsicmp(argv[i], L"--log-size") == 0) {
+            config->Log.MaxFileBytes = wcstoull(argv[++i], NULL, 10);
+        } else if (_wcsicmp(argv[i], L"--log-files") == 0) {
+            config->Log.MaxFiles = (DWORD)wcstoul(argv[++i], NULL, 10);
+        } else if (_wcsicmp(argv[i], L"--stop-timeout") == 0) {
+            config->StopTimeoutMs = (DWORD)wcstoul(argv[++i], NULL, 10);
+        } else {
+            return HostUsage(L"unknown host option");
+        }
+    }
+    if (!logPath) return HostUsage(L"host requires --log");
+    if (i + 1 >= argc) return HostUsage(L"host requires a command after --");
+    config->Log.Path = logPath;
+    
+    for (int arg = i + 1; arg < argc; arg++) {
+        if (arg > i + 1) config->CommandLine.push_back(L' ');
+        config->CommandLine.append(argv[arg]);
+    }
+    
+#ifdef _WIN32
+    // Run the command line as written after " --", quoting intact
+    LPCWSTR raw = wcsstr(GetCommandLineW(), L" -- ");
+    if (raw) config->CommandLine = raw + 4;
+    
+    SERVICE_TABLE_ENTRYW table[] = { { (LPWSTR)L"", HostServiceMain }, { NULL, NULL } };
+    if (StartServiceCtrlDispatcherW(table)) return g_HostExitCode;
+    if (GetLastError() != ERROR_FAILED_SERVICE_CONTROLLER_CONNECT) {
+        DWORD err = GetLastError();
+        OUTPUT_RECORD record;
+        OutputBegin(&record, L"host", NULL);
+        OutputFinish(&record, FALSE, err, L"StartServiceCtrlDispatcher failed: %d", err);
+        return 1;
+    }
+    // Not started by the SCM: run from the console
+    SetConsoleCtrlHandler(HostConsoleHandler, TRUE);
+#else
+    config->Arguments = argv + i + 1;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = HostSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+#endif
+    return HostRun(config);
+}
+
+BOOL ServiceHostImagePath(LPCWSTR logPath, LPCWSTR command, std::wstring* imagePath) {
+#ifdef _WIN32
+    WCHAR self[MAX_PATH];
+    DWORD length = GetModuleFileNameW(NULL, self, MAX_PATH);
+    if (length == 0 || length >= MAX_PATH) {
+        if (length) SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return FALSE;
+    }
+#else
+    char narrow[4096];
+    ssize_t length = readlink("/proc/self/exe", narrow, sizeof(narrow) - 1);
+    if (length <= 0) {
+        SetLastError(ERROR_FILE_NOT_FOUND);
+        return FALSE;
+    }
+    narrow[length] = '\0';
+    WCHAR self[4096];
+    if (mbstowcs(self, narrow, sizeof(self) / sizeof(WCHAR)) == (size_t)-1) {
+        SetLastError(ERROR_INVALID_NAME);
+        return FALSE;
+    }
+#endif
+    
+    imagePath->assign(L"\"");
+    imagePath->append(self);
+    imagePath->append(L"\" host --log \"");
+    imagePath->append(logPath);
+    imagePath->append(L"\" -- ");
+    imagePath->append(command);
+    return TRUE;
+}
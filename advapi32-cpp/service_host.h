@@ -0,0 +1,27 @@
+#ifndef SERVICE_HOST_H
+#define SERVICE_HOST_H
+
+#include "win_compat.h"
+#include <string>
+
+// Service host: the tool itself runs as the service process and hosts a
+// plain console command. The child's stdout and stderr go through a log
+// pipe (log_pipe.h) into size-rotated files; host events are logged as
+// timestamped "[host]" lines. A stop request (SCM stop or shutdown, or
+// Ctrl+C / SIGTERM when run from a console) is forwarded to the child as
+// Ctrl+C (Windows) or SIGTERM, and the child's process tree is killed if
+// it has not exited within the stop timeout. The host exits with the
+// child's exit code.
+//
+//   host --log <file> [--log-size <bytes>] [--log-files <n>] [--stop-timeout <ms>] -- <command> [args...]
+//
+// Started by the SCM it reports START_PENDING, RUNNING once the child is
+// up, STOP_PENDING with advancing checkpoints and STOPPED; started from a
+// console it runs the same way without the SCM.
+int RunServiceHost(int argc, wchar_t* argv[]);
+
+// Image path that runs 'command' under this executable's service host,
+// logging to 'logPath':  "<this exe>" host --log "<logPath>" -- <command>
+BOOL ServiceHostImagePath(LPCWSTR logPath, LPCWSTR command, std::wstring* imagePath);
+
+#endif // SERVICE_HOST_H
@@ -1,266 +1,255 @@
 #include "service_installer.h"
-#include <stdio.h>
+#include "service_manager.h"
+#include "service_graph.h"
+#include "service_wait.h"
+#include "executor.h"
+#include "output.h"
 #include <wchar.h>
+#include <string>
+#include <vector>
 
-BOOL InstallService(LPCWSTR exePath, LPCWSTR serviceName, LPCWSTR displayName, LPCWSTR description) {
-    SC_HANDLE scManager = NULL;
-    SC_HANDLE service = NULL;
-    BOOL success = FALSE;
-    
-    // Open Service Control Manager
-    scManager = OpenSCManagerW(NULL, NULL, SC_MANAGER_CREATE_SERVICE);
-    if (!scManager) {
-        wprintf(L"OpenSCManager failed: %d\n", GetLastError());
-        return FALSE;
+// Progress of the library routines as console text
+static VOID InstallerEvent(PVOID context, LPCWSTR serviceName, SERVICE_EVENT event, DWORD error) {
+    (void)context;
+    switch (event) {
+        case SERVICE_EVENT_STARTING: OutputText(L"Starting service '%ls'...\n", serviceName); break;
+        case SERVICE_EVENT_STOPPING: OutputText(L"Stopping service '%ls'...\n", serviceName); break;
+        case SERVICE_EVENT_DESCRIPTION_FAILED: OutputText(L"Warning: Failed to set description: %d\n", error); break;
+        case SERVICE_EVENT_STOP_FAILED: OutputText(L"Warning: Service did not stop: %d\n", error); break;
     }
+}
+
+// The CLI is a client of the library layer: every operation goes through
+// one process-wide ServiceManager on the default session, with a worker per
+// executor job, and blocks on its future
+static ServiceManager* InstallerNewManager() {
+    SERVICE_OP_CONTEXT op;
+    op.Session = ScmDefaultSession();
+    op.TimeoutMs = g_ServiceWaitTimeout;
+    op.Ready = NULL;
+    op.OnEvent = InstallerEvent;
+    op.EventContext = NULL;
+    return new ServiceManager(g_ExecutorJobs, op);
+}
+
+static ServiceManager* InstallerManager() {
+    static ServiceManager* manager = InstallerNewManager();
+    return manager;
+}
+
+static void InstallerStates(OUTPUT_RECORD* record, const SERVICE_RESULT* result) {
+    if (result->State) record->State = result->State;
+    if (result->PreviousState) record->PreviousState = result->PreviousState;
+}
+
+// Generic report of a failed step: the API and its error, or the state a
+// wait ended in
+static BOOL InstallerFailed(OUTPUT_RECORD* record, const SERVICE_RESULT* result) {
+    if (result->FailedStep == SERVICE_STEP_WAIT_RUNNING || result->FailedStep == SERVICE_STEP_WAIT_STOPPED) {
+        return OutputFinish(record, FALSE, result->Error, L"Service state: %d (error %d)", result->State, result->Error);
+    }
+    return OutputFinish(record, FALSE, result->Error, L"%ls failed: %d", ServiceStepName(result->FailedStep),
+        result->Error);
+}
+
+BOOL InstallService(LPCWSTR exePath, LPCWSTR serviceName, LPCWSTR displayName, LPCWSTR description,
+    const SERVICE_BOOT_OPTIONS* boot) {
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"install", serviceName);
     
     // Create service
-    service = CreateServiceW(
-        scManager,
-        serviceName,
-        displayName ? displayName : serviceName,
-        SERVICE_ALL_ACCESS,
-        SERVICE_WIN32_OWN_PROCESS,
-        SERVICE_AUTO_START,
-        SERVICE_ERROR_NORMAL,
-        exePath,
-        NULL,   // No load ordering group
-        NULL,   // No tag identifier
-        NULL,   // No dependencies
-        NULL,   // LocalSystem account
-        NULL    // No password
-    );
-    
-    if (!service) {
-        DWORD err = GetLastError();
-        if (err == ERROR_SERVICE_EXISTS) {
-            wprintf(L"Service '%s' already exists\n", serviceName);
-        } else {
-            wprintf(L"CreateService failed: %d\n", err);
-        }
-        goto cleanup;
-    }
-    
-    wprintf(L"Service '%s' installed successfully\n", serviceName);
-    
-    // Set description if provided
-    if (description && wcslen(description) > 0) {
-        SERVICE_DESCRIPTIONW sd;
-        sd.lpDescription = (LPWSTR)description;
-        
-        if (!ChangeServiceConfig2W(service, SERVICE_CONFIG_DESCRIPTION, &sd)) {
-            wprintf(L"Warning: Failed to set description: %d\n", GetLastError());
-        }
-    }
-    
-    success = TRUE;
-    
-cleanup:
-    if (service) CloseServiceHandle(service);
-    if (scManager) CloseServiceHandle(scManager);
-    return success;
+    SERVICE_INSTALL_SPEC spec;
+    SchemaInitSpec(&spec);
+    spec.ServiceName = serviceName;
+    spec.DisplayName = displayName;
+    spec.ImagePath = exePath;
+    if (boot) {
+        // Applied by the create call itself, not as a follow-up change
+        spec.StartType = boot->StartType;
+        spec.DelayedAutoStart = boot->DelayedAutoStart;
+        spec.Trigger = boot->Trigger;
+        spec.Dependencies = boot->Dependencies;
+        spec.Recovery = boot->Recovery;
+    }
+    
+    SERVICE_RESULT result = InstallerManager()->Install(spec, description).get();
+    if (result.FailedStep == SERVICE_STEP_CREATE && result.Error == ERROR_SERVICE_EXISTS) {
+        return OutputFinish(&record, FALSE, result.Error, L"Service '%ls' already exists", serviceName);
+    }
+    if (result.FailedStep) return InstallerFailed(&record, &result);
+    
+    record.State = result.State;
+    record.StartType = result.StartType;
+    std::wstring start;
+    SchemaDescribeStart(&start, &spec);
+    if (spec.Recovery.RestartCount) {
+        start.append(L"\nRecovery: ");
+        SchemaDescribeRecovery(&start, &spec.Recovery);
+    }
+    return OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Service '%ls' installed successfully\nStart: %ls", serviceName,
+        start.c_str());
 }
 
 BOOL UninstallService(LPCWSTR serviceName) {
-    SC_HANDLE scManager = NULL;
-    SC_HANDLE service = NULL;
-    BOOL success = FALSE;
-    
-    scManager = OpenSCManagerW(NULL, NULL, SC_MANAGER_CONNECT);
-    if (!scManager) {
-        wprintf(L"OpenSCManager failed: %d\n", GetLastError());
-        return FALSE;
-    }
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"uninstall", serviceName);
     
-    service = OpenServiceW(scManager, serviceName, SERVICE_STOP | DELETE);
-    if (!service) {
-        DWORD err = GetLastError();
-        if (err == ERROR_SERVICE_DOES_NOT_EXIST) {
-            wprintf(L"Service '%s' does not exist\n", serviceName);
-        } else {
-            wprintf(L"OpenService failed: %d\n", err);
-        }
-        goto cleanup;
+    // Stops the service first
+    SERVICE_RESULT result = InstallerManager()->Uninstall(serviceName).get();
+    InstallerStates(&record, &result);
+    if (result.FailedStep == SERVICE_STEP_OPEN && result.Error == ERROR_SERVICE_DOES_NOT_EXIST) {
+        return OutputFinish(&record, FALSE, result.Error, L"Service '%ls' does not exist", serviceName);
     }
+    if (result.FailedStep) return InstallerFailed(&record, &result);
     
-    // Try to stop service first
-    SERVICE_STATUS status;
-    if (QueryServiceStatus(service, &status)) {
-        if (status.dwCurrentState != SERVICE_STOPPED) {
-            wprintf(L"Stopping service '%s'...\n", serviceName);
-            if (ControlService(service, SERVICE_CONTROL_STOP, &status)) {
-                Sleep(1000);
-            }
-        }
-    }
-    
-    // Delete service
-    if (!DeleteService(service)) {
-        wprintf(L"DeleteService failed: %d\n", GetLastError());
-        goto cleanup;
-    }
-    
-    wprintf(L"Service '%s' uninstalled successfully\n", serviceName);
-    success = TRUE;
-    
-cleanup:
-    if (service) CloseServiceHandle(service);
-    if (scManager) CloseServiceHandle(scManager);
-    return success;
+    return OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Service '%ls' uninstalled successfully", serviceName);
 }
 
-BOOL StartServiceByName(LPCWSTR serviceName) {
-    SC_HANDLE scManager = NULL;
-    SC_HANDLE service = NULL;
-    BOOL success = FALSE;
-    
-    scManager = OpenSCManagerW(NULL, NULL, SC_MANAGER_CONNECT);
-    if (!scManager) {
-        wprintf(L"OpenSCManager failed: %d\n", GetLastError());
-        return FALSE;
-    }
-    
-    service = OpenServiceW(scManager, serviceName, SERVICE_START | SERVICE_QUERY_STATUS);
-    if (!service) {
-        wprintf(L"OpenService failed: %d\n", GetLastError());
-        goto cleanup;
-    }
-    
-    SERVICE_STATUS status;
-    if (QueryServiceStatus(service, &status)) {
-        if (status.dwCurrentState == SERVICE_RUNNING) {
-            wprintf(L"Service '%s' is already running\n", serviceName);
-            success = TRUE;
-            goto cleanup;
-        }
-    }
-    
-    wprintf(L"Starting service '%s'...\n", serviceName);
-    if (!StartServiceW(service, 0, NULL)) {
-        wprintf(L"StartService failed: %d\n", GetLastError());
-        goto cleanup;
-    }
-    
-    // Wait for service to start
-    Sleep(1000);
-    if (QueryServiceStatus(service, &status)) {
-        if (status.dwCurrentState == SERVICE_RUNNING) {
-            wprintf(L"Service '%s' started successfully\n", serviceName);
-            success = TRUE;
-        } else {
-            wprintf(L"Service state: %d\n", status.dwCurrentState);
-        }
-    }
-    
-cleanup:
-    if (service) CloseServiceHandle(service);
-    if (scManager) CloseServiceHandle(scManager);
-    return success;
+// A readiness probe that failed: it timed out, or the service stopped first
+static BOOL InstallerNotReady(OUTPUT_RECORD* record, LPCWSTR serviceName, const SERVICE_RESULT* result,
+    const SERVICE_PROBE* ready) {
+    if (result->Error == ERROR_TIMEOUT) {
+        return OutputFinish(record, FALSE, result->Error, L"Service '%ls' is running but not ready: %ls not ready "
+            L"within %u ms", serviceName, ready->Text, ready->TimeoutMs ? ready->TimeoutMs : g_ServiceWaitTimeout);
+    }
+    return OutputFinish(record, FALSE, result->Error, L"Service '%ls' stopped before it was ready: state %d (error %d)",
+        serviceName, result->State, result->Error);
+}
+
+BOOL StartServiceByName(LPCWSTR serviceName, const SERVICE_PROBE* ready) {
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"start", serviceName);
+    
+    SERVICE_RESULT result = InstallerManager()->Start(serviceName, ready).get();
+    InstallerStates(&record, &result);
+    if (result.FailedStep == SERVICE_STEP_WAIT_READY) return InstallerNotReady(&record, serviceName, &result, ready);
+    if (result.FailedStep) return InstallerFailed(&record, &result);
+    if (!result.Changed) {
+        return OutputFinish(&record, TRUE, ERROR_SUCCESS, ready ? L"Service '%ls' is already running and ready" :
+            L"Service '%ls' is already running", serviceName);
+    }
+    if (ready) {
+        record.ReadyUs = result.ReadyUs;
+        return OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Service '%ls' started successfully, ready %.1f ms after "
+            L"running", serviceName, result.ReadyUs / 1000.0);
+    }
+    return OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Service '%ls' started successfully", serviceName);
 }
 
 BOOL StopServiceByName(LPCWSTR serviceName) {
-    SC_HANDLE scManager = NULL;
-    SC_HANDLE service = NULL;
-    BOOL success = FALSE;
-    
-    scManager = OpenSCManagerW(NULL, NULL, SC_MANAGER_CONNECT);
-    if (!scManager) {
-        wprintf(L"OpenSCManager failed: %d\n", GetLastError());
-        return FALSE;
-    }
-    
-    service = OpenServiceW(scManager, serviceName, SERVICE_STOP | SERVICE_QUERY_STATUS);
-    if (!service) {
-        wprintf(L"OpenService failed: %d\n", GetLastError());
-        goto cleanup;
-    }
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"stop", serviceName);
     
-    SERVICE_STATUS status;
-    if (QueryServiceStatus(service, &status)) {
-        if (status.dwCurrentState == SERVICE_STOPPED) {
-            wprintf(L"Service '%s' is already stopped\n", serviceName);
-            success = TRUE;
-            goto cleanup;
-        }
+    SERVICE_RESULT result = InstallerManager()->Stop(serviceName).get();
+    InstallerStates(&record, &result);
+    if (result.FailedStep) return InstallerFailed(&record, &result);
+    if (!result.Changed) {
+        return OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Service '%ls' is already stopped", serviceName);
     }
-    
-    wprintf(L"Stopping service '%s'...\n", serviceName);
-    if (!ControlService(service, SERVICE_CONTROL_STOP, &status)) {
-        wprintf(L"ControlService failed: %d\n", GetLastError());
-        goto cleanup;
-    }
-    
-    // Wait for service to stop
-    Sleep(1000);
-    if (QueryServiceStatus(service, &status)) {
-        if (status.dwCurrentState == SERVICE_STOPPED) {
-            wprintf(L"Service '%s' stopped successfully\n", serviceName);
-            success = TRUE;
+    return OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Service '%ls' stopped successfully", serviceName);
+}
+
+// Start the dependencies of a service that are not running, through the
+// dependency graph like the start command. Done before the stop, so their
+// start time is not part of the restart's downtime and a dependency that
+// fails leaves the service running. FALSE when a dependency did not start.
+static BOOL InstallerStartDependencies(LPCWSTR serviceName) {
+    SCM_SESSION* session = ScmDefaultSession();
+    if (!ScmSessionManager(session, SC_MANAGER_CONNECT)) return TRUE;
+    SVC_HANDLE service = ScmSessionOpenService(session, serviceName,
+        SERVICE_QUERY_CONFIG | SERVICE_QUERY_STATUS | SERVICE_STOP | SERVICE_START);
+    if (!service) return TRUE;  // The restart reports it
+    
+    std::vector<std::wstring> stopped;
+    {
+        ScopedScratch scratch(session);
+        LPQUERY_SERVICE_CONFIGW config = ScratchQueryConfig(service, scratch.Buffer);
+        for (LPCWSTR name = config ? config->lpDependencies : NULL; name && *name; name += wcslen(name) + 1) {
+            if (*name == SC_GROUP_IDENTIFIERW) continue;
+            SVC_HANDLE dependency = ScmSessionOpenService(session, name, SERVICE_QUERY_STATUS);
+            SERVICE_STATUS status;
+            if (!dependency || !g_Backend->QueryStatus(dependency, &status) || status.dwCurrentState != SERVICE_RUNNING) {
+                stopped.push_back(name);
+            }
         }
     }
-    
-cleanup:
-    if (service) CloseServiceHandle(service);
-    if (scManager) CloseServiceHandle(scManager);
-    return success;
+    return stopped.empty() || ControlServiceGraph(NULL, stopped, TRUE, 0) == 0;
+}
+
+// Reports the unavailability window, from the stop request until RUNNING
+// is observed again
+BOOL RestartServiceByName(LPCWSTR serviceName, const SERVICE_PROBE* ready) {
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"restart", serviceName);
+    if (!InstallerStartDependencies(serviceName)) {
+        return OutputFinish(&record, FALSE, ERROR_SERVICE_DEPENDENCY_FAIL, L"A dependency of '%ls' did not start; "
+            L"service not restarted", serviceName);
+    }
+    
+    SERVICE_RESULT result = InstallerManager()->Restart(serviceName, ready).get();
+    InstallerStates(&record, &result);
+    if (result.FailedStep == SERVICE_STEP_WAIT_STOPPED) {
+        return OutputFinish(&record, FALSE, result.Error, L"Service did not stop: state %d (error %d)", result.State,
+            result.Error);
+    }
+    if (result.FailedStep == SERVICE_STEP_START) {
+        return OutputFinish(&record, FALSE, result.Error, L"StartService failed: %d (service left stopped)", result.Error);
+    }
+    if (result.FailedStep == SERVICE_STEP_WAIT_READY) return InstallerNotReady(&record, serviceName, &result, ready);
+    if (result.FailedStep) return InstallerFailed(&record, &result);
+    
+    // With a probe the service is unavailable until it is ready
+    record.DowntimeUs = result.StopUs + result.StartUs + result.ReadyUs;
+    record.StopUs = result.StopUs;
+    record.StartUs = result.StartUs;
+    record.ReadyUs = result.ReadyUs;
+    if (ready) {
+        return OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Service '%ls' restarted: unavailable %.1f ms "
+            L"(stop %.1f ms, start %.1f ms, ready %.1f ms)", serviceName, record.DowntimeUs / 1000.0,
+            record.StopUs / 1000.0, record.StartUs / 1000.0, record.ReadyUs / 1000.0);
+    }
+    return OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Service '%ls' restarted: unavailable %.1f ms "
+        L"(stop %.1f ms, start %.1f ms)", serviceName, record.DowntimeUs / 1000.0, record.StopUs / 1000.0,
+        record.StartUs / 1000.0);
 }
 
 BOOL GetServiceStatusByName(LPCWSTR serviceName) {
-    SC_HANDLE scManager = NULL;
-    SC_HANDLE service = NULL;
-    BOOL found = FALSE;
+    SCM_SESSION* session = ScmDefaultSession();
+    SVC_HANDLE service = NULL;
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"status", serviceName);
     
-    scManager = OpenSCManagerW(NULL, NULL, SC_MANAGER_CONNECT);
-    if (!scManager) {
-        wprintf(L"OpenSCManager failed: %d\n", GetLastError());
-        return FALSE;
+    if (!ScmSessionManager(session, SC_MANAGER_CONNECT)) {
+        DWORD err = GetLastError();
+        return OutputFinish(&record, FALSE, err, L"OpenSCManager failed: %d", err);
     }
     
-    service = OpenServiceW(scManager, serviceName, SERVICE_QUERY_STATUS | SERVICE_QUERY_CONFIG);
+    service = ScmSessionOpenService(session, serviceName, SERVICE_QUERY_STATUS | SERVICE_QUERY_CONFIG);
     if (!service) {
-        wprintf(L"Service '%s' does not exist: %d\n", serviceName, GetLastError());
-        goto cleanup;
+        DWORD err = GetLastError();
+        return OutputFinish(&record, FALSE, err, L"Service '%ls' does not exist: %d", serviceName, err);
     }
     
     SERVICE_STATUS status;
-    if (QueryServiceStatus(service, &status)) {
-        wprintf(L"Service Name: %s\n", serviceName);
-        wprintf(L"Status: ");
-        switch (status.dwCurrentState) {
-            case SERVICE_STOPPED: wprintf(L"Stopped\n"); break;
-            case SERVICE_START_PENDING: wprintf(L"Start Pending\n"); break;
-            case SERVICE_STOP_PENDING: wprintf(L"Stop Pending\n"); break;
-            case SERVICE_RUNNING: wprintf(L"Running\n"); break;
-            case SERVICE_CONTINUE_PENDING: wprintf(L"Continue Pending\n"); break;
-            case SERVICE_PAUSE_PENDING: wprintf(L"Pause Pending\n"); break;
-            case SERVICE_PAUSED: wprintf(L"Paused\n"); break;
-            default: wprintf(L"Unknown (%d)\n", status.dwCurrentState);
-        }
-        
-        // Get start type
-        DWORD bytesNeeded = 0;
-        QueryServiceConfigW(service, NULL, 0, &bytesNeeded);
-        if (bytesNeeded > 0) {
-            LPQUERY_SERVICE_CONFIGW config = (LPQUERY_SERVICE_CONFIGW)malloc(bytesNeeded);
-            if (config && QueryServiceConfigW(service, config, bytesNeeded, &bytesNeeded)) {
-                wprintf(L"Start Type: ");
-                switch (config->dwStartType) {
-                    case SERVICE_AUTO_START: wprintf(L"Automatic\n"); break;
-                    case SERVICE_BOOT_START: wprintf(L"Boot\n"); break;
-                    case SERVICE_DEMAND_START: wprintf(L"Manual\n"); break;
-                    case SERVICE_DISABLED: wprintf(L"Disabled\n"); break;
-                    case SERVICE_SYSTEM_START: wprintf(L"System\n"); break;
-                    default: wprintf(L"Unknown\n");
-                }
-            }
-            if (config) free(config);
-        }
-        
-        found = TRUE;
+    if (!g_Backend->QueryStatus(service, &status)) {
+        DWORD err = GetLastError();
+        return OutputFinish(&record, FALSE, err, L"QueryServiceStatus failed: %d", err);
+    }
+    record.State = status.dwCurrentState;
+    
+    // Config fields shown by status come from the schema (session scratch
+    // buffer: no sizing probe, no heap churn)
+    ScopedScratch scratch(session);
+    LPQUERY_SERVICE_CONFIGW config = ScratchQueryConfig(service, scratch.Buffer);
+    if (!config) {
+        return OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Service Name: %ls\nStatus: %ls",
+            serviceName, ServiceStateName(status.dwCurrentState));
     }
     
-cleanup:
-    if (service) CloseServiceHandle(service);
-    if (scManager) CloseServiceHandle(scManager);
-    return found;
+    std::wstring details;
+    SchemaDescribeConfig(&details, config, SCHEMA_STATUS);
+    record.StartType = config->dwStartType;
+    record.DisplayName = config->lpDisplayName;
+    return OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Service Name: %ls\nStatus: %ls%ls",
+        serviceName, ServiceStateName(status.dwCurrentState), details.c_str());
 }
@@ -1,13 +1,27 @@
 #ifndef SERVICE_INSTALLER_H
 #define SERVICE_INSTALLER_H
 
-#include <windows.h>
+#include "service_backend.h"
+#include "service_probe.h"
 
-// Service management functions
-BOOL InstallService(LPCWSTR exePath, LPCWSTR serviceName, LPCWSTR displayName, LPCWSTR description);
+// Boot-time start and recovery behaviour chosen at install (install --start /
+// --trigger / --depends / --restart)
+typedef struct _SERVICE_BOOT_OPTIONS {
+    DWORD StartType;                // SERVICE_AUTO_START, SERVICE_DEMAND_START, ...
+    BOOL DelayedAutoStart;          // Automatic start after the boot-critical services
+    SERVICE_START_TRIGGER Trigger;  // Type 0 = no trigger
+    LPCWSTR Dependencies;           // Services started first, double-null-terminated (NULL = none)
+    SERVICE_RECOVERY Recovery;      // RestartCount 0 = stays down after a failure
+} SERVICE_BOOT_OPTIONS;
+
+// Service management functions. 'boot' may be NULL: automatic start.
+BOOL InstallService(LPCWSTR exePath, LPCWSTR serviceName, LPCWSTR displayName, LPCWSTR description,
+    const SERVICE_BOOT_OPTIONS* boot);
 BOOL UninstallService(LPCWSTR serviceName);
-BOOL StartServiceByName(LPCWSTR serviceName);
+// 'ready' (may be NULL): the start completes only once the probe passes
+BOOL StartServiceByName(LPCWSTR serviceName, const SERVICE_PROBE* ready = NULL);
 BOOL StopServiceByName(LPCWSTR serviceName);
+BOOL RestartServiceByName(LPCWSTR serviceName, const SERVICE_PROBE* ready = NULL);
 BOOL GetServiceStatusByName(LPCWSTR serviceName);
 
 #endif // SERVICE_INSTALLER_H
@@ -0,0 +1,425 @@
+#include "service_manager.h"
+#include "service_wait.h"
+#include "service_probe.h"
+#include "metrics.h"
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+
+LPCWSTR ServiceStepName(SERVICE_STEP step) {
+    static const LPCWSTR names[] = { L"", L"OpenSCManager", L"OpenService", L"CreateService", L"DeleteService",
+        L"StartService", L"ControlService", L"QueryServiceStatus", L"WaitForRunning", L"WaitForStopped", L"WaitForReady" };
+    return (DWORD)step < sizeof(names) / sizeof(names[0]) ? names[step] : L"";
+}
+
+// ElapsedUs holds the start time until OpFinish
+static void OpResultInit(SERVICE_RESULT* result) {
+    memset(result, 0, sizeof(*result));
+    result->Changed = TRUE;
+    result->ElapsedUs = MetricsNow();
+}
+
+// Record the failed step with the thread's last error and return FALSE
+static BOOL OpFail(SERVICE_RESULT* result, SERVICE_STEP step) {
+    result->Error = GetLastError();
+    result->FailedStep = step;
+    return FALSE;
+}
+
+static void OpEvent(const SERVICE_OP_CONTEXT* op, LPCWSTR serviceName, SERVICE_EVENT event, DWORD error) {
+    if (op->OnEvent) op->OnEvent(op->EventContext, serviceName, event, error);
+}
+
+// Stop request and wait; *status holds the state the service was found in
+static BOOL OpStopAndWait(const SERVICE_OP_CONTEXT* op, SVC_HANDLE service, LPCWSTR serviceName, SERVICE_STATUS* status,
+    SERVICE_RESULT* result) {
+    ULONGLONG begin = MetricsNow();
+    if (status->dwCurrentState != SERVICE_STOP_PENDING) {
+        OpEvent(op, serviceName, SERVICE_EVENT_STOPPING, ERROR_SUCCESS);
+        if (!g_Backend->Control(service, SERVICE_CONTROL_STOP, status)) return OpFail(result, SERVICE_STEP_CONTROL);
+    }
+    BOOL stopped = WaitForServiceState(service, SERVICE_STOP_PENDING, SERVICE_STOPPED, op->TimeoutMs, status);
+    result->State = status->dwCurrentState;
+    if (!stopped) return OpFail(result, SERVICE_STEP_WAIT_STOPPED);
+    result->StopUs = MetricsNow() - begin;
+    return TRUE;
+}
+
+static BOOL OpStartAndWait(const SERVICE_OP_CONTEXT* op, SVC_HANDLE service, LPCWSTR serviceName, SERVICE_STATUS* status,
+    SERVICE_RESULT* result) {
+    ULONGLONG begin = MetricsNow();
+    OpEvent(op, serviceName, SERVICE_EVENT_STARTING, ERROR_SUCCESS);
+    if (!g_Backend->Start(service)) return OpFail(result, SERVICE_STEP_START);
+    
+    BOOL started = WaitForServiceState(service, SERVICE_START_PENDING, SERVICE_RUNNING, op->TimeoutMs, status);
+    result->State = status->dwCurrentState;
+    if (!started) return OpFail(result, SERVICE_STEP_WAIT_RUNNING);
+    result->StartUs = MetricsNow() - begin;
+    return TRUE;
+}
+
+// Readiness probe of a running service, within the probe's own deadline or
+// else the transition deadline
+static BOOL OpWaitReady(const SERVICE_OP_CONTEXT* op, SVC_HANDLE service, SERVICE_STATUS* status, SERVICE_RESULT* result) {
+    if (!op->Ready) return TRUE;
+    ULONGLONG begin = MetricsNow();
+    BOOL ready = WaitForServiceReady(service, op->Ready, op->Ready->TimeoutMs ? op->Ready->TimeoutMs : op->TimeoutMs,
+        status);
+    result->State = status->dwCurrentState;
+    if (!ready) return OpFail(result, SERVICE_STEP_WAIT_READY);
+    result->ReadyUs = MetricsNow() - begin;
+    return TRUE;
+}
+
+// Manager and service handle from the session, FailedStep set on error
+static SVC_HANDLE OpOpen(const SERVICE_OP_CONTEXT* op, LPCWSTR serviceName, DWORD managerAccess, DWORD access,
+    SERVICE_RESULT* result) {
+    if (!ScmSessionManager(op->Session, managerAccess)) {
+        OpFail(result, SERVICE_STEP_MANAGER);
+        return NULL;
+    }
+    SVC_HANDLE service = ScmSessionOpenService(op->Session, serviceName, access);
+    if (!service) OpFail(result, SERVICE_STEP_OPEN);
+    return service;
+}
+
+static void OpFinish(SERVICE_RESULT* result) {
+    result->ElapsedUs = MetricsNow() - result->ElapsedUs;
+}
+
+VOID ServiceOpInstall(const SERVICE_OP_CONTEXT* op, const SERVICE_INSTALL_SPEC* spec, LPCWSTR description,
+    SERVICE_RESULT* result) {
+    OpResultInit(result);
+    if (!ScmSessionManager(op->Session, SC_MANAGER_CREATE_SERVICE)) {
+        OpFail(result, SERVICE_STEP_MANAGER);
+    } else {
+        SVC_HANDLE service = ScmSessionCreateService(op->Session, spec);
+        if (!service) {
+            OpFail(result, SERVICE_STEP_CREATE);
+        } else {
+            if (description && description[0] && !g_Backend->SetDescription(service, description)) {
+                OpEvent(op, spec->ServiceName, SERVICE_EVENT_DESCRIPTION_FAILED, GetLastError());
+            }
+            result->State = SERVICE_STOPPED;
+            result->StartType = spec->StartType;
+        }
+    }
+    OpFinish(result);
+}
+
+VOID ServiceOpUninstall(const SERVICE_OP_CONTEXT* op, LPCWSTR serviceName, SERVICE_RESULT* result) {
+    OpResultInit(result);
+    if (!ScmSessionManager(op->Session, SC_MANAGER_CONNECT)) {
+        OpFail(result, SERVICE_STEP_MANAGER);
+        OpFinish(result);
+        return;
+    }
+    
+    // One handle for stop and delete; a backend that opens the registry key
+    // for DELETE can still delete a service the SCM cannot open yet
+    SVC_HANDLE service = ScmSessionOpenService(op->Session, serviceName, SERVICE_STOP | SERVICE_QUERY_STATUS | DELETE);
+    SERVICE_STATUS status;
+    if (service && g_Backend->QueryStatus(service, &status)) {
+        result->PreviousState = status.dwCurrentState;
+        result->State = status.dwCurrentState;
+        if (status.dwCurrentState != SERVICE_STOPPED && !OpStopAndWait(op, service, serviceName, &status, result)) {
+            OpEvent(op, serviceName, SERVICE_EVENT_STOP_FAILED, result->Error);
+            result->Error = ERROR_SUCCESS;
+            result->FailedStep = SERVICE_STEP_NONE;
+        }
+    }
+    if (!service) service = ScmSessionOpenService(op->Session, serviceName, DELETE);
+    
+    if (!service) {
+        OpFail(result, SERVICE_STEP_OPEN);
+    } else if (!g_Backend->Delete(service)) {
+        OpFail(result, SERVICE_STEP_DELETE);
+    } else {
+        // Release the handle so the SCM can remove the service
+        ScmSessionForget(op->Session, serviceName);
+    }
+    OpFinish(result);
+}
+
+VOID ServiceOpStart(const SERVICE_OP_CONTEXT* op, LPCWSTR serviceName, SERVICE_RESULT* result) {
+    OpResultInit(result);
+    SVC_HANDLE service = OpOpen(op, serviceName, SC_MANAGER_CONNECT, SERVICE_START | SERVICE_QUERY_STATUS, result);
+    SERVICE_STATUS status;
+    if (service) {
+        if (g_Backend->QueryStatus(service, &status)) {
+            result->PreviousState = status.dwCurrentState;
+            result->State = status.dwCurrentState;
+        }
+        if (result->State == SERVICE_RUNNING) {
+            result->Changed = FALSE;
+            OpWaitReady(op, service, &status, result);
+        } else if (OpStartAndWait(op, service, serviceName, &status, result)) {
+            OpWaitReady(op, service, &status, result);
+        }
+    }
+    OpFinish(result);
+}
+
+VOID ServiceOpStop(const SERVICE_OP_CONTEXT* op, LPCWSTR serviceName, SERVICE_RESULT* result) {
+    OpResultInit(result);
+    SVC_HANDLE service = OpOpen(op, serviceName, SC_MANAGER_CONNECT, SERVICE_STOP | SERVICE_QUERY_STATUS, result);
+    SERVICE_STATUS status;
+    if (service) {
+        status.dwCurrentState = 0;
+        if (g_Backend->QueryStatus(service, &status)) {
+            result->PreviousState = status.dwCurrentState;
+            result->State = status.dwCurrentState;
+        }
+        if (result->State == SERVICE_STOPPED) {
+            result->Changed = FALSE;
+        } else {
+            OpStopAndWait(op, service, serviceName, &status, result);
+        }
+    }
+    OpFinish(result);
+}
+
+VOID ServiceOpRestart(const SERVICE_OP_CONTEXT* op, LPCWSTR serviceName, SERVICE_RESULT* result) {
+    OpResultInit(result);
+    SVC_HANDLE service = OpOpen(op, serviceName, SC_MANAGER_CONNECT,
+        SERVICE_STOP | SERVICE_START | SERVICE_QUERY_STATUS, result);
+    SERVICE_STATUS status;
+    if (service) {
+        if (!g_Backend->QueryStatus(service, &status)) {
+            OpFail(result, SERVICE_STEP_QUERY);
+        } else {
+            result->PreviousState = status.dwCurrentState;
+            if ((status.dwCurrentState == SERVICE_STOPPED || OpStopAndWait(op, service, serviceName, &status, result)) &&
+                OpStartAndWait(op, service, serviceName, &status, result)) {
+                OpWaitReady(op, service, &status, result);
+            }
+        }
+    }
+    OpFinish(result);
+}
+
+VOID ServiceOpQuery(const SERVICE_OP_CONTEXT* op, LPCWSTR serviceName, SERVICE_RESULT* result) {
+    OpResultInit(result);
+    result->Changed = FALSE;
+    SVC_HANDLE service = OpOpen(op, serviceName, SC_MANAGER_CONNECT, SERVICE_QUERY_STATUS | SERVICE_QUERY_CONFIG,
+        result);
+    SERVICE_STATUS status;
+    if (service) {
+        if (!g_Backend->QueryStatus(service, &status)) {
+            OpFail(result, SERVICE_STEP_QUERY);
+        } else {
+            result->State = status.dwCurrentState;
+            ScopedScratch scratch(op->Session);
+            LPQUERY_SERVICE_CONFIGW config = ScratchQueryConfig(service, scratch.Buffer);
+            if (config) result->StartType = config->dwStartType;
+        }
+    }
+    OpFinish(result);
+}
+
+// Queued operation. The strings are owned copies: the caller's arguments
+// may be gone by the time a worker runs it.
+typedef enum _SERVICE_JOB_KIND {
+    JOB_INSTALL,
+    JOB_UNINSTALL,
+    JOB_START,
+    JOB_STOP,
+    JOB_RESTART,
+    JOB_QUERY
+} SERVICE_JOB_KIND;
+
+struct ServiceManager::Job {
+    SERVICE_JOB_KIND Kind;
+    std::wstring Name;
+    std::wstring Key;               // Lower-case Name, its binding
+    std::wstring DisplayName;
+    std::wstring ImagePath;
+    std::wstring Description;
+    std::wstring Dependencies;      // Double-null-terminated list, kept with its inner nulls
+    SERVICE_INSTALL_SPEC Spec;
+    SERVICE_PROBE Ready;            // Type SERVICE_PROBE_NONE = no probe
+    std::promise<SERVICE_RESULT> Promise;
+};
+
+// Length of a double-null-terminated list, excluding the final null
+static size_t ManagerMultiStringLength(LPCWSTR list) {
+    size_t length = 0;
+    while (list[length]) {
+        length += wcslen(list + length) + 1;
+    }
+    return length;
+}
+
+ServiceManager::ServiceManager(DWORD workers, DWORD timeoutMs) {
+    Op.Session = ScmSessionCreate();
+    Op.TimeoutMs = timeoutMs;
+    Op.Ready = NULL;
+    Op.OnEvent = NULL;
+    Op.EventContext = NULL;
+    OwnsSession = true;
+    StartWorkers(workers);
+}
+
+ServiceManager::ServiceManager(DWORD workers, const SERVICE_OP_CONTEXT& op) {
+    Op = op;
+    Op.Ready = NULL;
+    OwnsSession = false;
+    StartWorkers(workers);
+}
+
+void ServiceManager::StartWorkers(DWORD workers) {
+    if (workers == 0) workers = 1;
+    for (DWORD i = 0; i < workers; i++) {
+        Worker* worker = new Worker();
+        worker->Depth = 0;
+        worker->Closing = false;
+        worker->Thread = std::thread(WorkerLoop, this, worker);
+        Workers.push_back(worker);
+    }
+}
+
+ServiceManager::~ServiceManager() {
+    for (size_t i = 0; i < Workers.size(); i++) {
+        std::lock_guard<std::mutex> lock(Workers[i]->Lock);
+        Workers[i]->Closing = true;
+        Workers[i]->Ready.notify_one();
+    }
+    for (size_t i = 0; i < Workers.size(); i++) {
+        Workers[i]->Thread.join();
+        delete Workers[i];
+    }
+    if (OwnsSession) ScmSessionDestroy(Op.Session);
+}
+
+// Runs queued jobs until the manager closes and the queue is drained
+void ServiceManager::WorkerLoop(ServiceManager* manager, Worker* worker) {
+    for (;;) {
+        Job* job;
+        {
+            std::unique_lock<std::mutex> lock(worker->Lock);
+            while (worker->Queue.empty() && !worker->Closing) {
+                worker->Ready.wait(lock);
+            }
+            if (worker->Queue.empty()) return;
+            job = worker->Queue.front();
+            worker->Queue.pop_front();
+        }
+        
+        SERVICE_RESULT result;
+        LPCWSTR name = job->Name.c_str();
+        SERVICE_OP_CONTEXT op = manager->Op;
+        if (job->Ready.Type != SERVICE_PROBE_NONE) op.Ready = &job->Ready;
+        {
+            // Keeps the handles this job was handed open while it runs
+            ScopedSessionUse use(op.Session);
+            switch (job->Kind) {
+                case JOB_INSTALL:
+                    ServiceOpInstall(&op, &job->Spec, job->Description.empty() ? NULL : job->Description.c_str(),
+                        &result);
+                    break;
+                case JOB_UNINSTALL: ServiceOpUninstall(&op, name, &result); break;
+                case JOB_START: ServiceOpStart(&op, name, &result); break;
+                case JOB_STOP: ServiceOpStop(&op, name, &result); break;
+                case JOB_RESTART: ServiceOpRestart(&op, name, &result); break;
+                default: ServiceOpQuery(&op, name, &result); break;
+            }
+        }
+        // Released first, so a caller woken by the result sees the queue
+        // depth without this job
+        manager->Unbind(job->Key);
+        job->Promise.set_value(result);
+        delete job;
+    }
+}
+
+// Worker for one more job of a service: the one its earlier jobs still
+// wait or run on, else the worker with the shortest queue
+ServiceManager::Worker* ServiceManager::Bind(const std::wstring& key) {
+    std::lock_guard<std::mutex> lock(BindLock);
+    std::map<std::wstring, Binding>::iterator it = Bindings.find(key);
+    if (it == Bindings.end()) {
+        Worker* worker = Workers[0];
+        for (size_t i = 1; i < Workers.size(); i++) {
+            if (Workers[i]->Depth < worker->Depth) worker = Workers[i];
+        }
+        Binding binding = { worker, 0 };
+        it = Bindings.insert(std::make_pair(key, binding)).first;
+    }
+    it->second.Pending++;
+    it->second.Owner->Depth++;
+    return it->second.Owner;
+}
+
+// One job of a service completed; the name is forgotten with its last job
+void ServiceManager::Unbind(const std::wstring& key) {
+    std::lock_guard<std::mutex> lock(BindLock);
+    std::map<std::wstring, Binding>::iterator it = Bindings.find(key);
+    it->second.Owner->Depth--;
+    if (--it->second.Pending == 0) Bindings.erase(it);
+}
+
+std::future<SERVICE_RESULT> ServiceManager::Submit(Job* job) {
+    Worker* worker = Bind(job->Key);
+    std::future<SERVICE_RESULT> future = job->Promise.get_future();
+    std::lock_guard<std::mutex> lock(worker->Lock);
+    worker->Queue.push_back(job);
+    worker->Ready.notify_one();
+    return future;
+}
+
+ServiceManager::Job* ServiceManager::NewJob(int kind, LPCWSTR serviceName) {
+    Job* job = new Job();
+    job->Kind = (SERVICE_JOB_KIND)kind;
+    job->Name = serviceName ? serviceName : L"";
+    job->Key = job->Name;
+    for (size_t i = 0; i < job->Key.size(); i++) {
+        job->Key[i] = (wchar_t)towlower((wint_t)job->Key[i]);
+    }
+    job->Ready.Type = SERVICE_PROBE_NONE;
+    return job;
+}
+
+std::future<SERVICE_RESULT> ServiceManager::Install(const SERVICE_INSTALL_SPEC& spec, LPCWSTR description) {
+    Job* job = NewJob(JOB_INSTALL, spec.ServiceName);
+    job->Spec = spec;
+    job->Spec.ServiceName = job->Name.c_str();
+    if (spec.DisplayName) {
+        job->DisplayName = spec.DisplayName;
+        job->Spec.DisplayName = job->DisplayName.c_str();
+    }
+    if (spec.ImagePath) {
+        job->ImagePath = spec.ImagePath;
+        job->Spec.ImagePath = job->ImagePath.c_str();
+    }
+    if (spec.Dependencies) {
+        job->Dependencies.assign(spec.Dependencies, ManagerMultiStringLength(spec.Dependencies));
+        job->Dependencies.push_back(L'\0');
+        job->Spec.Dependencies = job->Dependencies.c_str();
+    }
+    if (description) job->Description = description;
+    return Submit(job);
+}
+
+std::future<SERVICE_RESULT> ServiceManager::Uninstall(LPCWSTR serviceName) {
+    return Submit(NewJob(JOB_UNINSTALL, serviceName));
+}
+
+std::future<SERVICE_RESULT> ServiceManager::Start(LPCWSTR serviceName, const SERVICE_PROBE* ready) {
+    Job* job = NewJob(JOB_START, serviceName);
+    if (ready) job->Ready = *ready;
+    return Submit(job);
+}
+
+std::future<SERVICE_RESULT> ServiceManager::Stop(LPCWSTR serviceName) {
+    return Submit(NewJob(JOB_STOP, serviceName));
+}
+
+std::future<SERVICE_RESULT> ServiceManager::Restart(LPCWSTR serviceName, const SERVICE_PROBE* ready) {
+    Job* job = NewJob(JOB_RESTART, serviceName);
+    if (ready) job->Ready = *ready;
+    return Submit(job);
+}
+
+std::future<SERVICE_RESULT> ServiceManager::Query(LPCWSTR serviceName) {
+    return Submit(NewJob(JOB_QUERY, serviceName));
+}
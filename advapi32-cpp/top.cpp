@@ -0,0 +1,156 @@
+#include "top.h"
+#include "catalog.h"
+#include "metrics.h"
+#include "output.h"
+#include <stdio.h>
+#include <wchar.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#define TOP_NAME_WIDTH  32
+
+// One sample: the matched services and one usage entry per distinct PID
+// (services sharing a process share its entry)
+struct TopSample {
+    std::vector<std::wstring> Names;
+    std::vector<DWORD> States;
+    std::vector<DWORD> Process;    // Index into Usage, OUTPUT_NONE when not running
+    std::vector<SERVICE_PROCESS_USAGE> Usage;
+};
+
+// Resolve the targets against a fresh catalog; the PIDs come from the same
+// enumeration. Targets that match nothing are reported on the first sample.
+static BOOL TopResolve(LPCWSTR* targets, DWORD targetCount, BOOL first, TopSample* sample) {
+    SERVICE_CATALOG catalog;
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"top", NULL);
+    if (!CatalogLoad(ScmDefaultSession(), &catalog)) {
+        DWORD err = GetLastError();
+        return OutputFinish(&record, FALSE, err, L"EnumServicesStatusEx failed: %d", err);
+    }
+    
+    std::vector<DWORD> matches;
+    for (DWORD i = 0; i < targetCount; i++) {
+        if (CatalogMatch(&catalog, targets[i], &matches) == 0 && first) {
+            record.Service = targets[i];
+            OutputFinish(&record, FALSE, ERROR_SERVICE_DOES_NOT_EXIST, L"No services match '%ls'", targets[i]);
+        }
+    }
+    
+    std::vector<bool> seen(catalog.Entries.size(), false);
+    std::map<DWORD, DWORD> processIndex;
+    for (size_t i = 0; i < matches.size(); i++) {
+        if (seen[matches[i]]) continue;
+        seen[matches[i]] = true;
+        
+        const CATALOG_ENTRY* entry = &catalog.Entries[matches[i]];
+        DWORD process = OUTPUT_NONE;
+        if (entry->ProcessId != 0) {
+            std::map<DWORD, DWORD>::iterator it = processIndex.find(entry->ProcessId);
+            if (it == processIndex.end()) {
+                SERVICE_PROCESS_USAGE usage = {};
+                usage.ProcessId = entry->ProcessId;
+                process = (DWORD)sample->Usage.size();
+                processIndex[entry->ProcessId] = process;
+                sample->Usage.push_back(usage);
+            } else {
+                process = it->second;
+            }
+        }
+        sample->Names.push_back(CatalogString(&catalog, entry->Name));
+        sample->States.push_back(entry->CurrentState);
+        sample->Process.push_back(process);
+    }
+    return TRUE;
+}
+
+static void TopFormatBytes(WCHAR* buffer, size_t count, ULONGLONG bytes) {
+    swprintf(buffer, count, L"%.1f MB", bytes / (1024.0 * 1024.0));
+}
+
+// One row per service; 'previous' holds the CPU time of each PID at the
+// last sample, so the rate covers exactly one interval
+static void TopPrint(const TopSample* sample, LPCWSTR time, const std::map<DWORD, ULONGLONG>& previous,
+    ULONGLONG intervalUs) {
+    OutputText(L"%ls  %u service(s)\n", time, (DWORD)sample->Names.size());
+    OutputText(L"%-*ls %-16ls %-8ls %7ls %10ls %12ls %12ls %8ls %8ls\n", TOP_NAME_WIDTH, L"Name", L"State", L"PID",
+        L"CPU %", L"CPU time", L"Working set", L"Private", L"Handles", L"Threads");
+    
+    for (size_t i = 0; i < sample->Names.size(); i++) {
+        OUTPUT_RECORD record;
+        OutputBegin(&record, L"top", sample->Names[i].c_str());
+        record.Time = time;
+        record.State = sample->States[i];
+        
+        const SERVICE_PROCESS_USAGE* usage = NULL;
+        if (sample->Process[i] != OUTPUT_NONE) {
+            usage = &sample->Usage[sample->Process[i]];
+            record.ProcessId = usage->ProcessId;
+        }
+        if (!usage || !usage->Present) {
+            OutputFinish(&record, TRUE, ERROR_SUCCESS, L"%-*ls %-16ls %-8ls %7ls %10ls %12ls %12ls %8ls %8ls",
+                TOP_NAME_WIDTH, record.Service, ServiceStateName(record.State), L"-", L"-", L"-", L"-", L"-", L"-", L"-");
+            continue;
+        }
+        record.Usage = usage;
+        
+        WCHAR cpu[16] = L"-";
+        std::map<DWORD, ULONGLONG>::const_iterator last = previous.find(usage->ProcessId);
+        if (last != previous.end() && usage->CpuTime >= last->second && intervalUs > 0) {
+            record.CpuRate = (DWORD)((usage->CpuTime - last->second) * 100000 / intervalUs);
+            swprintf(cpu, sizeof(cpu) / sizeof(WCHAR), L"%.1f", record.CpuRate / 10000.0);
+        }
+        WCHAR cpuTime[24], workingSet[24], privateBytes[24];
+        swprintf(cpuTime, sizeof(cpuTime) / sizeof(WCHAR), L"%.2f s", usage->CpuTime / 1e7);
+        TopFormatBytes(workingSet, sizeof(workingSet) / sizeof(WCHAR), usage->WorkingSet);
+        TopFormatBytes(privateBytes, sizeof(privateBytes) / sizeof(WCHAR), usage->PrivateBytes);
+        OutputFinish(&record, TRUE, ERROR_SUCCESS, L"%-*ls %-16ls %-8u %7ls %10ls %12ls %12ls %8u %8u", TOP_NAME_WIDTH,
+            record.Service, ServiceStateName(record.State), usage->ProcessId, cpu, cpuTime, workingSet, privateBytes,
+            usage->HandleCount, usage->ThreadCount);
+    }
+    OutputText(L"\n");
+    OutputFlush();
+}
+
+int TopServices(LPCWSTR* targets, DWORD targetCount, DWORD intervalMs, DWORD samples) {
+    if (!g_Backend->QueryProcesses) {
+        OUTPUT_RECORD record;
+        OutputBegin(&record, L"top", NULL);
+        OutputFinish(&record, FALSE, ERROR_NOT_SUPPORTED, L"The %ls backend cannot sample processes", g_Backend->Name);
+        return 1;
+    }
+    
+    std::map<DWORD, ULONGLONG> previous;
+    ULONGLONG previousAt = 0;
+    for (DWORD n = 0; samples == 0 || n < samples; n++) {
+        if (n > 0) Sleep(intervalMs);
+        
+        TopSample sample;
+        if (!TopResolve(targets, targetCount, n == 0, &sample)) return 1;
+        if (n == 0 && sample.Names.empty()) return 1;
+        
+        if (!sample.Usage.empty() && !g_Backend->QueryProcesses(sample.Usage.data(), (DWORD)sample.Usage.size())) {
+            DWORD err = GetLastError();
+            OUTPUT_RECORD record;
+            OutputBegin(&record, L"top", NULL);
+            OutputFinish(&record, FALSE, err, L"Process sampling failed: %d", err);
+            return 1;
+        }
+        ULONGLONG now = MetricsNow();
+        
+        SYSTEMTIME local;
+        WCHAR time[32];
+        GetLocalTime(&local);
+        swprintf(time, sizeof(time) / sizeof(WCHAR), L"%04u-%02u-%02u %02u:%02u:%02u.%03u", local.wYear, local.wMonth,
+            local.wDay, local.wHour, local.wMinute, local.wSecond, local.wMilliseconds);
+        TopPrint(&sample, time, previous, now - previousAt);
+        
+        previous.clear();
+        for (size_t i = 0; i < sample.Usage.size(); i++) {
+            if (sample.Usage[i].Present) previous[sample.Usage[i].ProcessId] = sample.Usage[i].CpuTime;
+        }
+        previousAt = now;
+    }
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include "watch.h"
+#include "catalog.h"
+#include "output.h"
+#include <wchar.h>
+#include <string>
+#include <vector>
+
+#define WATCH_POLL_INTERVAL  250  // Fallback poll period when notifications are unavailable (ms)
+
+// The services being watched; the three vectors stay index-aligned. The
+// handles are opened for the watch itself rather than borrowed from the
+// session, so a command that forgets a service cannot close them.
+struct WatchSet {
+    std::vector<std::wstring> Names;
+    std::vector<SVC_HANDLE> Handles;
+    std::vector<DWORD> Known;
+};
+
+// One record per event, flushed so a pipe sees it immediately. 'previous'
+// is OUTPUT_NONE for the initial state, 'current' OUTPUT_NONE for a
+// deleted service.
+static void WatchPrint(LPCWSTR serviceName, DWORD previous, DWORD current) {
+    SYSTEMTIME now;
+    WCHAR time[32];
+    GetLocalTime(&now);
+    swprintf(time, sizeof(time) / sizeof(WCHAR), L"%04u-%02u-%02u %02u:%02u:%02u.%03u", now.wYear, now.wMonth,
+        now.wDay, now.wHour, now.wMinute, now.wSecond, now.wMilliseconds);
+    
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"watch", serviceName);
+    record.Time = time;
+    record.PreviousState = previous;
+    record.State = current;
+    BOOL deleted = (current == OUTPUT_NONE);
+    OutputFinish(&record, !deleted, ERROR_SERVICE_MARKED_FOR_DELETE, L"%ls  %-32ls %ls -> %ls", time, serviceName,
+        previous == OUTPUT_NONE ? L"-" : ServiceStateName(previous), deleted ? L"Deleted" : ServiceStateName(current));
+    OutputFlush();
+}
+
+// Resolve names and patterns against one catalog snapshot; a service
+// matched by several targets is watched once
+static BOOL WatchResolve(LPCWSTR* targets, DWORD targetCount, std::vector<std::wstring>* names) {
+    SERVICE_CATALOG catalog;
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"watch", NULL);
+    if (!CatalogLoad(ScmDefaultSession(), &catalog)) {
+        DWORD err = GetLastError();
+        return OutputFinish(&record, FALSE, err, L"EnumServicesStatusEx failed: %d", err);
+    }
+    
+    std::vector<DWORD> matches;
+    for (DWORD i = 0; i < targetCount; i++) {
+        if (CatalogMatch(&catalog, targets[i], &matches) == 0) {
+            record.Service = targets[i];
+            OutputFinish(&record, FALSE, ERROR_SERVICE_DOES_NOT_EXIST, L"No services match '%ls'", targets[i]);
+        }
+    }
+    
+    std::vector<bool> seen(catalog.Entries.size(), false);
+    for (size_t i = 0; i < matches.size(); i++) {
+        if (seen[matches[i]]) continue;
+        seen[matches[i]] = true;
+        names->push_back(CatalogString(&catalog, catalog.Entries[matches[i]].Name));
+    }
+    return !names->empty();
+}
+
+static void WatchRemove(WatchSet* set, size_t index) {
+    // Release the handle so the SCM can remove a deleted service
+    g_Backend->Close(set->Handles[index]);
+    set->Names.erase(set->Names.begin() + index);
+    set->Handles.erase(set->Handles.begin() + index);
+    set->Known.erase(set->Known.begin() + index);
+}
+
+// A status-change wait fails for the whole set when any one service is
+// marked for deletion; probe each on its own to find and drop those
+static BOOL WatchDropDeleted(WatchSet* set) {
+    BOOL dropped = FALSE;
+    for (size_t i = set->Handles.size(); i-- > 0; ) {
+        if (g_Backend->WaitStatusChange(&set->Handles[i], &set->Known[i], 1, 0) == WAIT_FAILED &&
+            GetLastError() == ERROR_SERVICE_MARKED_FOR_DELETE) {
+            WatchPrint(set->Names[i].c_str(), set->Known[i], OUTPUT_NONE);
+            WatchRemove(set, i);
+            dropped = TRUE;
+        }
+    }
+    return dropped;
+}
+
+// Re-read one service and report it if its state moved
+static void WatchRefresh(WatchSet* set, size_t index) {
+    SERVICE_STATUS status;
+    if (!g_Backend->QueryStatus(set->Handles[index], &status)) return;
+    if (status.dwCurrentState == set->Known[index]) return;
+    
+    WatchPrint(set->Names[index].c_str(), set->Known[index], status.dwCurrentState);
+    set->Known[index] = status.dwCurrentState;
+}
+
+int WatchServices(LPCWSTR* targets, DWORD targetCount, DWORD durationMs) {
+    std::vector<std::wstring> names;
+    if (!WatchResolve(targets, targetCount, &names)) return 1;
+    
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"watch", NULL);
+    SVC_HANDLE manager = ScmSessionManager(ScmDefaultSession(), SC_MANAGER_CONNECT);
+    if (!manager) {
+        DWORD err = GetLastError();
+        OutputFinish(&record, FALSE, err, L"OpenSCManager failed: %d", err);
+        return 1;
+    }
+    
+    WatchSet set;
+    for (size_t i = 0; i < names.size(); i++) {
+        SVC_HANDLE service = g_Backend->Open(manager, names[i].c_str(), SERVICE_QUERY_STATUS);
+        SERVICE_STATUS status;
+        if (!service || !g_Backend->QueryStatus(service, &status)) {
+            DWORD err = GetLastError();
+            record.Service = names[i].c_str();
+            OutputFinish(&record, FALSE, err, L"Cannot watch '%ls': %d", names[i].c_str(), err);
+            if (service) g_Backend->Close(service);
+            continue;
+        }
+        set.Names.push_back(names[i]);
+        set.Handles.push_back(service);
+        set.Known.push_back(status.dwCurrentState);
+    }
+    if (set.Handles.empty()) return 1;
+    
+    OutputText(L"Watching %u service(s)\n", (DWORD)set.Handles.size());
+    for (size_t i = 0; i < set.Handles.size(); i++) {
+        WatchPrint(set.Names[i].c_str(), OUTPUT_NONE, set.Known[i]);
+    }
+    
+    ULONGLONG start = GetTickCount64();
+    BOOL useNotify = g_Backend->WaitStatusChange != NULL;
+    
+    while (!set.Handles.empty()) {
+        ULONGLONG elapsed = GetTickCount64() - start;
+        if (durationMs != INFINITE && elapsed >= durationMs) break;
+        DWORD remaining = (durationMs == INFINITE) ? INFINITE : (DWORD)(durationMs - elapsed);
+        
+        if (useNotify) {
+            // Sleeps until a service changes: no CPU while nothing happens
+            DWORD changed = g_Backend->WaitStatusChange(set.Handles.data(), set.Known.data(),
+                (DWORD)set.Handles.size(), remaining);
+            if (changed == WAIT_TIMEOUT) continue;
+            if (changed != WAIT_FAILED) {
+                WatchRefresh(&set, changed);
+                continue;
+            }
+            DWORD err = GetLastError();
+            if (err == ERROR_SERVICE_MARKED_FOR_DELETE && WatchDropDeleted(&set)) continue;
+            
+            OutputText(L"Status-change notifications unavailable (%d), polling every %u ms\n", err, WATCH_POLL_INTERVAL);
+            useNotify = FALSE;
+        }
+        
+        Sleep(remaining < WATCH_POLL_INTERVAL ? remaining : WATCH_POLL_INTERVAL);
+        for (size_t i = 0; i < set.Handles.size(); i++) {
+            WatchRefresh(&set, i);
+        }
+    }
+    
+    for (size_t i = 0; i < set.Handles.size(); i++) {
+        g_Backend->Close(set.Handles[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,277 @@
+#ifndef WIN_COMPAT_H
+#define WIN_COMPAT_H
+
+// On Windows this is just <windows.h>. Elsewhere it supplies the subset of
+// Win32 types, constants and helpers the tool needs so that it can be built
+// against the simulated SCM backend (e.g. on Linux CI hosts).
+
+#ifdef _WIN32
+
+// NotifyServiceStatusChange and friends need Vista or later
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0601
+#endif
+
+#include <windows.h>
+
+#else
+
+#include <stdint.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <time.h>
+
+typedef void VOID;
+typedef int BOOL;
+typedef uint8_t BYTE;
+typedef uint16_t USHORT;
+typedef uint32_t DWORD;
+typedef uint32_t ULONG;
+typedef int32_t LONG;
+typedef uint64_t ULONGLONG;
+typedef int64_t LONGLONG;
+typedef wchar_t WCHAR;
+typedef WCHAR* LPWSTR;
+typedef const WCHAR* LPCWSTR;
+typedef void* HANDLE;
+typedef void* LPVOID;
+typedef void* PVOID;
+typedef DWORD* LPDWORD;
+typedef BYTE* LPBYTE;
+
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+#define INFINITE                         0xFFFFFFFF
+#define WAIT_TIMEOUT                     258
+#define WAIT_FAILED                      0xFFFFFFFF
+
+// Win32 error codes
+#define ERROR_SUCCESS                    0
+#define NO_ERROR                         0
+#define ERROR_FILE_NOT_FOUND             2
+#define ERROR_ACCESS_DENIED              5
+#define ERROR_INVALID_HANDLE             6
+#define ERROR_NOT_ENOUGH_MEMORY          8
+#define ERROR_BAD_FORMAT                 11
+#define ERROR_WRITE_FAULT                29
+#define ERROR_GEN_FAILURE                31
+#define ERROR_NOT_SUPPORTED              50
+#define ERROR_INVALID_PARAMETER          87
+#define ERROR_INSUFFICIENT_BUFFER        122
+#define ERROR_INVALID_NAME               123
+#define ERROR_MORE_DATA                  234
+#define ERROR_NO_MORE_ITEMS              259
+#define ERROR_DEPENDENT_SERVICES_RUNNING 1051
+#define ERROR_INVALID_SERVICE_CONTROL    1052
+#define ERROR_SERVICE_REQUEST_TIMEOUT    1053
+#define ERROR_SERVICE_ALREADY_RUNNING    1056
+#define ERROR_SERVICE_DISABLED           1058
+#define ERROR_CIRCULAR_DEPENDENCY        1059
+#define ERROR_SERVICE_DOES_NOT_EXIST     1060
+#define ERROR_SERVICE_CANNOT_ACCEPT_CTRL 1061
+#define ERROR_SERVICE_NOT_ACTIVE         1062
+#define ERROR_SERVICE_SPECIFIC_ERROR     1066
+#define ERROR_SERVICE_DEPENDENCY_FAIL    1068
+#define ERROR_SERVICE_MARKED_FOR_DELETE  1072
+#define ERROR_SERVICE_EXISTS             1073
+#define ERROR_TIMEOUT                    1460
+
+// Generic / SCM access rights
+#define DELETE                           0x00010000
+#define SC_MANAGER_CONNECT               0x0001
+#define SC_MANAGER_CREATE_SERVICE        0x0002
+#define SC_MANAGER_ENUMERATE_SERVICE     0x0004
+#define SC_MANAGER_ALL_ACCESS            0xF003F
+#define SERVICE_QUERY_CONFIG             0x0001
+#define SERVICE_CHANGE_CONFIG            0x0002
+#define SERVICE_QUERY_STATUS             0x0004
+#define SERVICE_ENUMERATE_DEPENDENTS     0x0008
+#define SERVICE_START                    0x0010
+#define SERVICE_STOP                     0x0020
+#define SERVICE_PAUSE_CONTINUE           0x0040
+#define SERVICE_INTERROGATE              0x0080
+#define SERVICE_USER_DEFINED_CONTROL     0x0100
+#define SERVICE_ALL_ACCESS               0xF01FF
+
+// Service types
+#define SERVICE_KERNEL_DRIVER            0x00000001
+#define SERVICE_FILE_SYSTEM_DRIVER       0x00000002
+#define SERVICE_WIN32_OWN_PROCESS        0x00000010
+#define SERVICE_WIN32_SHARE_PROCESS      0x00000020
+#define SERVICE_WIN32                    0x00000030
+#define SERVICE_INTERACTIVE_PROCESS      0x00000100
+
+// Start types
+#define SERVICE_BOOT_START               0x00000000
+#define SERVICE_SYSTEM_START             0x00000001
+#define SERVICE_AUTO_START               0x00000002
+#define SERVICE_DEMAND_START             0x00000003
+#define SERVICE_DISABLED                 0x00000004
+
+// Error control
+#define SERVICE_ERROR_IGNORE             0x00000000
+#define SERVICE_ERROR_NORMAL             0x00000001
+#define SERVICE_ERROR_SEVERE             0x00000002
+#define SERVICE_ERROR_CRITICAL           0x00000003
+
+// Service states
+#define SERVICE_STOPPED                  0x00000001
+#define SERVICE_START_PENDING            0x00000002
+#define SERVICE_STOP_PENDING             0x00000003
+#define SERVICE_RUNNING                  0x00000004
+#define SERVICE_CONTINUE_PENDING         0x00000005
+#define SERVICE_PAUSE_PENDING            0x00000006
+#define SERVICE_PAUSED                   0x00000007
+
+// Enumeration filters
+#define SERVICE_ACTIVE                   0x00000001
+#define SERVICE_INACTIVE                 0x00000002
+#define SERVICE_STATE_ALL                0x00000003
+#define SC_ENUM_PROCESS_INFO             0
+
+// Controls
+#define SERVICE_CONTROL_STOP             0x00000001
+#define SERVICE_CONTROL_PAUSE            0x00000002
+#define SERVICE_CONTROL_CONTINUE         0x00000003
+#define SERVICE_CONTROL_INTERROGATE      0x00000004
+
+// Controls accepted
+#define SERVICE_ACCEPT_STOP              0x00000001
+#define SERVICE_ACCEPT_PAUSE_CONTINUE    0x00000002
+
+#define SERVICE_NO_CHANGE                0xFFFFFFFF
+
+// Prefix of a load-order group in a dependency list
+#define SC_GROUP_IDENTIFIERW             L'+'
+
+// Service start triggers
+#define SERVICE_TRIGGER_TYPE_IP_ADDRESS_AVAILABILITY  2
+#define SERVICE_TRIGGER_TYPE_CUSTOM                   20
+#define SERVICE_TRIGGER_ACTION_SERVICE_START          1
+
+typedef struct _GUID {
+    DWORD Data1;
+    USHORT Data2;
+    USHORT Data3;
+    BYTE Data4[8];
+} GUID;
+
+typedef struct _SERVICE_STATUS {
+    DWORD dwServiceType;
+    DWORD dwCurrentState;
+    DWORD dwControlsAccepted;
+    DWORD dwWin32ExitCode;
+    DWORD dwServiceSpecificExitCode;
+    DWORD dwCheckPoint;
+    DWORD dwWaitHint;
+} SERVICE_STATUS, *LPSERVICE_STATUS;
+
+typedef struct _SERVICE_STATUS_PROCESS {
+    DWORD dwServiceType;
+    DWORD dwCurrentState;
+    DWORD dwControlsAccepted;
+    DWORD dwWin32ExitCode;
+    DWORD dwServiceSpecificExitCode;
+    DWORD dwCheckPoint;
+    DWORD dwWaitHint;
+    DWORD dwProcessId;
+    DWORD dwServiceFlags;
+} SERVICE_STATUS_PROCESS, *LPSERVICE_STATUS_PROCESS;
+
+typedef struct _ENUM_SERVICE_STATUSW {
+    LPWSTR lpServiceName;
+    LPWSTR lpDisplayName;
+    SERVICE_STATUS ServiceStatus;
+} ENUM_SERVICE_STATUSW, *LPENUM_SERVICE_STATUSW;
+
+typedef struct _ENUM_SERVICE_STATUS_PROCESSW {
+    LPWSTR lpServiceName;
+    LPWSTR lpDisplayName;
+    SERVICE_STATUS_PROCESS ServiceStatusProcess;
+} ENUM_SERVICE_STATUS_PROCESSW, *LPENUM_SERVICE_STATUS_PROCESSW;
+
+typedef struct _QUERY_SERVICE_CONFIGW {
+    DWORD dwServiceType;
+    DWORD dwStartType;
+    DWORD dwErrorControl;
+    LPWSTR lpBinaryPathName;
+    LPWSTR lpLoadOrderGroup;
+    DWORD dwTagId;
+    LPWSTR lpDependencies;
+    LPWSTR lpServiceStartName;
+    LPWSTR lpDisplayName;
+} QUERY_SERVICE_CONFIGW, *LPQUERY_SERVICE_CONFIGW;
+
+typedef struct _SYSTEMTIME {
+    uint16_t wYear;
+    uint16_t wMonth;
+    uint16_t wDayOfWeek;
+    uint16_t wDay;
+    uint16_t wHour;
+    uint16_t wMinute;
+    uint16_t wSecond;
+    uint16_t wMilliseconds;
+} SYSTEMTIME, *LPSYSTEMTIME;
+
+// Per-thread last error, mirroring GetLastError/SetLastError
+inline DWORD* CompatLastErrorSlot() {
+    static thread_local DWORD lastError = 0;
+    return &lastError;
+}
+
+inline DWORD GetLastError() {
+    return *CompatLastErrorSlot();
+}
+
+inline void SetLastError(DWORD error) {
+    *CompatLastErrorSlot() = error;
+}
+
+inline void Sleep(DWORD milliseconds) {
+    struct timespec ts;
+    ts.tv_sec = milliseconds / 1000;
+    ts.tv_nsec = (long)(milliseconds % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+inline ULONGLONG GetTickCount64() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000 + (ULONGLONG)ts.tv_nsec / 1000000;
+}
+
+inline void GetLocalTime(LPSYSTEMTIME time) {
+    struct timespec ts;
+    struct tm local;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    localtime_r(&ts.tv_sec, &local);
+    time->wYear = (uint16_t)(local.tm_year + 1900);
+    time->wMonth = (uint16_t)(local.tm_mon + 1);
+    time->wDayOfWeek = (uint16_t)local.tm_wday;
+    time->wDay = (uint16_t)local.tm_mday;
+    time->wHour = (uint16_t)local.tm_hour;
+    time->wMinute = (uint16_t)local.tm_min;
+    time->wSecond = (uint16_t)local.tm_sec;
+    time->wMilliseconds = (uint16_t)(ts.tv_nsec / 1000000);
+}
+
+inline int _wcsnicmp(const wchar_t* a, const wchar_t* b, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        wint_t ca = towlower((wint_t)a[i]);
+        wint_t cb = towlower((wint_t)b[i]);
+        if (ca != cb) return ca < cb ? -1 : 1;
+        if (ca == 0) return 0;
+    }
+    return 0;
+}
+
+inline int _wcsicmp(const wchar_t* a, const wchar_t* b) {
+    return _wcsnicmp(a, b, (size_t)-1);
+}
+
+#endif // _WIN32
+
+#endif // WIN_COMPAT_H
@@ -0,0 +1,331 @@
+#include "batch.h"
+#include "catalog.h"
+#include "commands.h"
+#include "executor.h"
+#include "scm_session.h"
+#include "service_graph.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <map>
+
+static FILE* OpenManifest(LPCWSTR path) {
+#ifdef _WIN32
+    return _wfopen(path, L"rb");
+#else
+    size_t len = wcstombs(NULL, path, 0);
+    if (len == (size_t)-1) return NULL;
+    std::string narrow(len, '\0');
+    wcstombs(&narrow[0], path, len + 1);
+    return fopen(narrow.c_str(), "rb");
+#endif
+}
+
+// Append one code point, as a surrogate pair where wchar_t is 16 bits
+static void AppendCodePoint(std::wstring& text, DWORD cp) {
+    if (sizeof(wchar_t) == 2 && cp > 0xFFFF) {
+        cp -= 0x10000;
+        text += (wchar_t)(0xD800 + (cp >> 10));
+        text += (wchar_t)(0xDC00 + (cp & 0x3FF));
+    } else {
+        text += (wchar_t)cp;
+    }
+}
+
+static void DecodeUtf16Le(const std::string& bytes, size_t pos, std::wstring& text) {
+    for (; pos + 1 < bytes.size(); pos += 2) {
+        DWORD unit = (BYTE)bytes[pos] | ((DWORD)(BYTE)bytes[pos + 1] << 8);
+        if (unit >= 0xD800 && unit <= 0xDBFF && pos + 3 < bytes.size()) {
+            DWORD low = (BYTE)bytes[pos + 2] | ((DWORD)(BYTE)bytes[pos + 3] << 8);
+            if (low >= 0xDC00 && low <= 0xDFFF) {
+                AppendCodePoint(text, 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+                pos += 2;
+                continue;
+            }
+        }
+        AppendCodePoint(text, unit);
+    }
+}
+
+// Lenient UTF-8: malformed sequences become U+FFFD
+static void DecodeUtf8(const std::string& bytes, size_t pos, std::wstring& text) {
+    while (pos < bytes.size()) {
+        BYTE lead = (BYTE)bytes[pos++];
+        DWORD cp;
+        int extra;
+        if (lead < 0x80) { cp = lead; extra = 0; }
+        else if ((lead & 0xE0) == 0xC0) { cp = lead & 0x1F; extra = 1; }
+        else if ((lead & 0xF0) == 0xE0) { cp = lead & 0x0F; extra = 2; }
+        else if ((lead & 0xF8) == 0xF0) { cp = lead & 0x07; extra = 3; }
+        else { AppendCodePoint(text, 0xFFFD); continue; }
+        
+        int i = 0;
+        for (; i < extra && pos < bytes.size() && ((BYTE)bytes[pos] & 0xC0) == 0x80; i++) {
+            cp = (cp << 6) | ((BYTE)bytes[pos++] & 0x3F);
+        }
+        AppendCodePoint(text, (i == extra && cp <= 0x10FFFF) ? cp : 0xFFFD);
+    }
+}
+
+// Split one line into arguments. Double quotes group words ("" is a literal
+// quote inside them); backslashes are kept as-is so Windows paths need no
+// escaping. An unquoted '#' at the start of a word begins a comment.
+static BOOL TokenizeLine(const std::wstring& line, std::vector<std::wstring>* args) {
+    size_t i = 0;
+    while (i < line.size()) {
+        while (i < line.size() && iswspace(line[i])) i++;
+        if (i == line.size() || line[i] == L'#') break;
+        
+        std::wstring arg;
+        BOOL quoted = FALSE;
+        while (i < line.size() && (quoted || !iswspace(line[i]))) {
+            if (line[i] == L'"') {
+                if (quoted && i + 1 < line.size() && line[i + 1] == L'"') {
+                    arg += L'"';
+                    i += 2;
+                    continue;
+                }
+                quoted = !quoted;
+                i++;
+                continue;
+            }
+            arg += line[i++];
+        }
+        if (quoted) return FALSE;
+        args->push_back(arg);
+    }
+    return TRUE;
+}
+
+BOOL LoadBatchManifest(LPCWSTR path, std::vector<BATCH_OP>* ops) {
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"batch", NULL);
+    FILE* file = OpenManifest(path);
+    if (!file) {
+        return OutputFinish(&record, FALSE, ERROR_FILE_NOT_FOUND, L"Failed to open manifest '%ls'", path);
+    }
+    
+    std::string bytes;
+    char chunk[4096];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        bytes.append(chunk, read);
+    }
+    fclose(file);
+    
+    std::wstring text;
+    if (bytes.size() >= 2 && (BYTE)bytes[0] == 0xFF && (BYTE)bytes[1] == 0xFE) {
+        DecodeUtf16Le(bytes, 2, text);
+    } else if (bytes.size() >= 3 && (BYTE)bytes[0] == 0xEF && (BYTE)bytes[1] == 0xBB && (BYTE)bytes[2] == 0xBF) {
+        DecodeUtf8(bytes, 3, text);
+    } else {
+        DecodeUtf8(bytes, 0, text);
+    }
+    
+    DWORD lineNumber = 0;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(L'\n', start);
+        if (end == std::wstring::npos) end = text.size();
+        std::wstring line = text.substr(start, end - start);
+        start = end + 1;
+        lineNumber++;
+        
+        BATCH_OP op;
+        op.Line = lineNumber;
+        if (!TokenizeLine(line, &op.Args)) {
+            return OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER, L"%ls(%u): unterminated quote", path, lineNumber);
+        }
+        if (op.Args.empty()) continue;
+        
+        std::vector<wchar_t*> argv;
+        for (size_t j = 0; j < op.Args.size(); j++) {
+            argv.push_back(&op.Args[j][0]);
+        }
+        SERVICE_COMMAND parsed;
+        if (!ParseServiceCommand((int)argv.size(), argv.data(), &parsed)) {
+            if (!parsed.Error) {
+                return OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER, L"%ls(%u): unknown command '%ls'",
+                    path, lineNumber, op.Args[0].c_str());
+            }
+            return OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER, L"%ls(%u): %ls\nUsage: %ls",
+                path, lineNumber, parsed.Error, parsed.Usage);
+        }
+        op.Target = parsed.ServiceName ? parsed.ServiceName : L"*";
+        for (LPCWSTR name = parsed.Boot.Dependencies; name && *name; name += wcslen(name) + 1) {
+            op.Dependencies.push_back(name);
+        }
+        ops->push_back(op);
+    }
+    
+    return TRUE;
+}
+
+static std::wstring BatchServiceKey(const std::wstring& name) {
+    std::wstring key(name);
+    for (size_t i = 0; i < key.size(); i++) {
+        key[i] = (wchar_t)towlower((wint_t)key[i]);
+    }
+    return key;
+}
+
+// Services an operation acts on. A pattern stands for every service it
+// matches in the catalog and every service the manifest names directly,
+// which covers services installed by an earlier line. A start, stop or
+// restart also reaches the dependency closure of each of its services; an
+// install names the services it will depend on.
+static void BatchOpServices(const std::vector<BATCH_OP>& ops, DWORD index, const SERVICE_CATALOG* catalog,
+    std::vector<std::wstring>* names) {
+    const BATCH_OP& op = ops[index];
+    LPCWSTR target = op.Target.c_str();
+    std::vector<std::wstring> targets;
+    if (!IsServicePattern(target)) {
+        targets.push_back(target);
+    } else {
+        std::vector<DWORD> matches;
+        CatalogMatch(catalog, target, &matches);
+        for (size_t i = 0; i < matches.size(); i++) {
+            targets.push_back(CatalogString(catalog, catalog->Entries[matches[i]].Name));
+        }
+        for (size_t i = 0; i < ops.size(); i++) {
+            LPCWSTR name = ops[i].Target.c_str();
+            if (!IsServicePattern(name) && WildcardMatch(target, name)) targets.push_back(name);
+        }
+    }
+    names->insert(names->end(), op.Dependencies.begin(), op.Dependencies.end());
+    
+    LPCWSTR command = op.Args[0].c_str();
+    if (_wcsicmp(command, L"start") != 0 && _wcsicmp(command, L"stop") != 0 && _wcsicmp(command, L"restart") != 0) {
+        names->insert(names->end(), targets.begin(), targets.end());
+        return;
+    }
+    for (size_t i = 0; i < targets.size(); i++) {
+        ServiceGraphClosure(targets[i].c_str(), names);
+    }
+}
+
+static DWORD BatchChainRoot(std::vector<DWORD>& parent, DWORD op) {
+    while (parent[op] != op) {
+        parent[op] = parent[parent[op]];
+        op = parent[op];
+    }
+    return op;
+}
+
+// Merge the chains of two operations; the earlier one names the result
+static void BatchChainJoin(std::vector<DWORD>& parent, DWORD a, DWORD b) {
+    a = BatchChainRoot(parent, a);
+    b = BatchChainRoot(parent, b);
+    if (a < b) parent[b] = a;
+    else parent[a] = b;
+}
+
+// One executor key per operation. Operations that share a service, directly
+// or through other operations, get the same key and so run as one chain in
+// manifest order, graph operations included. When the catalog cannot be
+// loaded a pattern operation joins every chain.
+static void BatchChainKeys(const std::vector<BATCH_OP>& ops, std::vector<std::wstring>* keys) {
+    SERVICE_CATALOG catalog;
+    BOOL catalogTried = FALSE;
+    BOOL catalogLoaded = FALSE;
+    std::vector<DWORD> parent(ops.size());
+    std::map<std::wstring, DWORD> owner;    // Lower-case service name -> first operation on it
+    for (DWORD i = 0; i < (DWORD)ops.size(); i++) {
+        parent[i] = i;
+    }
+    
+    for (DWORD i = 0; i < (DWORD)ops.size(); i++) {
+        if (IsServicePattern(ops[i].Target.c_str()) && !catalogTried) {
+            catalogLoaded = CatalogLoad(ScmDefaultSession(), &catalog);
+            catalogTried = TRUE;
+        }
+        if (IsServicePattern(ops[i].Target.c_str()) && !catalogLoaded) {
+            for (DWORD j = 0; j < (DWORD)ops.size(); j++) {
+                BatchChainJoin(parent, i, j);
+            }
+            continue;
+        }
+        
+        std::vector<std::wstring> names;
+        BatchOpServices(ops, i, &catalog, &names);
+        for (size_t j = 0; j < names.size(); j++) {
+            std::wstring key = BatchServiceKey(names[j]);
+            std::map<std::wstring, DWORD>::iterator it = owner.find(key);
+            if (it == owner.end()) {
+                owner[key] = i;
+            } else {
+                BatchChainJoin(parent, i, it->second);
+            }
+        }
+    }
+    
+    for (DWORD i = 0; i < (DWORD)ops.size(); i++) {
+        WCHAR key[16];
+        swprintf(key, sizeof(key) / sizeof(WCHAR), L"#%u", BatchChainRoot(parent, i));
+        keys->push_back(key);
+    }
+}
+
+// Executor routine: run one manifest operation
+static int RunBatchOp(PVOID context, DWORD index) {
+    std::vector<BATCH_OP>& ops = *(std::vector<BATCH_OP>*)context;
+    BATCH_OP& op = ops[index];
+    
+    std::vector<wchar_t*> argv;
+    for (size_t j = 0; j < op.Args.size(); j++) {
+        argv.push_back(&op.Args[j][0]);
+    }
+    
+    OutputText(L"[%u/%u] line %u: %ls %ls\n", index + 1, (DWORD)ops.size(),
+        op.Line, op.Args[0].c_str(), op.Target.c_str());
+    ScopedSessionUse use(ScmDefaultSession());
+    return RunServiceCommand((int)argv.size(), argv.data()) == 0 ? 0 : 1;
+}
+
+int RunBatch(LPCWSTR path, BOOL stopOnError) {
+    std::vector<BATCH_OP> ops;
+    if (!LoadBatchManifest(path, &ops)) {
+        return 1;
+    }
+    if (ops.empty()) {
+        OutputText(L"Manifest '%ls' contains no operations\n", path);
+        return 0;
+    }
+    
+    // Operations on the same service keep their manifest order
+    std::vector<std::wstring> keys;
+    BatchChainKeys(ops, &keys);
+    
+    std::vector<EXECUTOR_RESULT> results;
+    ULONGLONG batchStart = GetTickCount64();
+    BOOL allSucceeded = ExecuteOperations(keys, RunBatchOp, &ops, g_ExecutorJobs, stopOnError, &results);
+    ULONGLONG total = GetTickCount64() - batchStart;
+    
+    DWORD failed = 0, skipped = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].ExitCode == EXECUTOR_SKIPPED) skipped++;
+        else if (results[i].ExitCode != 0) failed++;
+    }
+    
+    OutputText(L"\nBatch summary: %u operation(s), %u succeeded, %u failed, %u skipped (%llu ms, %u job(s))\n",
+        (DWORD)ops.size(), (DWORD)ops.size() - failed - skipped, failed, skipped, total, g_ExecutorJobs);
+    OutputText(L"  %-6ls %-10ls %-32ls %-8ls %ls\n", L"Line", L"Command", L"Service", L"Result", L"Time");
+    for (size_t i = 0; i < ops.size(); i++) {
+        int exitCode = results[i].ExitCode;
+        LPCWSTR result = exitCode == 0 ? L"OK" : (exitCode == EXECUTOR_SKIPPED ? L"SKIPPED" : L"FAILED");
+        OutputText(L"  %-6u %-10ls %-32ls %-8ls %llu ms\n", ops[i].Line, ops[i].Args[0].c_str(),
+            ops[i].Target.c_str(), result, results[i].ElapsedMs);
+    }
+    
+    // One summary record for JSON consumers (the operations reported themselves)
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"batch", NULL);
+    record.StartTick = batchStart;
+    record.Count = (DWORD)ops.size();
+    record.Failed = failed;
+    record.Skipped = skipped;
+    OutputFinish(&record, allSucceeded, ERROR_GEN_FAILURE, NULL);
+    return allSucceeded ? 0 : 1;
+}
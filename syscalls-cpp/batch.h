@@ -0,0 +1,27 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "service_backend.h"
+#include <string>
+#include <vector>
+
+// One manifest entry: a service command in command-line syntax
+typedef struct _BATCH_OP {
+    DWORD Line;
+    std::vector<std::wstring> Args;
+    std::wstring Target;        // Service name or pattern, "*" for a bare list
+    std::vector<std::wstring> Dependencies;     // install / reconcile --depends
+} BATCH_OP;
+
+// Read and validate a manifest (UTF-8 or UTF-16LE with BOM). Every line is
+// parsed as its command would parse it, options included, so a bad line
+// is reported before any operation runs. Prints the offending line and
+// returns FALSE on any error.
+BOOL LoadBatchManifest(LPCWSTR path, std::vector<BATCH_OP>* ops);
+
+// Run every operation of a manifest in this process, g_ExecutorJobs at a
+// time, and print a summary in manifest order.
+// Returns the process exit code: 0 when all operations succeeded.
+int RunBatch(LPCWSTR path, BOOL stopOnError);
+
+#endif // BATCH_H
@@ -0,0 +1,18 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "service_backend.h"
+
+// bench [--sizes <n,...>] [--rounds <n>] [--image <path>] [--prefix <name>]
+// Runs the install -> reconcile -> start -> status -> stop -> uninstall
+// lifecycle over batches of generated services (default sizes 1, 10, 100
+// and 1000) through the same functions the commands use, g_ExecutorJobs at
+// a time, and reports ops/sec and the p50/p95/p99/max latency of every
+// command path per batch size. The reconcile path changes the boot options
+// and then reconciles again, which must find the service up to date. A
+// "pipeline" row then queues each service's whole lifecycle on a
+// ServiceManager at once and checks every result. argv[0] is "bench".
+// Returns the process exit code: 0 when every operation succeeded.
+int RunBenchmark(int argc, wchar_t* argv[]);
+
+#endif // BENCH_H
@@ -0,0 +1,38 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include "service_installer.h"
+#include <string>
+
+// Result of RunServiceCommand when argv[0] names no service command
+#define COMMAND_UNKNOWN (-1)
+
+// An install, reconcile, uninstall, start, stop, restart, status or list
+// command line, parsed but not run. Pointers refer to the argv strings.
+typedef struct _SERVICE_COMMAND {
+    LPCWSTR Command;            // argv[0]
+    LPCWSTR ServiceName;        // Name or pattern; NULL = every service (list)
+    LPCWSTR ExePath;            // install / reconcile
+    LPCWSTR DisplayName;        // install / reconcile, may be NULL
+    LPCWSTR Description;        // install / reconcile, may be NULL
+    LPCWSTR HostLog;            // --host log file, NULL = run the command directly
+    SERVICE_BOOT_OPTIONS Boot;  // install / reconcile
+    std::wstring Dependencies;  // Storage for Boot.Dependencies
+    SERVICE_PROBE Ready;        // start / restart, SERVICE_PROBE_NONE without --ready
+    LPCWSTR Error;              // Why the line was rejected
+    LPCWSTR Usage;
+} SERVICE_COMMAND;
+
+// Parse and check a command line (argv[0] is the command name) the way
+// RunServiceCommand does, without touching any service. Returns FALSE with
+// Error and Usage set for a malformed line, or with Error NULL when argv[0]
+// is not one of the commands above.
+BOOL ParseServiceCommand(int argc, wchar_t* argv[], SERVICE_COMMAND* parsed);
+
+// Dispatch one service command (install, reconcile, uninstall, start, stop,
+// restart, status, list, inventory, export, diff, watch, top,
+// profile-start); argv[0] is the command name.
+// Returns the process exit code (0/1) or COMMAND_UNKNOWN.
+int RunServiceCommand(int argc, wchar_t* argv[]);
+
+#endif // COMMANDS_H
@@ -0,0 +1,107 @@
+#include "executor.h"
+#include <wctype.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+DWORD g_ExecutorJobs = 1;
+
+// Set on pool threads: nested executions (a wildcard op inside a parallel
+// batch) run serially instead of multiplying the thread count
+static thread_local bool t_ExecutorWorker = false;
+
+struct ExecutorState {
+    const std::vector<std::vector<DWORD> >* Chains;
+    EXECUTOR_ROUTINE Routine;
+    PVOID Context;
+    BOOL StopOnError;
+    std::vector<EXECUTOR_RESULT>* Results;
+    std::atomic<size_t> NextChain;
+    std::atomic<bool> Failed;
+};
+
+static std::wstring ExecutorKey(const std::wstring& key) {
+    std::wstring lower(key);
+    for (size_t i = 0; i < lower.size(); i++) {
+        lower[i] = (wchar_t)towlower((wint_t)lower[i]);
+    }
+    return lower;
+}
+
+// Worker loop: claim whole chains until none are left
+static void ExecutorWorker(ExecutorState* state) {
+    t_ExecutorWorker = true;
+    for (;;) {
+        size_t chain = state->NextChain.fetch_add(1);
+        if (chain >= state->Chains->size()) return;
+        
+        const std::vector<DWORD>& ops = (*state->Chains)[chain];
+        for (size_t i = 0; i < ops.size(); i++) {
+            if (state->StopOnError && state->Failed.load()) return;
+            
+            EXECUTOR_RESULT& result = (*state->Results)[ops[i]];
+            ULONGLONG start = GetTickCount64();
+            result.ExitCode = state->Routine(state->Context, ops[i]);
+            result.ElapsedMs = GetTickCount64() - start;
+            
+            if (result.ExitCode != 0) state->Failed.store(true);
+        }
+    }
+}
+
+BOOL ExecuteOperations(const std::vector<std::wstring>& keys, EXECUTOR_ROUTINE routine, PVOID context,
+    DWORD jobs, BOOL stopOnError, std::vector<EXECUTOR_RESULT>* results) {
+    EXECUTOR_RESULT skipped = { EXECUTOR_SKIPPED, 0 };
+    results->assign(keys.size(), skipped);
+    
+    // Group operations into per-key chains, in order of first appearance
+    std::vector<std::vector<DWORD> > chains;
+    std::unordered_map<std::wstring, size_t> chainIndex;
+    for (DWORD i = 0; i < (DWORD)keys.size(); i++) {
+        std::wstring key = ExecutorKey(keys[i]);
+        std::unordered_map<std::wstring, size_t>::iterator it = chainIndex.find(key);
+        if (it == chainIndex.end()) {
+            chainIndex[key] = chains.size();
+            chains.push_back(std::vector<DWORD>(1, i));
+        } else {
+            chains[it->second].push_back(i);
+        }
+    }
+    
+    ExecutorState state;
+    state.Chains = &chains;
+    state.Routine = routine;
+    state.Context = context;
+    state.StopOnError = stopOnError;
+    state.Results = results;
+    state.NextChain = 0;
+    state.Failed = false;
+    
+    if (jobs > EXECUTOR_MAX_JOBS) jobs = EXECUTOR_MAX_JOBS;
+    if (t_ExecutorWorker) jobs = 1;
+    if (jobs > chains.size()) jobs = (DWORD)chains.size();
+    
+    if (jobs <= 1) {
+        // Serial: run everything on the calling thread, in submission order
+        for (DWORD i = 0; i < (DWORD)keys.size(); i++) {
+            if (stopOnError && state.Failed.load()) break;
+            
+            EXECUTOR_RESULT& result = (*results)[i];
+            ULONGLONG start = GetTickCount64();
+            result.ExitCode = routine(context, i);
+            result.ElapsedMs = GetTickCount64() - start;
+            if (result.ExitCode != 0) state.Failed.store(true);
+        }
+    } else {
+        std::vector<std::thread> workers;
+        for (DWORD i = 0; i < jobs; i++) {
+            workers.push_back(std::thread(ExecutorWorker, &state));
+        }
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+    
+    return !state.Failed.load();
+}
@@ -0,0 +1,36 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include "service_backend.h"
+#include <string>
+#include <vector>
+
+// Upper bound accepted for --jobs
+#define EXECUTOR_MAX_JOBS  64
+
+// ExitCode of an operation that never ran (stop-on-error)
+#define EXECUTOR_SKIPPED   (-1)
+
+// Number of operations run concurrently (--jobs, default 1 = serial)
+extern DWORD g_ExecutorJobs;
+
+typedef struct _EXECUTOR_RESULT {
+    int ExitCode;
+    ULONGLONG ElapsedMs;
+} EXECUTOR_RESULT;
+
+// Runs operation 'index' and returns its exit code (0 = success)
+typedef int (*EXECUTOR_ROUTINE)(PVOID context, DWORD index);
+
+// Run keys.size() operations on at most 'jobs' worker threads.
+// Operations with the same key (case-insensitive, normally the service
+// name) form a chain that runs in submission order on a single worker, so
+// they never overlap and a service's status-change registration stays on
+// one thread. Independent chains run concurrently. results[i] always
+// belongs to operation i, whatever order the work completed in. With
+// stopOnError no new operation starts after the first failure.
+// Returns TRUE when every operation succeeded.
+BOOL ExecuteOperations(const std::vector<std::wstring>& keys, EXECUTOR_ROUTINE routine, PVOID context,
+    DWORD jobs, BOOL stopOnError, std::vector<EXECUTOR_RESULT>* results);
+
+#endif // EXECUTOR_H
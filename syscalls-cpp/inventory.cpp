@@ -0,0 +1,102 @@
+#include "inventory.h"
+#include "catalog.h"
+#include "output.h"
+#include <wchar.h>
+
+typedef struct _INVENTORY_WALK {
+    const SERVICE_CATALOG* Catalog;
+    LPCWSTR Pattern;
+    DWORD Listed;
+    DWORD Unloaded;
+    DWORD Skipped;
+} INVENTORY_WALK;
+
+static BOOL InventoryEntry(PVOID context, const SERVICE_REGISTRY_ENTRY* entry) {
+    INVENTORY_WALK* walk = (INVENTORY_WALK*)context;
+    if (walk->Pattern && !WildcardMatch(walk->Pattern, entry->Name)) return TRUE;
+    
+    DWORD type = entry->Config.dwServiceType;
+    if (type == SERVICE_NO_CHANGE || !(type & SERVICE_WIN32)) {
+        walk->Skipped++;
+        return TRUE;
+    }
+    
+    BOOL loaded = CatalogFind(walk->Catalog, entry->Name) != NULL;
+    walk->Listed++;
+    if (!loaded) walk->Unloaded++;
+    
+    WCHAR typeNumber[16];
+    WCHAR startNumber[16];
+    SCHEMA_VALUE start = SchemaConfigValue(&entry->Config, FIELD_START_TYPE);
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"inventory", entry->Name);
+    record.DisplayName = entry->Config.lpDisplayName;
+    record.ImagePath = entry->Config.lpBinaryPathName;
+    record.ServiceType = type;
+    record.StartType = start.Number;
+    record.Loaded = loaded;
+    OutputFinish(&record, TRUE, ERROR_SUCCESS, L"%-32ls %-10ls %-20ls %-10ls %ls", entry->Name,
+        loaded ? L"Loaded" : L"Not loaded",
+        SchemaFormatValue(FIELD_SERVICE_TYPE, SchemaConfigValue(&entry->Config, FIELD_SERVICE_TYPE), typeNumber,
+            sizeof(typeNumber) / sizeof(WCHAR)),
+        start.Number == SERVICE_NO_CHANGE ? L"-" : SchemaFormatValue(FIELD_START_TYPE, start, startNumber,
+            sizeof(startNumber) / sizeof(WCHAR)),
+        (record.ImagePath && *record.ImagePath) ? record.ImagePath : L"-");
+    return TRUE;
+}
+
+int InventoryServices(LPCWSTR pattern) {
+    SCM_SESSION* session = ScmDefaultSession();
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"inventory", pattern);
+    if (!g_Backend->ReadRegistry) {
+        OutputFinish(&record, FALSE, ERROR_NOT_SUPPORTED, L"The %ls backend cannot read the service registry",
+            g_Backend->Name);
+        return 1;
+    }
+    
+    // One enumeration tells which registry entries the SCM has loaded
+    SERVICE_CATALOG catalog;
+    if (!CatalogLoad(session, &catalog)) {
+        DWORD err = GetLastError();
+        OutputFinish(&record, FALSE, err, L"EnumServicesStatusEx failed: %d", err);
+        return 1;
+    }
+    
+    INVENTORY_WALK walk;
+    walk.Catalog = &catalog;
+    walk.Pattern = pattern;
+    walk.Listed = 0;
+    walk.Unloaded = 0;
+    walk.Skipped = 0;
+    
+    OutputText(L"%-32ls %-10ls %-20ls %-10ls %ls\n", L"Name", L"SCM", L"Type", L"Start", L"Image Path");
+    SVC_HANDLE manager = ScmSessionManager(session, SC_MANAGER_CONNECT);
+    if (!manager || !g_Backend->ReadRegistry(manager, NULL, InventoryEntry, &walk)) {
+        DWORD err = GetLastError();
+        OutputFinish(&record, FALSE, err, L"Cannot read the service registry: %d", err);
+        return 1;
+    }
+    
+    record.Count = walk.Listed;
+    record.Skipped = walk.Skipped;
+    OutputFinish(&record, TRUE, ERROR_SUCCESS, L"%u service(s), %u not loaded by SCM, %u other registry entries",
+        walk.Listed, walk.Unloaded, walk.Skipped);
+    return 0;
+}
+
+static BOOL InventoryCapture(PVOID context, const SERVICE_REGISTRY_ENTRY* entry) {
+    SchemaDescribeConfig((std::wstring*)context, &entry->Config, SCHEMA_INVENTORY);
+    return FALSE;
+}
+
+BOOL InventoryDescribe(LPCWSTR serviceName, std::wstring* details) {
+    if (!g_Backend->ReadRegistry) {
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return FALSE;
+    }
+    
+    SVC_HANDLE manager = ScmSessionManager(ScmDefaultSession(), SC_MANAGER_CONNECT);
+    if (!manager) return FALSE;
+    return g_Backend->ReadRegistry(manager, serviceName, InventoryCapture, details);
+}
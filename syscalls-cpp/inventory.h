@@ -0,0 +1,19 @@
+#ifndef INVENTORY_H
+#define INVENTORY_H
+
+#include "scm_session.h"
+#include <string>
+
+// Read-only audit of the Services registry key. One walk through the
+// backend's ReadRegistry is checked against one SCM enumeration, so the
+// whole host costs two bulk reads instead of an SCM query per name. Win32
+// services matching 'pattern' (NULL = all) are listed with their registry
+// config and whether the SCM has loaded them. Drivers and keys without a
+// service type are counted but not listed.
+int InventoryServices(LPCWSTR pattern);
+
+// Registry config of one service, appended as "\nLabel: value" lines.
+// Fails with ERROR_SERVICE_DOES_NOT_EXIST when it has no key.
+BOOL InventoryDescribe(LPCWSTR serviceName, std::wstring* details);
+
+#endif // INVENTORY_H
@@ -0,0 +1,46 @@
+#ifndef LOG_PIPE_H
+#define LOG_PIPE_H
+
+#include "win_compat.h"
+
+// Asynchronous log file writer. Producers copy bytes into a pending buffer
+// and return; one background thread writes the buffer out in batches (when
+// it reaches LOG_PIPE_BATCH_BYTES or has waited FlushMs) and rotates the
+// file by size. A producer never waits for the disk: when the backlog
+// reaches MaxPendingBytes new output is dropped and counted, and the count
+// is written to the log as a marker line once the writer catches up.
+
+#define LOG_PIPE_BATCH_BYTES  (64 * 1024)  // Pending bytes that wake the writer early
+
+typedef struct _LOG_PIPE_CONFIG {
+    LPCWSTR Path;
+    ULONGLONG MaxFileBytes;     // Rotate before the file would pass this (0 = never)
+    DWORD MaxFiles;             // Rotated files kept as <path>.1 .. <path>.N (0 = truncate)
+    DWORD FlushMs;              // Longest output waits in memory
+    DWORD MaxPendingBytes;      // Backlog beyond which output is dropped
+} LOG_PIPE_CONFIG;
+
+typedef struct _LOG_PIPE_STATS {
+    ULONGLONG WrittenBytes;
+    ULONGLONG DroppedBytes;
+    DWORD Batches;              // Writes to the file
+    DWORD Rotations;
+} LOG_PIPE_STATS;
+
+typedef struct _LOG_PIPE LOG_PIPE;
+
+// Defaults: 10 MB files, 5 kept, 200 ms flush, 8 MB backlog
+VOID LogPipeInitConfig(LOG_PIPE_CONFIG* config, LPCWSTR path);
+
+// Open (append to) the log file and start the writer thread. NULL with
+// ERROR_FILE_NOT_FOUND when the file cannot be opened.
+LOG_PIPE* LogPipeOpen(const LOG_PIPE_CONFIG* config);
+
+// Queue bytes for the file; thread-safe, never blocks on I/O
+VOID LogPipeWrite(LOG_PIPE* pipe, const void* data, DWORD bytes);
+
+// Write everything still queued, stop the writer and close the file.
+// 'stats' (may be NULL) receives the totals.
+VOID LogPipeClose(LOG_PIPE* pipe, LOG_PIPE_STATS* stats);
+
+#endif // LOG_PIPE_H
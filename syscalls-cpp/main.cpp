@@ -1,11 +1,28 @@
-#include "service_installer.h"
+#include "commands.h"
+#include "batch.h"
+#include "bench.h"
+#include "service_wait.h"
+#include "executor.h"
+#include "output.h"
+#include "metrics.h"
+#include "service_host.h"
+#include "trace.h"
+#include "replay.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <wchar.h>
+#ifdef _WIN32
 #include <windows.h>
 #include <sddl.h>
+#else
+#include <locale.h>
+#endif
 
 // Check if running as administrator
 BOOL IsAdministrator() {
+#ifndef _WIN32
+    return TRUE;
+#else
     BOOL isAdmin = FALSE;
     PSID adminGroup = NULL;
     SID_IDENTIFIER_AUTHORITY ntAuthority = SECURITY_NT_AUTHORITY;
@@ -25,55 +42,142 @@ BOOL IsAdministrator() {
     }
     
     return isAdmin;
+#endif
 }
 
 void ShowHelp() {
-    wprintf(L"NT Service Installer - Direct Syscalls Implementation\n");
-    wprintf(L"======================================================\n\n");
-    wprintf(L"Uses direct ntdll.dll calls to bypass user-mode API hooks\n\n");
-    wprintf(L"USAGE:\n");
-    wprintf(L"  NtServiceInstaller.exe <command> [arguments]\n\n");
-    wprintf(L"COMMANDS:\n");
-    wprintf(L"  install <exe-path> <service-name> [display-name] [description]\n");
-    wprintf(L"      Install an executable as a Windows service\n");
-    wprintf(L"      - exe-path: Full path to the executable file\n");
-    wprintf(L"      - service-name: Name for the service (no spaces)\n");
-    wprintf(L"      - display-name: (Optional) Display name for the service\n");
-    wprintf(L"      - description: (Optional) Service description\n\n");
-    wprintf(L"  uninstall <service-name>\n");
-    wprintf(L"      Uninstall a Windows service\n\n");
-    wprintf(L"  start <service-name>\n");
-    wprintf(L"      Start a Windows service\n\n");
-    wprintf(L"  stop <service-name>\n");
-    wprintf(L"      Stop a Windows service\n\n");
-    wprintf(L"  status <service-name>\n");
-    wprintf(L"      Check the status of a Windows service\n\n");
-    wprintf(L"  help\n");
-    wprintf(L"      Show this help message\n\n");
-    wprintf(L"EXAMPLES:\n");
-    wprintf(L"  NtServiceInstaller.exe install \"C:\\MyApp\\app.exe\" MyService \"My App\"\n");
-    wprintf(L"  NtServiceInstaller.exe start MyService\n");
-    wprintf(L"  NtServiceInstaller.exe status MyService\n");
-    wprintf(L"  NtServiceInstaller.exe stop MyService\n");
-    wprintf(L"  NtServiceInstaller.exe uninstall MyService\n\n");
-    wprintf(L"NOTE:\n");
-    wprintf(L"  - This program must be run as Administrator\n");
-    wprintf(L"  - Uses NT API to bypass advapi32.dll hooks\n");
-    wprintf(L"  - Service may require reboot or SCM refresh to appear\n\n");
-    wprintf(L"OPSEC:\n");
-    wprintf(L"  - No CreateService/OpenSCManager calls during install\n");
-    wprintf(L"  - Direct ntdll.dll registry manipulation\n");
-    wprintf(L"  - Bypasses user-mode API hooks\n");
+    OutputWrite(L"NT Service Installer - Direct Syscalls Implementation\n");
+    OutputWrite(L"======================================================\n\n");
+    OutputWrite(L"Uses direct ntdll.dll calls to bypass user-mode API hooks\n\n");
+    OutputWrite(L"USAGE:\n");
+    OutputWrite(L"  NtServiceInstaller.exe <command> [arguments]\n\n");
+    OutputWrite(L"COMMANDS:\n");
+    OutputWrite(L"  install <exe-path> <service-name> [display-name] [description] [boot options]\n");
+    OutputWrite(L"      Install an executable as a Windows service\n");
+    OutputWrite(L"      - exe-path: Full path to the executable file\n");
+    OutputWrite(L"      - service-name: Name for the service (no spaces)\n");
+    OutputWrite(L"      - display-name: (Optional) Display name for the service\n");
+    OutputWrite(L"      - description: (Optional) Service description\n");
+    OutputWrite(L"      - --start <auto|delayed|demand|disabled>: (Optional) Start type; delayed\n");
+    OutputWrite(L"        starts after the boot-critical services (default: auto)\n");
+    OutputWrite(L"      - --trigger <network|event:<provider-guid>>: (Optional) Start when the\n");
+    OutputWrite(L"        first IP address arrives or an ETW provider fires (implies demand)\n");
+    OutputWrite(L"      - --depends <service,...>: (Optional) Services that must run first\n");
+    OutputWrite(L"      - --host <log-file>: (Optional) Run exe-path, any console command line,\n");
+    OutputWrite(L"        under this tool's service host, logging its output to log-file\n");
+    OutputWrite(L"      - --restart <ms,...>: (Optional) Have the SCM restart the service after\n");
+    OutputWrite(L"        a crash, waiting the n-th delay before the n-th consecutive restart\n");
+    OutputWrite(L"        (the last delay repeats)\n");
+    OutputWrite(L"      - --reset-period <seconds>: (Optional) Failure-free time after which the\n");
+    OutputWrite(L"        restart count starts over (default: 86400)\n");
+    OutputWrite(L"      - --restart-on-error: (Optional) Also restart after the service stops\n");
+    OutputWrite(L"        with an error exit code\n\n");
+    OutputWrite(L"  reconcile <exe-path> <service-name> [display-name] [description] [boot options]\n");
+    OutputWrite(L"      Install the service if it is missing, otherwise change only the config\n");
+    OutputWrite(L"      fields and recovery policy that differ from the arguments (none when it\n");
+    OutputWrite(L"      is up to date)\n\n");
+    OutputWrite(L"  uninstall <service-name>\n");
+    OutputWrite(L"      Uninstall a Windows service\n\n");
+    OutputWrite(L"  start <service-name|pattern> [--ready <probe>] [--ready-timeout <ms>]\n");
+    OutputWrite(L"        [--ready-interval <ms>]\n");
+    OutputWrite(L"      Start a Windows service after the stopped services it depends on;\n");
+    OutputWrite(L"      with --ready, also wait until the probe passes: tcp:[host:]port\n");
+    OutputWrite(L"      accepts connections, pipe:<name> or file:<path> exists (deadline\n");
+    OutputWrite(L"      default --timeout, attempts backing off to every 250 ms)\n\n");
+    OutputWrite(L"  stop <service-name|pattern>\n");
+    OutputWrite(L"      Stop a Windows service after the running services that depend on it\n\n");
+    OutputWrite(L"  restart <service-name> [--ready <probe>] [--ready-timeout <ms>]\n");
+    OutputWrite(L"          [--ready-interval <ms>]\n");
+    OutputWrite(L"      Stop and start a Windows service, starting it as soon as it reports\n");
+    OutputWrite(L"      stopped, and report how long it was unavailable (until ready with\n");
+    OutputWrite(L"      --ready)\n\n");
+    OutputWrite(L"  status <service-name|pattern>\n");
+    OutputWrite(L"      Check the status of a Windows service\n\n");
+    OutputWrite(L"  list [pattern]\n");
+    OutputWrite(L"      List services (name, state, PID, display name) from one enumeration\n");
+    OutputWrite(L"      - pattern: '*' matches any characters, '?' one character,\n");
+    OutputWrite(L"        e.g. \"MyApp*\" (quote it in the shell)\n\n");
+    OutputWrite(L"  inventory [pattern]\n");
+    OutputWrite(L"      Read-only audit of the Services registry key: type, start type and\n");
+    OutputWrite(L"      image path of every service, and whether the SCM has loaded it\n\n");
+    OutputWrite(L"  export <snapshot-file> [pattern]\n");
+    OutputWrite(L"      Write the state and registry config of every service (or those\n");
+    OutputWrite(L"      matching the pattern) to a compact binary snapshot\n\n");
+    OutputWrite(L"  diff <before-file> <after-file>\n");
+    OutputWrite(L"      List services added, removed or changed between two snapshots\n");
+    OutputWrite(L"      (exit code 1 when they differ)\n\n");
+    OutputWrite(L"  watch <service-name|pattern>... [--duration <ms>]\n");
+    OutputWrite(L"      Stream state changes as they happen, one timestamped line per\n");
+    OutputWrite(L"      transition (previous -> new), until interrupted or the duration ends\n\n");
+    OutputWrite(L"  top <service-name|pattern>... [--interval <ms>] [--count <n>]\n");
+    OutputWrite(L"      Sample CPU, working set, private bytes, handles and threads of the\n");
+    OutputWrite(L"      service processes every interval (default 1000 ms) until interrupted\n");
+    OutputWrite(L"      or n samples are taken\n\n");
+    OutputWrite(L"  profile-start <service-name> [--runs <n>] [--poll <ms>] [--timeline]\n");
+    OutputWrite(L"      Start the service n times (default 5), polling its status every\n");
+    OutputWrite(L"      poll ms (default 5), and report time to running and how long each\n");
+    OutputWrite(L"      checkpoint took (min/median/max); the service is left as it was\n\n");
+    OutputWrite(L"  host --log <file> [--log-size <bytes>] [--log-files <n>] [--stop-timeout <ms>]\n");
+    OutputWrite(L"       -- <command> [args...]\n");
+    OutputWrite(L"      Run as the service process: start the command, write its stdout and\n");
+    OutputWrite(L"      stderr to size-rotated log files (default 10 MB x 5) and forward stop\n");
+    OutputWrite(L"      requests to it as Ctrl+C (killed after the timeout, default 10000 ms)\n\n");
+    OutputWrite(L"  replay <trace-file> [--list] [--jobs <n>] [--timeout <ms>] [-- <command> ...]\n");
+    OutputWrite(L"      Run a command recorded with --trace again in the simulated SCM, with\n");
+    OutputWrite(L"      the services, states, transition times and call latencies of the\n");
+    OutputWrite(L"      trace, and compare the recorded and replayed latency and wall time;\n");
+    OutputWrite(L"      --list prints the recorded calls instead\n\n");
+    OutputWrite(L"  batch <manifest-file> [--stop-on-error]\n");
+    OutputWrite(L"      Run the install/reconcile/uninstall/start/stop/restart/status/list\n");
+    OutputWrite(L"      operations listed in a manifest (one command per line, '#' comments)\n");
+    OutputWrite(L"      in a single process\n\n");
+    OutputWrite(L"  bench [--sizes <n,...>] [--rounds <n>] [--image <path>] [--prefix <name>]\n");
+    OutputWrite(L"      Install, start, query, stop and uninstall batches of generated services\n");
+    OutputWrite(L"      (default sizes 1,10,100,1000) and report ops/sec and p50/p95/p99/max\n");
+    OutputWrite(L"      latency per command, plus a checked run of the whole lifecycle queued\n");
+    OutputWrite(L"      at once on the library layer; use --backend sim unless real services\n");
+    OutputWrite(L"      are wanted\n\n");
+    OutputWrite(L"  help\n");
+    OutputWrite(L"      Show this help message\n\n");
+    OutputWrite(L"OPTIONS (before the command):\n");
+    OutputWrite(L"  --backend <nt|sim>\n");
+    OutputWrite(L"      Service backend (default: nt; sim = in-memory simulated SCM,\n");
+    OutputWrite(L"      configured through SIMSCM_* environment variables)\n");
+    OutputWrite(L"  --timeout <ms>\n");
+    OutputWrite(L"      Deadline for start/stop state transitions (default: 30000)\n");
+    OutputWrite(L"  --jobs <n>\n");
+    OutputWrite(L"      Run up to n batch operations concurrently (default: 1); operations\n");
+    OutputWrite(L"      on the same service always run in manifest order\n");
+    OutputWrite(L"  --format <text|json>\n");
+    OutputWrite(L"      Output format (default: text; json = one JSON object per line for each\n");
+    OutputWrite(L"      operation with state, error code and elapsed time)\n");
+    OutputWrite(L"  --stats\n");
+    OutputWrite(L"      Time every backend call and state wait; report count and p50/p95/p99/\n");
+    OutputWrite(L"      max latency per call type when the command finishes\n");
+    OutputWrite(L"  --stats-file <path>\n");
+    OutputWrite(L"      As --stats, and also write the latencies to a file in the Prometheus\n");
+    OutputWrite(L"      text format (for a node_exporter textfile collector or a CI artifact)\n");
+    OutputWrite(L"  --trace <file>\n");
+    OutputWrite(L"      Record every backend call (arguments, result, observed states and\n");
+    OutputWrite(L"      timing) to a compact binary trace for 'replay'\n\n");
+    OutputWrite(L"EXAMPLES:\n");
+    OutputWrite(L"  NtServiceInstaller.exe install \"C:\\MyApp\\app.exe\" MyService \"My App\"\n");
+    OutputWrite(L"  NtServiceInstaller.exe start MyService\n");
+    OutputWrite(L"  NtServiceInstaller.exe status MyService\n");
+    OutputWrite(L"  NtServiceInstaller.exe stop MyService\n");
+    OutputWrite(L"  NtServiceInstaller.exe uninstall MyService\n\n");
+    OutputWrite(L"NOTE:\n");
+    OutputWrite(L"  - This program must be run as Administrator\n");
+    OutputWrite(L"  - Uses NT API to bypass advapi32.dll hooks\n");
+    OutputWrite(L"  - Service may require reboot or SCM refresh to appear\n\n");
+    OutputWrite(L"OPSEC:\n");
+    OutputWrite(L"  - No CreateService/OpenSCManager calls during install\n");
+    OutputWrite(L"  - Direct ntdll.dll registry manipulation\n");
+    OutputWrite(L"  - Bypasses user-mode API hooks\n");
 }
 
-int wmain(int argc, wchar_t* argv[]) {
-    // Check administrator privileges
-    if (!IsAdministrator()) {
-        wprintf(L"ERROR: This program must be run as Administrator\n");
-        wprintf(L"Please run this application with administrator privileges\n");
-        return 1;
-    }
-    
+// Dispatch the command line (argv[1] is the command)
+static int RunCommand(int argc, wchar_t* argv[]) {
     if (argc < 2) {
         ShowHelp();
         return 0;
@@ -90,73 +194,138 @@ int wmain(int argc, wchar_t* argv[]) {
         return 0;
     }
     
-    // Install command
-    if (_wcsicmp(command, L"install") == 0) {
-        if (argc < 4) {
-            wprintf(L"ERROR: install command requires at least 2 arguments\n");
-            wprintf(L"Usage: install <exe-path> <service-name> [display-name] [description]\n");
+    // Batch command
+    if (_wcsicmp(command, L"batch") == 0) {
+        if (argc < 3) {
+            OUTPUT_RECORD record;
+            OutputBegin(&record, command, NULL);
+            OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER, L"ERROR: batch command requires a manifest file\n"
+                L"Usage: batch <manifest-file> [--stop-on-error]");
             return 1;
         }
         
-        wchar_t* exePath = argv[2];
-        wchar_t* serviceName = argv[3];
-        wchar_t* displayName = (argc > 4) ? argv[4] : NULL;
-        wchar_t* description = (argc > 5) ? argv[5] : NULL;
-        
-        return InstallService(exePath, serviceName, displayName, description) ? 0 : 1;
+        BOOL stopOnError = (argc > 3 && _wcsicmp(argv[3], L"--stop-on-error") == 0);
+        return RunBatch(argv[2], stopOnError);
     }
     
-    // Uninstall command
-    if (_wcsicmp(command, L"uninstall") == 0) {
-        if (argc < 3) {
-            wprintf(L"ERROR: uninstall command requires service name\n");
-            wprintf(L"Usage: uninstall <service-name>\n");
-            return 1;
-        }
-        
-        wchar_t* serviceName = argv[2];
-        return UninstallService(serviceName) ? 0 : 1;
+    // Benchmark command
+    if (_wcsicmp(command, L"bench") == 0) {
+        return RunBenchmark(argc - 1, argv + 1);
     }
     
-    // Start command
-    if (_wcsicmp(command, L"start") == 0) {
-        if (argc < 3) {
-            wprintf(L"ERROR: start command requires service name\n");
-            wprintf(L"Usage: start <service-name>\n");
-            return 1;
-        }
-        
-        wchar_t* serviceName = argv[2];
-        return StartServiceByName(serviceName) ? 0 : 1;
+    // Service commands (install, uninstall, start, stop, status, list, watch)
+    int exitCode = RunServiceCommand(argc - 1, argv + 1);
+    if (exitCode != COMMAND_UNKNOWN) {
+        return exitCode;
     }
     
-    // Stop command
-    if (_wcsicmp(command, L"stop") == 0) {
-        if (argc < 3) {
-            wprintf(L"ERROR: stop command requires service name\n");
-            wprintf(L"Usage: stop <service-name>\n");
-            return 1;
+    // Unknown command
+    OUTPUT_RECORD record;
+    OutputBegin(&record, command, NULL);
+    OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER, L"Unknown command: %ls", command);
+    if (g_OutputFormat == OUTPUT_TEXT) {
+        OutputText(L"\n");
+        ShowHelp();
+    }
+    return 1;
+}
+
+int wmain(int argc, wchar_t* argv[]) {
+    // Global options
+    LPCWSTR backendName = NULL;
+    LPCWSTR formatName = NULL;
+    LPCWSTR statsFile = NULL;
+    LPCWSTR traceFile = NULL;
+    BOOL stats = FALSE;
+    while (argc > 2 && wcsncmp(argv[1], L"--", 2) == 0) {
+        if (_wcsicmp(argv[1], L"--stats") == 0) {
+            // The only option without a value
+            stats = TRUE;
+            argv += 1;
+            argc -= 1;
+            continue;
         }
-        
-        wchar_t* serviceName = argv[2];
-        return StopServiceByName(serviceName) ? 0 : 1;
+        if (_wcsicmp(argv[1], L"--backend") == 0) {
+            backendName = argv[2];
+        } else if (_wcsicmp(argv[1], L"--format") == 0) {
+            formatName = argv[2];
+        } else if (_wcsicmp(argv[1], L"--timeout") == 0) {
+            g_ServiceWaitTimeout = (DWORD)wcstoul(argv[2], NULL, 10);
+        } else if (_wcsicmp(argv[1], L"--jobs") == 0) {
+            g_ExecutorJobs = (DWORD)wcstoul(argv[2], NULL, 10);
+            if (g_ExecutorJobs < 1) g_ExecutorJobs = 1;
+            if (g_ExecutorJobs > EXECUTOR_MAX_JOBS) g_ExecutorJobs = EXECUTOR_MAX_JOBS;
+        } else if (_wcsicmp(argv[1], L"--stats-file") == 0) {
+            statsFile = argv[2];
+            stats = TRUE;
+        } else if (_wcsicmp(argv[1], L"--trace") == 0) {
+            traceFile = argv[2];
+        } else {
+            break;
+        }
+        argv += 2;
+        argc -= 2;
     }
     
-    // Status command
-    if (_wcsicmp(command, L"status") == 0) {
-        if (argc < 3) {
-            wprintf(L"ERROR: status command requires service name\n");
-            wprintf(L"Usage: status <service-name>\n");
-            return 1;
-        }
-        
-        wchar_t* serviceName = argv[2];
-        GetServiceStatusByName(serviceName);
-        return 0;
+    if (!OutputInitialize(formatName)) {
+        return 1;
     }
     
-    // Unknown command
-    wprintf(L"Unknown command: %s\n\n", command);
-    ShowHelp();
-    return 1;
+    // The service host is the service process itself and uses no backend
+    if (argc > 1 && _wcsicmp(argv[1], L"host") == 0) {
+        return RunServiceHost(argc - 1, argv + 1);
+    }
+    
+    // Replay brings its own simulated backend
+    if (argc > 1 && _wcsicmp(argv[1], L"replay") == 0) {
+        return RunReplay(argc - 1, argv + 1);
+    }
+    
+    if (!SelectServiceBackend(backendName)) {
+        return 1;
+    }
+    
+    // Check administrator privileges (the simulated SCM needs none)
+    if (g_Backend != &SimulatedBackend && !IsAdministrator()) {
+        OUTPUT_RECORD record;
+        OutputBegin(&record, argc > 1 ? argv[1] : NULL, NULL);
+        OutputFinish(&record, FALSE, ERROR_ACCESS_DENIED, L"ERROR: This program must be run as Administrator\n"
+            L"Please run this application with administrator privileges");
+        return 1;
+    }
+    
+    // Tracing and timing wrappers go on after the backend identity check
+    // above; metrics then time the traced calls
+    if (traceFile && !TraceEnable(traceFile, argc - 1, argv + 1)) {
+        return 1;
+    }
+    if (stats) {
+        MetricsEnable();
+    }
+    
+    int exitCode = RunCommand(argc, argv);
+    if (stats && !MetricsReport(statsFile) && exitCode == 0) {
+        exitCode = 1;
+    }
+    if (traceFile && !TraceClose() && exitCode == 0) {
+        exitCode = 1;
+    }
+    return exitCode;
+}
+
+#ifndef _WIN32
+// Non-Windows entry point: convert the locale-encoded arguments for wmain
+int main(int argc, char* argv[]) {
+    setlocale(LC_ALL, "");
+    
+    wchar_t** wargv = (wchar_t**)calloc(argc + 1, sizeof(wchar_t*));
+    for (int i = 0; i < argc; i++) {
+        size_t len = mbstowcs(NULL, argv[i], 0);
+        if (len == (size_t)-1) len = 0;
+        wargv[i] = (wchar_t*)calloc(len + 1, sizeof(wchar_t));
+        mbstowcs(wargv[i], argv[i], len + 1);
+    }
+    
+    return wmain(argc, wargv);
 }
+#endif
@@ -1,34 +1,41 @@
 #include "nt_api.h"
-#include <stdio.h>
 
 // Global function pointers
 pNtCreateKey NtCreateKey = NULL;
 pNtOpenKey NtOpenKey = NULL;
 pNtSetValueKey NtSetValueKey = NULL;
 pNtQueryValueKey NtQueryValueKey = NULL;
+pNtEnumerateKey NtEnumerateKey = NULL;
 pNtDeleteKey NtDeleteKey = NULL;
 pNtDeleteValueKey NtDeleteValueKey = NULL;
 pNtClose NtClose = NULL;
+pNtQuerySystemInformation NtQuerySystemInformation = NULL;
 pRtlInitUnicodeString RtlInitUnicodeString = NULL;
+pRtlNtStatusToDosError RtlNtStatusToDosError = NULL;
 
 BOOL InitNtFunctions() {
-    HMODULE ntdll = GetModuleHandleW(L"ntdll.dll");
-    if (!ntdll) {
-        wprintf(L"Failed to get ntdll.dll handle\n");
-        return FALSE;
+    // Already resolved (batch runs and repeated backend selection)
+    if (NtCreateKey && NtOpenKey && NtSetValueKey && NtClose && RtlInitUnicodeString) {
+        return TRUE;
     }
     
+    HMODULE ntdll = GetModuleHandleW(L"ntdll.dll");
+    if (!ntdll) return FALSE;
+    
     NtCreateKey = (pNtCreateKey)GetProcAddress(ntdll, "NtCreateKey");
     NtOpenKey = (pNtOpenKey)GetProcAddress(ntdll, "NtOpenKey");
     NtSetValueKey = (pNtSetValueKey)GetProcAddress(ntdll, "NtSetValueKey");
     NtQueryValueKey = (pNtQueryValueKey)GetProcAddress(ntdll, "NtQueryValueKey");
+    NtEnumerateKey = (pNtEnumerateKey)GetProcAddress(ntdll, "NtEnumerateKey");
     NtDeleteKey = (pNtDeleteKey)GetProcAddress(ntdll, "NtDeleteKey");
     NtDeleteValueKey = (pNtDeleteValueKey)GetProcAddress(ntdll, "NtDeleteValueKey");
     NtClose = (pNtClose)GetProcAddress(ntdll, "NtClose");
+    NtQuerySystemInformation = (pNtQuerySystemInformation)GetProcAddress(ntdll, "NtQuerySystemInformation");
     RtlInitUnicodeString = (pRtlInitUnicodeString)GetProcAddress(ntdll, "RtlInitUnicodeString");
+    RtlNtStatusToDosError = (pRtlNtStatusToDosError)GetProcAddress(ntdll, "RtlNtStatusToDosError");
     
     if (!NtCreateKey || !NtOpenKey || !NtSetValueKey || !NtClose || !RtlInitUnicodeString) {
-        wprintf(L"Failed to load NT functions\n");
+        SetLastError(ERROR_PROC_NOT_FOUND);
         return FALSE;
     }
     
@@ -38,6 +38,15 @@ typedef NTSTATUS (NTAPI *pNtQueryValueKey)(
     PULONG ResultLength
 );
 
+typedef NTSTATUS (NTAPI *pNtEnumerateKey)(
+    HANDLE KeyHandle,
+    ULONG Index,
+    int KeyInformationClass,
+    PVOID KeyInformation,
+    ULONG Length,
+    PULONG ResultLength
+);
+
 typedef NTSTATUS (NTAPI *pNtDeleteKey)(
     HANDLE KeyHandle
 );
@@ -51,20 +60,34 @@ typedef NTSTATUS (NTAPI *pNtClose)(
     HANDLE Handle
 );
 
+typedef NTSTATUS (NTAPI *pNtQuerySystemInformation)(
+    int SystemInformationClass,
+    PVOID SystemInformation,
+    ULONG Length,
+    PULONG ReturnLength
+);
+
 typedef VOID (NTAPI *pRtlInitUnicodeString)(
     PUNICODE_STRING DestinationString,
     PCWSTR SourceString
 );
 
+typedef ULONG (NTAPI *pRtlNtStatusToDosError)(
+    NTSTATUS Status
+);
+
 // Global function pointers
 extern pNtCreateKey NtCreateKey;
 extern pNtOpenKey NtOpenKey;
 extern pNtSetValueKey NtSetValueKey;
 extern pNtQueryValueKey NtQueryValueKey;
+extern pNtEnumerateKey NtEnumerateKey;
 extern pNtDeleteKey NtDeleteKey;
 extern pNtDeleteValueKey NtDeleteValueKey;
 extern pNtClose NtClose;
+extern pNtQuerySystemInformation NtQuerySystemInformation;
 extern pRtlInitUnicodeString RtlInitUnicodeString;
+extern pRtlNtStatusToDosError RtlNtStatusToDosError;  // Optional: NULL maps failures to ERROR_GEN_FAILURE
 
 // Initialization
 BOOL InitNtFunctions();
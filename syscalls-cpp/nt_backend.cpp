@@ -0,0 +1,964 @@
+#include "service_backend.h"
+
+#ifdef _WIN32
+
+#include "nt_api.h"
+#include "scm_notify.h"
+#include "scratch.h"
+#include "service_schema.h"
+#include <stddef.h>
+#include <string.h>
+#include <wchar.h>
+#include <vector>
+
+// Backend that creates and deletes services directly in the registry via
+// ntdll.dll (no CreateService/DeleteService/OpenSCManager for install or
+// uninstall). Runtime operations - start, stop, status, config - still go
+// through the SCM, which is only contacted when one of them is requested.
+
+#define NT_HANDLE_MANAGER 0x4D43544E  // 'NTCM'
+#define NT_HANDLE_SERVICE 0x5643544E  // 'NTCV'
+
+#define NT_TRIGGER_KEY  L"TriggerInfo\\0"  // First (only) trigger of a service
+#define NT_DEPEND_VALUE L"DependOnService"  // REG_MULTI_SZ of service names
+#define NT_FAILURE_VALUE  L"FailureActions"                     // REG_BINARY, NT_FAILURE_ACTIONS
+#define NT_NONCRASH_VALUE L"FailureActionsOnNonCrashFailures"   // REG_DWORD
+#define NT_FAILURE_ACTIONS_MAX 64  // Actions read back; the rest count as other actions
+
+// FailureActions data, the layout the SCM writes: SERVICE_FAILURE_ACTIONS
+// with its pointers stored as 32-bit fields (0 = no reboot message or
+// command; Actions is the offset of the array), then the SC_ACTION array
+typedef struct _NT_FAILURE_ACTIONS {
+    DWORD ResetPeriod;
+    DWORD RebootMessage;
+    DWORD Command;
+    DWORD ActionCount;
+    DWORD Actions;
+    SC_ACTION Action[NT_FAILURE_ACTIONS_MAX];
+} NT_FAILURE_ACTIONS;
+
+struct NtHandle {
+    DWORD Magic;
+    HANDLE Key;         // Services key (manager) or service subkey
+    SC_HANDLE Scm;      // SCM manager or service handle, opened on demand
+    SCM_NOTIFY Notify;  // Status-change registration on Scm
+    BOOL ConfigInKey;   // Config is queried and changed through Key
+};
+
+static DWORD NtStatusToWin32(NTSTATUS status) {
+    switch (status) {
+        case STATUS_SUCCESS: return ERROR_SUCCESS;
+        case STATUS_OBJECT_NAME_NOT_FOUND: return ERROR_SERVICE_DOES_NOT_EXIST;
+        case STATUS_ACCESS_DENIED: return ERROR_ACCESS_DENIED;
+        default: return RtlNtStatusToDosError ? RtlNtStatusToDosError(status) : ERROR_GEN_FAILURE;
+    }
+}
+
+// Value name of a schema field; its length comes from the table
+static void NtSchemaValueName(const SCHEMA_FIELD& field, UNICODE_STRING* valueName) {
+    valueName->Length = field.ValueNameBytes;
+    valueName->MaximumLength = (USHORT)(field.ValueNameBytes + sizeof(WCHAR));
+    valueName->Buffer = (PWSTR)field.ValueName;
+}
+
+// Write one schema field; only the data of string values needs measuring
+static BOOL SetRegistryField(HANDLE keyHandle, SERVICE_FIELD_ID id, SCHEMA_VALUE value) {
+    const SCHEMA_FIELD& field = SchemaField(id);
+    UNICODE_STRING valueNameUs;
+    NtSchemaValueName(field, &valueNameUs);
+    
+    NTSTATUS status;
+    if (field.Type == SCHEMA_DWORD) {
+        status = NtSetValueKey(keyHandle, &valueNameUs, 0, REG_DWORD, &value.Number, sizeof(DWORD));
+    } else {
+        SIZE_T length = (wcslen(value.Text) + 1) * sizeof(WCHAR);
+        status = NtSetValueKey(keyHandle, &valueNameUs, 0, REG_SZ, (PVOID)value.Text, (ULONG)length);
+    }
+    
+    if (status != STATUS_SUCCESS) {
+        SetLastError(NtStatusToWin32(status));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Create (or open) a subkey of 'root'
+static NTSTATUS NtCreateSubkey(HANDLE* key, HANDLE root, LPCWSTR path) {
+    UNICODE_STRING pathUs;
+    InitUnicodeString(&pathUs, path);
+    
+    OBJECT_ATTRIBUTES oa;
+    InitObjectAttributes(&oa, &pathUs, OBJ_CASE_INSENSITIVE, root);
+    ULONG disposition;
+    return NtCreateKey(key, KEY_ALL_ACCESS, &oa, 0, NULL, REG_OPTION_NON_VOLATILE, &disposition);
+}
+
+static NTSTATUS NtOpenSubkey(HANDLE* key, HANDLE root, LPCWSTR path, ACCESS_MASK access) {
+    UNICODE_STRING pathUs;
+    InitUnicodeString(&pathUs, path);
+    
+    OBJECT_ATTRIBUTES oa;
+    InitObjectAttributes(&oa, &pathUs, OBJ_CASE_INSENSITIVE, root);
+    return NtOpenKey(key, access, &oa);
+}
+
+static NTSTATUS NtSetDwordValue(HANDLE key, LPCWSTR name, DWORD data) {
+    UNICODE_STRING nameUs;
+    InitUnicodeString(&nameUs, name);
+    return NtSetValueKey(key, &nameUs, 0, REG_DWORD, &data, sizeof(data));
+}
+
+// FALSE when the value is missing or not a REG_DWORD
+static BOOL NtReadDwordValue(HANDLE key, LPCWSTR name, DWORD* data) {
+    UNICODE_STRING nameUs;
+    InitUnicodeString(&nameUs, name);
+    ULONGLONG buffer[(sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(DWORD)) / sizeof(ULONGLONG) + 1];
+    KEY_VALUE_PARTIAL_INFORMATION* info = (KEY_VALUE_PARTIAL_INFORMATION*)buffer;
+    ULONG length = 0;
+    if (NtQueryValueKey(key, &nameUs, KeyValuePartialInformation, info, sizeof(buffer), &length) != STATUS_SUCCESS ||
+        info->Type != REG_DWORD || info->DataLength != sizeof(DWORD)) {
+        return FALSE;
+    }
+    memcpy(data, info->Data, sizeof(DWORD));
+    return TRUE;
+}
+
+// TriggerInfo\0 with the trigger type, action and subtype GUID; the SCM
+// reads it at boot just like a trigger set through ChangeServiceConfig2
+static BOOL NtWriteTrigger(HANDLE serviceKey, const SERVICE_START_TRIGGER* trigger) {
+    // NtCreateKey creates one level at a time
+    HANDLE infoKey = NULL;
+    HANDLE triggerKey = NULL;
+    NTSTATUS status = NtCreateSubkey(&infoKey, serviceKey, L"TriggerInfo");
+    if (status == STATUS_SUCCESS) {
+        status = NtCreateSubkey(&triggerKey, infoKey, L"0");
+        NtClose(infoKey);
+    }
+    if (status == STATUS_SUCCESS) {
+        UNICODE_STRING guidName;
+        InitUnicodeString(&guidName, L"Guid");
+        status = NtSetDwordValue(triggerKey, L"Type", trigger->Type);
+        if (status == STATUS_SUCCESS) status = NtSetDwordValue(triggerKey, L"Action", SERVICE_TRIGGER_ACTION_SERVICE_START);
+        if (status == STATUS_SUCCESS) {
+            status = NtSetValueKey(triggerKey, &guidName, 0, REG_BINARY, (PVOID)&trigger->Subtype, sizeof(GUID));
+        }
+        NtClose(triggerKey);
+    }
+    
+    if (status != STATUS_SUCCESS) {
+        SetLastError(NtStatusToWin32(status));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Characters of a double-null-terminated list, both terminators included
+static size_t NtMultiStringChars(LPCWSTR list) {
+    LPCWSTR cursor = list;
+    while (*cursor) cursor += wcslen(cursor) + 1;
+    return (size_t)(cursor - list) + 1;
+}
+
+static BOOL NtWriteDependencies(HANDLE serviceKey, LPCWSTR dependencies) {
+    UNICODE_STRING valueName;
+    InitUnicodeString(&valueName, NT_DEPEND_VALUE);
+    ULONG length = (ULONG)(NtMultiStringChars(dependencies) * sizeof(WCHAR));
+    NTSTATUS status = NtSetValueKey(serviceKey, &valueName, 0, REG_MULTI_SZ, (PVOID)dependencies, length);
+    if (status != STATUS_SUCCESS) {
+        SetLastError(NtStatusToWin32(status));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// FailureActions with one restart action per delay, and the non-crash
+// failure flag; no restarts writes an empty action list
+static BOOL NtWriteRecovery(HANDLE serviceKey, const SERVICE_RECOVERY* recovery) {
+    if (recovery->RestartCount > SERVICE_RECOVERY_MAX_RESTARTS) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    
+    NT_FAILURE_ACTIONS data;
+    memset(&data, 0, sizeof(data));
+    data.ResetPeriod = recovery->ResetPeriod;
+    data.ActionCount = recovery->RestartCount;
+    data.Actions = (DWORD)offsetof(NT_FAILURE_ACTIONS, Action);
+    for (DWORD i = 0; i < recovery->RestartCount; i++) {
+        data.Action[i].Type = SC_ACTION_RESTART;
+        data.Action[i].Delay = recovery->RestartDelayMs[i];
+    }
+    
+    UNICODE_STRING valueName;
+    InitUnicodeString(&valueName, NT_FAILURE_VALUE);
+    ULONG length = (ULONG)(offsetof(NT_FAILURE_ACTIONS, Action) + recovery->RestartCount * sizeof(SC_ACTION));
+    NTSTATUS status = NtSetValueKey(serviceKey, &valueName, 0, REG_BINARY, &data, length);
+    if (status == STATUS_SUCCESS) status = NtSetDwordValue(serviceKey, NT_NONCRASH_VALUE, recovery->OnNonCrashFailure ? 1 : 0);
+    if (status != STATUS_SUCCESS) {
+        SetLastError(NtStatusToWin32(status));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Leading restart actions become the restart delays; any other action, or
+// restarts past SERVICE_RECOVERY_MAX_RESTARTS, only sets OtherActions
+static void NtCollectRecovery(const SC_ACTION* actions, DWORD count, SERVICE_RECOVERY* recovery) {
+    for (DWORD i = 0; i < count; i++) {
+        if (actions[i].Type != SC_ACTION_RESTART || recovery->OtherActions ||
+            recovery->RestartCount == SERVICE_RECOVERY_MAX_RESTARTS) {
+            recovery->OtherActions = TRUE;
+            continue;
+        }
+        recovery->RestartDelayMs[recovery->RestartCount++] = actions[i].Delay;
+    }
+}
+
+static BOOL NtReadRecovery(HANDLE serviceKey, SERVICE_RECOVERY* recovery) {
+    memset(recovery, 0, sizeof(*recovery));
+    ULONGLONG buffer[(sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(NT_FAILURE_ACTIONS)) / sizeof(ULONGLONG) + 1];
+    KEY_VALUE_PARTIAL_INFORMATION* info = (KEY_VALUE_PARTIAL_INFORMATION*)buffer;
+    const size_t header = offsetof(NT_FAILURE_ACTIONS, Action);
+    
+    UNICODE_STRING valueName;
+    InitUnicodeString(&valueName, NT_FAILURE_VALUE);
+    ULONG length = 0;
+    NTSTATUS status = NtQueryValueKey(serviceKey, &valueName, KeyValuePartialInformation, info, sizeof(buffer), &length);
+    if (status == STATUS_OBJECT_NAME_NOT_FOUND) return TRUE;  // No policy
+    if (status == STATUS_BUFFER_OVERFLOW) {
+        recovery->OtherActions = TRUE;  // More actions than we read back
+        return TRUE;
+    }
+    if (status != STATUS_SUCCESS) {
+        SetLastError(NtStatusToWin32(status));
+        return FALSE;
+    }
+    if (info->Type != REG_BINARY || info->DataLength < header) {
+        recovery->OtherActions = TRUE;
+        return TRUE;
+    }
+    
+    NT_FAILURE_ACTIONS data;
+    memset(&data, 0, sizeof(data));
+    memcpy(&data, info->Data, info->DataLength < sizeof(data) ? info->DataLength : sizeof(data));
+    DWORD stored = (DWORD)((info->DataLength - header) / sizeof(SC_ACTION));
+    recovery->ResetPeriod = data.ResetPeriod;
+    NtCollectRecovery(data.Action, data.ActionCount < stored ? data.ActionCount : stored, recovery);
+    
+    InitUnicodeString(&valueName, NT_NONCRASH_VALUE);
+    status = NtQueryValueKey(serviceKey, &valueName, KeyValuePartialInformation, info, sizeof(buffer), &length);
+    if (status == STATUS_SUCCESS && info->Type == REG_DWORD && info->DataLength == sizeof(DWORD)) {
+        DWORD flag;
+        memcpy(&flag, info->Data, sizeof(flag));
+        recovery->OnNonCrashFailure = flag != 0;
+    }
+    return TRUE;
+}
+
+// A key with subkeys cannot be deleted: remove TriggerInfo\0, \1, ...
+// and then TriggerInfo (absent unless a trigger was installed)
+static void NtDeleteTrigger(HANDLE serviceKey) {
+    for (DWORD i = 0;; i++) {
+        WCHAR path[32];
+        swprintf(path, sizeof(path) / sizeof(WCHAR), L"TriggerInfo\\%u", i);
+        HANDLE key = NULL;
+        if (NtOpenSubkey(&key, serviceKey, path, DELETE) != STATUS_SUCCESS) break;
+        NtDeleteKey(key);
+        NtClose(key);
+    }
+    
+    HANDLE key = NULL;
+    if (NtOpenSubkey(&key, serviceKey, L"TriggerInfo", DELETE) != STATUS_SUCCESS) return;
+    NtDeleteKey(key);
+    NtClose(key);
+}
+
+// DelayedAutostart, and TriggerInfo\0 as NtWriteTrigger lays it out; a
+// second trigger, or one that does more than start the service, only sets
+// OtherTriggers
+static BOOL NtReadStartOptions(HANDLE serviceKey, SERVICE_START_OPTIONS* options) {
+    memset(options, 0, sizeof(*options));
+    DWORD delayed = 0;
+    if (NtReadDwordValue(serviceKey, SchemaField(FIELD_DELAYED_AUTO_START).ValueName, &delayed)) {
+        options->DelayedAutoStart = delayed != 0;
+    }
+    
+    HANDLE triggerKey = NULL;
+    if (NtOpenSubkey(&triggerKey, serviceKey, NT_TRIGGER_KEY, KEY_QUERY_VALUE) != STATUS_SUCCESS) return TRUE;
+    ULONGLONG buffer[(sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(GUID)) / sizeof(ULONGLONG) + 1];
+    KEY_VALUE_PARTIAL_INFORMATION* info = (KEY_VALUE_PARTIAL_INFORMATION*)buffer;
+    UNICODE_STRING guidName;
+    InitUnicodeString(&guidName, L"Guid");
+    DWORD type = 0, action = 0;
+    ULONG length = 0;
+    if (NtReadDwordValue(triggerKey, L"Type", &type) && NtReadDwordValue(triggerKey, L"Action", &action) &&
+        action == SERVICE_TRIGGER_ACTION_SERVICE_START &&
+        NtQueryValueKey(triggerKey, &guidName, KeyValuePartialInformation, info, sizeof(buffer), &length) ==
+            STATUS_SUCCESS &&
+        info->Type == REG_BINARY && info->DataLength == sizeof(GUID)) {
+        options->Trigger.Type = type;
+        memcpy(&options->Trigger.Subtype, info->Data, sizeof(GUID));
+    } else {
+        options->OtherTriggers = TRUE;
+    }
+    NtClose(triggerKey);
+    
+    if (NtOpenSubkey(&triggerKey, serviceKey, L"TriggerInfo\\1", KEY_QUERY_VALUE) == STATUS_SUCCESS) {
+        options->OtherTriggers = TRUE;
+        NtClose(triggerKey);
+    }
+    return TRUE;
+}
+
+// Delayed start always written, so FALSE clears an earlier TRUE; the
+// triggers are replaced as a whole
+static BOOL NtWriteStartOptions(HANDLE serviceKey, const SERVICE_START_OPTIONS* options) {
+    SCHEMA_VALUE delayed = { (DWORD)(options->DelayedAutoStart ? TRUE : FALSE), NULL };
+    if (!SetRegistryField(serviceKey, FIELD_DELAYED_AUTO_START, delayed)) return FALSE;
+    NtDeleteTrigger(serviceKey);
+    return !options->Trigger.Type || NtWriteTrigger(serviceKey, &options->Trigger);
+}
+
+static NtHandle* NtNewHandle(DWORD magic) {
+    NtHandle* h = new NtHandle();
+    h->Magic = magic;
+    h->Key = NULL;
+    h->Scm = NULL;
+    h->ConfigInKey = FALSE;
+    ScmNotifyInit(&h->Notify);
+    return h;
+}
+
+static NtHandle* NtCheckHandle(SVC_HANDLE handle, DWORD magic) {
+    NtHandle* h = (NtHandle*)handle;
+    if (!h || h->Magic != magic) {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return NULL;
+    }
+    return h;
+}
+
+// Open the Services registry key on first use
+static HANDLE NtManagerKey(NtHandle* manager) {
+    if (manager->Key) return manager->Key;
+    
+    UNICODE_STRING servicesPath;
+    InitUnicodeString(&servicesPath, SERVICES_KEY_PATH);
+    
+    OBJECT_ATTRIBUTES servicesOa;
+    InitObjectAttributes(&servicesOa, &servicesPath, OBJ_CASE_INSENSITIVE, NULL);
+    
+    NTSTATUS status = NtOpenKey(&manager->Key, KEY_CREATE_SUB_KEY | KEY_ENUMERATE_SUB_KEYS, &servicesOa);
+    if (status != STATUS_SUCCESS) {
+        manager->Key = NULL;
+        SetLastError(NtStatusToWin32(status));
+        return NULL;
+    }
+    return manager->Key;
+}
+
+// Open the SCM on first use (runtime operations and enumeration only).
+// Enumeration runs outside the session lock, so publish the handle with a
+// compare-exchange and drop ours if another thread got there first.
+static SC_HANDLE NtManagerScm(NtHandle* manager) {
+    if (manager->Scm) return manager->Scm;
+    
+    SC_HANDLE scm = OpenSCManagerW(NULL, NULL, SC_MANAGER_CONNECT | SC_MANAGER_ENUMERATE_SERVICE);
+    if (!scm) return NULL;
+    if (InterlockedCompareExchangePointer((PVOID*)&manager->Scm, scm, NULL) != NULL) {
+        CloseServiceHandle(scm);
+    }
+    return manager->Scm;
+}
+
+static BOOL NtInitialize() {
+    return InitNtFunctions();
+}
+
+static SVC_HANDLE NtConnect(DWORD desiredAccess) {
+    (void)desiredAccess;
+    return (SVC_HANDLE)NtNewHandle(NT_HANDLE_MANAGER);
+}
+
+// DELETE and SERVICE_CHANGE_CONFIG open the service's registry key: config
+// is then read and written there, so a service the SCM has not loaded yet
+// can be reconfigured. Every other right is satisfied by an SCM service
+// handle.
+static SVC_HANDLE NtOpen(SVC_HANDLE manager, LPCWSTR serviceName, DWORD desiredAccess) {
+    NtHandle* m = NtCheckHandle(manager, NT_HANDLE_MANAGER);
+    if (!m) return NULL;
+    
+    NtHandle* h = NtNewHandle(NT_HANDLE_SERVICE);
+    ACCESS_MASK keyAccess = desiredAccess & DELETE;
+    DWORD scmAccess = desiredAccess & ~DELETE;
+    if (desiredAccess & SERVICE_CHANGE_CONFIG) {
+        keyAccess |= KEY_QUERY_VALUE | KEY_SET_VALUE | KEY_CREATE_SUB_KEY;  // Subkeys: start triggers
+        scmAccess &= ~(SERVICE_CHANGE_CONFIG | SERVICE_QUERY_CONFIG);
+        h->ConfigInKey = TRUE;
+    }
+    
+    if (keyAccess) {
+        HANDLE servicesKey = NtManagerKey(m);
+        if (!servicesKey) goto fail;
+        
+        UNICODE_STRING serviceNameUs;
+        InitUnicodeString(&serviceNameUs, serviceName);
+        
+        OBJECT_ATTRIBUTES serviceOa;
+        InitObjectAttributes(&serviceOa, &serviceNameUs, OBJ_CASE_INSENSITIVE, servicesKey);
+        
+        NTSTATUS status = NtOpenKey(&h->Key, keyAccess, &serviceOa);
+        if (status != STATUS_SUCCESS) {
+            h->Key = NULL;
+            SetLastError(NtStatusToWin32(status));
+            goto fail;
+        }
+    }
+    
+    if (scmAccess) {
+        SC_HANDLE scm = NtManagerScm(m);
+        if (!scm) goto fail;
+        
+        h->Scm = OpenServiceW(scm, serviceName, scmAccess);
+        if (!h->Scm) goto fail;
+    }
+    
+    return (SVC_HANDLE)h;
+    
+fail:
+    DWORD err = GetLastError();
+    if (h->Key) NtClose(h->Key);
+    delete h;
+    SetLastError(err);
+    return NULL;
+}
+
+static SVC_HANDLE NtCreate(SVC_HANDLE manager, const SERVICE_INSTALL_SPEC* spec) {
+    NtHandle* m = NtCheckHandle(manager, NT_HANDLE_MANAGER);
+    if (!m) return NULL;
+    
+    HANDLE servicesKey = NtManagerKey(m);
+    if (!servicesKey) return NULL;
+    
+    // Create service subkey
+    UNICODE_STRING serviceNameUs;
+    InitUnicodeString(&serviceNameUs, spec->ServiceName);
+    
+    OBJECT_ATTRIBUTES serviceOa;
+    InitObjectAttributes(&serviceOa, &serviceNameUs, OBJ_CASE_INSENSITIVE, servicesKey);
+    
+    HANDLE serviceKey = NULL;
+    ULONG disposition;
+    NTSTATUS status = NtCreateKey(
+        &serviceKey,
+        KEY_ALL_ACCESS,
+        &serviceOa,
+        0,
+        NULL,
+        REG_OPTION_NON_VOLATILE,
+        &disposition
+    );
+    
+    if (status != STATUS_SUCCESS) {
+        SetLastError(NtStatusToWin32(status));
+        return NULL;
+    }
+    
+    // Set service parameters: every install field of the schema that has a value
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        const SCHEMA_FIELD& field = g_ServiceSchema[i];
+        if (!(field.Flags & SCHEMA_INSTALL)) continue;
+        
+        SCHEMA_VALUE value = SchemaSpecValue(spec, field.Id);
+        if (field.Type == SCHEMA_STRING && !value.Text) continue;
+        if ((field.Flags & SCHEMA_OPTIONAL) && field.Type == SCHEMA_DWORD && value.Number == field.DefaultNumber) continue;
+        if (!SetRegistryField(serviceKey, field.Id, value)) {
+            DWORD err = GetLastError();
+            NtClose(serviceKey);
+            SetLastError(err);
+            return NULL;
+        }
+    }
+    
+    // Start trigger and recovery policy, in the layouts the SCM itself
+    // writes, and the services the SCM must start first
+    if ((spec->Trigger.Type && !NtWriteTrigger(serviceKey, &spec->Trigger)) ||
+        (spec->Recovery.RestartCount && !NtWriteRecovery(serviceKey, &spec->Recovery)) ||
+        (spec->Dependencies && *spec->Dependencies && !NtWriteDependencies(serviceKey, spec->Dependencies))) {
+        DWORD err = GetLastError();
+        NtClose(serviceKey);
+        SetLastError(err);
+        return NULL;
+    }
+    
+    NtHandle* h = NtNewHandle(NT_HANDLE_SERVICE);
+    h->Key = serviceKey;
+    h->ConfigInKey = TRUE;
+    return (SVC_HANDLE)h;
+}
+
+static BOOL NtSetDescription(SVC_HANDLE service, LPCWSTR description) {
+    NtHandle* h = NtCheckHandle(service, NT_HANDLE_SERVICE);
+    if (!h) return FALSE;
+    
+    if (h->Key) {
+        SCHEMA_VALUE value = { 0, description };
+        return SetRegistryField(h->Key, FIELD_DESCRIPTION, value);
+    }
+    
+    SERVICE_DESCRIPTIONW sd;
+    sd.lpDescription = (LPWSTR)description;
+    return ChangeServiceConfig2W(h->Scm, SERVICE_CONFIG_DESCRIPTION, &sd);
+}
+
+static BOOL NtDelete(SVC_HANDLE service) {
+    NtHandle* h = NtCheckHandle(service, NT_HANDLE_SERVICE);
+    if (!h) return FALSE;
+    if (!h->Key) {
+        SetLastError(ERROR_ACCESS_DENIED);
+        return FALSE;
+    }
+    
+    NtDeleteTrigger(h->Key);
+    NTSTATUS status = NtDeleteKey(h->Key);
+    if (status != STATUS_SUCCESS) {
+        SetLastError(NtStatusToWin32(status));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static SC_HANDLE NtServiceScm(SVC_HANDLE service) {
+    NtHandle* h = NtCheckHandle(service, NT_HANDLE_SERVICE);
+    if (!h) return NULL;
+    if (!h->Scm) {
+        SetLastError(ERROR_ACCESS_DENIED);
+        return NULL;
+    }
+    return h->Scm;
+}
+
+static BOOL NtStart(SVC_HANDLE service) {
+    SC_HANDLE scm = NtServiceScm(service);
+    return scm ? StartServiceW(scm, 0, NULL) : FALSE;
+}
+
+static BOOL NtControl(SVC_HANDLE service, DWORD control, SERVICE_STATUS* status) {
+    SC_HANDLE scm = NtServiceScm(service);
+    SERVICE_STATUS ignored;
+    return scm ? ControlService(scm, control, status ? status : &ignored) : FALSE;
+}
+
+static BOOL NtQueryStatus(SVC_HANDLE service, SERVICE_STATUS* status) {
+    SC_HANDLE scm = NtServiceScm(service);
+    return scm ? QueryServiceStatus(scm, status) : FALSE;
+}
+
+static BOOL NtQueryKeyConfig(HANDLE serviceKey, LPQUERY_SERVICE_CONFIGW config, DWORD bufSize, LPDWORD bytesNeeded);
+
+static BOOL NtQueryConfig(SVC_HANDLE service, LPQUERY_SERVICE_CONFIGW config, DWORD bufSize, LPDWORD bytesNeeded) {
+    NtHandle* h = NtCheckHandle(service, NT_HANDLE_SERVICE);
+    if (!h) return FALSE;
+    if (h->ConfigInKey) return NtQueryKeyConfig(h->Key, config, bufSize, bytesNeeded);
+    
+    SC_HANDLE scm = NtServiceScm(service);
+    return scm ? QueryServiceConfigW(scm, config, bufSize, bytesNeeded) : FALSE;
+}
+
+// Registry writes of the fields that are set, like install; the SCM picks
+// them up when it next loads the service
+static BOOL NtChangeConfig(SVC_HANDLE service, const QUERY_SERVICE_CONFIGW* changes) {
+    NtHandle* h = NtCheckHandle(service, NT_HANDLE_SERVICE);
+    if (!h) return FALSE;
+    if (!h->ConfigInKey) {
+        SetLastError(ERROR_ACCESS_DENIED);
+        return FALSE;
+    }
+    
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        SERVICE_FIELD_ID id = g_ServiceSchema[i].Id;
+        if (!SchemaConfigIsSet(changes, id)) continue;
+        if (!SetRegistryField(h->Key, id, SchemaConfigValue(changes, id))) return FALSE;
+    }
+    return !changes->lpDependencies || NtWriteDependencies(h->Key, changes->lpDependencies);
+}
+
+// QueryServiceConfig2W into the scratch buffer, growing and retrying once
+// when the hint was too small (as ScratchQueryConfig)
+static LPBYTE NtQueryConfig2(SC_HANDLE scm, DWORD infoLevel, SCRATCH_BUFFER* scratch) {
+    if (!ScratchReserve(scratch, SCRATCH_SIZE_HINT)) return NULL;
+    
+    DWORD needed = 0;
+    if (QueryServiceConfig2W(scm, infoLevel, scratch->Data, scratch->Size, &needed)) return scratch->Data;
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER || !ScratchReserve(scratch, needed)) return NULL;
+    
+    if (!QueryServiceConfig2W(scm, infoLevel, scratch->Data, scratch->Size, &needed)) return NULL;
+    return scratch->Data;
+}
+
+static BOOL NtQueryRecovery(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_RECOVERY* recovery) {
+    NtHandle* h = NtCheckHandle(service, NT_HANDLE_SERVICE);
+    if (!h) return FALSE;
+    if (h->ConfigInKey) return NtReadRecovery(h->Key, recovery);
+    
+    SC_HANDLE scm = NtServiceScm(service);
+    if (!scm) return FALSE;
+    SERVICE_FAILURE_ACTIONS_FLAG flag;
+    DWORD needed = 0;
+    if (!QueryServiceConfig2W(scm, SERVICE_CONFIG_FAILURE_ACTIONS_FLAG, (LPBYTE)&flag, sizeof(flag), &needed)) {
+        return FALSE;
+    }
+    const SERVICE_FAILURE_ACTIONSW* actions =
+        (const SERVICE_FAILURE_ACTIONSW*)NtQueryConfig2(scm, SERVICE_CONFIG_FAILURE_ACTIONS, scratch);
+    if (!actions) return FALSE;
+    
+    memset(recovery, 0, sizeof(*recovery));
+    recovery->ResetPeriod = actions->dwResetPeriod;
+    recovery->OnNonCrashFailure = flag.fFailureActionsOnNonCrashFailures;
+    NtCollectRecovery(actions->lpsaActions, actions->lpsaActions ? actions->cActions : 0, recovery);
+    return TRUE;
+}
+
+// Registry write like install; the SCM picks it up when it next loads the
+// service
+static BOOL NtChangeRecovery(SVC_HANDLE service, const SERVICE_RECOVERY* recovery) {
+    NtHandle* h = NtCheckHandle(service, NT_HANDLE_SERVICE);
+    if (!h) return FALSE;
+    if (!h->ConfigInKey) {
+        SetLastError(ERROR_ACCESS_DENIED);
+        return FALSE;
+    }
+    return NtWriteRecovery(h->Key, recovery);
+}
+
+static BOOL NtQueryStartOptions(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_START_OPTIONS* options) {
+    NtHandle* h = NtCheckHandle(service, NT_HANDLE_SERVICE);
+    if (!h) return FALSE;
+    if (h->ConfigInKey) return NtReadStartOptions(h->Key, options);
+    
+    SC_HANDLE scm = NtServiceScm(service);
+    if (!scm) return FALSE;
+    SERVICE_DELAYED_AUTO_START_INFO delayed;
+    DWORD needed = 0;
+    if (!QueryServiceConfig2W(scm, SERVICE_CONFIG_DELAYED_AUTO_START_INFO, (LPBYTE)&delayed, sizeof(delayed), &needed)) {
+        return FALSE;
+    }
+    const SERVICE_TRIGGER_INFO* info = (const SERVICE_TRIGGER_INFO*)NtQueryConfig2(scm, SERVICE_CONFIG_TRIGGER_INFO, scratch);
+    if (!info) return FALSE;
+    
+    memset(options, 0, sizeof(*options));
+    options->DelayedAutoStart = delayed.fDelayedAutostart;
+    DWORD count = info->pTriggers ? info->cTriggers : 0;
+    for (DWORD i = 0; i < count; i++) {
+        const SERVICE_TRIGGER& trigger = info->pTriggers[i];
+        if (i > 0 || trigger.dwAction != SERVICE_TRIGGER_ACTION_SERVICE_START || !trigger.pTriggerSubtype ||
+            trigger.cDataItems) {
+            options->OtherTriggers = TRUE;
+            continue;
+        }
+        options->Trigger.Type = trigger.dwTriggerType;
+        options->Trigger.Subtype = *trigger.pTriggerSubtype;
+    }
+    return TRUE;
+}
+
+// Registry writes like install
+static BOOL NtChangeStartOptions(SVC_HANDLE service, const SERVICE_START_OPTIONS* options) {
+    NtHandle* h = NtCheckHandle(service, NT_HANDLE_SERVICE);
+    if (!h) return FALSE;
+    if (!h->ConfigInKey) {
+        SetLastError(ERROR_ACCESS_DENIED);
+        return FALSE;
+    }
+    return NtWriteStartOptions(h->Key, options);
+}
+
+// Enumeration has no registry equivalent worth the cost (the Services key
+// also holds drivers and stale entries), so it always goes through the SCM
+static BOOL NtEnumServices(SVC_HANDLE manager, DWORD serviceType, DWORD serviceState, LPBYTE buffer, DWORD bufSize,
+    LPDWORD bytesNeeded, LPDWORD servicesReturned, LPDWORD resumeHandle) {
+    NtHandle* m = NtCheckHandle(manager, NT_HANDLE_MANAGER);
+    if (!m) return FALSE;
+    
+    SC_HANDLE scm = NtManagerScm(m);
+    if (!scm) return FALSE;
+    return EnumServicesStatusExW(scm, SC_ENUM_PROCESS_INFO, serviceType, serviceState,
+        buffer, bufSize, bytesNeeded, servicesReturned, resumeHandle, NULL);
+}
+
+static BOOL NtEnumDependents(SVC_HANDLE service, DWORD serviceState, LPENUM_SERVICE_STATUSW services, DWORD bufSize,
+    LPDWORD bytesNeeded, LPDWORD servicesReturned) {
+    SC_HANDLE scm = NtServiceScm(service);
+    return scm ? EnumDependentServicesW(scm, serviceState, services, bufSize, bytesNeeded, servicesReturned) : FALSE;
+}
+
+static DWORD NtWaitStatusChange(SVC_HANDLE* services, const DWORD* knownStates, DWORD count, DWORD timeoutMs) {
+    std::vector<SC_HANDLE> handles(count);
+    std::vector<SCM_NOTIFY*> notifies(count);
+    
+    for (DWORD i = 0; i < count; i++) {
+        NtHandle* h = NtCheckHandle(services[i], NT_HANDLE_SERVICE);
+        if (!h) return WAIT_FAILED;
+        if (!h->Scm) {
+            SetLastError(ERROR_INVALID_HANDLE);
+            return WAIT_FAILED;
+        }
+        handles[i] = h->Scm;
+        notifies[i] = &h->Notify;
+    }
+    return ScmWaitStatusChange(handles.data(), notifies.data(), knownStates, count, timeoutMs);
+}
+
+// Buffers for one registry walk, reused for every entry so a full-host
+// inventory allocates nothing per service. String values longer than
+// NT_VALUE_CHARS read as missing.
+#define NT_VALUE_CHARS  1024
+#define NT_KEY_CHARS    256   // Longest registry key name
+
+struct NtRegistryBuffers {
+    ULONGLONG KeyInfo[(sizeof(KEY_BASIC_INFORMATION) + NT_KEY_CHARS * sizeof(WCHAR)) / sizeof(ULONGLONG) + 1];
+    WCHAR Name[NT_KEY_CHARS + 1];
+    ULONGLONG Values[FIELD_COUNT][(sizeof(KEY_VALUE_PARTIAL_INFORMATION) + (NT_VALUE_CHARS + 1) * sizeof(WCHAR)) /
+        sizeof(ULONGLONG) + 1];
+    ULONGLONG Dependencies[(sizeof(KEY_VALUE_PARTIAL_INFORMATION) + (NT_VALUE_CHARS + 2) * sizeof(WCHAR)) /
+        sizeof(ULONGLONG) + 1];
+};
+
+// Read the fields carrying 'flags' of one service key, each into its own
+// buffer
+static void NtReadServiceValues(HANDLE serviceKey, NtRegistryBuffers* buffers, QUERY_SERVICE_CONFIGW* config,
+    DWORD flags) {
+    SchemaInitConfig(config);
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        const SCHEMA_FIELD& field = g_ServiceSchema[i];
+        if (!(field.Flags & flags)) continue;
+        
+        UNICODE_STRING valueName;
+        NtSchemaValueName(field, &valueName);
+        KEY_VALUE_PARTIAL_INFORMATION* info = (KEY_VALUE_PARTIAL_INFORMATION*)buffers->Values[i];
+        ULONG length = 0;
+        // Keep room for a terminator: REG_SZ data need not carry one
+        NTSTATUS status = NtQueryValueKey(serviceKey, &valueName, KeyValuePartialInformation, info,
+            sizeof(buffers->Values[i]) - sizeof(WCHAR), &length);
+        if (status != STATUS_SUCCESS) continue;
+        
+        SCHEMA_VALUE value = { SERVICE_NO_CHANGE, NULL };
+        if (field.Type == SCHEMA_DWORD) {
+            if (info->Type != REG_DWORD || info->DataLength != sizeof(DWORD)) continue;
+            memcpy(&value.Number, info->Data, sizeof(DWORD));
+        } else {
+            if (info->Type != REG_SZ && info->Type != REG_EXPAND_SZ) continue;
+            WCHAR* text = (WCHAR*)info->Data;
+            text[info->DataLength / sizeof(WCHAR)] = L'\0';
+            value.Text = text;
+        }
+        SchemaStoreConfig(config, field.Id, value);
+    }
+}
+
+// DependOnService as a double-null-terminated list, NULL when absent
+static LPCWSTR NtReadDependencies(HANDLE serviceKey, NtRegistryBuffers* buffers) {
+    UNICODE_STRING valueName;
+    InitUnicodeString(&valueName, NT_DEPEND_VALUE);
+    KEY_VALUE_PARTIAL_INFORMATION* info = (KEY_VALUE_PARTIAL_INFORMATION*)buffers->Dependencies;
+    ULONG length = 0;
+    // Keep room for two terminators: the data need not carry them
+    NTSTATUS status = NtQueryValueKey(serviceKey, &valueName, KeyValuePartialInformation, info,
+        sizeof(buffers->Dependencies) - 2 * sizeof(WCHAR), &length);
+    if (status != STATUS_SUCCESS || info->Type != REG_MULTI_SZ) return NULL;
+    
+    WCHAR* list = (WCHAR*)info->Data;
+    list[info->DataLength / sizeof(WCHAR)] = L'\0';
+    list[info->DataLength / sizeof(WCHAR) + 1] = L'\0';
+    return list;
+}
+
+// QueryServiceConfigW from the registry: the installed fields and the
+// dependencies, packed into the caller's buffer the same way (strings after
+// the structure)
+static BOOL NtQueryKeyConfig(HANDLE serviceKey, LPQUERY_SERVICE_CONFIGW config, DWORD bufSize, LPDWORD bytesNeeded) {
+    NtRegistryBuffers buffers;
+    QUERY_SERVICE_CONFIGW values;
+    memset(&values, 0, sizeof(values));
+    NtReadServiceValues(serviceKey, &buffers, &values, SCHEMA_INSTALL);
+    LPCWSTR dependencies = NtReadDependencies(serviceKey, &buffers);
+    size_t dependencyChars = dependencies ? NtMultiStringChars(dependencies) : 0;
+    
+    DWORD needed = (DWORD)(sizeof(QUERY_SERVICE_CONFIGW) + dependencyChars * sizeof(WCHAR));
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        const SCHEMA_FIELD& field = g_ServiceSchema[i];
+        if (field.Type != SCHEMA_STRING || !SchemaConfigIsSet(&values, field.Id)) continue;
+        needed += (DWORD)((wcslen(SchemaConfigValue(&values, field.Id).Text) + 1) * sizeof(WCHAR));
+    }
+    if (bytesNeeded) *bytesNeeded = needed;
+    if (!config || bufSize < needed) {
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return FALSE;
+    }
+    
+    *config = values;
+    WCHAR* cursor = (WCHAR*)(config + 1);
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        const SCHEMA_FIELD& field = g_ServiceSchema[i];
+        if (field.Type != SCHEMA_STRING || !SchemaConfigIsSet(&values, field.Id)) continue;
+        
+        SCHEMA_VALUE value = SchemaConfigValue(&values, field.Id);
+        size_t chars = wcslen(value.Text) + 1;
+        wmemcpy(cursor, value.Text, chars);
+        value.Text = cursor;
+        SchemaStoreConfig(config, field.Id, value);
+        cursor += chars;
+    }
+    if (dependencies) {
+        wmemcpy(cursor, dependencies, dependencyChars);
+        config->lpDependencies = cursor;
+    }
+    return TRUE;
+}
+
+static NTSTATUS NtVisitService(HANDLE servicesKey, LPCWSTR serviceName, NtRegistryBuffers* buffers,
+    SERVICE_REGISTRY_ROUTINE routine, PVOID context, BOOL* more) {
+    HANDLE serviceKey = NULL;
+    NTSTATUS status = NtOpenSubkey(&serviceKey, servicesKey, serviceName, KEY_QUERY_VALUE);
+    if (status != STATUS_SUCCESS) return status;
+    
+    SERVICE_REGISTRY_ENTRY entry;
+    entry.Name = serviceName;
+    NtReadServiceValues(serviceKey, buffers, &entry.Config, SCHEMA_INVENTORY);
+    NtClose(serviceKey);
+    *more = routine(context, &entry);
+    return STATUS_SUCCESS;
+}
+
+// Walks the Services key on a read-only handle of its own: no create rights
+// needed and no SCM call at all
+static BOOL NtReadRegistry(SVC_HANDLE manager, LPCWSTR serviceName, SERVICE_REGISTRY_ROUTINE routine, PVOID context) {
+    if (!NtCheckHandle(manager, NT_HANDLE_MANAGER)) return FALSE;
+    if (!NtEnumerateKey || !NtQueryValueKey) {
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return FALSE;
+    }
+    
+    HANDLE servicesKey = NULL;
+    NTSTATUS status = NtOpenSubkey(&servicesKey, NULL, SERVICES_KEY_PATH, KEY_ENUMERATE_SUB_KEYS | KEY_QUERY_VALUE);
+    if (status != STATUS_SUCCESS) {
+        SetLastError(NtStatusToWin32(status));
+        return FALSE;
+    }
+    
+    NtRegistryBuffers buffers;
+    BOOL more = TRUE;
+    if (serviceName) {
+        status = NtVisitService(servicesKey, serviceName, &buffers, routine, context, &more);
+    } else {
+        KEY_BASIC_INFORMATION* info = (KEY_BASIC_INFORMATION*)buffers.KeyInfo;
+        for (ULONG index = 0; more; index++) {
+            ULONG length = 0;
+            status = NtEnumerateKey(servicesKey, index, KeyBasicInformation, info, sizeof(buffers.KeyInfo), &length);
+            if (status == STATUS_NO_MORE_ENTRIES) {
+                status = STATUS_SUCCESS;
+                break;
+            }
+            if (status == STATUS_BUFFER_OVERFLOW) continue;  // Longer than any service name
+            if (status != STATUS_SUCCESS) break;
+            
+            ULONG chars = info->NameLength / sizeof(WCHAR);
+            memcpy(buffers.Name, info->Name, chars * sizeof(WCHAR));
+            buffers.Name[chars] = L'\0';
+            // A subkey we may not read is left out rather than ending the walk
+            NtVisitService(servicesKey, buffers.Name, &buffers, routine, context, &more);
+        }
+    }
+    NtClose(servicesKey);
+    
+    if (status != STATUS_SUCCESS) {
+        SetLastError(NtStatusToWin32(status));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+#define NT_PROCESS_BUFFER_HINT  (512 * 1024)  // Typical desktop process list, threads included
+
+// One NtQuerySystemInformation call returns every process with its times,
+// memory, handle and thread counts: no process handles are opened, so
+// protected service processes are sampled too
+static BOOL NtQueryProcesses(SERVICE_PROCESS_USAGE* usage, DWORD count) {
+    if (!NtQuerySystemInformation) {
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return FALSE;
+    }
+    
+    std::vector<BYTE> buffer(NT_PROCESS_BUFFER_HINT);
+    NTSTATUS status;
+    for (;;) {
+        ULONG length = 0;
+        status = NtQuerySystemInformation(SystemProcessInformation, buffer.data(), (ULONG)buffer.size(), &length);
+        if (status != STATUS_INFO_LENGTH_MISMATCH) break;
+        // The list may grow between calls: leave room for new processes
+        buffer.resize((length > buffer.size() ? length : buffer.size()) + 64 * 1024);
+    }
+    if (status != STATUS_SUCCESS) {
+        SetLastError(NtStatusToWin32(status));
+        return FALSE;
+    }
+    
+    for (DWORD i = 0; i < count; i++) {
+        usage[i].Present = FALSE;
+    }
+    ULONG offset = 0;
+    for (;;) {
+        SYSTEM_PROCESS_INFORMATION* process = (SYSTEM_PROCESS_INFORMATION*)(buffer.data() + offset);
+        DWORD pid = (DWORD)(ULONG_PTR)process->UniqueProcessId;
+        for (DWORD i = 0; i < count; i++) {
+            if (usage[i].ProcessId != pid || pid == 0) continue;
+            usage[i].Present = TRUE;
+            usage[i].CpuTime = (ULONGLONG)(process->KernelTime.QuadPart + process->UserTime.QuadPart);
+            usage[i].WorkingSet = process->WorkingSetSize;
+            usage[i].PrivateBytes = process->PagefileUsage;
+            usage[i].HandleCount = process->HandleCount;
+            usage[i].ThreadCount = process->NumberOfThreads;
+        }
+        if (process->NextEntryOffset == 0) break;
+        offset += process->NextEntryOffset;
+    }
+    return TRUE;
+}
+
+static void NtCloseHandle(SVC_HANDLE handle) {
+    NtHandle* h = (NtHandle*)handle;
+    if (!h) return;
+    
+    if (h->Key) NtClose(h->Key);
+    // Drains the status-change callbacks that still point into h
+    if (h->Scm) ScmNotifyClose(h->Scm, &h->Notify);
+    h->Magic = 0;
+    delete h;
+}
+
+const SERVICE_BACKEND NtRegistryBackend = {
+    L"nt",
+    NtInitialize,
+    NtConnect,
+    NtOpen,
+    NtCreate,
+    NtSetDescription,
+    NtDelete,
+    NtStart,
+    NtControl,
+    NtQueryStatus,
+    NtQueryConfig,
+    NtChangeConfig,
+    NtQueryRecovery,
+    NtChangeRecovery,
+    NtQueryStartOptions,
+    NtChangeStartOptions,
+    NtEnumServices,
+    NtEnumDependents,
+    NtWaitStatusChange,
+    NtReadRegistry,
+    NtQueryProcesses,
+    NtCloseHandle
+};
+
+#endif // _WIN32
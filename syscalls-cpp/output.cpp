@@ -0,0 +1,301 @@
+#include "output.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#define OutputIsTerminal() _isatty(_fileno(stdout))
+#else
+#include <unistd.h>
+#define OutputIsTerminal() isatty(fileno(stdout))
+#endif
+
+#define OUTPUT_FLUSH_CHARS  (32 * 1024)  // Buffered characters that trigger a write
+
+OUTPUT_FORMAT g_OutputFormat = OUTPUT_TEXT;
+BOOL g_OutputMuted = FALSE;
+
+static std::mutex g_OutputLock;
+static std::wstring g_OutputBuffer;
+static BOOL g_OutputLineFlush = FALSE;
+
+static void OutputFlushLocked() {
+    if (g_OutputBuffer.empty()) return;
+    fputws(g_OutputBuffer.c_str(), stdout);
+    fflush(stdout);
+    g_OutputBuffer.clear();
+}
+
+// Append whole lines at once so concurrent operations never interleave
+// within a line
+static void OutputAppend(const std::wstring& text) {
+    std::lock_guard<std::mutex> lock(g_OutputLock);
+    g_OutputBuffer += text;
+    if (g_OutputLineFlush || g_OutputBuffer.size() >= OUTPUT_FLUSH_CHARS) {
+        OutputFlushLocked();
+    }
+}
+
+static void OutputFormatV(std::wstring* out, LPCWSTR format, va_list args) {
+    WCHAR stackBuffer[512];
+    va_list copy;
+    va_copy(copy, args);
+    int written = vswprintf(stackBuffer, sizeof(stackBuffer) / sizeof(WCHAR), format, copy);
+    va_end(copy);
+    if (written >= 0) {
+        out->append(stackBuffer, written);
+        return;
+    }
+    
+    // vswprintf only reports that the text did not fit; grow until it does
+    std::vector<WCHAR> heap(sizeof(stackBuffer) / sizeof(WCHAR));
+    do {
+        heap.resize(heap.size() * 2);
+        va_copy(copy, args);
+        written = vswprintf(heap.data(), heap.size(), format, copy);
+        va_end(copy);
+    } while (written < 0 && heap.size() < 1024 * 1024);
+    if (written > 0) out->append(heap.data(), written);
+}
+
+BOOL OutputInitialize(LPCWSTR formatName) {
+    if (!formatName || _wcsicmp(formatName, L"text") == 0) {
+        g_OutputFormat = OUTPUT_TEXT;
+    } else if (_wcsicmp(formatName, L"json") == 0) {
+        g_OutputFormat = OUTPUT_JSON;
+    } else {
+        wprintf(L"Unknown output format: %ls\n", formatName);
+        return FALSE;
+    }
+    
+    g_OutputLineFlush = OutputIsTerminal() ? TRUE : FALSE;
+    atexit(OutputFlush);
+    return TRUE;
+}
+
+VOID OutputFlush() {
+    std::lock_guard<std::mutex> lock(g_OutputLock);
+    OutputFlushLocked();
+}
+
+VOID OutputText(LPCWSTR format, ...) {
+    if (g_OutputFormat != OUTPUT_TEXT || g_OutputMuted) return;
+    
+    std::wstring text;
+    va_list args;
+    va_start(args, format);
+    OutputFormatV(&text, format, args);
+    va_end(args);
+    OutputAppend(text);
+}
+
+VOID OutputWrite(LPCWSTR format, ...) {
+    std::wstring text;
+    va_list args;
+    va_start(args, format);
+    OutputFormatV(&text, format, args);
+    va_end(args);
+    OutputAppend(text);
+}
+
+VOID OutputBegin(OUTPUT_RECORD* record, LPCWSTR command, LPCWSTR service) {
+    record->Command = command;
+    record->Service = service;
+    record->DisplayName = NULL;
+    record->ImagePath = NULL;
+    record->Time = NULL;
+    record->Change = NULL;
+    record->Success = FALSE;
+    record->Error = ERROR_SUCCESS;
+    record->State = OUTPUT_NONE;
+    record->PreviousState = OUTPUT_NONE;
+    record->StartType = OUTPUT_NONE;
+    record->ServiceType = OUTPUT_NONE;
+    record->Loaded = OUTPUT_NONE;
+    record->ProcessId = OUTPUT_NONE;
+    record->Count = OUTPUT_NONE;
+    record->Failed = OUTPUT_NONE;
+    record->Skipped = OUTPUT_NONE;
+    record->Waves = OUTPUT_NONE;
+    record->BatchSize = OUTPUT_NONE;
+    record->Rate = OUTPUT_NONE;
+    record->Call = NULL;
+    record->P50Us = 0;
+    record->P95Us = 0;
+    record->P99Us = 0;
+    record->MaxUs = 0;
+    record->TotalUs = 0;
+    record->Run = OUTPUT_NONE;
+    record->CheckPoint = OUTPUT_NONE;
+    record->WaitHint = OUTPUT_NONE;
+    record->AtUs = 0;
+    record->Thread = OUTPUT_NONE;
+    record->MinUs = 0;
+    record->DowntimeUs = 0;
+    record->StopUs = 0;
+    record->StartUs = 0;
+    record->ReadyUs = 0;
+    record->Usage = NULL;
+    record->CpuRate = OUTPUT_NONE;
+    record->StartTick = GetTickCount64();
+    record->ElapsedMs = 0;
+    record->Message = NULL;
+}
+
+// JSON string with everything outside printable ASCII escaped, so the
+// line survives any console code page
+static void JsonString(std::wstring* out, LPCWSTR text) {
+    static const WCHAR hex[] = L"0123456789abcdef";
+    out->push_back(L'"');
+    for (; *text; text++) {
+        DWORD ch = (DWORD)*text;
+        if (ch == L'"' || ch == L'\\') {
+            out->push_back(L'\\');
+            out->push_back((WCHAR)ch);
+        } else if (ch >= 0x20 && ch < 0x7F) {
+            out->push_back((WCHAR)ch);
+        } else if (ch == L'\n') {
+            out->append(L"\\n");
+        } else {
+            // wchar_t may be 32 bits: split into a UTF-16 surrogate pair
+            DWORD units[2];
+            int count = 1;
+            units[0] = ch;
+            if (ch > 0xFFFF) {
+                units[0] = 0xD800 + ((ch - 0x10000) >> 10);
+                units[1] = 0xDC00 + ((ch - 0x10000) & 0x3FF);
+                count = 2;
+            }
+            for (int i = 0; i < count; i++) {
+                out->append(L"\\u");
+                for (int shift = 12; shift >= 0; shift -= 4) {
+                    out->push_back(hex[(units[i] >> shift) & 0xF]);
+                }
+            }
+        }
+    }
+    out->push_back(L'"');
+}
+
+static void JsonKey(std::wstring* out, LPCWSTR key) {
+    if (out->size() > 1) out->push_back(L',');
+    JsonString(out, key);
+    out->push_back(L':');
+}
+
+static void JsonStringField(std::wstring* out, LPCWSTR key, LPCWSTR value) {
+    if (!value) return;
+    JsonKey(out, key);
+    JsonString(out, value);
+}
+
+static void JsonNumberField(std::wstring* out, LPCWSTR key, ULONGLONG value) {
+    WCHAR digits[24];
+    swprintf(digits, sizeof(digits) / sizeof(WCHAR), L"%llu", value);
+    JsonKey(out, key);
+    out->append(digits);
+}
+
+static void JsonOptionalField(std::wstring* out, LPCWSTR key, DWORD value) {
+    if (value != OUTPUT_NONE) JsonNumberField(out, key, value);
+}
+
+static void OutputJsonRecord(const OUTPUT_RECORD* record) {
+    std::wstring line(L"{");
+    JsonStringField(&line, L"command", record->Command);
+    JsonStringField(&line, L"service", record->Service);
+    JsonKey(&line, L"ok");
+    line.append(record->Success ? L"true" : L"false");
+    JsonNumberField(&line, L"error", record->Error);
+    JsonStringField(&line, L"change", record->Change);
+    if (record->State != OUTPUT_NONE) {
+        JsonStringField(&line, L"state", ServiceStateName(record->State));
+        JsonNumberField(&line, L"state_code", record->State);
+    }
+    if (record->PreviousState != OUTPUT_NONE) {
+        JsonStringField(&line, L"previous_state", ServiceStateName(record->PreviousState));
+    }
+    if (record->StartType != OUTPUT_NONE) {
+        JsonStringField(&line, L"start_type", ServiceStartTypeName(record->StartType));
+    }
+    if (record->ServiceType != OUTPUT_NONE) {
+        JsonStringField(&line, L"service_type", ServiceTypeName(record->ServiceType));
+    }
+    if (record->Loaded != OUTPUT_NONE) {
+        JsonKey(&line, L"scm_loaded");
+        line.append(record->Loaded ? L"true" : L"false");
+    }
+    JsonOptionalField(&line, L"pid", record->ProcessId);
+    JsonStringField(&line, L"display_name", record->DisplayName);
+    JsonStringField(&line, L"image_path", record->ImagePath);
+    JsonOptionalField(&line, L"count", record->Count);
+    JsonOptionalField(&line, L"failed", record->Failed);
+    JsonOptionalField(&line, L"skipped", record->Skipped);
+    JsonOptionalField(&line, L"waves", record->Waves);
+    JsonOptionalField(&line, L"batch_size", record->BatchSize);
+    JsonOptionalField(&line, L"ops_per_sec", record->Rate);
+    if (record->Call) {
+        JsonStringField(&line, L"call", record->Call);
+        JsonNumberField(&line, L"min_us", record->MinUs);
+        JsonNumberField(&line, L"p50_us", record->P50Us);
+        JsonNumberField(&line, L"p95_us", record->P95Us);
+        JsonNumberField(&line, L"p99_us", record->P99Us);
+        JsonNumberField(&line, L"max_us", record->MaxUs);
+        JsonNumberField(&line, L"total_us", record->TotalUs);
+    }
+    JsonOptionalField(&line, L"run", record->Run);
+    JsonOptionalField(&line, L"checkpoint", record->CheckPoint);
+    JsonOptionalField(&line, L"wait_hint_ms", record->WaitHint);
+    JsonOptionalField(&line, L"thread", record->Thread);
+    if (record->Run != OUTPUT_NONE || record->Thread != OUTPUT_NONE) JsonNumberField(&line, L"at_us", record->AtUs);
+    if (record->DowntimeUs) {
+        JsonNumberField(&line, L"downtime_us", record->DowntimeUs);
+        JsonNumberField(&line, L"stop_us", record->StopUs);
+        JsonNumberField(&line, L"start_us", record->StartUs);
+    }
+    if (record->ReadyUs) JsonNumberField(&line, L"ready_us", record->ReadyUs);
+    if (record->Usage && record->Usage->Present) {
+        JsonNumberField(&line, L"cpu_time_us", record->Usage->CpuTime / 10);
+        JsonOptionalField(&line, L"cpu_us_per_sec", record->CpuRate);
+        JsonNumberField(&line, L"working_set_bytes", record->Usage->WorkingSet);
+        JsonNumberField(&line, L"private_bytes", record->Usage->PrivateBytes);
+        JsonNumberField(&line, L"handles", record->Usage->HandleCount);
+        JsonNumberField(&line, L"threads", record->Usage->ThreadCount);
+    }
+    JsonStringField(&line, L"time", record->Time);
+    JsonNumberField(&line, L"elapsed_ms", record->ElapsedMs);
+    JsonStringField(&line, L"message", record->Message);
+    line.append(L"}\n");
+    OutputAppend(line);
+}
+
+VOID OutputRecord(const OUTPUT_RECORD* record) {
+    if (g_OutputMuted) return;
+    if (g_OutputFormat == OUTPUT_JSON) {
+        OutputJsonRecord(record);
+    } else if (record->Message) {
+        OutputAppend(std::wstring(record->Message) + L"\n");
+    }
+}
+
+BOOL OutputFinish(OUTPUT_RECORD* record, BOOL success, DWORD error, LPCWSTR format, ...) {
+    std::wstring message;
+    if (format) {
+        va_list args;
+        va_start(args, format);
+        OutputFormatV(&message, format, args);
+        va_end(args);
+        record->Message = message.c_str();
+    }
+    
+    record->Success = success;
+    record->Error = success ? ERROR_SUCCESS : error;
+    record->ElapsedMs = GetTickCount64() - record->StartTick;
+    OutputRecord(record);
+    record->Message = NULL;
+    return success;
+}
@@ -0,0 +1,92 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "service_schema.h"
+
+// Report format (--format)
+typedef enum _OUTPUT_FORMAT {
+    OUTPUT_TEXT,    // Human-readable messages (default)
+    OUTPUT_JSON     // JSON lines: one object per operation, no free text
+} OUTPUT_FORMAT;
+
+extern OUTPUT_FORMAT g_OutputFormat;
+
+// Drop records and progress text (set while bench runs commands); change
+// it only while no other thread is reporting
+extern BOOL g_OutputMuted;
+
+// Optional record field that was not reported
+#define OUTPUT_NONE  0xFFFFFFFF
+
+// Outcome of one operation. The text formatter prints Message; the JSON
+// formatter prints every field except those left at OUTPUT_NONE / NULL.
+typedef struct _OUTPUT_RECORD {
+    LPCWSTR Command;
+    LPCWSTR Service;
+    LPCWSTR DisplayName;
+    LPCWSTR ImagePath;
+    LPCWSTR Time;           // Wall-clock timestamp (watch events)
+    LPCWSTR Change;         // Snapshot diff: "added", "removed" or "changed"
+    BOOL Success;
+    DWORD Error;            // Win32 error code, 0 on success
+    DWORD State;            // SERVICE_* state
+    DWORD PreviousState;    // State before a transition (watch)
+    DWORD StartType;        // SERVICE_*_START
+    DWORD ServiceType;      // SERVICE_WIN32_*
+    DWORD Loaded;           // TRUE / FALSE: the SCM has loaded the service (inventory)
+    DWORD ProcessId;
+    DWORD Count;            // Operations / services covered (summaries)
+    DWORD Failed;
+    DWORD Skipped;
+    DWORD Waves;            // Dependency levels run one after another (start/stop)
+    DWORD BatchSize;        // Services per benchmark run (bench)
+    DWORD Rate;             // Operations per second (bench)
+    DWORD Run;              // Profiled start: run number, checkpoint and wait
+    DWORD CheckPoint;       // hint of an observed status, and its time since
+    DWORD WaitHint;         // the start request (AtUs, reported with Run)
+    ULONGLONG AtUs;
+    DWORD Thread;           // Recording thread of a traced call (replay --list), with AtUs
+    LPCWSTR Call;           // Backend call, wait or start step measured; the
+    ULONGLONG MinUs;        // latency fields below are reported only with it
+    ULONGLONG P50Us;
+    ULONGLONG P95Us;
+    ULONGLONG P99Us;
+    ULONGLONG MaxUs;
+    ULONGLONG TotalUs;
+    ULONGLONG DowntimeUs;   // Restart: stop request to RUNNING, reported when
+    ULONGLONG StopUs;       // set, with its stop and start phases
+    ULONGLONG StartUs;
+    ULONGLONG ReadyUs;      // Start / restart with a readiness probe: RUNNING to ready
+    const SERVICE_PROCESS_USAGE* Usage;  // Process sample (top); reported
+    DWORD CpuRate;          // with it: CPU microseconds per second over the last interval
+    ULONGLONG StartTick;
+    ULONGLONG ElapsedMs;
+    LPCWSTR Message;
+} OUTPUT_RECORD;
+
+// Select the format by name ("text", "json"; NULL = text) and arrange for
+// the buffer to be flushed at exit. Call once, before any output.
+BOOL OutputInitialize(LPCWSTR formatName);
+
+// Start a record for 'command' on 'service' (may be NULL) and its timer
+VOID OutputBegin(OUTPUT_RECORD* record, LPCWSTR command, LPCWSTR service);
+
+// Emit a finished record through the active formatter
+VOID OutputRecord(const OUTPUT_RECORD* record);
+
+// Set the outcome, elapsed time and message (printf-style, may be NULL),
+// emit the record and return 'success'
+BOOL OutputFinish(OUTPUT_RECORD* record, BOOL success, DWORD error, LPCWSTR format, ...);
+
+// Free-form progress text, shown by the text formatter only
+VOID OutputText(LPCWSTR format, ...);
+
+// Text written in every format (help screen)
+VOID OutputWrite(LPCWSTR format, ...);
+
+// Write everything buffered so far. Output is flushed in large chunks when
+// stdout is a file or pipe and line by line on a console; callers that
+// block for a long time flush explicitly.
+VOID OutputFlush();
+
+#endif // OUTPUT_H
@@ -0,0 +1,220 @@
+#include "profile.h"
+#include "scm_session.h"
+#include "service_wait.h"
+#include "metrics.h"
+#include "output.h"
+#include <stdio.h>
+#include <wchar.h>
+#include <algorithm>
+#include <vector>
+
+// One observed status, timed from the StartService call
+typedef struct _PROFILE_EVENT {
+    ULONGLONG AtUs;
+    DWORD State;
+    DWORD CheckPoint;
+    DWORD WaitHint;
+} PROFILE_EVENT;
+
+// Time spent at one (state, checkpoint) in each run that reached it
+struct ProfileStep {
+    DWORD State;
+    DWORD CheckPoint;
+    DWORD WaitHint;     // Largest hint reported at this step
+    std::vector<ULONGLONG> DurationsUs;
+};
+
+// Nearest-rank percentile of a sorted sample
+static ULONGLONG ProfilePercentile(const std::vector<ULONGLONG>& sorted, DWORD percent) {
+    size_t rank = (sorted.size() * percent + 99) / 100;
+    return sorted[rank ? rank - 1 : 0];
+}
+
+// Bring the service to STOPPED before a run (not part of the measurement)
+static BOOL ProfileStop(SVC_HANDLE service, OUTPUT_RECORD* record) {
+    SERVICE_STATUS status;
+    if (!g_Backend->QueryStatus(service, &status)) {
+        DWORD err = GetLastError();
+        return OutputFinish(record, FALSE, err, L"QueryServiceStatus failed: %d", err);
+    }
+    if (status.dwCurrentState == SERVICE_STOPPED) return TRUE;
+    
+    if (status.dwCurrentState != SERVICE_STOP_PENDING && !g_Backend->Control(service, SERVICE_CONTROL_STOP, &status)) {
+        DWORD err = GetLastError();
+        return OutputFinish(record, FALSE, err, L"ControlService failed: %d", err);
+    }
+    if (!WaitForServiceState(service, SERVICE_STOP_PENDING, SERVICE_STOPPED, g_ServiceWaitTimeout, &status)) {
+        DWORD err = GetLastError();
+        return OutputFinish(record, FALSE, err, L"Service did not stop: state %d (error %d)", status.dwCurrentState, err);
+    }
+    return TRUE;
+}
+
+// One start, polled at a fixed interval: the notification wait would wake
+// on state changes only and miss the checkpoints in between
+static BOOL ProfileRun(SVC_HANDLE service, DWORD pollMs, ULONGLONG* startCallUs, std::vector<PROFILE_EVENT>* events,
+    OUTPUT_RECORD* record) {
+    ULONGLONG begin = MetricsNow();
+    if (!g_Backend->Start(service)) {
+        DWORD err = GetLastError();
+        return OutputFinish(record, FALSE, err, L"StartService failed: %d", err);
+    }
+    *startCallUs = MetricsNow() - begin;
+    
+    SERVICE_STATUS status;
+    for (;;) {
+        if (!g_Backend->QueryStatus(service, &status)) {
+            DWORD err = GetLastError();
+            return OutputFinish(record, FALSE, err, L"QueryServiceStatus failed: %d", err);
+        }
+        ULONGLONG at = MetricsNow() - begin;
+        const PROFILE_EVENT* last = events->empty() ? NULL : &events->back();
+        if (!last || last->State != status.dwCurrentState || last->CheckPoint != status.dwCheckPoint ||
+            last->WaitHint != status.dwWaitHint) {
+            PROFILE_EVENT event = { at, status.dwCurrentState, status.dwCheckPoint, status.dwWaitHint };
+            events->push_back(event);
+        }
+        
+        if (status.dwCurrentState == SERVICE_RUNNING) return TRUE;
+        if (status.dwCurrentState != SERVICE_START_PENDING) {
+            DWORD err = status.dwWin32ExitCode != ERROR_SUCCESS ? status.dwWin32ExitCode : ERROR_SERVICE_REQUEST_TIMEOUT;
+            record->State = status.dwCurrentState;
+            return OutputFinish(record, FALSE, err, L"Service left Start Pending for %ls after %.1f ms (error %d)",
+                ServiceStateName(status.dwCurrentState), at / 1e3, err);
+        }
+        if (g_ServiceWaitTimeout != INFINITE && at / 1000 >= g_ServiceWaitTimeout) {
+            return OutputFinish(record, FALSE, ERROR_TIMEOUT, L"Service still starting after %u ms", g_ServiceWaitTimeout);
+        }
+        Sleep(pollMs);
+    }
+}
+
+// Charge the time between consecutive (state, checkpoint) observations to
+// the earlier one; a wait hint change alone does not start a new step
+static void ProfileAccumulate(const std::vector<PROFILE_EVENT>& events, std::vector<ProfileStep>* steps) {
+    size_t i = 0;
+    while (i < events.size() && events[i].State != SERVICE_RUNNING) {
+        size_t next = i + 1;
+        DWORD hint = events[i].WaitHint;
+        while (next < events.size() && events[next].State == events[i].State &&
+            events[next].CheckPoint == events[i].CheckPoint) {
+            if (events[next].WaitHint > hint) hint = events[next].WaitHint;
+            next++;
+        }
+        if (next == events.size()) break;
+        
+        ProfileStep* step = NULL;
+        for (size_t s = 0; s < steps->size(); s++) {
+            if ((*steps)[s].State == events[i].State && (*steps)[s].CheckPoint == events[i].CheckPoint) {
+                step = &(*steps)[s];
+                break;
+            }
+        }
+        if (!step) {
+            ProfileStep added;
+            added.State = events[i].State;
+            added.CheckPoint = events[i].CheckPoint;
+            added.WaitHint = 0;
+            steps->push_back(added);
+            step = &steps->back();
+        }
+        if (hint > step->WaitHint) step->WaitHint = hint;
+        step->DurationsUs.push_back(events[next].AtUs - events[i].AtUs);
+        i = next;
+    }
+}
+
+// One summary row: count, min, median, p95, p99, max and total of a step
+static void ProfileReport(LPCWSTR serviceName, LPCWSTR label, std::vector<ULONGLONG> samples, DWORD state,
+    DWORD checkPoint, DWORD waitHint) {
+    std::sort(samples.begin(), samples.end());
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"profile-start", serviceName);
+    record.Call = label;
+    record.State = state;
+    record.CheckPoint = checkPoint;
+    record.WaitHint = waitHint;
+    record.Count = (DWORD)samples.size();
+    record.MinUs = samples.front();
+    record.P50Us = ProfilePercentile(samples, 50);
+    record.P95Us = ProfilePercentile(samples, 95);
+    record.P99Us = ProfilePercentile(samples, 99);
+    record.MaxUs = samples.back();
+    for (size_t i = 0; i < samples.size(); i++) {
+        record.TotalUs += samples[i];
+    }
+    
+    WCHAR hint[16] = L"-";
+    if (waitHint != OUTPUT_NONE) swprintf(hint, sizeof(hint) / sizeof(WCHAR), L"%u", waitHint);
+    OutputFinish(&record, TRUE, ERROR_SUCCESS, L"%-32ls %-6u %10.1f %10.1f %10.1f %8ls", label, record.Count,
+        record.MinUs / 1e3, record.P50Us / 1e3, record.MaxUs / 1e3, hint);
+}
+
+int ProfileServiceStart(LPCWSTR serviceName, DWORD runs, DWORD pollMs, BOOL timeline) {
+    SCM_SESSION* session = ScmDefaultSession();
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"profile-start", serviceName);
+    if (!ScmSessionManager(session, SC_MANAGER_CONNECT)) {
+        DWORD err = GetLastError();
+        OutputFinish(&record, FALSE, err, L"OpenSCManager failed: %d", err);
+        return 1;
+    }
+    SVC_HANDLE service = ScmSessionOpenService(session, serviceName, SERVICE_START | SERVICE_STOP | SERVICE_QUERY_STATUS);
+    SERVICE_STATUS status;
+    if (!service || !g_Backend->QueryStatus(service, &status)) {
+        DWORD err = GetLastError();
+        OutputFinish(&record, FALSE, err, L"OpenService failed: %d", err);
+        return 1;
+    }
+    BOOL wasRunning = (status.dwCurrentState == SERVICE_RUNNING || status.dwCurrentState == SERVICE_START_PENDING);
+    
+    OutputText(L"Profiling start of '%ls': %u run(s), status polled every %u ms\n", serviceName, runs, pollMs);
+    std::vector<ULONGLONG> startCalls, toRunning;
+    std::vector<ProfileStep> steps;
+    for (DWORD run = 1; run <= runs; run++) {
+        OutputBegin(&record, L"profile-start", serviceName);
+        record.Run = run;
+        ULONGLONG startCallUs = 0;
+        std::vector<PROFILE_EVENT> events;
+        if (!ProfileStop(service, &record) || !ProfileRun(service, pollMs, &startCallUs, &events, &record)) return 1;
+        
+        if (timeline) {
+            for (size_t i = 0; i < events.size(); i++) {
+                OUTPUT_RECORD event;
+                OutputBegin(&event, L"profile-start", serviceName);
+                event.Run = run;
+                event.AtUs = events[i].AtUs;
+                event.State = events[i].State;
+                event.CheckPoint = events[i].CheckPoint;
+                event.WaitHint = events[i].WaitHint;
+                OutputFinish(&event, TRUE, ERROR_SUCCESS, L"  %10.1f ms  %-16ls checkpoint %-4u wait hint %u ms",
+                    events[i].AtUs / 1e3, ServiceStateName(events[i].State), events[i].CheckPoint, events[i].WaitHint);
+            }
+        }
+        
+        startCalls.push_back(startCallUs);
+        toRunning.push_back(events.back().AtUs);
+        ProfileAccumulate(events, &steps);
+        record.State = SERVICE_RUNNING;
+        record.AtUs = events.back().AtUs;
+        record.Count = (DWORD)events.size();
+        OutputFinish(&record, TRUE, ERROR_SUCCESS, L"Run %u/%u: Running after %.1f ms (%u status change(s))", run, runs,
+            record.AtUs / 1e3, record.Count);
+    }
+    
+    OutputText(L"\n%-32ls %-6ls %10ls %10ls %10ls %8ls\n", L"Step", L"Runs", L"Min ms", L"Median ms", L"Max ms",
+        L"Hint ms");
+    ProfileReport(serviceName, L"StartService call", startCalls, OUTPUT_NONE, OUTPUT_NONE, OUTPUT_NONE);
+    for (size_t i = 0; i < steps.size(); i++) {
+        WCHAR label[64];
+        swprintf(label, sizeof(label) / sizeof(WCHAR), L"%ls #%u", ServiceStateName(steps[i].State), steps[i].CheckPoint);
+        ProfileReport(serviceName, label, steps[i].DurationsUs, steps[i].State, steps[i].CheckPoint, steps[i].WaitHint);
+    }
+    ProfileReport(serviceName, L"Time to running", toRunning, SERVICE_RUNNING, OUTPUT_NONE, OUTPUT_NONE);
+    
+    if (!wasRunning) {
+        OutputBegin(&record, L"profile-start", serviceName);
+        if (!ProfileStop(service, &record)) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "service_backend.h"
+
+// replay <trace> [--list] [--jobs <n>] [--timeout <ms>] [-- <command> ...]
+// Rebuilds a traced run (trace.h) in the simulated backend and runs its
+// command again: every service the run saw is loaded in the state first
+// observed, with the start / stop times the trace shows and its observed
+// dependencies, and each backend call takes as long as the recorded call did
+// (in order, per call and service; extra calls take the median). Reports the
+// recorded and replayed per-call latency and wall time, so the effect of a
+// different --jobs, --timeout or command can be measured. A batch command
+// reads its manifest again. '--list' prints
+// the recorded calls instead. argv[0] is "replay". Returns the process exit
+// code.
+int RunReplay(int argc, wchar_t* argv[]);
+
+#endif // REPLAY_H
@@ -0,0 +1,62 @@
+#ifndef SCM_SESSION_H
+#define SCM_SESSION_H
+
+#include "scratch.h"
+
+// A session keeps one manager handle open across operations and caches one
+// service handle per service name (case-insensitive). A cached handle
+// carries the union of all access rights requested for that service so
+// far; asking for a right it lacks reopens it once with the wider mask.
+// Handles returned by a session are owned by it - do not Close() them. A
+// returned handle stays valid after a wider one replaces it, until the
+// service is forgotten or the session destroyed. Backend calls that open
+// handles run outside the session lock; a thread that loses a race to open
+// the same handle closes its own.
+typedef struct _SCM_SESSION SCM_SESSION;
+
+SCM_SESSION* ScmSessionCreate();
+VOID ScmSessionDestroy(SCM_SESSION* session);
+
+// Process-wide session used by the service management functions
+SCM_SESSION* ScmDefaultSession();
+
+SVC_HANDLE ScmSessionManager(SCM_SESSION* session, DWORD desiredAccess);
+SVC_HANDLE ScmSessionOpenService(SCM_SESSION* session, LPCWSTR serviceName, DWORD desiredAccess);
+SVC_HANDLE ScmSessionCreateService(SCM_SESSION* session, const SERVICE_INSTALL_SPEC* spec);
+
+// Borrow a scratch buffer for query results. Buffers are pooled per
+// session (one per concurrent user) and never shrink, so repeated queries
+// reuse memory that is already large enough.
+SCRATCH_BUFFER* ScmSessionAcquireScratch(SCM_SESSION* session);
+VOID ScmSessionReleaseScratch(SCM_SESSION* session, SCRATCH_BUFFER* scratch);
+
+// Returns the borrowed buffer at the end of the enclosing scope
+struct ScopedScratch {
+    explicit ScopedScratch(SCM_SESSION* session) : Session(session), Buffer(ScmSessionAcquireScratch(session)) {}
+    ~ScopedScratch() { ScmSessionReleaseScratch(Session, Buffer); }
+    
+    SCM_SESSION* Session;
+    SCRATCH_BUFFER* Buffer;
+};
+
+// Drop the cached handle (required after Delete so the SCM can remove the
+// service). It closes once no operation scope that was handed it is still
+// open; the caller's own scope does not count.
+VOID ScmSessionForget(SCM_SESSION* session, LPCWSTR serviceName);
+
+// One operation on the calling thread. A service handle the session hands
+// out inside the scope stays open until the scope ends, even if the service
+// is forgotten or created again meanwhile. Scopes nest.
+typedef struct _SCM_SESSION_USE SCM_SESSION_USE;
+
+SCM_SESSION_USE* ScmSessionEnter(SCM_SESSION* session);
+VOID ScmSessionLeave(SCM_SESSION_USE* use);
+
+struct ScopedSessionUse {
+    explicit ScopedSessionUse(SCM_SESSION* session) : Use(ScmSessionEnter(session)) {}
+    ~ScopedSessionUse() { ScmSessionLeave(Use); }
+    
+    SCM_SESSION_USE* Use;
+};
+
+#endif // SCM_SESSION_H
@@ -0,0 +1,59 @@
+#include "scratch.h"
+#include <stdlib.h>
+
+BOOL ScratchReserve(SCRATCH_BUFFER* scratch, DWORD size) {
+    if (size <= scratch->Size) return TRUE;
+    
+    // Round up so a slowly growing result does not reallocate every time
+    DWORD newSize = scratch->Size ? scratch->Size : SCRATCH_SIZE_HINT;
+    while (newSize < size) newSize *= 2;
+    
+    LPBYTE data = (LPBYTE)malloc(newSize);
+    if (!data) {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return FALSE;
+    }
+    free(scratch->Data);
+    scratch->Data = data;
+    scratch->Size = newSize;
+    return TRUE;
+}
+
+VOID ScratchFree(SCRATCH_BUFFER* scratch) {
+    free(scratch->Data);
+    scratch->Data = NULL;
+    scratch->Size = 0;
+}
+
+LPQUERY_SERVICE_CONFIGW ScratchQueryConfig(SVC_HANDLE service, SCRATCH_BUFFER* scratch) {
+    if (!ScratchReserve(scratch, SCRATCH_SIZE_HINT)) return NULL;
+    
+    DWORD bytesNeeded = 0;
+    if (g_Backend->QueryConfig(service, (LPQUERY_SERVICE_CONFIGW)scratch->Data, scratch->Size, &bytesNeeded)) {
+        return (LPQUERY_SERVICE_CONFIGW)scratch->Data;
+    }
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER || !ScratchReserve(scratch, bytesNeeded)) return NULL;
+    
+    if (!g_Backend->QueryConfig(service, (LPQUERY_SERVICE_CONFIGW)scratch->Data, scratch->Size, &bytesNeeded)) {
+        return NULL;
+    }
+    return (LPQUERY_SERVICE_CONFIGW)scratch->Data;
+}
+
+LPENUM_SERVICE_STATUSW ScratchEnumDependents(SVC_HANDLE service, DWORD serviceState, SCRATCH_BUFFER* scratch,
+    LPDWORD count) {
+    if (!ScratchReserve(scratch, SCRATCH_SIZE_HINT)) return NULL;
+    
+    DWORD bytesNeeded = 0;
+    if (g_Backend->EnumDependents(service, serviceState, (LPENUM_SERVICE_STATUSW)scratch->Data, scratch->Size,
+        &bytesNeeded, count)) {
+        return (LPENUM_SERVICE_STATUSW)scratch->Data;
+    }
+    if (GetLastError() != ERROR_MORE_DATA || !ScratchReserve(scratch, bytesNeeded)) return NULL;
+    
+    if (!g_Backend->EnumDependents(service, serviceState, (LPENUM_SERVICE_STATUSW)scratch->Data, scratch->Size,
+        &bytesNeeded, count)) {
+        return NULL;
+    }
+    return (LPENUM_SERVICE_STATUSW)scratch->Data;
+}
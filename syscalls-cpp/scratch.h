@@ -0,0 +1,30 @@
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include "service_backend.h"
+
+// First size of every scratch buffer; large enough for a typical
+// QUERY_SERVICE_CONFIGW or QueryServiceConfig2W result, so the first call
+// usually succeeds without a sizing probe
+#define SCRATCH_SIZE_HINT  (8 * 1024)
+
+// Grow-only buffer for variable-length query results. Growing discards the
+// contents; memory is kept until ScratchFree.
+typedef struct _SCRATCH_BUFFER {
+    LPBYTE Data;
+    DWORD Size;
+} SCRATCH_BUFFER;
+
+BOOL ScratchReserve(SCRATCH_BUFFER* scratch, DWORD size);
+VOID ScratchFree(SCRATCH_BUFFER* scratch);
+
+// QueryConfig into the scratch buffer, growing and retrying once when the
+// hint was too small. The result is valid until the buffer is reused.
+LPQUERY_SERVICE_CONFIGW ScratchQueryConfig(SVC_HANDLE service, SCRATCH_BUFFER* scratch);
+
+// EnumDependents into the scratch buffer, growing and retrying the same way;
+// *count receives the number of records
+LPENUM_SERVICE_STATUSW ScratchEnumDependents(SVC_HANDLE service, DWORD serviceState, SCRATCH_BUFFER* scratch,
+    LPDWORD count);
+
+#endif // SCRATCH_H
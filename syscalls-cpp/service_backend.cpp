@@ -0,0 +1,39 @@
+#include "service_backend.h"
+#include "output.h"
+#include <wchar.h>
+
+// syscalls build: registry-based install/uninstall by default on Windows
+#ifdef _WIN32
+const SERVICE_BACKEND* g_Backend = &NtRegistryBackend;
+#else
+const SERVICE_BACKEND* g_Backend = &SimulatedBackend;
+#endif
+
+// Backends report why they could not start through the last error
+static BOOL BackendInitialize() {
+    if (g_Backend->Initialize()) return TRUE;
+    
+    DWORD error = GetLastError();
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"backend", NULL);
+    return OutputFinish(&record, FALSE, error, L"Failed to initialize %ls backend: %d", g_Backend->Name, error);
+}
+
+BOOL SelectServiceBackend(LPCWSTR name) {
+    if (!name) return BackendInitialize();
+    
+#ifdef _WIN32
+    if (_wcsicmp(name, L"nt") == 0) {
+        g_Backend = &NtRegistryBackend;
+        return BackendInitialize();
+    }
+#endif
+    if (_wcsicmp(name, L"sim") == 0) {
+        g_Backend = &SimulatedBackend;
+        return BackendInitialize();
+    }
+    
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"backend", NULL);
+    return OutputFinish(&record, FALSE, ERROR_INVALID_PARAMETER, L"Unknown backend: %ls", name);
+}
@@ -0,0 +1,319 @@
+#include "service_graph.h"
+#include "service_installer.h"
+#include "executor.h"
+#include "output.h"
+#include <wchar.h>
+#include <wctype.h>
+#include <map>
+
+// Rights the closure walk needs
+#define GRAPH_CLOSURE_ACCESS  (SERVICE_QUERY_CONFIG | SERVICE_ENUMERATE_DEPENDENTS)
+
+// Rights the start / stop itself needs as well, so the session's cached
+// handle serves it without a reopen
+#define GRAPH_START_ACCESS  (SERVICE_QUERY_CONFIG | SERVICE_QUERY_STATUS | SERVICE_START)
+#define GRAPH_STOP_ACCESS   (SERVICE_QUERY_CONFIG | SERVICE_QUERY_STATUS | SERVICE_ENUMERATE_DEPENDENTS | SERVICE_STOP)
+
+typedef struct _GRAPH_NODE {
+    std::wstring Name;
+    std::vector<DWORD> After;   // Nodes that must finish first
+    DWORD Wave;
+} GRAPH_NODE;
+
+typedef struct _SERVICE_GRAPH {
+    std::vector<GRAPH_NODE> Nodes;
+    std::map<std::wstring, DWORD> Index;    // Lower-case name -> node
+    DWORD Roots;                            // Nodes [0, Roots) are the services asked for
+    DWORD Waves;
+} SERVICE_GRAPH;
+
+static std::wstring GraphKey(LPCWSTR name) {
+    std::wstring key(name);
+    for (size_t i = 0; i < key.size(); i++) {
+        key[i] = (wchar_t)towlower((wint_t)key[i]);
+    }
+    return key;
+}
+
+// Node of 'name', added if new (*added tells which)
+static DWORD GraphNode(SERVICE_GRAPH* graph, LPCWSTR name, BOOL* added) {
+    std::wstring key = GraphKey(name);
+    std::map<std::wstring, DWORD>::iterator it = graph->Index.find(key);
+    *added = (it == graph->Index.end());
+    if (!*added) return it->second;
+    
+    GRAPH_NODE node;
+    node.Name = name;
+    node.Wave = 0;
+    graph->Nodes.push_back(node);
+    graph->Index[key] = (DWORD)(graph->Nodes.size() - 1);
+    return (DWORD)(graph->Nodes.size() - 1);
+}
+
+// Service names of a dependency list, load-order groups left out
+static void GraphDependencies(LPCWSTR list, std::vector<std::wstring>* names) {
+    for (LPCWSTR name = list; name && *name; name += wcslen(name) + 1) {
+        if (*name != SC_GROUP_IDENTIFIERW) names->push_back(name);
+    }
+}
+
+// Start: walk the dependencies of every root that is not running. Running
+// dependencies are satisfied and get no node; a root or dependency that
+// cannot be opened or queried stays without edges and reports the error
+// when its start runs.
+static void GraphBuildStart(SCM_SESSION* session, const std::vector<std::wstring>& roots, SERVICE_GRAPH* graph) {
+    ScopedScratch scratch(session);
+    std::vector<DWORD> pending;
+    BOOL added;
+    for (size_t i = 0; i < roots.size(); i++) {
+        DWORD node = GraphNode(graph, roots[i].c_str(), &added);
+        if (added) pending.push_back(node);
+    }
+    DWORD rootCount = (DWORD)graph->Nodes.size();
+    graph->Roots = rootCount;
+    
+    while (!pending.empty()) {
+        DWORD node = pending.back();
+        pending.pop_back();
+        SVC_HANDLE service = ScmSessionOpenService(session, graph->Nodes[node].Name.c_str(), GRAPH_START_ACCESS);
+        if (!service) continue;
+        
+        // Dependencies were checked when found; roots are checked here
+        SERVICE_STATUS status;
+        if (node < rootCount && g_Backend->QueryStatus(service, &status) && status.dwCurrentState == SERVICE_RUNNING) {
+            continue;
+        }
+        LPQUERY_SERVICE_CONFIGW config = ScratchQueryConfig(service, scratch.Buffer);
+        if (!config) continue;
+        
+        std::vector<std::wstring> dependencies;
+        GraphDependencies(config->lpDependencies, &dependencies);
+        for (size_t i = 0; i < dependencies.size(); i++) {
+            LPCWSTR name = dependencies[i].c_str();
+            if (!graph->Index.count(GraphKey(name))) {
+                SVC_HANDLE dependency = ScmSessionOpenService(session, name, GRAPH_START_ACCESS);
+                if (dependency && g_Backend->QueryStatus(dependency, &status) &&
+                    status.dwCurrentState == SERVICE_RUNNING) {
+                    continue;
+                }
+            }
+            DWORD before = GraphNode(graph, name, &added);
+            graph->Nodes[node].After.push_back(before);
+            if (added) pending.push_back(before);
+        }
+    }
+}
+
+// Stop: every active dependent of every root (one EnumDependents each,
+// which is already transitive), then the edges among them from their
+// dependency lists. A dependency waits for its dependents.
+static void GraphBuildStop(SCM_SESSION* session, const std::vector<std::wstring>& roots, SERVICE_GRAPH* graph) {
+    ScopedScratch scratch(session);
+    BOOL added;
+    for (size_t i = 0; i < roots.size(); i++) {
+        GraphNode(graph, roots[i].c_str(), &added);
+        SVC_HANDLE service = ScmSessionOpenService(session, roots[i].c_str(), GRAPH_STOP_ACCESS);
+        if (!service) continue;
+        
+        DWORD count = 0;
+        LPENUM_SERVICE_STATUSW dependents = ScratchEnumDependents(service, SERVICE_ACTIVE, scratch.Buffer, &count);
+        for (DWORD j = 0; dependents && j < count; j++) {
+            GraphNode(graph, dependents[j].lpServiceName, &added);
+        }
+    }
+    if (graph->Nodes.size() < 2) return;
+    
+    for (size_t i = 0; i < graph->Nodes.size(); i++) {
+        SVC_HANDLE service = ScmSessionOpenService(session, graph->Nodes[i].Name.c_str(), GRAPH_STOP_ACCESS);
+        LPQUERY_SERVICE_CONFIGW config = service ? ScratchQueryConfig(service, scratch.Buffer) : NULL;
+        if (!config) continue;
+        
+        std::vector<std::wstring> dependencies;
+        GraphDependencies(config->lpDependencies, &dependencies);
+        for (size_t j = 0; j < dependencies.size(); j++) {
+            std::map<std::wstring, DWORD>::iterator it = graph->Index.find(GraphKey(dependencies[j].c_str()));
+            if (it != graph->Index.end()) graph->Nodes[it->second].After.push_back((DWORD)i);
+        }
+    }
+}
+
+// Wave of a node = length of the longest chain of prerequisites before it
+// (Kahn's algorithm). Fails with ERROR_CIRCULAR_DEPENDENCY on a cycle.
+static BOOL GraphAssignWaves(SERVICE_GRAPH* graph) {
+    size_t count = graph->Nodes.size();
+    std::vector<DWORD> remaining(count);
+    std::vector<std::vector<DWORD> > unblocks(count);
+    std::vector<DWORD> ready;
+    for (size_t i = 0; i < count; i++) {
+        const std::vector<DWORD>& after = graph->Nodes[i].After;
+        remaining[i] = (DWORD)after.size();
+        for (size_t j = 0; j < after.size(); j++) {
+            unblocks[after[j]].push_back((DWORD)i);
+        }
+        if (after.empty()) ready.push_back((DWORD)i);
+    }
+    
+    size_t placed = 0;
+    graph->Waves = 0;
+    while (!ready.empty()) {
+        DWORD node = ready.back();
+        ready.pop_back();
+        placed++;
+        DWORD wave = graph->Nodes[node].Wave;
+        if (wave + 1 > graph->Waves) graph->Waves = wave + 1;
+        for (size_t j = 0; j < unblocks[node].size(); j++) {
+            DWORD next = unblocks[node][j];
+            if (graph->Nodes[next].Wave < wave + 1) graph->Nodes[next].Wave = wave + 1;
+            if (--remaining[next] == 0) ready.push_back(next);
+        }
+    }
+    if (placed < count) {
+        SetLastError(ERROR_CIRCULAR_DEPENDENCY);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+typedef struct _GRAPH_WAVE {
+    const SERVICE_GRAPH* Graph;
+    std::vector<DWORD> Nodes;
+    BOOL Start;
+    const SERVICE_PROBE* Ready;     // Roots only
+} GRAPH_WAVE;
+
+static int RunGraphOp(PVOID context, DWORD index) {
+    GRAPH_WAVE* wave = (GRAPH_WAVE*)context;
+    DWORD node = wave->Nodes[index];
+    LPCWSTR name = wave->Graph->Nodes[node].Name.c_str();
+    if (!wave->Start) return StopServiceByName(name) ? 0 : 1;
+    return StartServiceByName(name, node < wave->Graph->Roots ? wave->Ready : NULL) ? 0 : 1;
+}
+
+// Run the waves in order; *failed and *skipped count services that failed
+// or never ran because a prerequisite did not succeed
+static BOOL GraphRun(const SERVICE_GRAPH* graph, BOOL start, const SERVICE_PROBE* ready, DWORD* failed,
+    DWORD* skipped) {
+    BOOL verbose = graph->Nodes.size() > 1;
+    std::vector<BOOL> succeeded(graph->Nodes.size(), FALSE);
+    *failed = 0;
+    *skipped = 0;
+    
+    for (DWORD w = 0; w < graph->Waves; w++) {
+        GRAPH_WAVE wave;
+        wave.Graph = graph;
+        wave.Start = start;
+        wave.Ready = ready;
+        std::vector<std::wstring> keys;
+        for (size_t i = 0; i < graph->Nodes.size(); i++) {
+            const GRAPH_NODE& node = graph->Nodes[i];
+            if (node.Wave != w) continue;
+            
+            BOOL ready = TRUE;
+            for (size_t j = 0; j < node.After.size(); j++) {
+                if (!succeeded[node.After[j]]) ready = FALSE;
+            }
+            if (!ready) {
+                OutputText(L"SKIPPED: %ls (%ls)\n", node.Name.c_str(),
+                    start ? L"a dependency did not start" : L"a dependent did not stop");
+                (*skipped)++;
+                continue;
+            }
+            wave.Nodes.push_back((DWORD)i);
+            keys.push_back(node.Name);
+        }
+        if (keys.empty()) continue;
+        
+        if (verbose) OutputText(L"Wave %u/%u: %u service(s)\n", w + 1, graph->Waves, (DWORD)keys.size());
+        std::vector<EXECUTOR_RESULT> results;
+        ExecuteOperations(keys, RunGraphOp, &wave, g_ExecutorJobs, FALSE, &results);
+        for (size_t i = 0; i < results.size(); i++) {
+            if (results[i].ExitCode == 0) {
+                succeeded[wave.Nodes[i]] = TRUE;
+            } else {
+                if (verbose) OutputText(L"FAILED: %ls\n", keys[i].c_str());
+                (*failed)++;
+            }
+        }
+    }
+    return *failed == 0 && *skipped == 0;
+}
+
+void ServiceGraphClosure(LPCWSTR serviceName, std::vector<std::wstring>* names) {
+    SCM_SESSION* session = ScmDefaultSession();
+    SERVICE_GRAPH graph;
+    BOOL added;
+    GraphNode(&graph, serviceName, &added);
+    if (!ScmSessionManager(session, SC_MANAGER_CONNECT)) {
+        names->push_back(serviceName);
+        return;
+    }
+    
+    ScopedScratch scratch(session);
+    for (size_t i = 0; i < graph.Nodes.size(); i++) {
+        SVC_HANDLE service = ScmSessionOpenService(session, graph.Nodes[i].Name.c_str(), GRAPH_CLOSURE_ACCESS);
+        LPQUERY_SERVICE_CONFIGW config = service ? ScratchQueryConfig(service, scratch.Buffer) : NULL;
+        if (!config) continue;
+        
+        std::vector<std::wstring> dependencies;
+        GraphDependencies(config->lpDependencies, &dependencies);
+        for (size_t j = 0; j < dependencies.size(); j++) {
+            GraphNode(&graph, dependencies[j].c_str(), &added);
+        }
+    }
+    
+    // Dependents come back transitively from one call
+    SVC_HANDLE service = ScmSessionOpenService(session, serviceName, GRAPH_CLOSURE_ACCESS);
+    DWORD count = 0;
+    LPENUM_SERVICE_STATUSW dependents = service ?
+        ScratchEnumDependents(service, SERVICE_STATE_ALL, scratch.Buffer, &count) : NULL;
+    for (DWORD i = 0; dependents && i < count; i++) {
+        GraphNode(&graph, dependents[i].lpServiceName, &added);
+    }
+    
+    for (size_t i = 0; i < graph.Nodes.size(); i++) {
+        names->push_back(graph.Nodes[i].Name);
+    }
+}
+
+int ControlServiceGraph(LPCWSTR target, const std::vector<std::wstring>& roots, BOOL start, DWORD unchanged,
+    const SERVICE_PROBE* ready) {
+    LPCWSTR command = start ? L"start" : L"stop";
+    SCM_SESSION* session = ScmDefaultSession();
+    OUTPUT_RECORD record;
+    OutputBegin(&record, command, target ? target : (roots.empty() ? NULL : roots[0].c_str()));
+    
+    SERVICE_GRAPH graph;
+    graph.Roots = 0;
+    if (!ScmSessionManager(session, SC_MANAGER_CONNECT)) {
+        DWORD err = GetLastError();
+        OutputFinish(&record, FALSE, err, L"OpenSCManager failed: %d", err);
+        return 1;
+    }
+    if (start) {
+        GraphBuildStart(session, roots, &graph);
+    } else {
+        GraphBuildStop(session, roots, &graph);
+    }
+    if (!GraphAssignWaves(&graph)) {
+        OutputFinish(&record, FALSE, GetLastError(), L"Circular dependency among %u service(s); nothing was %ls",
+            (DWORD)graph.Nodes.size(), start ? L"started" : L"stopped");
+        return 1;
+    }
+    
+    if (graph.Nodes.size() > 1) {
+        OutputText(L"%ls %u service(s) in %u wave(s)\n", start ? L"Starting" : L"Stopping",
+            (DWORD)graph.Nodes.size(), graph.Waves);
+    }
+    DWORD failed = 0;
+    DWORD skipped = 0;
+    BOOL allSucceeded = GraphRun(&graph, start, ready, &failed, &skipped);
+    if (!target && graph.Nodes.size() == 1) return allSucceeded ? 0 : 1;
+    
+    // Summary (JSON only; text already has the lines above)
+    record.Count = (DWORD)graph.Nodes.size() + unchanged;
+    record.Failed = failed;
+    record.Skipped = skipped + unchanged;
+    record.Waves = graph.Waves;
+    OutputFinish(&record, allSucceeded, ERROR_GEN_FAILURE, NULL);
+    return allSucceeded ? 0 : 1;
+}
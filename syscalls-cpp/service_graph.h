@@ -0,0 +1,35 @@
+#ifndef SERVICE_GRAPH_H
+#define SERVICE_GRAPH_H
+
+#include "scm_session.h"
+#include "service_probe.h"
+#include <string>
+#include <vector>
+
+// Dependency-ordered start and stop. Starting a service first starts every
+// stopped service it depends on (recursively); stopping one first stops
+// every active service that depends on it. The services are split into
+// waves by their depth in the dependency graph: a wave holds only services
+// whose prerequisites finished in earlier waves and runs on the executor
+// (--jobs), so a stack takes about its depth times the per-service latency
+// instead of the sum. A service whose prerequisite failed is skipped.
+// Load-order groups ("+Group" dependencies) are not followed.
+//
+// Each service reports its own record. A summary record for 'target'
+// (count, failed, skipped, waves) follows when 'target' is a pattern or
+// the graph holds more than one service; 'unchanged' services already in
+// the target state count towards it as skipped. 'target' NULL means a
+// single service name. 'ready' (start only, may be NULL) is the readiness
+// probe of the roots; their dependencies are not probed. Returns the
+// process exit code (0/1).
+int ControlServiceGraph(LPCWSTR target, const std::vector<std::wstring>& roots, BOOL start, DWORD unchanged,
+    const SERVICE_PROBE* ready = NULL);
+
+// Every service a start, stop or restart of 'serviceName' may act on, the
+// service itself first: the services it depends on, recursively, and every
+// service that depends on it, whatever their current state. A service the
+// SCM does not know yet stands only for itself. Used to keep operations
+// that overlap through the graph in order.
+void ServiceGraphClosure(LPCWSTR serviceName, std::vector<std::wstring>* names);
+
+#endif // SERVICE_GRAPH_H
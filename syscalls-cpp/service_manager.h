@@ -0,0 +1,147 @@
+#ifndef SERVICE_MANAGER_H
+#define SERVICE_MANAGER_H
+
+#include "scm_session.h"
+#include "service_probe.h"
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Library layer. The ServiceOp* routines carry out one operation on the
+// calling thread and report it as a SERVICE_RESULT: no console output, no
+// globals besides the selected backend. ServiceManager runs them on worker
+// threads of its own and hands back futures. The CLI commands are thin
+// formatters over the same routines.
+
+// API call or wait an operation failed in
+typedef enum _SERVICE_STEP {
+    SERVICE_STEP_NONE,
+    SERVICE_STEP_MANAGER,           // OpenSCManager
+    SERVICE_STEP_OPEN,              // OpenService
+    SERVICE_STEP_CREATE,            // CreateService
+    SERVICE_STEP_DELETE,            // DeleteService
+    SERVICE_STEP_START,             // StartService
+    SERVICE_STEP_CONTROL,           // ControlService
+    SERVICE_STEP_QUERY,             // QueryServiceStatus
+    SERVICE_STEP_WAIT_RUNNING,      // Start pending -> running
+    SERVICE_STEP_WAIT_STOPPED,      // Stop pending -> stopped
+    SERVICE_STEP_WAIT_READY         // Running -> readiness probe passed
+} SERVICE_STEP;
+
+// API name of a step ("OpenService", ...)
+LPCWSTR ServiceStepName(SERVICE_STEP step);
+
+// Typed outcome of one operation
+typedef struct _SERVICE_RESULT {
+    DWORD Error;            // ERROR_SUCCESS or the Win32 error of the failed step
+    SERVICE_STEP FailedStep; // SERVICE_STEP_NONE on success
+    BOOL Changed;           // FALSE: the service was already in the requested state
+    DWORD State;            // Last observed SERVICE_* state, 0 = not observed
+    DWORD PreviousState;    // State before the operation, 0 = not observed
+    DWORD StartType;        // Install / query: SERVICE_*_START
+    ULONGLONG StopUs;       // Stop request to STOPPED (stop, restart, uninstall)
+    ULONGLONG StartUs;      // Start request to RUNNING (start, restart)
+    ULONGLONG ReadyUs;      // RUNNING to the readiness probe passing (start, restart with a probe)
+    ULONGLONG ElapsedUs;    // Whole operation
+} SERVICE_RESULT;
+
+// Progress reported while an operation runs
+typedef enum _SERVICE_EVENT {
+    SERVICE_EVENT_STARTING,             // Start request about to be sent
+    SERVICE_EVENT_STOPPING,             // Stop request about to be sent
+    SERVICE_EVENT_DESCRIPTION_FAILED,   // Install: created, description not set (error)
+    SERVICE_EVENT_STOP_FAILED           // Uninstall: did not stop, deleting anyway (error)
+} SERVICE_EVENT;
+
+typedef VOID (*SERVICE_EVENT_ROUTINE)(PVOID context, LPCWSTR serviceName, SERVICE_EVENT event, DWORD error);
+
+// Where and how the ServiceOp* routines run. OnEvent may be NULL.
+typedef struct _SERVICE_OP_CONTEXT {
+    SCM_SESSION* Session;
+    DWORD TimeoutMs;                // Deadline of each state transition
+    const SERVICE_PROBE* Ready;     // Start / restart: probed once RUNNING (NULL = none)
+    SERVICE_EVENT_ROUTINE OnEvent;
+    PVOID EventContext;
+} SERVICE_OP_CONTEXT;
+
+// Create the service with every boot option in 'spec', then set the
+// description if one is given
+VOID ServiceOpInstall(const SERVICE_OP_CONTEXT* op, const SERVICE_INSTALL_SPEC* spec, LPCWSTR description,
+    SERVICE_RESULT* result);
+// Stop the service if the SCM runs it, then delete it. A service the SCM
+// has not loaded yet (registry-only install) is deleted without stopping.
+VOID ServiceOpUninstall(const SERVICE_OP_CONTEXT* op, LPCWSTR serviceName, SERVICE_RESULT* result);
+// Start the service unless it runs, then wait for op->Ready (a running
+// service is probed too)
+VOID ServiceOpStart(const SERVICE_OP_CONTEXT* op, LPCWSTR serviceName, SERVICE_RESULT* result);
+VOID ServiceOpStop(const SERVICE_OP_CONTEXT* op, LPCWSTR serviceName, SERVICE_RESULT* result);
+// Stop and start on one handle, the start issued as soon as STOPPED is seen
+VOID ServiceOpRestart(const SERVICE_OP_CONTEXT* op, LPCWSTR serviceName, SERVICE_RESULT* result);
+// Current state and start type
+VOID ServiceOpQuery(const SERVICE_OP_CONTEXT* op, LPCWSTR serviceName, SERVICE_RESULT* result);
+
+// Asynchronous front end. Every call copies its arguments, queues the
+// operation and returns at once. Operations on the same service name
+// (case-insensitive) always run on the same worker, in submission order,
+// so they never overlap; different services run concurrently. A name with no job
+// queued or running is bound to the worker with the shortest queue, and
+// keeps that worker only until its last job completes. A worker is busy
+// for the whole of a state transition, so 'workers' bounds the number of
+// transitions in flight.
+// Select and initialize the backend first.
+class ServiceManager {
+public:
+    // Own session, no progress events
+    explicit ServiceManager(DWORD workers, DWORD timeoutMs = 30000);
+    // The caller's session, deadline and event routine; op.Ready is
+    // ignored (each call passes its own probe) and the session is not
+    // destroyed with the manager
+    ServiceManager(DWORD workers, const SERVICE_OP_CONTEXT& op);
+    ~ServiceManager();  // Completes the queued operations, then joins the workers
+    
+    std::future<SERVICE_RESULT> Install(const SERVICE_INSTALL_SPEC& spec, LPCWSTR description = NULL);
+    std::future<SERVICE_RESULT> Uninstall(LPCWSTR serviceName);
+    std::future<SERVICE_RESULT> Start(LPCWSTR serviceName, const SERVICE_PROBE* ready = NULL);
+    std::future<SERVICE_RESULT> Stop(LPCWSTR serviceName);
+    std::future<SERVICE_RESULT> Restart(LPCWSTR serviceName, const SERVICE_PROBE* ready = NULL);
+    std::future<SERVICE_RESULT> Query(LPCWSTR serviceName);
+    
+private:
+    struct Job;
+    struct Worker {
+        std::thread Thread;
+        std::mutex Lock;
+        std::condition_variable Ready;
+        std::deque<Job*> Queue;
+        DWORD Depth;            // Jobs queued or running (BindLock)
+        bool Closing;
+    };
+    // Worker of a service name while it has jobs queued or running
+    struct Binding {
+        Worker* Owner;
+        DWORD Pending;
+    };
+    
+    ServiceManager(const ServiceManager&);
+    ServiceManager& operator=(const ServiceManager&);
+    
+    void StartWorkers(DWORD workers);
+    static Job* NewJob(int kind, LPCWSTR serviceName);
+    Worker* Bind(const std::wstring& key);
+    void Unbind(const std::wstring& key);
+    std::future<SERVICE_RESULT> Submit(Job* job);
+    static void WorkerLoop(ServiceManager* manager, Worker* worker);
+    
+    SERVICE_OP_CONTEXT Op;
+    bool OwnsSession;
+    std::vector<Worker*> Workers;
+    std::mutex BindLock;
+    std::map<std::wstring, Binding> Bindings;   // Lower-case service name -> worker
+};
+
+#endif // SERVICE_MANAGER_H
@@ -0,0 +1,208 @@
+#ifdef _WIN32
+// Before <windows.h> (via the header), which would pull in the old winsock.h
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+#include "service_probe.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <string>
+#ifdef _WIN32
+#include <mutex>
+typedef SOCKET PROBE_SOCKET;
+#define PROBE_NO_SOCKET  INVALID_SOCKET
+#define ProbeCloseSocket closesocket
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+typedef int PROBE_SOCKET;
+#define PROBE_NO_SOCKET  (-1)
+#define ProbeCloseSocket close
+#endif
+
+#define PROBE_POLL_MIN      10      // First pause between attempts (ms)
+#define PROBE_CONNECT_MAX   1000    // Longest wait for one TCP handshake (ms)
+
+static std::string ProbeNarrow(LPCWSTR text) {
+    size_t len = wcstombs(NULL, text, 0);
+    if (len == (size_t)-1) return std::string();
+    std::string narrow(len, '\0');
+    wcstombs(&narrow[0], text, len + 1);
+    return narrow;
+}
+
+BOOL ParseServiceProbe(LPCWSTR text, SERVICE_PROBE* probe) {
+    memset(probe, 0, sizeof(*probe));
+    probe->IntervalMs = SERVICE_PROBE_INTERVAL_MS;
+    LPCWSTR colon = wcschr(text, L':');
+    if (!colon || !colon[1] || wcslen(text) >= SERVICE_PROBE_MAX_CHARS) return FALSE;
+    wcscpy(probe->Text, text);
+    
+    std::wstring type(text, colon - text);
+    LPCWSTR target = colon + 1;
+    if (_wcsicmp(type.c_str(), L"file") == 0) {
+        probe->Type = SERVICE_PROBE_FILE;
+        wcscpy(probe->Target, target);
+        return TRUE;
+    }
+    if (_wcsicmp(type.c_str(), L"pipe") == 0) {
+        probe->Type = SERVICE_PROBE_PIPE;
+#ifdef _WIN32
+        // A bare name is a local pipe
+        if (wcsncmp(target, L"\\\\", 2) != 0) {
+            if (wcslen(target) + 9 >= SERVICE_PROBE_MAX_CHARS) return FALSE;
+            wcscpy(probe->Target, L"\\\\.\\pipe\\");
+        }
+#endif
+        wcscat(probe->Target, target);
+        return TRUE;
+    }
+    if (_wcsicmp(type.c_str(), L"tcp") != 0) return FALSE;
+    
+    // [host:]port, an IPv6 host in brackets
+    LPCWSTR portText = wcsrchr(target, L':');
+    std::wstring host(L"127.0.0.1");
+    if (portText) {
+        host.assign(target, portText - target);
+        if (host.size() >= 2 && host[0] == L'[' && host[host.size() - 1] == L']') host = host.substr(1, host.size() - 2);
+        portText++;
+    } else {
+        portText = target;
+    }
+    WCHAR* end = NULL;
+    unsigned long port = wcstoul(portText, &end, 10);
+    if (host.empty() || !*portText || *end || port == 0 || port > 65535) return FALSE;
+    probe->Type = SERVICE_PROBE_TCP;
+    probe->Port = (DWORD)port;
+    wcscpy(probe->Target, host.c_str());
+    return TRUE;
+}
+
+#ifdef _WIN32
+static std::once_flag g_ProbeSocketsOnce;
+static BOOL g_ProbeSockets = FALSE;
+
+static void ProbeStartSockets() {
+    WSADATA data;
+    g_ProbeSockets = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+}
+#endif
+
+// Non-blocking connect to each address of the host, waiting at most waitMs
+// in all for a handshake
+static BOOL ProbeTcp(const SERVICE_PROBE* probe, DWORD waitMs) {
+#ifdef _WIN32
+    std::call_once(g_ProbeSocketsOnce, ProbeStartSockets);
+    if (!g_ProbeSockets) return FALSE;
+#endif
+    char port[8];
+    snprintf(port, sizeof(port), "%u", probe->Port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = NULL;
+    if (getaddrinfo(ProbeNarrow(probe->Target).c_str(), port, &hints, &addresses) != 0) return FALSE;
+    
+    BOOL connected = FALSE;
+    ULONGLONG start = GetTickCount64();
+    for (struct addrinfo* address = addresses; address && !connected; address = address->ai_next) {
+        PROBE_SOCKET s = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (s == PROBE_NO_SOCKET) continue;
+#ifdef _WIN32
+        u_long nonBlocking = 1;
+        ioctlsocket(s, FIONBIO, &nonBlocking);
+        int result = connect(s, address->ai_addr, (int)address->ai_addrlen);
+        BOOL pending = result != 0 && WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+        fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+        int result = connect(s, address->ai_addr, address->ai_addrlen);
+        BOOL pending = result != 0 && errno == EINPROGRESS;
+#endif
+        // Otherwise refused at once, or (local peers) connected at once
+        if (result == 0) connected = TRUE;
+        ULONGLONG spent = GetTickCount64() - start;
+        if (pending && spent < waitMs) {
+            fd_set writable, failed;
+            FD_ZERO(&writable);
+            FD_ZERO(&failed);
+            FD_SET(s, &writable);
+            FD_SET(s, &failed);
+            DWORD remaining = (DWORD)(waitMs - spent);
+            struct timeval timeout = { (long)(remaining / 1000), (long)(remaining % 1000) * 1000 };
+            if (select((int)s + 1, NULL, &writable, &failed, &timeout) > 0 && FD_ISSET(s, &writable)) {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                connected = getsockopt(s, SOL_SOCKET, SO_ERROR, (char*)&error, &length) == 0 && error == 0;
+            }
+        }
+        ProbeCloseSocket(s);
+    }
+    freeaddrinfo(addresses);
+    return connected;
+}
+
+static BOOL ProbePipe(const SERVICE_PROBE* probe) {
+#ifdef _WIN32
+    // A pipe whose instances are all busy still exists
+    return WaitNamedPipeW(probe->Target, 1) || GetLastError() == ERROR_SEM_TIMEOUT;
+#else
+    struct stat info;
+    return stat(ProbeNarrow(probe->Target).c_str(), &info) == 0 && (S_ISSOCK(info.st_mode) || S_ISFIFO(info.st_mode));
+#endif
+}
+
+static BOOL ProbeFile(const SERVICE_PROBE* probe) {
+#ifdef _WIN32
+    return GetFileAttributesW(probe->Target) != INVALID_FILE_ATTRIBUTES;
+#else
+    struct stat info;
+    return stat(ProbeNarrow(probe->Target).c_str(), &info) == 0;
+#endif
+}
+
+BOOL ServiceProbeCheck(const SERVICE_PROBE* probe, DWORD waitMs) {
+    switch (probe->Type) {
+        case SERVICE_PROBE_TCP: return ProbeTcp(probe, waitMs);
+        case SERVICE_PROBE_PIPE: return ProbePipe(probe);
+        case SERVICE_PROBE_FILE: return ProbeFile(probe);
+        default: return TRUE;
+    }
+}
+
+BOOL WaitForServiceReady(SVC_HANDLE service, const SERVICE_PROBE* probe, DWORD timeoutMs, SERVICE_STATUS* status) {
+    MetricScope scope(METRIC_WAIT_READY);
+    ULONGLONG start = GetTickCount64();
+    DWORD pause = PROBE_POLL_MIN;
+    DWORD ceiling = probe->IntervalMs > PROBE_POLL_MIN ? probe->IntervalMs : PROBE_POLL_MIN;
+    
+    for (;;) {
+        if (!g_Backend->QueryStatus(service, status)) return FALSE;
+        if (status->dwCurrentState != SERVICE_RUNNING) {
+            DWORD exitCode = status->dwWin32ExitCode;
+            SetLastError(exitCode != ERROR_SUCCESS ? exitCode : ERROR_SERVICE_NOT_ACTIVE);
+            return FALSE;
+        }
+        
+        ULONGLONG elapsed = GetTickCount64() - start;
+        DWORD remaining = (timeoutMs == INFINITE) ? INFINITE : (elapsed < timeoutMs ? (DWORD)(timeoutMs - elapsed) : 0);
+        if (ServiceProbeCheck(probe, remaining < PROBE_CONNECT_MAX ? remaining : PROBE_CONNECT_MAX)) return TRUE;
+        
+        elapsed = GetTickCount64() - start;
+        if (timeoutMs != INFINITE && elapsed >= timeoutMs) {
+            SetLastError(ERROR_TIMEOUT);
+            return FALSE;
+        }
+        remaining = (timeoutMs == INFINITE) ? INFINITE : (DWORD)(timeoutMs - elapsed);
+        Sleep(pause < remaining ? pause : remaining);
+        pause = pause * 2 < ceiling ? pause * 2 : ceiling;
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef SERVICE_PROBE_H
+#define SERVICE_PROBE_H
+
+#include "service_backend.h"
+
+// Readiness probe (start / restart --ready): what must accept connections
+// or exist before a RUNNING service counts as usable. Many services report
+// RUNNING as soon as their main thread is up, well before they serve.
+typedef enum _SERVICE_PROBE_TYPE {
+    SERVICE_PROBE_NONE,
+    SERVICE_PROBE_TCP,          // "tcp:[host:]port", host defaults to 127.0.0.1
+    SERVICE_PROBE_PIPE,         // "pipe:<name>": \\.\pipe\<name>; elsewhere a Unix socket or FIFO path
+    SERVICE_PROBE_FILE          // "file:<path>"
+} SERVICE_PROBE_TYPE;
+
+#define SERVICE_PROBE_MAX_CHARS     260
+#define SERVICE_PROBE_INTERVAL_MS   250     // Default longest pause between attempts
+
+// Self-contained (no pointers), so it can be copied into queued operations
+typedef struct _SERVICE_PROBE {
+    SERVICE_PROBE_TYPE Type;
+    WCHAR Text[SERVICE_PROBE_MAX_CHARS];    // As given, for messages
+    WCHAR Target[SERVICE_PROBE_MAX_CHARS];  // Host, pipe / socket path or file path
+    DWORD Port;                             // TCP only
+    DWORD TimeoutMs;                        // Deadline from RUNNING, 0 = the transition deadline
+    DWORD IntervalMs;                       // Longest pause between attempts
+} SERVICE_PROBE;
+
+// Parse "tcp:...", "pipe:..." or "file:..." with the default deadline and
+// interval. FALSE for an unknown type, an empty target or a bad port.
+BOOL ParseServiceProbe(LPCWSTR text, SERVICE_PROBE* probe);
+
+// One attempt: TRUE when the target is ready now. A TCP connect waits at
+// most waitMs for the handshake.
+BOOL ServiceProbeCheck(const SERVICE_PROBE* probe, DWORD waitMs);
+
+// Probe a running service until it is ready. Attempts start 10 ms apart
+// and back off to probe->IntervalMs; the service's state is checked before
+// each one. Fails with ERROR_TIMEOUT when the deadline passes, or
+// ERROR_SERVICE_NOT_ACTIVE (the service's exit code if it set one) when it
+// leaves RUNNING. *status holds the last observed status.
+BOOL WaitForServiceReady(SVC_HANDLE service, const SERVICE_PROBE* probe, DWORD timeoutMs, SERVICE_STATUS* status);
+
+#endif // SERVICE_PROBE_H
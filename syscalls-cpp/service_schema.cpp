@@ -0,0 +1,172 @@
+#include "service_schema.h"
+#include <string.h>
+#include <wchar.h>
+
+// Rows must stay in SERVICE_FIELD_ID order for SchemaField to index them
+constexpr bool SchemaRowsInOrder() {
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        if (g_ServiceSchema[i].Id != (SERVICE_FIELD_ID)i) return false;
+    }
+    return true;
+}
+
+static_assert(SchemaRowsInOrder(), "g_ServiceSchema rows out of SERVICE_FIELD_ID order");
+static_assert(SchemaField(FIELD_START_TYPE).ValueNameBytes == 5 * sizeof(WCHAR), "value name length");
+static_assert(SchemaNameText(SCHEMA_NAMES(g_StartTypeNames), SERVICE_AUTO_START) != NULL, "start type names");
+
+static SCHEMA_VALUE SchemaReadMember(const SCHEMA_FIELD& field, const void* base, USHORT offset) {
+    SCHEMA_VALUE value = { field.DefaultNumber, field.DefaultText };
+    if (!base || offset == SCHEMA_NO_OFFSET) return value;
+    
+    const BYTE* member = (const BYTE*)base + offset;
+    if (field.Type == SCHEMA_DWORD) {
+        value.Number = *(const DWORD*)member;
+    } else if (*(LPCWSTR const*)member) {
+        value.Text = *(LPCWSTR const*)member;
+    }
+    return value;
+}
+
+VOID SchemaInitSpec(SERVICE_INSTALL_SPEC* spec) {
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        const SCHEMA_FIELD& field = g_ServiceSchema[i];
+        if (field.SpecOffset == SCHEMA_NO_OFFSET) continue;
+        
+        BYTE* member = (BYTE*)spec + field.SpecOffset;
+        if (field.Type == SCHEMA_DWORD) {
+            *(DWORD*)member = field.DefaultNumber;
+        } else {
+            *(LPCWSTR*)member = field.DefaultText;
+        }
+    }
+    spec->ServiceName = NULL;
+    memset(&spec->Trigger, 0, sizeof(spec->Trigger));
+    spec->Dependencies = NULL;
+    memset(&spec->Recovery, 0, sizeof(spec->Recovery));
+}
+
+SCHEMA_VALUE SchemaSpecValue(const SERVICE_INSTALL_SPEC* spec, SERVICE_FIELD_ID id) {
+    SCHEMA_VALUE value = SchemaReadMember(SchemaField(id), spec, SchemaField(id).SpecOffset);
+    if (id == FIELD_DISPLAY_NAME && !value.Text) value.Text = spec->ServiceName;
+    return value;
+}
+
+SCHEMA_VALUE SchemaConfigValue(const QUERY_SERVICE_CONFIGW* config, SERVICE_FIELD_ID id) {
+    return SchemaReadMember(SchemaField(id), config, SchemaField(id).ConfigOffset);
+}
+
+VOID SchemaInitConfig(QUERY_SERVICE_CONFIGW* config) {
+    // ChangeConfig passes these through as well: never leave them undefined
+    config->lpLoadOrderGroup = NULL;
+    config->dwTagId = 0;
+    config->lpDependencies = NULL;
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        SCHEMA_VALUE unset = { SERVICE_NO_CHANGE, NULL };
+        SchemaStoreConfig(config, g_ServiceSchema[i].Id, unset);
+    }
+}
+
+BOOL SchemaConfigIsSet(const QUERY_SERVICE_CONFIGW* config, SERVICE_FIELD_ID id) {
+    const SCHEMA_FIELD& field = SchemaField(id);
+    if (field.ConfigOffset == SCHEMA_NO_OFFSET) return FALSE;
+    
+    const BYTE* member = (const BYTE*)config + field.ConfigOffset;
+    if (field.Type == SCHEMA_DWORD) return *(const DWORD*)member != SERVICE_NO_CHANGE;
+    return *(LPCWSTR const*)member != NULL;
+}
+
+VOID SchemaStoreConfig(QUERY_SERVICE_CONFIGW* config, SERVICE_FIELD_ID id, SCHEMA_VALUE value) {
+    const SCHEMA_FIELD& field = SchemaField(id);
+    if (field.ConfigOffset == SCHEMA_NO_OFFSET) return;
+    
+    BYTE* member = (BYTE*)config + field.ConfigOffset;
+    if (field.Type == SCHEMA_DWORD) {
+        *(DWORD*)member = value.Number;
+    } else {
+        *(LPWSTR*)member = (LPWSTR)value.Text;
+    }
+}
+
+LPCWSTR SchemaFormatValue(SERVICE_FIELD_ID id, SCHEMA_VALUE value, WCHAR* buffer, size_t bufferChars) {
+    const SCHEMA_FIELD& field = SchemaField(id);
+    if (field.Type == SCHEMA_STRING) return value.Text ? value.Text : L"";
+    
+    LPCWSTR name = SchemaNameText(field.Names, field.NameCount, value.Number);
+    if (name) return name;
+    swprintf(buffer, bufferChars, L"0x%X", value.Number);
+    return buffer;
+}
+
+VOID SchemaDescribeConfig(std::wstring* out, const QUERY_SERVICE_CONFIGW* config, DWORD flags) {
+    WCHAR number[16];
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        const SCHEMA_FIELD& field = g_ServiceSchema[i];
+        if (!(field.Flags & flags)) continue;
+        
+        SCHEMA_VALUE value = SchemaConfigValue(config, field.Id);
+        BOOL unset = (field.Type == SCHEMA_DWORD) ? value.Number == SERVICE_NO_CHANGE : !value.Text || !*value.Text;
+        out->append(L"\n");
+        out->append(field.Label);
+        out->append(L": ");
+        out->append(unset ? L"-" : SchemaFormatValue(field.Id, value, number, sizeof(number) / sizeof(WCHAR)));
+    }
+}
+
+VOID SchemaDescribeStart(std::wstring* out, const SERVICE_INSTALL_SPEC* spec) {
+    out->append(ServiceStartTypeName(SchemaSpecValue(spec, FIELD_START_TYPE).Number));
+    if (SchemaSpecValue(spec, FIELD_DELAYED_AUTO_START).Number) out->append(L" (Delayed)");
+    if (spec->Trigger.Type) {
+        out->append(L", trigger: ");
+        out->append(ServiceTriggerName(spec->Trigger.Type));
+    }
+    for (LPCWSTR name = spec->Dependencies; name && *name; name += wcslen(name) + 1) {
+        out->append(name == spec->Dependencies ? L", after: " : L", ");
+        out->append(name);
+    }
+}
+
+VOID SchemaDescribeRecovery(std::wstring* out, const SERVICE_RECOVERY* recovery) {
+    WCHAR number[16];
+    if (recovery->RestartCount == 0) {
+        out->append(recovery->OtherActions ? L"no restarts (other actions set)" : L"none");
+        return;
+    }
+    out->append(L"restart after ");
+    for (DWORD i = 0; i < recovery->RestartCount; i++) {
+        swprintf(number, sizeof(number) / sizeof(WCHAR), i ? L"/%u" : L"%u", recovery->RestartDelayMs[i]);
+        out->append(number);
+    }
+    swprintf(number, sizeof(number) / sizeof(WCHAR), L"%u", recovery->ResetPeriod);
+    out->append(L" ms, reset after ");
+    out->append(number);
+    out->append(L" s");
+    if (recovery->OnNonCrashFailure) out->append(L", error exits too");
+    if (recovery->OtherActions) out->append(L", other actions set");
+}
+
+BOOL SchemaRecoveryDiffers(const SERVICE_RECOVERY* a, const SERVICE_RECOVERY* b) {
+    if (a->RestartCount != b->RestartCount || a->OtherActions != b->OtherActions) return TRUE;
+    if (a->RestartCount == 0) return FALSE;  // Reset period and flag only matter with restarts
+    if (a->ResetPeriod != b->ResetPeriod || !a->OnNonCrashFailure != !b->OnNonCrashFailure) return TRUE;
+    return memcmp(a->RestartDelayMs, b->RestartDelayMs, a->RestartCount * sizeof(DWORD)) != 0;
+}
+
+LPCWSTR ServiceStateName(DWORD state) {
+    LPCWSTR name = SchemaNameText(SCHEMA_NAMES(g_ServiceStateNames), state);
+    return name ? name : L"Unknown";
+}
+
+LPCWSTR ServiceStartTypeName(DWORD startType) {
+    LPCWSTR name = SchemaNameText(SCHEMA_NAMES(g_StartTypeNames), startType);
+    return name ? name : L"Unknown";
+}
+
+LPCWSTR ServiceTypeName(DWORD serviceType) {
+    LPCWSTR name = SchemaNameText(SCHEMA_NAMES(g_ServiceTypeNames), serviceType);
+    return name ? name : L"Unknown";
+}
+
+LPCWSTR ServiceTriggerName(DWORD triggerType) {
+    LPCWSTR name = SchemaNameText(SCHEMA_NAMES(g_TriggerTypeNames), triggerType);
+    return name ? name : L"Unknown";
+}
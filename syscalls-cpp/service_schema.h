@@ -0,0 +1,197 @@
+#ifndef SERVICE_SCHEMA_H
+#define SERVICE_SCHEMA_H
+
+#include "service_backend.h"
+#include <stddef.h>
+#include <string>
+
+// One table describes every service config field: its registry value, type,
+// default, display label and where it lives in SERVICE_INSTALL_SPEC and
+// QUERY_SERVICE_CONFIGW. Install, status display and the backends all read
+// fields through it, so a field is added or renamed in one place. The table
+// is constexpr: value name lengths and field lookups by id are resolved at
+// compile time.
+
+// Field identifiers; also the row index in g_ServiceSchema
+typedef enum _SERVICE_FIELD_ID {
+    FIELD_SERVICE_TYPE,
+    FIELD_START_TYPE,
+    FIELD_ERROR_CONTROL,
+    FIELD_IMAGE_PATH,
+    FIELD_DISPLAY_NAME,
+    FIELD_OBJECT_NAME,
+    FIELD_DESCRIPTION,
+    FIELD_DELAYED_AUTO_START,
+    FIELD_COUNT
+} SERVICE_FIELD_ID;
+
+typedef enum _SCHEMA_TYPE {
+    SCHEMA_DWORD,   // REG_DWORD
+    SCHEMA_STRING   // REG_SZ
+} SCHEMA_TYPE;
+
+// Field flags
+#define SCHEMA_INSTALL   0x0001  // Written when the service is created
+#define SCHEMA_STATUS    0x0002  // Shown by the status command
+#define SCHEMA_INVENTORY 0x0004  // Read by the registry inventory
+#define SCHEMA_OPTIONAL  0x0008  // Installed only when it differs from the default
+
+// Member absent from SERVICE_INSTALL_SPEC / QUERY_SERVICE_CONFIGW
+#define SCHEMA_NO_OFFSET  0xFFFF
+
+// Display string of one DWORD value (start type, service type, ...)
+typedef struct _SCHEMA_NAME {
+    DWORD Value;
+    LPCWSTR Text;
+} SCHEMA_NAME;
+
+typedef struct _SCHEMA_FIELD {
+    SERVICE_FIELD_ID Id;
+    LPCWSTR ValueName;          // Registry value under the service key
+    USHORT ValueNameBytes;      // Without terminator (UNICODE_STRING Length)
+    LPCWSTR Label;              // Display label
+    SCHEMA_TYPE Type;
+    DWORD Flags;                // SCHEMA_*
+    DWORD DefaultNumber;        // Default of DWORD fields
+    LPCWSTR DefaultText;        // Default of string fields (may be NULL)
+    USHORT SpecOffset;          // Member of SERVICE_INSTALL_SPEC
+    USHORT ConfigOffset;        // Member of QUERY_SERVICE_CONFIGW
+    const SCHEMA_NAME* Names;   // Display strings of DWORD values (may be NULL)
+    USHORT NameCount;
+} SCHEMA_FIELD;
+
+// Value name literal followed by its byte length, computed by the compiler
+#define SCHEMA_VALUE_NAME(name)  name, (USHORT)(sizeof(name) - sizeof(WCHAR))
+#define SCHEMA_SPEC(member)      (USHORT)offsetof(SERVICE_INSTALL_SPEC, member)
+#define SCHEMA_CONFIG(member)    (USHORT)offsetof(QUERY_SERVICE_CONFIGW, member)
+#define SCHEMA_NAMES(table)      table, (USHORT)(sizeof(table) / sizeof(table[0]))
+
+constexpr SCHEMA_NAME g_ServiceTypeNames[] = {
+    { SERVICE_KERNEL_DRIVER, L"Kernel Driver" },
+    { SERVICE_FILE_SYSTEM_DRIVER, L"File System Driver" },
+    { SERVICE_WIN32_OWN_PROCESS, L"Win32 Own Process" },
+    { SERVICE_WIN32_SHARE_PROCESS, L"Win32 Share Process" },
+};
+
+constexpr SCHEMA_NAME g_StartTypeNames[] = {
+    { SERVICE_BOOT_START, L"Boot" },
+    { SERVICE_SYSTEM_START, L"System" },
+    { SERVICE_AUTO_START, L"Automatic" },
+    { SERVICE_DEMAND_START, L"Manual" },
+    { SERVICE_DISABLED, L"Disabled" },
+};
+
+constexpr SCHEMA_NAME g_ErrorControlNames[] = {
+    { SERVICE_ERROR_IGNORE, L"Ignore" },
+    { SERVICE_ERROR_NORMAL, L"Normal" },
+    { SERVICE_ERROR_SEVERE, L"Severe" },
+    { SERVICE_ERROR_CRITICAL, L"Critical" },
+};
+
+constexpr SCHEMA_NAME g_BooleanNames[] = {
+    { FALSE, L"No" },
+    { TRUE, L"Yes" },
+};
+
+constexpr SCHEMA_NAME g_TriggerTypeNames[] = {
+    { SERVICE_TRIGGER_TYPE_IP_ADDRESS_AVAILABILITY, L"Network" },
+    { SERVICE_TRIGGER_TYPE_CUSTOM, L"Event" },
+};
+
+constexpr SCHEMA_NAME g_ServiceStateNames[] = {
+    { SERVICE_STOPPED, L"Stopped" },
+    { SERVICE_START_PENDING, L"Start Pending" },
+    { SERVICE_STOP_PENDING, L"Stop Pending" },
+    { SERVICE_RUNNING, L"Running" },
+    { SERVICE_CONTINUE_PENDING, L"Continue Pending" },
+    { SERVICE_PAUSE_PENDING, L"Pause Pending" },
+    { SERVICE_PAUSED, L"Paused" },
+};
+
+constexpr SCHEMA_FIELD g_ServiceSchema[FIELD_COUNT] = {
+    { FIELD_SERVICE_TYPE, SCHEMA_VALUE_NAME(L"Type"), L"Service Type", SCHEMA_DWORD,
+        SCHEMA_INSTALL | SCHEMA_STATUS | SCHEMA_INVENTORY, SERVICE_WIN32_OWN_PROCESS, NULL,
+        SCHEMA_SPEC(ServiceType), SCHEMA_CONFIG(dwServiceType), SCHEMA_NAMES(g_ServiceTypeNames) },
+    { FIELD_START_TYPE, SCHEMA_VALUE_NAME(L"Start"), L"Start Type", SCHEMA_DWORD,
+        SCHEMA_INSTALL | SCHEMA_STATUS | SCHEMA_INVENTORY, SERVICE_AUTO_START, NULL,
+        SCHEMA_SPEC(StartType), SCHEMA_CONFIG(dwStartType), SCHEMA_NAMES(g_StartTypeNames) },
+    { FIELD_ERROR_CONTROL, SCHEMA_VALUE_NAME(L"ErrorControl"), L"Error Control", SCHEMA_DWORD,
+        SCHEMA_INSTALL, SERVICE_ERROR_NORMAL, NULL,
+        SCHEMA_SPEC(ErrorControl), SCHEMA_CONFIG(dwErrorControl), SCHEMA_NAMES(g_ErrorControlNames) },
+    { FIELD_IMAGE_PATH, SCHEMA_VALUE_NAME(L"ImagePath"), L"Binary Path", SCHEMA_STRING,
+        SCHEMA_INSTALL | SCHEMA_INVENTORY, 0, NULL,
+        SCHEMA_SPEC(ImagePath), SCHEMA_CONFIG(lpBinaryPathName), NULL, 0 },
+    { FIELD_DISPLAY_NAME, SCHEMA_VALUE_NAME(L"DisplayName"), L"Display Name", SCHEMA_STRING,
+        SCHEMA_INSTALL | SCHEMA_INVENTORY, 0, NULL,
+        SCHEMA_SPEC(DisplayName), SCHEMA_CONFIG(lpDisplayName), NULL, 0 },
+    { FIELD_OBJECT_NAME, SCHEMA_VALUE_NAME(L"ObjectName"), L"Account", SCHEMA_STRING,
+        SCHEMA_INSTALL, 0, L"LocalSystem",
+        SCHEMA_NO_OFFSET, SCHEMA_CONFIG(lpServiceStartName), NULL, 0 },
+    { FIELD_DESCRIPTION, SCHEMA_VALUE_NAME(L"Description"), L"Description", SCHEMA_STRING,
+        0, 0, NULL,
+        SCHEMA_NO_OFFSET, SCHEMA_NO_OFFSET, NULL, 0 },
+    { FIELD_DELAYED_AUTO_START, SCHEMA_VALUE_NAME(L"DelayedAutostart"), L"Delayed Start", SCHEMA_DWORD,
+        SCHEMA_INSTALL | SCHEMA_OPTIONAL, FALSE, NULL,
+        SCHEMA_SPEC(DelayedAutoStart), SCHEMA_NO_OFFSET, SCHEMA_NAMES(g_BooleanNames) },
+};
+
+constexpr const SCHEMA_FIELD& SchemaField(SERVICE_FIELD_ID id) {
+    return g_ServiceSchema[id];
+}
+
+// Display string of 'value' in a name table, NULL when it has none
+constexpr LPCWSTR SchemaNameText(const SCHEMA_NAME* names, USHORT count, DWORD value) {
+    for (USHORT i = 0; i < count; i++) {
+        if (names[i].Value == value) return names[i].Text;
+    }
+    return NULL;
+}
+
+// A field value: Number for DWORD fields, Text for string fields
+typedef struct _SCHEMA_VALUE {
+    DWORD Number;
+    LPCWSTR Text;
+} SCHEMA_VALUE;
+
+// Install spec with every field at its schema default
+VOID SchemaInitSpec(SERVICE_INSTALL_SPEC* spec);
+
+// Field value of an install spec or a queried config; members the structure
+// does not have, and NULL strings, read as the schema default (the display
+// name of a spec defaults to its service name)
+SCHEMA_VALUE SchemaSpecValue(const SERVICE_INSTALL_SPEC* spec, SERVICE_FIELD_ID id);
+SCHEMA_VALUE SchemaConfigValue(const QUERY_SERVICE_CONFIGW* config, SERVICE_FIELD_ID id);
+
+// Config with every schema member unset (SERVICE_NO_CHANGE / NULL) and the
+// members outside the schema (load order group, tag, dependencies) NULL /
+// 0, and storing one field into it
+VOID SchemaInitConfig(QUERY_SERVICE_CONFIGW* config);
+BOOL SchemaConfigIsSet(const QUERY_SERVICE_CONFIGW* config, SERVICE_FIELD_ID id);
+VOID SchemaStoreConfig(QUERY_SERVICE_CONFIGW* config, SERVICE_FIELD_ID id, SCHEMA_VALUE value);
+
+// Display form of a value: its name, else the number (written to 'buffer')
+// or the text
+LPCWSTR SchemaFormatValue(SERVICE_FIELD_ID id, SCHEMA_VALUE value, WCHAR* buffer, size_t bufferChars);
+
+// Append "\nLabel: value" for every field of 'config' carrying 'flags'
+// (unset and empty fields show as "-")
+VOID SchemaDescribeConfig(std::wstring* out, const QUERY_SERVICE_CONFIGW* config, DWORD flags);
+
+// Boot behaviour of an install spec: start type, "(Delayed)", the start
+// trigger and the dependencies, e.g. "Manual, trigger: Network, after: Db"
+VOID SchemaDescribeStart(std::wstring* out, const SERVICE_INSTALL_SPEC* spec);
+
+// Recovery policy, e.g. "restart after 0/5000/60000 ms, reset after 86400 s,
+// error exits too", or "none"
+VOID SchemaDescribeRecovery(std::wstring* out, const SERVICE_RECOVERY* recovery);
+// Whether two policies act differently (OtherActions counts as a difference)
+BOOL SchemaRecoveryDiffers(const SERVICE_RECOVERY* a, const SERVICE_RECOVERY* b);
+
+// Display names of SERVICE_* states, start types, service types and
+// trigger types
+LPCWSTR ServiceStateName(DWORD state);
+LPCWSTR ServiceStartTypeName(DWORD startType);
+LPCWSTR ServiceTypeName(DWORD serviceType);
+LPCWSTR ServiceTriggerName(DWORD triggerType);
+
+#endif // SERVICE_SCHEMA_H
@@ -0,0 +1,78 @@
+#include "service_wait.h"
+#include "metrics.h"
+
+#define WAIT_POLL_MIN      10    // First poll after a request (ms)
+#define WAIT_POLL_MAX      1000  // Upper bound on any single poll sleep (ms)
+
+DWORD g_ServiceWaitTimeout = 30000;
+
+static DWORD WaitClamp(DWORD value, DWORD low, DWORD high) {
+    if (value < low) return low;
+    if (value > high) return high;
+    return value;
+}
+
+BOOL WaitForServiceState(SVC_HANDLE service, DWORD pendingState, DWORD desiredState, DWORD timeoutMs, SERVICE_STATUS* status) {
+    MetricScope scope(METRIC_WAIT_STATE);
+    ULONGLONG start = GetTickCount64();
+    BOOL useNotify = g_Backend->WaitStatusChange != NULL;
+    DWORD pollInterval = WAIT_POLL_MIN;
+    DWORD lastCheckPoint;
+    ULONGLONG lastProgress = start;
+    
+    if (!g_Backend->QueryStatus(service, status)) return FALSE;
+    lastCheckPoint = status->dwCheckPoint;
+    
+    while (status->dwCurrentState != desiredState) {
+        if (status->dwCurrentState != pendingState) {
+            DWORD exitCode = status->dwWin32ExitCode;
+            SetLastError(exitCode != ERROR_SUCCESS ? exitCode : ERROR_SERVICE_REQUEST_TIMEOUT);
+            return FALSE;
+        }
+        
+        ULONGLONG now = GetTickCount64();
+        if (timeoutMs != INFINITE && now - start >= timeoutMs) {
+            SetLastError(ERROR_TIMEOUT);
+            return FALSE;
+        }
+        DWORD remaining = (timeoutMs == INFINITE) ? INFINITE : (DWORD)(timeoutMs - (now - start));
+        
+        // A service that stops advancing dwCheckPoint for longer than its
+        // wait hint is hung
+        if (status->dwCheckPoint != lastCheckPoint) {
+            lastCheckPoint = status->dwCheckPoint;
+            lastProgress = now;
+        } else if (status->dwWaitHint > 0 && now - lastProgress > status->dwWaitHint) {
+            SetLastError(ERROR_SERVICE_REQUEST_TIMEOUT);
+            return FALSE;
+        }
+        
+        if (useNotify) {
+            // Wake on the state change itself, but no later than one wait
+            // hint so checkpoint progress is still verified
+            DWORD slice = remaining;
+            if (status->dwWaitHint > 0 && status->dwWaitHint < slice) slice = status->dwWaitHint;
+            
+            DWORD known = status->dwCurrentState;
+            if (g_Backend->WaitStatusChange(&service, &known, 1, slice) == WAIT_FAILED) {
+                useNotify = FALSE;
+                continue;
+            }
+        } else {
+            // Start fast and back off, never beyond a tenth of the wait hint
+            DWORD ceiling = status->dwWaitHint ? WaitClamp(status->dwWaitHint / 10, WAIT_POLL_MIN, WAIT_POLL_MAX) : WAIT_POLL_MAX;
+            DWORD interval = pollInterval < ceiling ? pollInterval : ceiling;
+            if (interval > remaining) interval = remaining;
+            
+            {
+                MetricScope sleepScope(METRIC_POLL_SLEEP);
+                Sleep(interval);
+            }
+            pollInterval *= 2;
+        }
+        
+        if (!g_Backend->QueryStatus(service, status)) return FALSE;
+    }
+    
+    return TRUE;
+}
@@ -0,0 +1,18 @@
+#ifndef SERVICE_WAIT_H
+#define SERVICE_WAIT_H
+
+#include "service_backend.h"
+
+// Default deadline for state transitions (milliseconds, --timeout)
+extern DWORD g_ServiceWaitTimeout;
+
+// Wait while the service is in pendingState until it reaches desiredState.
+// Uses backend change notifications when available and falls back to
+// adaptive polling that follows dwWaitHint / dwCheckPoint. On return
+// *status holds the last observed status. Fails with ERROR_TIMEOUT when the
+// deadline passes, ERROR_SERVICE_REQUEST_TIMEOUT when the service stops
+// reporting progress, or the status' exit code if it left pendingState for
+// another state.
+BOOL WaitForServiceState(SVC_HANDLE service, DWORD pendingState, DWORD desiredState, DWORD timeoutMs, SERVICE_STATUS* status);
+
+#endif // SERVICE_WAIT_H
@@ -0,0 +1,932 @@
+#include "service_backend.h"
+#include "service_schema.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// In-memory Service Control Manager. Models the service state machine
+// (STOPPED -> START_PENDING -> RUNNING -> STOP_PENDING -> STOPPED) with
+// advancing dwCheckPoint / dwWaitHint, SCM-style access checks, delete-on-
+// last-close semantics, dependency checks and a configurable latency on
+// every call. Unlike the real SCM it does not start dependencies on its
+// own: starting a service whose dependencies are not running fails. State is
+// evaluated lazily from timestamps, so no background thread is needed;
+// status-change waits sleep until the next scheduled transition or until
+// another call changes a service.
+
+typedef std::chrono::steady_clock SimClock;
+
+struct SimService {
+    std::wstring Name;
+    std::wstring DisplayName;
+    std::wstring ImagePath;
+    std::wstring Description;
+    std::wstring ObjectName;
+    DWORD ServiceType;
+    DWORD StartType;
+    DWORD ErrorControl;
+    DWORD DelayedAutoStart;
+    SERVICE_START_TRIGGER Trigger;
+    std::vector<std::wstring> Dependencies;  // Services this one needs running
+    SERVICE_RECOVERY Recovery;
+    DWORD State;
+    DWORD ProcessId;
+    DWORD StartTime;
+    DWORD StopTime;
+    SimClock::time_point TransitionBegin;
+    SimClock::time_point ProcessStart;
+    int OpenHandles;
+    bool MarkedForDelete;
+};
+
+#define SIM_HANDLE_MANAGER 0x4D435353  // 'SSCM'
+#define SIM_HANDLE_SERVICE 0x56435353  // 'SSCV'
+
+struct SimHandle {
+    DWORD Magic;
+    DWORD Access;
+    SimService* Service;
+};
+
+static std::mutex g_SimLock;
+static std::condition_variable g_SimChanged;
+static std::map<std::wstring, SimService*> g_SimServices;
+// Registry entries the SCM has not loaded (as the nt backend leaves them
+// until a reboot); only ReadRegistry sees these
+static std::map<std::wstring, SimService*> g_SimUnloaded;
+static SIM_SCM_CONFIG g_SimConfig = { 0, 100, 100, 25 };
+static BOOL g_SimInitialized = FALSE;
+static DWORD g_SimNextProcessId = 4100;
+
+static std::wstring SimKey(LPCWSTR name) {
+    std::wstring key(name);
+    for (size_t i = 0; i < key.size(); i++) {
+        key[i] = (wchar_t)towlower((wint_t)key[i]);
+    }
+    return key;
+}
+
+static void SimCallLatency() {
+    if (g_SimConfig.CallLatencyUs > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(g_SimConfig.CallLatencyUs));
+    }
+}
+
+static DWORD SimEnvDWord(const char* name, DWORD defaultValue) {
+    const char* value = getenv(name);
+    if (!value || !*value) return defaultValue;
+    return (DWORD)strtoul(value, NULL, 10);
+}
+
+static SimService* SimNewService(LPCWSTR name, DWORD startTime, DWORD stopTime) {
+    SimService* svc = new SimService();
+    svc->Name = name;
+    svc->DisplayName = name;
+    svc->ObjectName = SchemaField(FIELD_OBJECT_NAME).DefaultText;
+    svc->ServiceType = SERVICE_WIN32_OWN_PROCESS;
+    svc->StartType = SERVICE_DEMAND_START;
+    svc->ErrorControl = SERVICE_ERROR_NORMAL;
+    svc->DelayedAutoStart = FALSE;
+    memset(&svc->Trigger, 0, sizeof(svc->Trigger));
+    memset(&svc->Recovery, 0, sizeof(svc->Recovery));
+    svc->State = SERVICE_STOPPED;
+    svc->ProcessId = 0;
+    svc->StartTime = startTime;
+    svc->StopTime = stopTime;
+    svc->OpenHandles = 0;
+    svc->MarkedForDelete = false;
+    return svc;
+}
+
+static SimService* SimInsert(LPCWSTR name, DWORD startTime, DWORD stopTime) {
+    SimService* svc = SimNewService(name, startTime, stopTime);
+    g_SimServices[SimKey(name)] = svc;
+    return svc;
+}
+
+// Time at which a pending service completes its transition
+static SimClock::time_point SimTransitionEnd(SimService* svc) {
+    DWORD duration = (svc->State == SERVICE_START_PENDING) ? svc->StartTime : svc->StopTime;
+    return svc->TransitionBegin + std::chrono::milliseconds(duration);
+}
+
+// Complete any transition whose duration has elapsed
+static void SimAdvance(SimService* svc, SimClock::time_point now) {
+    if (svc->State != SERVICE_START_PENDING && svc->State != SERVICE_STOP_PENDING) return;
+    if (now < SimTransitionEnd(svc)) return;
+    
+    svc->State = (svc->State == SERVICE_START_PENDING) ? SERVICE_RUNNING : SERVICE_STOPPED;
+    if (svc->State == SERVICE_STOPPED) svc->ProcessId = 0;
+}
+
+static void SimFillStatus(SimService* svc, SimClock::time_point now, SERVICE_STATUS* status) {
+    SimAdvance(svc, now);
+    
+    memset(status, 0, sizeof(SERVICE_STATUS));
+    status->dwServiceType = svc->ServiceType;
+    status->dwCurrentState = svc->State;
+    
+    if (svc->State == SERVICE_RUNNING) {
+        status->dwControlsAccepted = SERVICE_ACCEPT_STOP;
+    } else if (svc->State == SERVICE_START_PENDING || svc->State == SERVICE_STOP_PENDING) {
+        DWORD elapsed = (DWORD)std::chrono::duration_cast<std::chrono::milliseconds>(now - svc->TransitionBegin).count();
+        DWORD interval = g_SimConfig.CheckPointInterval;
+        DWORD total = (svc->State == SERVICE_START_PENDING) ? svc->StartTime : svc->StopTime;
+        
+        status->dwCheckPoint = interval ? 1 + elapsed / interval : 1;
+        status->dwWaitHint = interval ? interval * 2 : total;
+    }
+}
+
+// Remove a deleted service once it is stopped and the last handle is gone
+static bool SimPurgeIfDeleted(SimService* svc) {
+    if (!svc->MarkedForDelete || svc->OpenHandles > 0) return false;
+    SimAdvance(svc, SimClock::now());
+    if (svc->State != SERVICE_STOPPED) return false;
+    g_SimServices.erase(SimKey(svc->Name.c_str()));
+    delete svc;
+    return true;
+}
+
+static SimService* SimLookup(LPCWSTR name) {
+    std::map<std::wstring, SimService*>::iterator it = g_SimServices.find(SimKey(name));
+    if (it == g_SimServices.end()) return NULL;
+    if (SimPurgeIfDeleted(it->second)) return NULL;
+    return it->second;
+}
+
+static bool SimDependsOn(SimService* svc, SimService* dependency) {
+    std::wstring key = SimKey(dependency->Name.c_str());
+    for (size_t i = 0; i < svc->Dependencies.size(); i++) {
+        if (SimKey(svc->Dependencies[i].c_str()) == key) return true;
+    }
+    return false;
+}
+
+// Services that depend on 'svc' and are not stopped
+static bool SimHasActiveDependents(SimService* svc, SimClock::time_point now) {
+    for (std::map<std::wstring, SimService*>::iterator it = g_SimServices.begin(); it != g_SimServices.end(); ++it) {
+        SimService* other = it->second;
+        if (!SimDependsOn(other, svc)) continue;
+        SimAdvance(other, now);
+        if (other->State != SERVICE_STOPPED) return true;
+    }
+    return false;
+}
+
+static SimHandle* SimServiceHandle(SVC_HANDLE handle, DWORD requiredAccess) {
+    SimHandle* h = (SimHandle*)handle;
+    if (!h || h->Magic != SIM_HANDLE_SERVICE) {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return NULL;
+    }
+    if ((h->Access & requiredAccess) != requiredAccess) {
+        SetLastError(ERROR_ACCESS_DENIED);
+        return NULL;
+    }
+    return h;
+}
+
+static SimHandle* SimNewServiceHandle(SimService* svc, DWORD access) {
+    SimHandle* h = new SimHandle();
+    h->Magic = SIM_HANDLE_SERVICE;
+    h->Access = access;
+    h->Service = svc;
+    svc->OpenHandles++;
+    return h;
+}
+
+VOID SimScmConfigure(const SIM_SCM_CONFIG* config) {
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    g_SimConfig = *config;
+    g_SimInitialized = TRUE;
+}
+
+BOOL SimScmAddService(LPCWSTR serviceName, DWORD startTime, DWORD stopTime) {
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    if (SimLookup(serviceName)) {
+        SetLastError(ERROR_SERVICE_EXISTS);
+        return FALSE;
+    }
+    SimInsert(serviceName, startTime, stopTime);
+    return TRUE;
+}
+
+BOOL SimScmLoadService(LPCWSTR serviceName, DWORD state, DWORD startTime, DWORD stopTime, LPCWSTR dependencies) {
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    if (SimLookup(serviceName)) {
+        SetLastError(ERROR_SERVICE_EXISTS);
+        return FALSE;
+    }
+    SimService* svc = SimInsert(serviceName, startTime, stopTime);
+    for (LPCWSTR dependency = dependencies; dependency && *dependency; dependency += wcslen(dependency) + 1) {
+        svc->Dependencies.push_back(dependency);
+    }
+    if (state == SERVICE_RUNNING) {
+        svc->State = SERVICE_RUNNING;
+        svc->ProcessId = g_SimNextProcessId;
+        g_SimNextProcessId += 4;
+        svc->ProcessStart = SimClock::now();
+    }
+    return TRUE;
+}
+
+VOID SimScmReset() {
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    for (std::map<std::wstring, SimService*>::iterator it = g_SimServices.begin(); it != g_SimServices.end(); ++it) {
+        delete it->second;
+    }
+    g_SimServices.clear();
+    for (std::map<std::wstring, SimService*>::iterator it = g_SimUnloaded.begin(); it != g_SimUnloaded.end(); ++it) {
+        delete it->second;
+    }
+    g_SimUnloaded.clear();
+}
+
+// Parses a "Name[:startMs[:stopMs]],Name2,..." list. Loaded entries become
+// stopped services; the rest are registry-only entries (timings ignored).
+static void SimSeedServices(const char* seed, BOOL loaded) {
+    std::string list(seed);
+    size_t pos = 0;
+    while (pos <= list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+        std::string entry = list.substr(pos, end - pos);
+        pos = end + 1;
+        if (entry.empty()) continue;
+        
+        DWORD startTime = g_SimConfig.StartTime;
+        DWORD stopTime = g_SimConfig.StopTime;
+        size_t colon = entry.find(':');
+        if (colon != std::string::npos) {
+            char* next = NULL;
+            startTime = (DWORD)strtoul(entry.c_str() + colon + 1, &next, 10);
+            if (next && *next == ':') stopTime = (DWORD)strtoul(next + 1, NULL, 10);
+            entry.resize(colon);
+        }
+        
+        std::wstring name(entry.begin(), entry.end());
+        std::wstring key = SimKey(name.c_str());
+        if (SimLookup(name.c_str()) || g_SimUnloaded.count(key)) continue;
+        if (loaded) {
+            SimInsert(name.c_str(), startTime, stopTime);
+        } else {
+            SimService* svc = SimNewService(name.c_str(), startTime, stopTime);
+            svc->StartType = SchemaField(FIELD_START_TYPE).DefaultNumber;
+            g_SimUnloaded[key] = svc;
+        }
+    }
+}
+
+// Reads SIMSCM_* environment variables once. SIMSCM_SERVICES pre-creates
+// stopped services, SIMSCM_UNLOADED registry entries the SCM has not loaded.
+static BOOL SimInitialize() {
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    if (g_SimInitialized) return TRUE;
+    
+    g_SimConfig.CallLatencyUs = SimEnvDWord("SIMSCM_CALL_LATENCY_US", g_SimConfig.CallLatencyUs);
+    g_SimConfig.StartTime = SimEnvDWord("SIMSCM_START_MS", g_SimConfig.StartTime);
+    g_SimConfig.StopTime = SimEnvDWord("SIMSCM_STOP_MS", g_SimConfig.StopTime);
+    g_SimConfig.CheckPointInterval = SimEnvDWord("SIMSCM_CHECKPOINT_MS", g_SimConfig.CheckPointInterval);
+    
+    const char* seed = getenv("SIMSCM_SERVICES");
+    if (seed) SimSeedServices(seed, TRUE);
+    const char* unloaded = getenv("SIMSCM_UNLOADED");
+    if (unloaded) SimSeedServices(unloaded, FALSE);
+    
+    g_SimInitialized = TRUE;
+    return TRUE;
+}
+
+static SVC_HANDLE SimConnect(DWORD desiredAccess) {
+    SimCallLatency();
+    SimHandle* h = new SimHandle();
+    h->Magic = SIM_HANDLE_MANAGER;
+    h->Access = desiredAccess;
+    h->Service = NULL;
+    return (SVC_HANDLE)h;
+}
+
+static SVC_HANDLE SimOpen(SVC_HANDLE manager, LPCWSTR serviceName, DWORD desiredAccess) {
+    SimCallLatency();
+    SimHandle* m = (SimHandle*)manager;
+    if (!m || m->Magic != SIM_HANDLE_MANAGER) {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return NULL;
+    }
+    
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimService* svc = SimLookup(serviceName);
+    if (!svc) {
+        SetLastError(ERROR_SERVICE_DOES_NOT_EXIST);
+        return NULL;
+    }
+    if (svc->MarkedForDelete) {
+        SetLastError(ERROR_SERVICE_MARKED_FOR_DELETE);
+        return NULL;
+    }
+    return (SVC_HANDLE)SimNewServiceHandle(svc, desiredAccess);
+}
+
+static SVC_HANDLE SimCreate(SVC_HANDLE manager, const SERVICE_INSTALL_SPEC* spec) {
+    SimCallLatency();
+    SimHandle* m = (SimHandle*)manager;
+    if (!m || m->Magic != SIM_HANDLE_MANAGER) {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return NULL;
+    }
+    if (!(m->Access & SC_MANAGER_CREATE_SERVICE)) {
+        SetLastError(ERROR_ACCESS_DENIED);
+        return NULL;
+    }
+    if (!spec->ServiceName || !*spec->ServiceName || wcschr(spec->ServiceName, L'\\') || wcschr(spec->ServiceName, L'/')) {
+        SetLastError(ERROR_INVALID_NAME);
+        return NULL;
+    }
+    
+    // As the real SCM: only automatic-start services can be delayed
+    DWORD delayed = SchemaSpecValue(spec, FIELD_DELAYED_AUTO_START).Number;
+    if ((delayed && spec->StartType != SERVICE_AUTO_START) || spec->Recovery.RestartCount > SERVICE_RECOVERY_MAX_RESTARTS) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+    
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimService* existing = SimLookup(spec->ServiceName);
+    if (existing) {
+        SetLastError(existing->MarkedForDelete ? ERROR_SERVICE_MARKED_FOR_DELETE : ERROR_SERVICE_EXISTS);
+        return NULL;
+    }
+    
+    SimService* svc = SimInsert(spec->ServiceName, g_SimConfig.StartTime, g_SimConfig.StopTime);
+    svc->DisplayName = SchemaSpecValue(spec, FIELD_DISPLAY_NAME).Text;
+    svc->ImagePath = spec->ImagePath ? spec->ImagePath : L"";
+    svc->ObjectName = SchemaSpecValue(spec, FIELD_OBJECT_NAME).Text;
+    svc->ServiceType = spec->ServiceType;
+    svc->StartType = spec->StartType;
+    svc->ErrorControl = spec->ErrorControl;
+    svc->DelayedAutoStart = delayed;
+    svc->Trigger = spec->Trigger;
+    svc->Recovery = spec->Recovery;
+    svc->Recovery.OtherActions = FALSE;
+    for (LPCWSTR dependency = spec->Dependencies; dependency && *dependency; dependency += wcslen(dependency) + 1) {
+        svc->Dependencies.push_back(dependency);
+    }
+    return (SVC_HANDLE)SimNewServiceHandle(svc, SERVICE_ALL_ACCESS);
+}
+
+static BOOL SimSetDescription(SVC_HANDLE service, LPCWSTR description) {
+    SimCallLatency();
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimHandle* h = SimServiceHandle(service, SERVICE_CHANGE_CONFIG);
+    if (!h) return FALSE;
+    h->Service->Description = description ? description : L"";
+    return TRUE;
+}
+
+static BOOL SimDelete(SVC_HANDLE service) {
+    SimCallLatency();
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimHandle* h = SimServiceHandle(service, DELETE);
+    if (!h) return FALSE;
+    if (h->Service->MarkedForDelete) {
+        SetLastError(ERROR_SERVICE_MARKED_FOR_DELETE);
+        return FALSE;
+    }
+    h->Service->MarkedForDelete = true;
+    g_SimChanged.notify_all();
+    return TRUE;
+}
+
+static BOOL SimStart(SVC_HANDLE service) {
+    SimCallLatency();
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimHandle* h = SimServiceHandle(service, SERVICE_START);
+    if (!h) return FALSE;
+    
+    SimService* svc = h->Service;
+    SimClock::time_point now = SimClock::now();
+    SimAdvance(svc, now);
+    
+    if (svc->MarkedForDelete) {
+        SetLastError(ERROR_SERVICE_MARKED_FOR_DELETE);
+        return FALSE;
+    }
+    if (svc->StartType == SERVICE_DISABLED) {
+        SetLastError(ERROR_SERVICE_DISABLED);
+        return FALSE;
+    }
+    if (svc->State != SERVICE_STOPPED) {
+        SetLastError(ERROR_SERVICE_ALREADY_RUNNING);
+        return FALSE;
+    }
+    for (size_t i = 0; i < svc->Dependencies.size(); i++) {
+        SimService* dependency = SimLookup(svc->Dependencies[i].c_str());
+        if (dependency) SimAdvance(dependency, now);
+        if (!dependency || dependency->State != SERVICE_RUNNING) {
+            SetLastError(ERROR_SERVICE_DEPENDENCY_FAIL);
+            return FALSE;
+        }
+    }
+    
+    svc->State = SERVICE_START_PENDING;
+    svc->ProcessId = g_SimNextProcessId;
+    g_SimNextProcessId += 4;
+    svc->TransitionBegin = now;
+    svc->ProcessStart = now;
+    SimAdvance(svc, now);
+    g_SimChanged.notify_all();
+    return TRUE;
+}
+
+static BOOL SimControl(SVC_HANDLE service, DWORD control, SERVICE_STATUS* status) {
+    SimCallLatency();
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    DWORD required = (control == SERVICE_CONTROL_STOP) ? SERVICE_STOP : SERVICE_INTERROGATE;
+    SimHandle* h = SimServiceHandle(service, required);
+    if (!h) return FALSE;
+    
+    SimService* svc = h->Service;
+    SimClock::time_point now = SimClock::now();
+    SimAdvance(svc, now);
+    
+    if (control == SERVICE_CONTROL_STOP) {
+        if (svc->State == SERVICE_STOPPED) {
+            SetLastError(ERROR_SERVICE_NOT_ACTIVE);
+            return FALSE;
+        }
+        if (svc->State != SERVICE_RUNNING) {
+            SetLastError(ERROR_SERVICE_CANNOT_ACCEPT_CTRL);
+            return FALSE;
+        }
+        if (SimHasActiveDependents(svc, now)) {
+            SetLastError(ERROR_DEPENDENT_SERVICES_RUNNING);
+            return FALSE;
+        }
+        svc->State = SERVICE_STOP_PENDING;
+        svc->TransitionBegin = now;
+        g_SimChanged.notify_all();
+    } else if (control == SERVICE_CONTROL_INTERROGATE) {
+        if (svc->State == SERVICE_STOPPED) {
+            SetLastError(ERROR_SERVICE_NOT_ACTIVE);
+            return FALSE;
+        }
+    } else {
+        SetLastError(ERROR_INVALID_SERVICE_CONTROL);
+        return FALSE;
+    }
+    
+    if (status) SimFillStatus(svc, now, status);
+    return TRUE;
+}
+
+static BOOL SimQueryStatus(SVC_HANDLE service, SERVICE_STATUS* status) {
+    SimCallLatency();
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimHandle* h = SimServiceHandle(service, SERVICE_QUERY_STATUS);
+    if (!h) return FALSE;
+    SimFillStatus(h->Service, SimClock::now(), status);
+    return TRUE;
+}
+
+static DWORD SimWaitStatusChange(SVC_HANDLE* services, const DWORD* knownStates, DWORD count, DWORD timeoutMs) {
+    SimCallLatency();
+    std::unique_lock<std::mutex> lock(g_SimLock);
+    
+    SimClock::time_point deadline = SimClock::now() + (timeoutMs == INFINITE
+        ? std::chrono::milliseconds(24LL * 3600 * 1000)
+        : std::chrono::milliseconds(timeoutMs));
+    
+    for (;;) {
+        SimClock::time_point now = SimClock::now();
+        SimClock::time_point wakeup = deadline;
+        
+        for (DWORD i = 0; i < count; i++) {
+            SimHandle* h = SimServiceHandle(services[i], SERVICE_QUERY_STATUS);
+            if (!h) return WAIT_FAILED;
+            
+            SimService* svc = h->Service;
+            SimAdvance(svc, now);
+            if (svc->State != knownStates[i]) return i;
+            if (svc->MarkedForDelete) {
+                // Like NotifyServiceStatusChange: the caller should close it
+                SetLastError(ERROR_SERVICE_MARKED_FOR_DELETE);
+                return WAIT_FAILED;
+            }
+            
+            if (svc->State == SERVICE_START_PENDING || svc->State == SERVICE_STOP_PENDING) {
+                SimClock::time_point end = SimTransitionEnd(svc);
+                if (end < wakeup) wakeup = end;
+            }
+        }
+        
+        if (now >= deadline) return WAIT_TIMEOUT;
+        g_SimChanged.wait_until(lock, wakeup);
+    }
+}
+
+// Packs the config the way QueryServiceConfigW does: fixed struct followed
+// by the strings it points to
+static BOOL SimQueryConfig(SVC_HANDLE service, LPQUERY_SERVICE_CONFIGW config, DWORD bufSize, LPDWORD bytesNeeded) {
+    SimCallLatency();
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimHandle* h = SimServiceHandle(service, SERVICE_QUERY_CONFIG);
+    if (!h) return FALSE;
+    
+    SimService* svc = h->Service;
+    size_t dependencyChars = 1;
+    for (size_t i = 0; i < svc->Dependencies.size(); i++) {
+        dependencyChars += svc->Dependencies[i].size() + 1;
+    }
+    size_t chars = (svc->ImagePath.size() + 1) + 1 + std::max(dependencyChars, (size_t)2) +
+        (svc->ObjectName.size() + 1) + (svc->DisplayName.size() + 1);
+    DWORD needed = (DWORD)(sizeof(QUERY_SERVICE_CONFIGW) + chars * sizeof(WCHAR));
+    if (bytesNeeded) *bytesNeeded = needed;
+    
+    if (!config || bufSize < needed) {
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return FALSE;
+    }
+    
+    WCHAR* cursor = (WCHAR*)(config + 1);
+    config->dwServiceType = svc->ServiceType;
+    config->dwStartType = svc->StartType;
+    config->dwErrorControl = svc->ErrorControl;
+    config->dwTagId = 0;
+    
+    config->lpBinaryPathName = cursor;
+    wmemcpy(cursor, svc->ImagePath.c_str(), svc->ImagePath.size() + 1);
+    cursor += svc->ImagePath.size() + 1;
+    
+    config->lpLoadOrderGroup = cursor;
+    *cursor++ = L'\0';
+    
+    config->lpDependencies = cursor;
+    for (size_t i = 0; i < svc->Dependencies.size(); i++) {
+        wmemcpy(cursor, svc->Dependencies[i].c_str(), svc->Dependencies[i].size() + 1);
+        cursor += svc->Dependencies[i].size() + 1;
+    }
+    if (svc->Dependencies.empty()) *cursor++ = L'\0';
+    *cursor++ = L'\0';
+    
+    config->lpServiceStartName = cursor;
+    wmemcpy(cursor, svc->ObjectName.c_str(), svc->ObjectName.size() + 1);
+    cursor += svc->ObjectName.size() + 1;
+    
+    config->lpDisplayName = cursor;
+    wmemcpy(cursor, svc->DisplayName.c_str(), svc->DisplayName.size() + 1);
+    return TRUE;
+}
+
+static BOOL SimChangeConfig(SVC_HANDLE service, const QUERY_SERVICE_CONFIGW* changes) {
+    SimCallLatency();
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimHandle* h = SimServiceHandle(service, SERVICE_CHANGE_CONFIG);
+    if (!h) return FALSE;
+    
+    SimService* svc = h->Service;
+    if (SchemaConfigIsSet(changes, FIELD_SERVICE_TYPE)) svc->ServiceType = changes->dwServiceType;
+    if (SchemaConfigIsSet(changes, FIELD_START_TYPE)) svc->StartType = changes->dwStartType;
+    if (SchemaConfigIsSet(changes, FIELD_ERROR_CONTROL)) svc->ErrorControl = changes->dwErrorControl;
+    if (SchemaConfigIsSet(changes, FIELD_IMAGE_PATH)) svc->ImagePath = changes->lpBinaryPathName;
+    if (SchemaConfigIsSet(changes, FIELD_OBJECT_NAME)) svc->ObjectName = changes->lpServiceStartName;
+    if (SchemaConfigIsSet(changes, FIELD_DISPLAY_NAME)) svc->DisplayName = changes->lpDisplayName;
+    if (changes->lpDependencies) {
+        svc->Dependencies.clear();
+        for (LPCWSTR dependency = changes->lpDependencies; *dependency; dependency += wcslen(dependency) + 1) {
+            svc->Dependencies.push_back(dependency);
+        }
+    }
+    // The SCM clears the delayed flag of a service that stops being automatic
+    if (svc->StartType != SERVICE_AUTO_START) svc->DelayedAutoStart = FALSE;
+    return TRUE;
+}
+
+static BOOL SimQueryRecovery(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_RECOVERY* recovery) {
+    (void)scratch;  // Fixed-size result, nothing to read back
+    SimCallLatency();
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimHandle* h = SimServiceHandle(service, SERVICE_QUERY_CONFIG);
+    if (!h) return FALSE;
+    *recovery = h->Service->Recovery;
+    return TRUE;
+}
+
+// As the real SCM: a policy that restarts the service also needs the right
+// to start it
+static BOOL SimChangeRecovery(SVC_HANDLE service, const SERVICE_RECOVERY* recovery) {
+    SimCallLatency();
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimHandle* h = SimServiceHandle(service, SERVICE_CHANGE_CONFIG | (recovery->RestartCount ? SERVICE_START : 0));
+    if (!h) return FALSE;
+    if (recovery->RestartCount > SERVICE_RECOVERY_MAX_RESTARTS) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    h->Service->Recovery = *recovery;
+    h->Service->Recovery.OtherActions = FALSE;
+    return TRUE;
+}
+
+static BOOL SimQueryStartOptions(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_START_OPTIONS* options) {
+    (void)scratch;  // Fixed-size result, nothing to read back
+    SimCallLatency();
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimHandle* h = SimServiceHandle(service, SERVICE_QUERY_CONFIG);
+    if (!h) return FALSE;
+    memset(options, 0, sizeof(*options));
+    options->DelayedAutoStart = h->Service->DelayedAutoStart;
+    options->Trigger = h->Service->Trigger;
+    return TRUE;
+}
+
+// As create: only an automatic service can be delayed
+static BOOL SimChangeStartOptions(SVC_HANDLE service, const SERVICE_START_OPTIONS* options) {
+    SimCallLatency();
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimHandle* h = SimServiceHandle(service, SERVICE_CHANGE_CONFIG);
+    if (!h) return FALSE;
+    if (options->DelayedAutoStart && h->Service->StartType != SERVICE_AUTO_START) {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    h->Service->DelayedAutoStart = options->DelayedAutoStart ? TRUE : FALSE;
+    h->Service->Trigger = options->Trigger;
+    return TRUE;
+}
+
+// Packs records the way EnumServicesStatusExW does: fixed records from the
+// start of the buffer, their strings from the end. Services are listed in
+// case-insensitive name order; *resumeHandle is the index to continue from.
+static BOOL SimEnumServices(SVC_HANDLE manager, DWORD serviceType, DWORD serviceState, LPBYTE buffer, DWORD bufSize,
+    LPDWORD bytesNeeded, LPDWORD servicesReturned, LPDWORD resumeHandle) {
+    SimCallLatency();
+    SimHandle* m = (SimHandle*)manager;
+    if (!m || m->Magic != SIM_HANDLE_MANAGER) {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    if (!(m->Access & SC_MANAGER_ENUMERATE_SERVICE)) {
+        SetLastError(ERROR_ACCESS_DENIED);
+        return FALSE;
+    }
+    
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimClock::time_point now = SimClock::now();
+    
+    std::vector<SimService*> matches;
+    for (std::map<std::wstring, SimService*>::iterator it = g_SimServices.begin(); it != g_SimServices.end(); ) {
+        SimService* svc = (it++)->second;
+        if (SimPurgeIfDeleted(svc)) continue;
+        
+        SimAdvance(svc, now);
+        BOOL active = svc->State != SERVICE_STOPPED;
+        if (!(svc->ServiceType & serviceType)) continue;
+        if (!(serviceState & (active ? SERVICE_ACTIVE : SERVICE_INACTIVE))) continue;
+        matches.push_back(svc);
+    }
+    
+    DWORD first = resumeHandle ? *resumeHandle : 0;
+    LPBYTE records = buffer;
+    WCHAR* strings = buffer ? (WCHAR*)(buffer + (bufSize / sizeof(WCHAR)) * sizeof(WCHAR)) : NULL;
+    DWORD used = 0;
+    DWORD returned = 0;
+    DWORD index = first;
+    
+    for (; index < matches.size(); index++) {
+        SimService* svc = matches[index];
+        size_t nameChars = svc->Name.size() + 1;
+        size_t displayChars = svc->DisplayName.size() + 1;
+        DWORD size = (DWORD)(sizeof(ENUM_SERVICE_STATUS_PROCESSW) + (nameChars + displayChars) * sizeof(WCHAR));
+        if (!buffer || used + size > bufSize) break;
+        
+        ENUM_SERVICE_STATUS_PROCESSW* record = (ENUM_SERVICE_STATUS_PROCESSW*)records;
+        strings -= displayChars;
+        wmemcpy(strings, svc->DisplayName.c_str(), displayChars);
+        record->lpDisplayName = strings;
+        strings -= nameChars;
+        wmemcpy(strings, svc->Name.c_str(), nameChars);
+        record->lpServiceName = strings;
+        
+        SERVICE_STATUS status;
+        SimFillStatus(svc, now, &status);
+        SERVICE_STATUS_PROCESS* process = &record->ServiceStatusProcess;
+        memcpy(process, &status, sizeof(SERVICE_STATUS));
+        process->dwProcessId = svc->ProcessId;
+        process->dwServiceFlags = 0;
+        
+        records += sizeof(ENUM_SERVICE_STATUS_PROCESSW);
+        used += size;
+        returned++;
+    }
+    
+    DWORD remaining = 0;
+    for (DWORD i = index; i < matches.size(); i++) {
+        remaining += (DWORD)(sizeof(ENUM_SERVICE_STATUS_PROCESSW) +
+            (matches[i]->Name.size() + matches[i]->DisplayName.size() + 2) * sizeof(WCHAR));
+    }
+    if (servicesReturned) *servicesReturned = returned;
+    if (bytesNeeded) *bytesNeeded = remaining;
+    if (resumeHandle) *resumeHandle = (index < matches.size()) ? index : 0;
+    
+    if (index < matches.size()) {
+        SetLastError(ERROR_MORE_DATA);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Post-order walk over dependents: a service is added after everything that
+// depends on it, which is the order they can be stopped in. 'seen' stops
+// the walk on dependency cycles.
+static void SimCollectDependents(SimService* svc, std::set<SimService*>* seen, std::vector<SimService*>* order) {
+    for (std::map<std::wstring, SimService*>::iterator it = g_SimServices.begin(); it != g_SimServices.end(); ++it) {
+        SimService* other = it->second;
+        if (!SimDependsOn(other, svc) || !seen->insert(other).second) continue;
+        SimCollectDependents(other, seen, order);
+        order->push_back(other);
+    }
+}
+
+// Packs records the way EnumDependentServicesW does: fixed records from the
+// start of the buffer, their strings from the end
+static BOOL SimEnumDependents(SVC_HANDLE service, DWORD serviceState, LPENUM_SERVICE_STATUSW services, DWORD bufSize,
+    LPDWORD bytesNeeded, LPDWORD servicesReturned) {
+    SimCallLatency();
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimHandle* h = SimServiceHandle(service, SERVICE_ENUMERATE_DEPENDENTS);
+    if (!h) return FALSE;
+    
+    SimClock::time_point now = SimClock::now();
+    std::set<SimService*> seen;
+    std::vector<SimService*> order;
+    seen.insert(h->Service);
+    SimCollectDependents(h->Service, &seen, &order);
+    
+    std::vector<SimService*> matches;
+    DWORD needed = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        SimService* svc = order[i];
+        SimAdvance(svc, now);
+        BOOL active = svc->State != SERVICE_STOPPED;
+        if (!(serviceState & (active ? SERVICE_ACTIVE : SERVICE_INACTIVE))) continue;
+        matches.push_back(svc);
+        needed += (DWORD)(sizeof(ENUM_SERVICE_STATUSW) + (svc->Name.size() + svc->DisplayName.size() + 2) * sizeof(WCHAR));
+    }
+    if (bytesNeeded) *bytesNeeded = needed;
+    if (servicesReturned) *servicesReturned = 0;
+    if (!services || bufSize < needed) {
+        SetLastError(ERROR_MORE_DATA);
+        return FALSE;
+    }
+    
+    WCHAR* strings = (WCHAR*)((LPBYTE)services + (bufSize / sizeof(WCHAR)) * sizeof(WCHAR));
+    for (size_t i = 0; i < matches.size(); i++) {
+        SimService* svc = matches[i];
+        size_t nameChars = svc->Name.size() + 1;
+        size_t displayChars = svc->DisplayName.size() + 1;
+        strings -= displayChars;
+        wmemcpy(strings, svc->DisplayName.c_str(), displayChars);
+        services[i].lpDisplayName = strings;
+        strings -= nameChars;
+        wmemcpy(strings, svc->Name.c_str(), nameChars);
+        services[i].lpServiceName = strings;
+        SimFillStatus(svc, now, &services[i].ServiceStatus);
+    }
+    if (servicesReturned) *servicesReturned = (DWORD)matches.size();
+    return TRUE;
+}
+
+static void SimFillRegistryEntry(SimService* svc, SERVICE_REGISTRY_ENTRY* entry) {
+    entry->Name = svc->Name.c_str();
+    SchemaInitConfig(&entry->Config);
+    SCHEMA_VALUE value = { SERVICE_NO_CHANGE, NULL };
+    value.Number = svc->ServiceType;
+    SchemaStoreConfig(&entry->Config, FIELD_SERVICE_TYPE, value);
+    value.Number = svc->StartType;
+    SchemaStoreConfig(&entry->Config, FIELD_START_TYPE, value);
+    value.Text = svc->ImagePath.c_str();
+    SchemaStoreConfig(&entry->Config, FIELD_IMAGE_PATH, value);
+    value.Text = svc->DisplayName.c_str();
+    SchemaStoreConfig(&entry->Config, FIELD_DISPLAY_NAME, value);
+}
+
+// The simulated Services key: every service the SCM has (a service marked
+// for deletion keeps its key until purged) plus the unloaded entries, in
+// case-insensitive name order
+static BOOL SimReadRegistry(SVC_HANDLE manager, LPCWSTR serviceName, SERVICE_REGISTRY_ROUTINE routine, PVOID context) {
+    SimCallLatency();
+    SimHandle* m = (SimHandle*)manager;
+    if (!m || m->Magic != SIM_HANDLE_MANAGER) {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    std::map<std::wstring, SimService*> entries(g_SimUnloaded);
+    for (std::map<std::wstring, SimService*>::iterator it = g_SimServices.begin(); it != g_SimServices.end(); ) {
+        SimService* svc = (it++)->second;
+        if (!SimPurgeIfDeleted(svc)) entries[SimKey(svc->Name.c_str())] = svc;
+    }
+    
+    SERVICE_REGISTRY_ENTRY entry;
+    if (serviceName) {
+        std::map<std::wstring, SimService*>::iterator it = entries.find(SimKey(serviceName));
+        if (it == entries.end()) {
+            SetLastError(ERROR_SERVICE_DOES_NOT_EXIST);
+            return FALSE;
+        }
+        SimFillRegistryEntry(it->second, &entry);
+        routine(context, &entry);
+        return TRUE;
+    }
+    
+    for (std::map<std::wstring, SimService*>::iterator it = entries.begin(); it != entries.end(); ++it) {
+        SimFillRegistryEntry(it->second, &entry);
+        if (!routine(context, &entry)) break;
+    }
+    return TRUE;
+}
+
+// Synthetic but stable figures: each process burns a fixed share of one CPU
+// (1-8%, by PID) and its memory grows slowly with uptime
+static void SimFillUsage(SimService* svc, SimClock::time_point now, SERVICE_PROCESS_USAGE* usage) {
+    ULONGLONG uptimeUs = (ULONGLONG)std::chrono::duration_cast<std::chrono::microseconds>(
+        now - svc->ProcessStart).count();
+    DWORD seed = svc->ProcessId / 4;
+    usage->Present = TRUE;
+    usage->CpuTime = uptimeUs * 10 * (seed % 8 + 1) / 100;
+    usage->WorkingSet = (8ULL << 20) + (ULONGLONG)(seed % 16) * (1 << 20) + uptimeUs / 1000 * 64;
+    usage->PrivateBytes = usage->WorkingSet / 2 + (4ULL << 20);
+    usage->HandleCount = 120 + seed % 64;
+    usage->ThreadCount = 4 + seed % 8;
+}
+
+static BOOL SimQueryProcesses(SERVICE_PROCESS_USAGE* usage, DWORD count) {
+    SimCallLatency();
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    SimClock::time_point now = SimClock::now();
+    std::map<DWORD, SimService*> processes;
+    for (std::map<std::wstring, SimService*>::iterator it = g_SimServices.begin(); it != g_SimServices.end(); ++it) {
+        SimAdvance(it->second, now);
+        if (it->second->ProcessId) processes[it->second->ProcessId] = it->second;
+    }
+    
+    for (DWORD i = 0; i < count; i++) {
+        DWORD pid = usage[i].ProcessId;
+        memset(&usage[i], 0, sizeof(usage[i]));
+        usage[i].ProcessId = pid;
+        std::map<DWORD, SimService*>::iterator it = processes.find(pid);
+        if (it != processes.end()) SimFillUsage(it->second, now, &usage[i]);
+    }
+    return TRUE;
+}
+
+static void SimClose(SVC_HANDLE handle) {
+    SimHandle* h = (SimHandle*)handle;
+    if (!h) return;
+    
+    std::lock_guard<std::mutex> lock(g_SimLock);
+    if (h->Magic == SIM_HANDLE_SERVICE && h->Service) {
+        h->Service->OpenHandles--;
+        SimPurgeIfDeleted(h->Service);
+    }
+    h->Magic = 0;
+    delete h;
+}
+
+const SERVICE_BACKEND SimulatedBackend = {
+    L"sim",
+    SimInitialize,
+    SimConnect,
+    SimOpen,
+    SimCreate,
+    SimSetDescription,
+    SimDelete,
+    SimStart,
+    SimControl,
+    SimQueryStatus,
+    SimQueryConfig,
+    SimChangeConfig,
+    SimQueryRecovery,
+    SimChangeRecovery,
+    SimQueryStartOptions,
+    SimChangeStartOptions,
+    SimEnumServices,
+    SimEnumDependents,
+    SimWaitStatusChange,
+    SimReadRegistry,
+    SimQueryProcesses,
+    SimClose
+};
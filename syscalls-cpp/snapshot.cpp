@@ -0,0 +1,367 @@
+#include "snapshot.h"
+#include "catalog.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wchar.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+typedef struct _SNAPSHOT_BUILD {
+    SERVICE_SNAPSHOT* Snapshot;
+    const SERVICE_CATALOG* Catalog;
+    LPCWSTR Pattern;
+    std::vector<BOOL> Listed;                       // Per catalog entry: has a registry row
+    std::unordered_map<std::wstring, DWORD> Strings; // Text -> pool offset
+} SNAPSHOT_BUILD;
+
+// Pool offset of 'text', appended the first time it is seen (image paths
+// and display names repeat across services)
+static DWORD SnapshotAddString(SNAPSHOT_BUILD* build, LPCWSTR text) {
+    if (!text) return SNAPSHOT_NO_TEXT;
+    
+    std::vector<WCHAR>& pool = build->Snapshot->Pool;
+    std::unordered_map<std::wstring, DWORD>::iterator it = build->Strings.find(text);
+    if (it != build->Strings.end()) return it->second;
+    
+    DWORD offset = (DWORD)pool.size();
+    pool.insert(pool.end(), text, text + wcslen(text) + 1);
+    build->Strings[text] = offset;
+    return offset;
+}
+
+static void SnapshotInitEntry(SNAPSHOT_ENTRY* entry) {
+    entry->Name = SNAPSHOT_NO_TEXT;
+    entry->State = 0;
+    entry->ProcessId = 0;
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        entry->Fields[i] = SERVICE_NO_CHANGE;
+    }
+}
+
+static void SnapshotAddState(SNAPSHOT_BUILD* build, SNAPSHOT_ENTRY* row, const CATALOG_ENTRY* loaded) {
+    if (!loaded) return;
+    row->State = loaded->CurrentState;
+    row->ProcessId = loaded->ProcessId;
+    build->Listed[loaded - &build->Catalog->Entries[0]] = TRUE;
+}
+
+static BOOL SnapshotRegistryEntry(PVOID context, const SERVICE_REGISTRY_ENTRY* entry) {
+    SNAPSHOT_BUILD* build = (SNAPSHOT_BUILD*)context;
+    if (build->Pattern && !WildcardMatch(build->Pattern, entry->Name)) return TRUE;
+    
+    DWORD type = entry->Config.dwServiceType;
+    if (type == SERVICE_NO_CHANGE || !(type & SERVICE_WIN32)) return TRUE;
+    
+    SNAPSHOT_ENTRY row;
+    SnapshotInitEntry(&row);
+    row.Name = SnapshotAddString(build, entry->Name);
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        const SCHEMA_FIELD& field = g_ServiceSchema[i];
+        if (!SchemaConfigIsSet(&entry->Config, field.Id)) continue;
+        SCHEMA_VALUE value = SchemaConfigValue(&entry->Config, field.Id);
+        row.Fields[i] = (field.Type == SCHEMA_DWORD) ? value.Number : SnapshotAddString(build, value.Text);
+    }
+    SnapshotAddState(build, &row, CatalogFind(build->Catalog, entry->Name));
+    build->Snapshot->Entries.push_back(row);
+    return TRUE;
+}
+
+// Rows in case-insensitive name order, the order the diff merges in
+struct SnapshotNameOrder {
+    const SERVICE_SNAPSHOT* Snapshot;
+    
+    bool operator()(const SNAPSHOT_ENTRY& a, const SNAPSHOT_ENTRY& b) const {
+        return _wcsicmp(SnapshotString(Snapshot, a.Name), SnapshotString(Snapshot, b.Name)) < 0;
+    }
+};
+
+static void SnapshotSort(SERVICE_SNAPSHOT* snapshot) {
+    SnapshotNameOrder order = { snapshot };
+    if (!std::is_sorted(snapshot->Entries.begin(), snapshot->Entries.end(), order)) {
+        std::sort(snapshot->Entries.begin(), snapshot->Entries.end(), order);
+    }
+}
+
+BOOL SnapshotCapture(SCM_SESSION* session, LPCWSTR pattern, SERVICE_SNAPSHOT* snapshot) {
+    snapshot->CaptureTime = (ULONGLONG)time(NULL);
+    snapshot->Entries.clear();
+    snapshot->Pool.clear();
+    if (!g_Backend->ReadRegistry) {
+        SetLastError(ERROR_NOT_SUPPORTED);
+        return FALSE;
+    }
+    
+    SERVICE_CATALOG catalog;
+    if (!CatalogLoad(session, &catalog)) return FALSE;
+    
+    SNAPSHOT_BUILD build;
+    build.Snapshot = snapshot;
+    build.Catalog = &catalog;
+    build.Pattern = pattern;
+    build.Listed.assign(catalog.Entries.size(), FALSE);
+    SVC_HANDLE manager = ScmSessionManager(session, SC_MANAGER_CONNECT);
+    if (!manager || !g_Backend->ReadRegistry(manager, NULL, SnapshotRegistryEntry, &build)) return FALSE;
+    
+    // Services the SCM lists but the registry walk did not return
+    for (size_t i = 0; i < catalog.Entries.size(); i++) {
+        const CATALOG_ENTRY* entry = &catalog.Entries[i];
+        LPCWSTR name = CatalogString(&catalog, entry->Name);
+        if (build.Listed[i] || (pattern && !WildcardMatch(pattern, name))) continue;
+        
+        SNAPSHOT_ENTRY row;
+        SnapshotInitEntry(&row);
+        row.Name = SnapshotAddString(&build, name);
+        row.Fields[FIELD_SERVICE_TYPE] = entry->ServiceType;
+        row.Fields[FIELD_DISPLAY_NAME] = SnapshotAddString(&build, CatalogString(&catalog, entry->DisplayName));
+        SnapshotAddState(&build, &row, entry);
+        snapshot->Entries.push_back(row);
+    }
+    
+    SnapshotSort(snapshot);
+    return TRUE;
+}
+
+static FILE* SnapshotOpenFile(LPCWSTR path, LPCWSTR mode) {
+#ifdef _WIN32
+    return _wfopen(path, mode);
+#else
+    size_t len = wcstombs(NULL, path, 0);
+    if (len == (size_t)-1) return NULL;
+    std::string narrow(len, '\0');
+    wcstombs(&narrow[0], path, len + 1);
+    std::string narrowMode(mode, mode + wcslen(mode));
+    return fopen(narrow.c_str(), narrowMode.c_str());
+#endif
+}
+
+// The pool is stored as UTF-16. Where wchar_t is 32 bits, characters
+// outside the BMP are written as U+FFFD so pool offsets stay unit-for-unit.
+BOOL SnapshotWrite(LPCWSTR path, const SERVICE_SNAPSHOT* snapshot) {
+    FILE* file = SnapshotOpenFile(path, L"wb");
+    if (!file) {
+        SetLastError(ERROR_FILE_NOT_FOUND);
+        return FALSE;
+    }
+    
+    SNAPSHOT_HEADER header;
+    header.Magic = SNAPSHOT_MAGIC;
+    header.Version = SNAPSHOT_VERSION;
+    header.FieldCount = FIELD_COUNT;
+    header.Count = (DWORD)snapshot->Entries.size();
+    header.PoolUnits = (DWORD)snapshot->Pool.size();
+    header.CaptureTime = snapshot->CaptureTime;
+    
+    std::vector<USHORT> units(snapshot->Pool.size());
+    for (size_t i = 0; i < units.size(); i++) {
+        DWORD ch = (DWORD)snapshot->Pool[i];
+        units[i] = (USHORT)(ch > 0xFFFF ? 0xFFFD : ch);
+    }
+    
+    BOOL ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(snapshot->Entries.data(), sizeof(SNAPSHOT_ENTRY), header.Count, file) == header.Count &&
+        fwrite(units.data(), sizeof(USHORT), units.size(), file) == units.size();
+    if (fclose(file) != 0) ok = FALSE;
+    if (!ok) SetLastError(ERROR_WRITE_FAULT);
+    return ok;
+}
+
+static BOOL SnapshotOffsetValid(const SERVICE_SNAPSHOT* snapshot, DWORD offset) {
+    return offset == SNAPSHOT_NO_TEXT || offset < snapshot->Pool.size();
+}
+
+// Every string offset must land in the pool, and the pool must end with a
+// terminator, so no string runs past it
+static BOOL SnapshotValidate(const SERVICE_SNAPSHOT* snapshot) {
+    if (!snapshot->Pool.empty() && snapshot->Pool.back() != L'\0') return FALSE;
+    for (size_t i = 0; i < snapshot->Entries.size(); i++) {
+        const SNAPSHOT_ENTRY* entry = &snapshot->Entries[i];
+        if (entry->Name == SNAPSHOT_NO_TEXT || !SnapshotOffsetValid(snapshot, entry->Name)) return FALSE;
+        for (int f = 0; f < FIELD_COUNT; f++) {
+            if (g_ServiceSchema[f].Type == SCHEMA_STRING && !SnapshotOffsetValid(snapshot, entry->Fields[f])) {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+BOOL SnapshotRead(LPCWSTR path, SERVICE_SNAPSHOT* snapshot) {
+    FILE* file = SnapshotOpenFile(path, L"rb");
+    if (!file) {
+        SetLastError(ERROR_FILE_NOT_FOUND);
+        return FALSE;
+    }
+    
+    // The size must match the header exactly before anything is allocated
+    SNAPSHOT_HEADER header;
+    BOOL ok = fread(&header, sizeof(header), 1, file) == 1 && header.Magic == SNAPSHOT_MAGIC &&
+        header.Version == SNAPSHOT_VERSION && header.FieldCount == FIELD_COUNT;
+    if (ok) {
+        ULONGLONG expected = sizeof(header) + (ULONGLONG)header.Count * sizeof(SNAPSHOT_ENTRY) +
+            (ULONGLONG)header.PoolUnits * sizeof(USHORT);
+        ok = fseek(file, 0, SEEK_END) == 0 && (ULONGLONG)ftell(file) == expected &&
+            fseek(file, sizeof(header), SEEK_SET) == 0;
+    }
+    
+    std::vector<USHORT> units;
+    if (ok) {
+        snapshot->CaptureTime = header.CaptureTime;
+        snapshot->Entries.resize(header.Count);
+        units.resize(header.PoolUnits);
+        ok = fread(snapshot->Entries.data(), sizeof(SNAPSHOT_ENTRY), header.Count, file) == header.Count &&
+            fread(units.data(), sizeof(USHORT), units.size(), file) == units.size();
+    }
+    fclose(file);
+    
+    if (ok) {
+        snapshot->Pool.assign(units.begin(), units.end());
+        ok = SnapshotValidate(snapshot);
+    }
+    if (!ok) {
+        snapshot->Entries.clear();
+        snapshot->Pool.clear();
+        SetLastError(ERROR_BAD_FORMAT);
+        return FALSE;
+    }
+    
+    // Written sorted; a writer whose case folding differs is re-sorted here
+    SnapshotSort(snapshot);
+    return TRUE;
+}
+
+int ExportSnapshot(LPCWSTR path, LPCWSTR pattern) {
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"export", pattern);
+    
+    SERVICE_SNAPSHOT snapshot;
+    if (!SnapshotCapture(ScmDefaultSession(), pattern, &snapshot)) {
+        DWORD err = GetLastError();
+        OutputFinish(&record, FALSE, err, L"Cannot capture the services: %d", err);
+        return 1;
+    }
+    if (!SnapshotWrite(path, &snapshot)) {
+        DWORD err = GetLastError();
+        OutputFinish(&record, FALSE, err, L"Failed to write snapshot '%ls'", path);
+        return 1;
+    }
+    
+    record.Count = (DWORD)snapshot.Entries.size();
+    OutputFinish(&record, TRUE, ERROR_SUCCESS, L"%u service(s) written to '%ls' (%u bytes)", record.Count, path,
+        (DWORD)(sizeof(SNAPSHOT_HEADER) + snapshot.Entries.size() * sizeof(SNAPSHOT_ENTRY) +
+            snapshot.Pool.size() * sizeof(USHORT)));
+    return 0;
+}
+
+static LPCWSTR SnapshotStateText(DWORD state) {
+    return state ? ServiceStateName(state) : L"Not loaded";
+}
+
+static LPCWSTR SnapshotFieldText(const SERVICE_SNAPSHOT* snapshot, int field, DWORD value, WCHAR* buffer,
+    size_t bufferChars) {
+    if (value == SERVICE_NO_CHANGE) return L"-";
+    SCHEMA_VALUE schemaValue = { value, NULL };
+    if (g_ServiceSchema[field].Type == SCHEMA_STRING) schemaValue.Text = SnapshotString(snapshot, value);
+    return SchemaFormatValue(g_ServiceSchema[field].Id, schemaValue, buffer, bufferChars);
+}
+
+// "Label: old -> new" for the state and every field that differs
+static void SnapshotCompare(const SERVICE_SNAPSHOT* before, const SNAPSHOT_ENTRY* a, const SERVICE_SNAPSHOT* after,
+    const SNAPSHOT_ENTRY* b, std::wstring* changes) {
+    WCHAR oldNumber[16];
+    WCHAR newNumber[16];
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        DWORD x = a->Fields[i];
+        DWORD y = b->Fields[i];
+        BOOL same = (g_ServiceSchema[i].Type == SCHEMA_DWORD || x == SNAPSHOT_NO_TEXT || y == SNAPSHOT_NO_TEXT) ?
+            x == y : wcscmp(SnapshotString(before, x), SnapshotString(after, y)) == 0;
+        if (same) continue;
+        
+        if (!changes->empty()) changes->append(L"; ");
+        changes->append(g_ServiceSchema[i].Label);
+        changes->append(L": ");
+        changes->append(SnapshotFieldText(before, i, x, oldNumber, sizeof(oldNumber) / sizeof(WCHAR)));
+        changes->append(L" -> ");
+        changes->append(SnapshotFieldText(after, i, y, newNumber, sizeof(newNumber) / sizeof(WCHAR)));
+    }
+    if (a->State != b->State) {
+        if (!changes->empty()) changes->append(L"; ");
+        changes->append(L"State: ");
+        changes->append(SnapshotStateText(a->State));
+        changes->append(L" -> ");
+        changes->append(SnapshotStateText(b->State));
+    }
+}
+
+// One diff record describing a row (its latest version)
+static void SnapshotDiffBegin(OUTPUT_RECORD* record, LPCWSTR change, const SERVICE_SNAPSHOT* snapshot,
+    const SNAPSHOT_ENTRY* entry) {
+    OutputBegin(record, L"diff", SnapshotString(snapshot, entry->Name));
+    record->Change = change;
+    if (entry->State) record->State = entry->State;
+    if (entry->Fields[FIELD_START_TYPE] != SERVICE_NO_CHANGE) record->StartType = entry->Fields[FIELD_START_TYPE];
+    record->DisplayName = SnapshotString(snapshot, entry->Fields[FIELD_DISPLAY_NAME]);
+    record->ImagePath = SnapshotString(snapshot, entry->Fields[FIELD_IMAGE_PATH]);
+}
+
+int DiffSnapshots(LPCWSTR beforePath, LPCWSTR afterPath) {
+    OUTPUT_RECORD record;
+    OutputBegin(&record, L"diff", NULL);
+    
+    SERVICE_SNAPSHOT before;
+    SERVICE_SNAPSHOT after;
+    LPCWSTR failed = !SnapshotRead(beforePath, &before) ? beforePath : !SnapshotRead(afterPath, &after) ? afterPath : NULL;
+    if (failed) {
+        DWORD err = GetLastError();
+        OutputFinish(&record, FALSE, err, err == ERROR_BAD_FORMAT ? L"'%ls' is not a readable snapshot" :
+            L"Failed to open snapshot '%ls'", failed);
+        return 1;
+    }
+    
+    // Both sides are sorted by name: one merge pass
+    DWORD added = 0;
+    DWORD removed = 0;
+    DWORD changed = 0;
+    DWORD same = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < before.Entries.size() || j < after.Entries.size()) {
+        const SNAPSHOT_ENTRY* a = (i < before.Entries.size()) ? &before.Entries[i] : NULL;
+        const SNAPSHOT_ENTRY* b = (j < after.Entries.size()) ? &after.Entries[j] : NULL;
+        int order = !a ? 1 : !b ? -1 : _wcsicmp(SnapshotString(&before, a->Name), SnapshotString(&after, b->Name));
+        
+        OUTPUT_RECORD entry;
+        if (order < 0) {
+            SnapshotDiffBegin(&entry, L"removed", &before, a);
+            OutputFinish(&entry, TRUE, ERROR_SUCCESS, L"- %ls", entry.Service);
+            removed++;
+            i++;
+        } else if (order > 0) {
+            SnapshotDiffBegin(&entry, L"added", &after, b);
+            OutputFinish(&entry, TRUE, ERROR_SUCCESS, L"+ %ls (%ls)", entry.Service, SnapshotStateText(b->State));
+            added++;
+            j++;
+        } else {
+            std::wstring changes;
+            SnapshotCompare(&before, a, &after, b, &changes);
+            if (changes.empty()) {
+                same++;
+            } else {
+                SnapshotDiffBegin(&entry, L"changed", &after, b);
+                if (a->State) entry.PreviousState = a->State;
+                OutputFinish(&entry, TRUE, ERROR_SUCCESS, L"~ %ls: %ls", entry.Service, changes.c_str());
+                changed++;
+            }
+            i++;
+            j++;
+        }
+    }
+    
+    record.Count = added + removed + changed;
+    record.Skipped = same;
+    OutputFinish(&record, TRUE, ERROR_SUCCESS, L"%u added, %u removed, %u changed, %u unchanged", added, removed,
+        changed, same);
+    return record.Count ? 1 : 0;
+}
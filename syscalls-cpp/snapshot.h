@@ -0,0 +1,69 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "scm_session.h"
+#include "service_schema.h"
+#include <vector>
+
+// Point-in-time record of a host's services for offline drift audits. A
+// capture costs two bulk reads (one SCM enumeration for the states, one
+// registry walk for the config), like the inventory. The file is binary:
+//
+//   SNAPSHOT_HEADER
+//   Count x SNAPSHOT_ENTRY     fixed-size rows, sorted by name (case-insensitive)
+//   PoolUnits x UTF-16         null-terminated strings, each stored once
+//
+// All integers little-endian. Sorted rows let two snapshots be compared
+// with one linear merge and no index.
+
+#define SNAPSHOT_MAGIC    0x50534E53  // "SNSP"
+#define SNAPSHOT_VERSION  1
+#define SNAPSHOT_NO_TEXT  0xFFFFFFFF  // String field without a value
+
+typedef struct _SNAPSHOT_HEADER {
+    DWORD Magic;
+    USHORT Version;
+    USHORT FieldCount;          // Schema fields per row (FIELD_COUNT of the writer)
+    DWORD Count;                // Rows
+    DWORD PoolUnits;            // UTF-16 code units in the string pool
+    ULONGLONG CaptureTime;      // Seconds since 1970-01-01 UTC
+} SNAPSHOT_HEADER;
+
+// One service. Fields are indexed by SERVICE_FIELD_ID: the number of a
+// DWORD field, the pool offset of a string field; SERVICE_NO_CHANGE /
+// SNAPSHOT_NO_TEXT when the capture has no value for it.
+typedef struct _SNAPSHOT_ENTRY {
+    DWORD Name;                 // Pool offset
+    DWORD State;                // SERVICE_* state, 0 = not loaded by the SCM
+    DWORD ProcessId;
+    DWORD Fields[FIELD_COUNT];
+} SNAPSHOT_ENTRY;
+
+typedef struct _SERVICE_SNAPSHOT {
+    ULONGLONG CaptureTime;
+    std::vector<SNAPSHOT_ENTRY> Entries;
+    std::vector<WCHAR> Pool;
+} SERVICE_SNAPSHOT;
+
+inline LPCWSTR SnapshotString(const SERVICE_SNAPSHOT* snapshot, DWORD offset) {
+    return offset == SNAPSHOT_NO_TEXT ? NULL : &snapshot->Pool[offset];
+}
+
+// Capture every Win32 service matching 'pattern' (NULL = all): registry
+// entries, loaded or not, and services the SCM lists without a key
+BOOL SnapshotCapture(SCM_SESSION* session, LPCWSTR pattern, SERVICE_SNAPSHOT* snapshot);
+
+// Write / read a snapshot file. Read fails with ERROR_FILE_NOT_FOUND or
+// ERROR_BAD_FORMAT (not a snapshot, other schema version, truncated).
+BOOL SnapshotWrite(LPCWSTR path, const SERVICE_SNAPSHOT* snapshot);
+BOOL SnapshotRead(LPCWSTR path, SERVICE_SNAPSHOT* snapshot);
+
+// export command: capture and write, one summary record
+int ExportSnapshot(LPCWSTR path, LPCWSTR pattern);
+
+// diff command: one record per service added, removed or changed between
+// the two files, then a summary. Returns 0 when they match, 1 on drift or
+// when a file cannot be read.
+int DiffSnapshots(LPCWSTR beforePath, LPCWSTR afterPath);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,14 @@
+#ifndef TOP_H
+#define TOP_H
+
+#include "service_backend.h"
+
+// Sample the processes of the named services (names or wildcard patterns)
+// every intervalMs, 'samples' times (0 = until interrupted): CPU use over
+// the interval, CPU time, working set, private bytes, handles and threads.
+// Each sample costs one service enumeration, which also yields the current
+// PIDs, and one QueryProcesses call for all of them; no handles are held
+// between samples.
+int TopServices(LPCWSTR* targets, DWORD targetCount, DWORD intervalMs, DWORD samples);
+
+#endif // TOP_H
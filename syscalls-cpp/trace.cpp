@@ -0,0 +1,595 @@
+#include "trace.h"
+#include "executor.h"
+#include "service_wait.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#define TRACE_FLUSH_BYTES  (64 * 1024)  // Buffered bytes written out at once
+
+static const BYTE g_TraceMagic[4] = { 'S', 'N', 'T', 'R' };
+
+// Recording state; everything below the backend pointers is guarded by
+// g_TraceLock
+static const SERVICE_BACKEND* g_TraceInner;
+static SERVICE_BACKEND g_TraceBackend;
+static std::mutex g_TraceLock;
+static FILE* g_TraceFile;
+static BOOL g_TraceFailed;
+static std::vector<BYTE> g_TraceBuffer;
+static ULONGLONG g_TraceOriginUs;       // MetricsNow() when recording began
+static ULONGLONG g_TraceLastStartUs;    // Start of the previous record
+static std::map<SVC_HANDLE, DWORD> g_TraceHandles;
+static DWORD g_TraceNextHandle = 1;
+static std::map<std::wstring, DWORD> g_TraceNames;
+static std::map<std::thread::id, DWORD> g_TraceThreads;
+
+static FILE* TraceOpenFile(LPCWSTR path, BOOL write) {
+#ifdef _WIN32
+    return _wfopen(path, write ? L"wb" : L"rb");
+#else
+    size_t len = wcstombs(NULL, path, 0);
+    if (len == (size_t)-1) return NULL;
+    std::string narrow(len, '\0');
+    wcstombs(&narrow[0], path, len + 1);
+    return fopen(narrow.c_str(), write ? "wb" : "rb");
+#endif
+}
+
+static void TracePutNumber(ULONGLONG value) {
+    while (value >= 0x80) {
+        g_TraceBuffer.push_back((BYTE)(value | 0x80));
+        value >>= 7;
+    }
+    g_TraceBuffer.push_back((BYTE)value);
+}
+
+static void TracePutString(LPCWSTR text) {
+    size_t chars = text ? wcslen(text) : 0;
+    TracePutNumber(chars);
+    for (size_t i = 0; i < chars; i++) {
+        TracePutNumber((ULONGLONG)(DWORD)text[i]);
+    }
+}
+
+// Id of a name; the first use also writes the name itself
+static void TracePutName(LPCWSTR name) {
+    if (!name) {
+        TracePutNumber(0);
+        return;
+    }
+    std::map<std::wstring, DWORD>::iterator it = g_TraceNames.find(name);
+    if (it != g_TraceNames.end()) {
+        TracePutNumber(it->second);
+        return;
+    }
+    DWORD id = (DWORD)g_TraceNames.size() + 1;
+    g_TraceNames[name] = id;
+    TracePutNumber(id);
+    TracePutString(name);
+}
+
+static DWORD TraceHandleId(SVC_HANDLE handle) {
+    std::map<SVC_HANDLE, DWORD>::iterator it = g_TraceHandles.find(handle);
+    return it == g_TraceHandles.end() ? 0 : it->second;
+}
+
+static void TraceFlush() {
+    if (g_TraceBuffer.empty()) return;
+    if (g_TraceFile && fwrite(g_TraceBuffer.data(), 1, g_TraceBuffer.size(), g_TraceFile) != g_TraceBuffer.size()) {
+        g_TraceFailed = TRUE;
+    }
+    g_TraceBuffer.clear();
+}
+
+// One record: timed around the inner call, then written under the lock
+// together with its call-specific fields. GetLastError survives it.
+class TraceRecord {
+public:
+    TraceRecord(METRIC_ID call, SVC_HANDLE handle) : Call(call), Handle(handle), Start(MetricsNow()) {}
+    
+    // The inner call returned: write the common fields and keep the lock
+    // for the call's own fields
+    void Done(BOOL ok) {
+        Error = ok ? ERROR_SUCCESS : GetLastError();
+        ULONGLONG end = MetricsNow();
+        Lock = std::unique_lock<std::mutex>(g_TraceLock);
+        if (!g_TraceFile) return;
+        
+        std::thread::id self = std::this_thread::get_id();
+        DWORD& thread = g_TraceThreads[self];
+        if (thread == 0) thread = (DWORD)g_TraceThreads.size();
+        ULONGLONG startUs = Start - g_TraceOriginUs;
+        LONGLONG delta = (LONGLONG)(startUs - g_TraceLastStartUs);
+        g_TraceLastStartUs = startUs;
+        
+        TracePutNumber(Call);
+        TracePutNumber(thread);
+        TracePutNumber(delta < 0 ? ((ULONGLONG)(-delta) << 1) - 1 : (ULONGLONG)delta << 1);  // Zigzag
+        TracePutNumber(end - Start);
+        TracePutNumber(((ULONGLONG)Error << 1) | (ok ? 1 : 0));
+        TracePutNumber(TraceHandleId(Handle));
+    }
+    
+    BOOL Recording() const { return g_TraceFile != NULL; }
+    void Number(ULONGLONG value) { if (Recording()) TracePutNumber(value); }
+    void Name(LPCWSTR name) { if (Recording()) TracePutName(name); }
+    
+    // A handle the call returned gets the next id (0 for NULL)
+    void NewHandle(SVC_HANDLE handle) {
+        if (!Recording()) return;
+        DWORD id = 0;
+        if (handle) {
+            id = g_TraceNextHandle++;
+            g_TraceHandles[handle] = id;
+        }
+        TracePutNumber(id);
+    }
+    
+    void Status(BOOL ok, const SERVICE_STATUS* status) {
+        Number(ok && status ? status->dwCurrentState : 0);
+        Number(ok && status ? status->dwCheckPoint : 0);
+        Number(ok && status ? status->dwWaitHint : 0);
+    }
+    
+    ~TraceRecord() {
+        if (Lock.owns_lock() && g_TraceBuffer.size() >= TRACE_FLUSH_BYTES) TraceFlush();
+        if (Lock.owns_lock()) Lock.unlock();
+        SetLastError(Error);
+    }
+    
+    METRIC_ID Call;
+    SVC_HANDLE Handle;
+    ULONGLONG Start;
+    DWORD Error;
+    std::unique_lock<std::mutex> Lock;
+};
+
+static SVC_HANDLE TraceConnect(DWORD desiredAccess) {
+    TraceRecord record(METRIC_CONNECT, NULL);
+    SVC_HANDLE handle = g_TraceInner->Connect(desiredAccess);
+    record.Done(handle != NULL);
+    record.Number(desiredAccess);
+    record.NewHandle(handle);
+    return handle;
+}
+
+static SVC_HANDLE TraceOpen(SVC_HANDLE manager, LPCWSTR serviceName, DWORD desiredAccess) {
+    TraceRecord record(METRIC_OPEN, manager);
+    SVC_HANDLE handle = g_TraceInner->Open(manager, serviceName, desiredAccess);
+    record.Done(handle != NULL);
+    record.Name(serviceName);
+    record.Number(desiredAccess);
+    record.NewHandle(handle);
+    return handle;
+}
+
+static SVC_HANDLE TraceCreate(SVC_HANDLE manager, const SERVICE_INSTALL_SPEC* spec) {
+    TraceRecord record(METRIC_CREATE, manager);
+    SVC_HANDLE handle = g_TraceInner->Create(manager, spec);
+    record.Done(handle != NULL);
+    record.Name(spec->ServiceName);
+    record.NewHandle(handle);
+    return handle;
+}
+
+static BOOL TraceSetDescription(SVC_HANDLE service, LPCWSTR description) {
+    TraceRecord record(METRIC_SET_DESCRIPTION, service);
+    BOOL ok = g_TraceInner->SetDescription(service, description);
+    record.Done(ok);
+    return ok;
+}
+
+static BOOL TraceDelete(SVC_HANDLE service) {
+    TraceRecord record(METRIC_DELETE, service);
+    BOOL ok = g_TraceInner->Delete(service);
+    record.Done(ok);
+    return ok;
+}
+
+static BOOL TraceStart(SVC_HANDLE service) {
+    TraceRecord record(METRIC_START, service);
+    BOOL ok = g_TraceInner->Start(service);
+    record.Done(ok);
+    return ok;
+}
+
+static BOOL TraceControl(SVC_HANDLE service, DWORD control, SERVICE_STATUS* status) {
+    TraceRecord record(METRIC_CONTROL, service);
+    SERVICE_STATUS observed;
+    BOOL ok = g_TraceInner->Control(service, control, &observed);
+    if (status) *status = observed;
+    record.Done(ok);
+    record.Number(control);
+    record.Status(ok, &observed);
+    return ok;
+}
+
+static BOOL TraceQueryStatus(SVC_HANDLE service, SERVICE_STATUS* status) {
+    TraceRecord record(METRIC_QUERY_STATUS, service);
+    BOOL ok = g_TraceInner->QueryStatus(service, status);
+    record.Done(ok);
+    record.Status(ok, status);
+    return ok;
+}
+
+static BOOL TraceQueryConfig(SVC_HANDLE service, LPQUERY_SERVICE_CONFIGW config, DWORD bufSize, LPDWORD bytesNeeded) {
+    TraceRecord record(METRIC_QUERY_CONFIG, service);
+    BOOL ok = g_TraceInner->QueryConfig(service, config, bufSize, bytesNeeded);
+    record.Done(ok);
+    return ok;
+}
+
+static BOOL TraceChangeConfig(SVC_HANDLE service, const QUERY_SERVICE_CONFIGW* changes) {
+    TraceRecord record(METRIC_CHANGE_CONFIG, service);
+    BOOL ok = g_TraceInner->ChangeConfig(service, changes);
+    record.Done(ok);
+    return ok;
+}
+
+static BOOL TraceQueryRecovery(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_RECOVERY* recovery) {
+    TraceRecord record(METRIC_QUERY_RECOVERY, service);
+    BOOL ok = g_TraceInner->QueryRecovery(service, scratch, recovery);
+    record.Done(ok);
+    return ok;
+}
+
+static BOOL TraceChangeRecovery(SVC_HANDLE service, const SERVICE_RECOVERY* recovery) {
+    TraceRecord record(METRIC_CHANGE_RECOVERY, service);
+    BOOL ok = g_TraceInner->ChangeRecovery(service, recovery);
+    record.Done(ok);
+    return ok;
+}
+
+static BOOL TraceQueryStartOptions(SVC_HANDLE service, SCRATCH_BUFFER* scratch, SERVICE_START_OPTIONS* options) {
+    TraceRecord record(METRIC_QUERY_START_OPTIONS, service);
+    BOOL ok = g_TraceInner->QueryStartOptions(service, scratch, options);
+    record.Done(ok);
+    return ok;
+}
+
+static BOOL TraceChangeStartOptions(SVC_HANDLE service, const SERVICE_START_OPTIONS* options) {
+    TraceRecord record(METRIC_CHANGE_START_OPTIONS, service);
+    BOOL ok = g_TraceInner->ChangeStartOptions(service, options);
+    record.Done(ok);
+    return ok;
+}
+
+// Enumerations record the name and state of every service returned,
+// including the part a too-small buffer held
+static BOOL TraceEnumServices(SVC_HANDLE manager, DWORD serviceType, DWORD serviceState, LPBYTE buffer, DWORD bufSize,
+    LPDWORD bytesNeeded, LPDWORD servicesReturned, LPDWORD resumeHandle) {
+    TraceRecord record(METRIC_ENUM_SERVICES, manager);
+    BOOL ok = g_TraceInner->EnumServices(manager, serviceType, serviceState, buffer, bufSize, bytesNeeded,
+        servicesReturned, resumeHandle);
+    record.Done(ok);
+    DWORD returned = (ok || record.Error == ERROR_MORE_DATA) && buffer ? *servicesReturned : 0;
+    const ENUM_SERVICE_STATUS_PROCESSW* services = (const ENUM_SERVICE_STATUS_PROCESSW*)buffer;
+    record.Number(serviceState);
+    record.Number(returned);
+    for (DWORD i = 0; i < returned; i++) {
+        record.Name(services[i].lpServiceName);
+        record.Number(services[i].ServiceStatusProcess.dwCurrentState);
+    }
+    return ok;
+}
+
+static BOOL TraceEnumDependents(SVC_HANDLE service, DWORD serviceState, LPENUM_SERVICE_STATUSW services,
+    DWORD bufSize, LPDWORD bytesNeeded, LPDWORD servicesReturned) {
+    TraceRecord record(METRIC_ENUM_DEPENDENTS, service);
+    BOOL ok = g_TraceInner->EnumDependents(service, serviceState, services, bufSize, bytesNeeded, servicesReturned);
+    record.Done(ok);
+    DWORD returned = (ok || record.Error == ERROR_MORE_DATA) && services ? *servicesReturned : 0;
+    record.Number(serviceState);
+    record.Number(returned);
+    for (DWORD i = 0; i < returned; i++) {
+        record.Name(services[i].lpServiceName);
+        record.Number(services[i].ServiceStatus.dwCurrentState);
+    }
+    return ok;
+}
+
+static DWORD TraceWaitStatusChange(SVC_HANDLE* services, const DWORD* knownStates, DWORD count, DWORD timeoutMs) {
+    TraceRecord record(METRIC_WAIT_STATUS_CHANGE, NULL);
+    DWORD result = g_TraceInner->WaitStatusChange(services, knownStates, count, timeoutMs);
+    record.Done(result != WAIT_FAILED);
+    record.Number(timeoutMs);
+    record.Number(result);
+    record.Number(count);
+    for (DWORD i = 0; i < count && record.Recording(); i++) {
+        record.Number(TraceHandleId(services[i]));
+        record.Number(knownStates[i]);
+    }
+    return result;
+}
+
+// Counts the entries a registry walk delivers
+typedef struct _TRACE_REGISTRY_CONTEXT {
+    SERVICE_REGISTRY_ROUTINE Routine;
+    PVOID Context;
+    DWORD Entries;
+} TRACE_REGISTRY_CONTEXT;
+
+static BOOL TraceRegistryEntry(PVOID context, const SERVICE_REGISTRY_ENTRY* entry) {
+    TRACE_REGISTRY_CONTEXT* walk = (TRACE_REGISTRY_CONTEXT*)context;
+    walk->Entries++;
+    return walk->Routine(walk->Context, entry);
+}
+
+static BOOL TraceReadRegistry(SVC_HANDLE manager, LPCWSTR serviceName, SERVICE_REGISTRY_ROUTINE routine, PVOID context) {
+    TraceRecord record(METRIC_READ_REGISTRY, manager);
+    TRACE_REGISTRY_CONTEXT walk = { routine, context, 0 };
+    BOOL ok = g_TraceInner->ReadRegistry(manager, serviceName, TraceRegistryEntry, &walk);
+    record.Done(ok);
+    record.Name(serviceName);
+    record.Number(walk.Entries);
+    return ok;
+}
+
+static BOOL TraceQueryProcesses(SERVICE_PROCESS_USAGE* usage, DWORD count) {
+    TraceRecord record(METRIC_QUERY_PROCESSES, NULL);
+    BOOL ok = g_TraceInner->QueryProcesses(usage, count);
+    record.Done(ok);
+    record.Number(count);
+    return ok;
+}
+
+static void TraceCloseHandle(SVC_HANDLE handle) {
+    TraceRecord record(METRIC_CLOSE, handle);
+    g_TraceInner->Close(handle);
+    record.Done(TRUE);
+    g_TraceHandles.erase(handle);
+}
+
+BOOL TraceEnable(LPCWSTR path, int argc, wchar_t* argv[]) {
+    g_TraceFile = TraceOpenFile(path, TRUE);
+    if (!g_TraceFile) {
+        OUTPUT_RECORD record;
+        OutputBegin(&record, L"trace", NULL);
+        return OutputFinish(&record, FALSE, ERROR_FILE_NOT_FOUND, L"Cannot create trace file '%ls'", path);
+    }
+    
+    g_TraceBuffer.insert(g_TraceBuffer.end(), g_TraceMagic, g_TraceMagic + sizeof(g_TraceMagic));
+    TracePutNumber(TRACE_VERSION);
+    TracePutString(g_Backend->Name);
+    TracePutNumber(g_ExecutorJobs);
+    TracePutNumber(g_ServiceWaitTimeout);
+    TracePutNumber((ULONGLONG)time(NULL));
+    TracePutNumber((ULONGLONG)argc);
+    for (int i = 0; i < argc; i++) {
+        TracePutString(argv[i]);
+    }
+    TraceFlush();
+    g_TraceOriginUs = MetricsNow();
+    g_TraceLastStartUs = 0;
+    
+    // Optional entries stay NULL so callers still see what is unsupported
+    g_TraceInner = g_Backend;
+    g_TraceBackend = *g_Backend;
+    g_TraceBackend.Connect = TraceConnect;
+    g_TraceBackend.Open = TraceOpen;
+    g_TraceBackend.Create = TraceCreate;
+    g_TraceBackend.SetDescription = TraceSetDescription;
+    g_TraceBackend.Delete = TraceDelete;
+    g_TraceBackend.Start = TraceStart;
+    g_TraceBackend.Control = TraceControl;
+    g_TraceBackend.QueryStatus = TraceQueryStatus;
+    g_TraceBackend.QueryConfig = TraceQueryConfig;
+    g_TraceBackend.ChangeConfig = TraceChangeConfig;
+    g_TraceBackend.QueryRecovery = TraceQueryRecovery;
+    g_TraceBackend.ChangeRecovery = TraceChangeRecovery;
+    g_TraceBackend.QueryStartOptions = TraceQueryStartOptions;
+    g_TraceBackend.ChangeStartOptions = TraceChangeStartOptions;
+    g_TraceBackend.EnumServices = TraceEnumServices;
+    g_TraceBackend.EnumDependents = TraceEnumDependents;
+    if (g_TraceInner->WaitStatusChange) g_TraceBackend.WaitStatusChange = TraceWaitStatusChange;
+    if (g_TraceInner->ReadRegistry) g_TraceBackend.ReadRegistry = TraceReadRegistry;
+    if (g_TraceInner->QueryProcesses) g_TraceBackend.QueryProcesses = TraceQueryProcesses;
+    g_TraceBackend.Close = TraceCloseHandle;
+    
+    g_Backend = &g_TraceBackend;
+    return TRUE;
+}
+
+BOOL TraceClose() {
+    std::lock_guard<std::mutex> lock(g_TraceLock);
+    if (!g_TraceFile) return TRUE;
+    
+    TraceFlush();
+    if (fclose(g_TraceFile) != 0) g_TraceFailed = TRUE;
+    g_TraceFile = NULL;
+    if (g_TraceFailed) {
+        OUTPUT_RECORD record;
+        OutputBegin(&record, L"trace", NULL);
+        return OutputFinish(&record, FALSE, ERROR_WRITE_FAULT, L"Failed to write the trace file");
+    }
+    return TRUE;
+}
+
+// Reading: a cursor over the whole file
+typedef struct _TRACE_READER {
+    const BYTE* Data;
+    size_t Size;
+    size_t Offset;
+} TRACE_READER;
+
+static BOOL TraceGetNumber(TRACE_READER* reader, ULONGLONG* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (reader->Offset >= reader->Size) return FALSE;
+        BYTE byte = reader->Data[reader->Offset++];
+        *value |= (ULONGLONG)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return TRUE;
+    }
+    return FALSE;
+}
+
+static BOOL TraceGetDword(TRACE_READER* reader, DWORD* value) {
+    ULONGLONG number;
+    if (!TraceGetNumber(reader, &number) || number > 0xFFFFFFFFULL) return FALSE;
+    *value = (DWORD)number;
+    return TRUE;
+}
+
+static BOOL TraceGetString(TRACE_READER* reader, std::wstring* text) {
+    ULONGLONG chars;
+    if (!TraceGetNumber(reader, &chars) || chars > reader->Size - reader->Offset) return FALSE;
+    text->clear();
+    for (ULONGLONG i = 0; i < chars; i++) {
+        DWORD unit;
+        if (!TraceGetDword(reader, &unit)) return FALSE;
+        text->push_back((wchar_t)unit);
+    }
+    return TRUE;
+}
+
+// A name id; a new one is followed by the name
+static BOOL TraceGetName(TRACE_READER* reader, TRACE_LOG* log, DWORD* id) {
+    if (!TraceGetDword(reader, id)) return FALSE;
+    if (*id == 0 || *id < log->Names.size()) return TRUE;
+    if (*id != log->Names.size()) return FALSE;
+    log->Names.push_back(std::wstring());
+    return TraceGetString(reader, &log->Names.back());
+}
+
+static BOOL TraceGetNewHandle(TRACE_READER* reader, TRACE_LOG* log, TRACE_CALL* call) {
+    if (!TraceGetDword(reader, &call->NewHandle)) return FALSE;
+    if (call->NewHandle == 0) return TRUE;
+    if (log->HandleNames.size() <= call->NewHandle) log->HandleNames.resize(call->NewHandle + 1, 0);
+    log->HandleNames[call->NewHandle] = call->Name;
+    return TRUE;
+}
+
+static BOOL TraceGetStatus(TRACE_READER* reader, TRACE_CALL* call) {
+    return TraceGetDword(reader, &call->State) && TraceGetDword(reader, &call->CheckPoint) &&
+        TraceGetDword(reader, &call->WaitHint);
+}
+
+// Items of an enumeration (name, state) or a wait (handle, known state)
+static BOOL TraceGetItems(TRACE_READER* reader, TRACE_LOG* log, TRACE_CALL* call, BOOL names) {
+    call->FirstItem = (DWORD)log->Items.size();
+    for (DWORD i = 0; i < call->ItemCount; i++) {
+        TRACE_ITEM item;
+        if (!(names ? TraceGetName(reader, log, &item.Id) : TraceGetDword(reader, &item.Id)) ||
+            !TraceGetDword(reader, &item.State)) {
+            return FALSE;
+        }
+        log->Items.push_back(item);
+    }
+    return TRUE;
+}
+
+static BOOL TraceGetCall(TRACE_READER* reader, TRACE_LOG* log, ULONGLONG* lastStartUs, TRACE_CALL* call) {
+    memset(call, 0, sizeof(*call));
+    ULONGLONG number, delta, result;
+    if (!TraceGetNumber(reader, &number) || number >= METRIC_COUNT) return FALSE;
+    call->Call = (METRIC_ID)number;
+    if (!TraceGetDword(reader, &call->Thread) || !TraceGetNumber(reader, &delta) ||
+        !TraceGetDword(reader, &call->DurationUs) || !TraceGetNumber(reader, &result) ||
+        !TraceGetDword(reader, &call->Handle)) {
+        return FALSE;
+    }
+    *lastStartUs += (delta & 1) ? (ULONGLONG)0 - ((delta + 1) >> 1) : delta >> 1;
+    call->StartUs = *lastStartUs;
+    call->Ok = (BOOL)(result & 1);
+    call->Error = (DWORD)(result >> 1);
+    if (call->Handle < log->HandleNames.size()) call->Name = log->HandleNames[call->Handle];
+    
+    switch (call->Call) {
+        case METRIC_CONNECT:
+            return TraceGetDword(reader, &call->Arg) && TraceGetNewHandle(reader, log, call);
+        case METRIC_OPEN:
+            return TraceGetName(reader, log, &call->Name) && TraceGetDword(reader, &call->Arg) &&
+                TraceGetNewHandle(reader, log, call);
+        case METRIC_CREATE:
+            return TraceGetName(reader, log, &call->Name) && TraceGetNewHandle(reader, log, call);
+        case METRIC_CONTROL:
+            return TraceGetDword(reader, &call->Arg) && TraceGetStatus(reader, call);
+        case METRIC_QUERY_STATUS:
+            return TraceGetStatus(reader, call);
+        case METRIC_ENUM_SERVICES:
+        case METRIC_ENUM_DEPENDENTS:
+            if (!TraceGetDword(reader, &call->Arg) || !TraceGetDword(reader, &call->Result)) return FALSE;
+            call->ItemCount = call->Result;
+            return TraceGetItems(reader, log, call, TRUE);
+        case METRIC_WAIT_STATUS_CHANGE:
+            if (!TraceGetDword(reader, &call->Arg) || !TraceGetDword(reader, &call->Result) ||
+                !TraceGetDword(reader, &call->ItemCount)) {
+                return FALSE;
+            }
+            return TraceGetItems(reader, log, call, FALSE);
+        case METRIC_READ_REGISTRY:
+            return TraceGetName(reader, log, &call->Name) && TraceGetDword(reader, &call->Result);
+        case METRIC_QUERY_PROCESSES:
+            return TraceGetDword(reader, &call->Arg);
+        default:
+            return TRUE;
+    }
+}
+
+BOOL TraceRead(LPCWSTR path, TRACE_LOG* log) {
+    FILE* file = TraceOpenFile(path, FALSE);
+    if (!file) {
+        SetLastError(ERROR_FILE_NOT_FOUND);
+        return FALSE;
+    }
+    std::vector<BYTE> data;
+    BYTE chunk[64 * 1024];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        data.insert(data.end(), chunk, chunk + got);
+    }
+    fclose(file);
+    
+    TRACE_READER reader = { data.data(), data.size(), sizeof(g_TraceMagic) };
+    ULONGLONG version, startTime, argc;
+    log->Names.assign(1, std::wstring());
+    log->HandleNames.assign(1, 0);
+    log->Calls.clear();
+    log->Items.clear();
+    log->Args.clear();
+    log->Truncated = FALSE;
+    if (data.size() < sizeof(g_TraceMagic) || memcmp(data.data(), g_TraceMagic, sizeof(g_TraceMagic)) != 0 ||
+        !TraceGetNumber(&reader, &version) || version != TRACE_VERSION || !TraceGetString(&reader, &log->Backend) ||
+        !TraceGetDword(&reader, &log->Jobs) || !TraceGetDword(&reader, &log->WaitTimeout) ||
+        !TraceGetNumber(&reader, &startTime) || !TraceGetNumber(&reader, &argc) || argc > reader.Size) {
+        SetLastError(ERROR_BAD_FORMAT);
+        return FALSE;
+    }
+    log->StartTime = startTime;
+    for (ULONGLONG i = 0; i < argc; i++) {
+        log->Args.push_back(std::wstring());
+        if (!TraceGetString(&reader, &log->Args.back())) {
+            SetLastError(ERROR_BAD_FORMAT);
+            return FALSE;
+        }
+    }
+    
+    // A record cut off by the end of the file (the run was killed) is
+    // dropped along with any name or item it had added
+    ULONGLONG lastStartUs = 0;
+    while (reader.Offset < reader.Size) {
+        size_t names = log->Names.size();
+        size_t items = log->Items.size();
+        size_t handles = log->HandleNames.size();
+        TRACE_CALL call;
+        if (!TraceGetCall(&reader, log, &lastStartUs, &call)) {
+            log->Names.resize(names);
+            log->Items.resize(items);
+            log->HandleNames.resize(handles);
+            log->Truncated = TRUE;
+            break;
+        }
+        log->Calls.push_back(call);
+    }
+    return TRUE;
+}
+
+LPCWSTR TraceCallName(const TRACE_LOG* log, const TRACE_CALL* call) {
+    return call->Name && call->Name < log->Names.size() ? log->Names[call->Name].c_str() : NULL;
+}
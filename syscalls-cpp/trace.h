@@ -0,0 +1,79 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "metrics.h"
+#include <string>
+#include <vector>
+
+// Backend call trace (--trace <file>). Every backend call is recorded with
+// its thread, start time and duration, result, the handle it acted on, the
+// service name it opened, and the states it observed. Records are
+// streamed to the file as they complete, so a run that is killed leaves a
+// usable trace. 'replay' (replay.h) reads it back.
+//
+// File: "SNTR", then a header and one record per call, all as LEB128
+// varints. Service names are interned: the first use of a name writes it
+// after its new id, later uses write the id only. Record start times are
+// stored as signed deltas from the previous record, so most records take
+// 10-20 bytes.
+
+#define TRACE_VERSION  2  // Call ids are METRIC_ID values: bump when they change
+
+// Observation of one service in an enumeration, or one service of a
+// status-change wait
+typedef struct _TRACE_ITEM {
+    DWORD Id;                   // Name id (enumerations) or handle id (waits)
+    DWORD State;                // Reported state, or the known state of a wait
+} TRACE_ITEM;
+
+// One decoded call. Fields a call does not use are 0.
+typedef struct _TRACE_CALL {
+    METRIC_ID Call;
+    DWORD Thread;               // 1 = the first thread that made a call
+    ULONGLONG StartUs;          // Since the trace began
+    DWORD DurationUs;
+    BOOL Ok;
+    DWORD Error;                // GetLastError after a failed call
+    DWORD Handle;               // Handle id the call acted on (0 = none)
+    DWORD NewHandle;            // Handle id Connect / Open / Create returned
+    DWORD Name;                 // Name id: Open, Create, ReadRegistry (0 = none)
+    DWORD Arg;                  // Access, control code, state filter, timeout or count
+    DWORD Result;               // WaitStatusChange result, entries returned
+    DWORD State;                // Observed status: Control, QueryStatus
+    DWORD CheckPoint;
+    DWORD WaitHint;
+    DWORD FirstItem;            // Enumerated services or waited handles
+    DWORD ItemCount;
+} TRACE_CALL;
+
+// A trace read back by TraceRead
+typedef struct _TRACE_LOG {
+    std::wstring Backend;
+    std::vector<std::wstring> Args;     // Command and its arguments
+    DWORD Jobs;                         // g_ExecutorJobs of the run
+    DWORD WaitTimeout;                  // g_ServiceWaitTimeout of the run
+    ULONGLONG StartTime;                // Seconds since 1970-01-01 UTC
+    std::vector<std::wstring> Names;    // Index 0 unused
+    std::vector<DWORD> HandleNames;     // Name id of each handle id (0 = manager)
+    std::vector<TRACE_CALL> Calls;      // In completion order
+    std::vector<TRACE_ITEM> Items;
+    BOOL Truncated;                     // The file ends inside a record
+} TRACE_LOG;
+
+// Start recording to 'path': route g_Backend through tracing wrappers.
+// 'argv' is the command and its arguments. Call after the backend is
+// selected, before MetricsEnable (so metrics time the traced calls) and
+// before any worker thread starts. FALSE when the file cannot be created.
+BOOL TraceEnable(LPCWSTR path, int argc, wchar_t* argv[]);
+
+// Write out what is buffered and close the file; FALSE if any write failed
+BOOL TraceClose();
+
+// Read a trace. FALSE with ERROR_FILE_NOT_FOUND or ERROR_BAD_FORMAT; a file
+// cut off inside a record is read up to the last complete one.
+BOOL TraceRead(LPCWSTR path, TRACE_LOG* log);
+
+// Name of a call's service: its own name, or that of the handle it used
+LPCWSTR TraceCallName(const TRACE_LOG* log, const TRACE_CALL* call);
+
+#endif // TRACE_H
@@ -0,0 +1,12 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "service_backend.h"
+
+// Stream state transitions of the named services (names or wildcard
+// patterns) until durationMs elapses (INFINITE = until interrupted).
+// Blocks in the backend's status-change wait between transitions and
+// prints one timestamped "previous -> new" line per change.
+int WatchServices(LPCWSTR* targets, DWORD targetCount, DWORD durationMs);
+
+#endif // WATCH_H